@@ -0,0 +1,374 @@
+/*
+ * File:   cacheFlusher.c
+ *
+ * Write back of dirty cache blocks. A background thread writes dirty blocks
+ * before they are chosen for replacement, so a thread missing in the cache
+ * finds clean blocks and only has to read. Dirty blocks that are adjacent in
+ * the file are written together with a single pwritev() call, and with an
+ * asynchronous I/O engine all those runs are in flight at the same time.
+ * Written blocks are not synced here; durability is up to TC_flushAllBlocks().
+ */
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include "tableCache.h"
+#include "tableIO.h"
+
+/**
+ * Number of clean unpinned blocks of a partition below which the partition
+ * is cleaned regardless of the dirty watermarks
+ */
+#define CLEAN_RESERVE (((TC_PARTITION_BLOCKS) * (TC_CLEAN_RESERVE_PERCENT) + 99) / 100)
+
+/** A dirty block chosen to be written
+ */
+typedef struct
+{
+    int fileIndex;
+    int cacheIndex;
+} flushCandidate_t;
+
+/** Asynchronous writes of a write back round still in flight
+ */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+    int pending;
+    int failed;
+} writeBatch_t;
+
+/** A run of blocks written by a single asynchronous request
+ */
+typedef struct
+{
+    TC_cache_t *cache;
+    writeBatch_t *batch;
+    flushCandidate_t *run;
+    int n;
+} runWrite_t;
+
+/**
+ * Order candidate blocks by their position in the file
+ */
+static int compareFileIndex(const void *a, const void *b)
+{
+    return ((const flushCandidate_t *) a)->fileIndex - ((const flushCandidate_t *) b)->fileIndex;
+}
+
+/**
+ * Drop the pin taken on a candidate block
+ */
+static void unpinCandidate(TC_cache_t *cache, int cacheIndex)
+{
+    TC_cachePartition_t *partition = &cache->partitions[cacheIndex2partition(cacheIndex)];
+    pthread_mutex_lock(&partition->mutex);
+    cache->controlBlocks[cacheIndex].pinCount--;
+    pthread_cond_broadcast(&partition->unpinned);
+    pthread_mutex_unlock(&partition->mutex);
+}
+
+/**
+ * The blocks of a run are on file: they are clean now
+ */
+static void runWritten(TC_cache_t *cache, flushCandidate_t *run, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        setBlockDirty(&cache->controlBlocks[run[i].cacheIndex], 0);
+        __atomic_sub_fetch(&cache->dirtyBlocks, 1, __ATOMIC_RELAXED);
+    }
+    printf("Cache blocks flushed to file blocks %d-%d\n", run[0].fileIndex, run[0].fileIndex + n - 1);
+}
+
+/**
+ * Completion of the asynchronous write of a run
+ */
+static void runWriteDone(void *arg, int status)
+{
+    runWrite_t *write = arg;
+    writeBatch_t *batch = write->batch;
+
+    if (status == 0) runWritten(write->cache, write->run, write->n);
+    pthread_mutex_lock(&batch->mutex);
+    if (status == -1) batch->failed += write->n;
+    if (--batch->pending == 0) pthread_cond_signal(&batch->done);
+    pthread_mutex_unlock(&batch->mutex);
+    free(write);
+}
+
+/**
+ * Write a run of latched blocks adjacent in the file with one pwritev()
+ * @param cache
+ * @param run Cache blocks ordered by file block
+ * @param n Number of blocks in run
+ * @return -1=error
+ */
+static int writeRun(TC_cache_t *cache, flushCandidate_t *run, int n)
+{
+    struct iovec iov[TC_FLUSH_MAX_RUN];
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        iov[i].iov_base = blockData(cache, run[i].cacheIndex);
+        iov[i].iov_len = cache->pageSize;
+    }
+    if (ioWriteBlocks(cache->fileDescriptor, iov, n, blockOffset(cache, run[0].fileIndex)) == -1) return -1;
+    runWritten(cache, run, n);
+    return 0;
+}
+
+/**
+ * Submit the write of a run of latched blocks to the I/O engine
+ * @param cache
+ * @param batch Batch the write is accounted in
+ * @param run Cache blocks ordered by file block
+ * @param n Number of blocks in run
+ * @return -1=error
+ */
+static int submitRun(TC_cache_t *cache, writeBatch_t *batch, flushCandidate_t *run, int n)
+{
+    struct iovec iov[TC_FLUSH_MAX_RUN];
+    runWrite_t *write = malloc(sizeof (runWrite_t));
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        iov[i].iov_base = blockData(cache, run[i].cacheIndex);
+        iov[i].iov_len = cache->pageSize;
+    }
+    write->cache = cache;
+    write->batch = batch;
+    write->run = run;
+    write->n = n;
+    pthread_mutex_lock(&batch->mutex);
+    batch->pending++;
+    pthread_mutex_unlock(&batch->mutex);
+    if (ioSubmitWrite(cache->io, iov, n, blockOffset(cache, run[0].fileIndex), runWriteDone, write) == -1)
+    {
+        runWriteDone(write, -1);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Write back dirty blocks.
+ * Blocks of partitions short of clean blocks are always written; beyond
+ * that, at most maxBlocks dirty blocks are written in file order.
+ * @param cache
+ * @param maxBlocks Number of dirty blocks to write besides short partitions
+ * @param wait 1 to wait for blocks latched by writers, 0 to skip them
+ * @return Number of blocks written, -1=error
+ */
+int writeBackBlocks(TC_cache_t *cache, int maxBlocks, int wait)
+{
+    int candidates[TC_CACHE_BLOCKS];
+    flushCandidate_t latched[TC_CACHE_BLOCKS];
+    writeBatch_t batch;
+    int nCandidates = 0, nLatched = 0;
+    int written = 0, status = 0;
+    int i, p, start;
+
+    // Pin the chosen dirty blocks
+    for (p = 0; p < TC_CACHE_PARTITIONS; p++)
+    {
+        TC_cachePartition_t *partition = &cache->partitions[p];
+        int clean = 0;
+
+        pthread_mutex_lock(&partition->mutex);
+        for (i = partition->firstBlock; i < partition->firstBlock + TC_PARTITION_BLOCKS; i++)
+        {
+            TC_cacheBlockCntl_t *cntl = &cache->controlBlocks[i];
+            if (!cntl->used || (cntl->pinCount == 0 && !isBlockDirty(cntl))) clean++;
+        }
+        for (i = partition->firstBlock; i < partition->firstBlock + TC_PARTITION_BLOCKS; i++)
+        {
+            TC_cacheBlockCntl_t *cntl = &cache->controlBlocks[i];
+            if (!cntl->used || !cntl->valid || !isBlockDirty(cntl)) continue;
+            if (clean < CLEAN_RESERVE)
+            {
+                if (cntl->pinCount == 0) clean++;
+            }
+            else if (maxBlocks > 0)
+            {
+                maxBlocks--;
+            }
+            else continue;
+            cntl->pinCount++;
+            candidates[nCandidates++] = i;
+        }
+        pthread_mutex_unlock(&partition->mutex);
+    }
+
+    // Latch them; blocks being modified are skipped unless asked to wait
+    for (i = 0; i < nCandidates; i++)
+    {
+        TC_cacheBlockCntl_t *cntl = &cache->controlBlocks[candidates[i]];
+        if (wait) pthread_rwlock_rdlock(&cntl->latch);
+        else if (pthread_rwlock_tryrdlock(&cntl->latch) != 0)
+        {
+            unpinCandidate(cache, candidates[i]);
+            continue;
+        }
+        if (!isBlockDirty(cntl))
+        {
+            pthread_rwlock_unlock(&cntl->latch);
+            unpinCandidate(cache, candidates[i]);
+            continue;
+        }
+        latched[nLatched].fileIndex = cntl->fileIndex;
+        latched[nLatched].cacheIndex = candidates[i];
+        nLatched++;
+    }
+
+    // Write runs of blocks adjacent in the file; with an I/O engine all runs
+    // are submitted first and then waited for, keeping the latches meanwhile
+    qsort(latched, nLatched, sizeof (flushCandidate_t), compareFileIndex);
+    pthread_mutex_init(&batch.mutex, NULL);
+    pthread_cond_init(&batch.done, NULL);
+    batch.pending = 0;
+    batch.failed = 0;
+    for (start = 0; start < nLatched; start = i)
+    {
+        for (i = start + 1; i < nLatched && i - start < TC_FLUSH_MAX_RUN; i++)
+        {
+            if (latched[i].fileIndex != latched[i - 1].fileIndex + 1) break;
+        }
+        if (cache->io != NULL)
+        {
+            if (submitRun(cache, &batch, &latched[start], i - start) == -1) status = -1;
+        }
+        else if (writeRun(cache, &latched[start], i - start) == -1) status = -1;
+        else written += i - start;
+    }
+    if (cache->io != NULL)
+    {
+        pthread_mutex_lock(&batch.mutex);
+        while (batch.pending > 0)
+            pthread_cond_wait(&batch.done, &batch.mutex);
+        pthread_mutex_unlock(&batch.mutex);
+        if (batch.failed > 0) status = -1;
+        written = nLatched - batch.failed;
+    }
+    pthread_mutex_destroy(&batch.mutex);
+    pthread_cond_destroy(&batch.done);
+
+    // Release them and wake up threads waiting for clean blocks
+    for (i = 0; i < nLatched; i++)
+    {
+        pthread_rwlock_unlock(&cache->controlBlocks[latched[i].cacheIndex].latch);
+        unpinCandidate(cache, latched[i].cacheIndex);
+    }
+    return status == -1 ? -1 : written;
+}
+
+/**
+ * Main loop of the flusher thread
+ */
+static void *flusherMain(void *arg)
+{
+    TC_cache_t *cache = arg;
+    TC_flusher_t *flusher = &cache->flusher;
+    int low = TC_CACHE_BLOCKS * TC_FLUSH_LOW_PERCENT / 100;
+
+    pthread_mutex_lock(&flusher->mutex);
+    while (!flusher->stop)
+    {
+        struct timespec deadline;
+        int dirty;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long) TC_FLUSH_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        if (!flusher->requested)
+            pthread_cond_timedwait(&flusher->wakeup, &flusher->mutex, &deadline);
+        if (flusher->stop) break;
+        flusher->requested = 0;
+        pthread_mutex_unlock(&flusher->mutex);
+
+        // Above the high watermark write down to the low one; otherwise only
+        // refill the clean reserve of the partitions
+        dirty = __atomic_load_n(&cache->dirtyBlocks, __ATOMIC_RELAXED);
+        if (dirty * 100 > TC_FLUSH_HIGH_PERCENT * TC_CACHE_BLOCKS)
+            writeBackBlocks(cache, dirty - low, 0);
+        else
+            writeBackBlocks(cache, 0, 0);
+
+        pthread_mutex_lock(&flusher->mutex);
+    }
+    pthread_mutex_unlock(&flusher->mutex);
+    return NULL;
+}
+
+/**
+ * Start the flusher thread of the cache
+ * @param cache
+ * @return -1=error
+ */
+int startFlusher(TC_cache_t *cache)
+{
+    TC_flusher_t *flusher = &cache->flusher;
+    pthread_mutex_init(&flusher->mutex, NULL);
+    pthread_cond_init(&flusher->wakeup, NULL);
+    flusher->stop = 0;
+    flusher->requested = 0;
+    if (pthread_create(&flusher->thread, NULL, flusherMain, cache) != 0)
+    {
+        pthread_mutex_destroy(&flusher->mutex);
+        pthread_cond_destroy(&flusher->wakeup);
+        return -1;
+    }
+    flusher->running = 1;
+    return 0;
+}
+
+/**
+ * Stop the flusher thread of the cache, if running
+ * @param cache
+ */
+void stopFlusher(TC_cache_t *cache)
+{
+    TC_flusher_t *flusher = &cache->flusher;
+    if (!flusher->running) return;
+    pthread_mutex_lock(&flusher->mutex);
+    flusher->stop = 1;
+    pthread_cond_signal(&flusher->wakeup);
+    pthread_mutex_unlock(&flusher->mutex);
+    pthread_join(flusher->thread, NULL);
+    flusher->running = 0;
+    pthread_mutex_destroy(&flusher->mutex);
+    pthread_cond_destroy(&flusher->wakeup);
+}
+
+/**
+ * Ask the flusher thread for a write back round
+ * @param cache
+ */
+void wakeFlusher(TC_cache_t *cache)
+{
+    TC_flusher_t *flusher = &cache->flusher;
+    if (!flusher->running) return;
+    pthread_mutex_lock(&flusher->mutex);
+    flusher->requested = 1;
+    pthread_cond_signal(&flusher->wakeup);
+    pthread_mutex_unlock(&flusher->mutex);
+}
+
+#ifdef	__cplusplus
+}
+#endif
@@ -0,0 +1,631 @@
+/*
+ * File:   cachePolicy.c
+ *
+ * CLOCK, LRU-K, 2Q and ARC replacement policies for the table cache.
+ *
+ * All policies try to be scan resistant: a block read only once by a
+ * sequential scan must not push out blocks that are referenced repeatedly.
+ *  - CLOCK admits new blocks with the reference bit cleared, so a scanned
+ *    block is replaced on the first sweep unless it is referenced again.
+ *  - LRU-K ranks blocks by their K-th most recent reference; blocks seen
+ *    fewer than K times have infinite distance and go first.
+ *  - 2Q keeps new blocks in a small FIFO and only promotes them to the main
+ *    LRU queue when they are referenced again after leaving it.
+ *  - ARC splits the cache between recency (T1) and frequency (T2) and adapts
+ *    the split from hits on recently evicted blocks.
+ */
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "cachePolicy.h"
+
+/* ------------------------------------------------------------------------
+ * Intrusive doubly linked lists shared by the policies.
+ * Nodes [0, nFrames) are the cache blocks, the rest are ghost entries which
+ * only remember the file block of a recently evicted block.
+ * Lists are ordered from head (most recent) to tail (least recent).
+ * ------------------------------------------------------------------------ */
+
+#define NO_NODE (-1)
+#define NO_LIST (-1)
+#define MAX_LISTS 5
+
+typedef struct
+{
+    int prev;
+    int next;
+    // List the node currently belongs to
+    int list;
+    // File block remembered by a ghost node
+    int fileBlock;
+} policyNode_t;
+
+typedef struct
+{
+    int head;
+    int tail;
+    int size;
+} policyList_t;
+
+typedef struct
+{
+    int nFrames;
+    int nNodes;
+    policyNode_t *nodes;
+    policyList_t lists[MAX_LISTS];
+    // List holding unused ghost nodes
+    int freeList;
+} policyLists_t;
+
+static void listsInit(policyLists_t *l, int nFrames, int nGhosts, int freeList)
+{
+    int i;
+    l->nFrames = nFrames;
+    l->nNodes = nFrames + nGhosts;
+    l->nodes = calloc(l->nNodes, sizeof (policyNode_t));
+    for (i = 0; i < MAX_LISTS; i++)
+    {
+        l->lists[i].head = l->lists[i].tail = NO_NODE;
+        l->lists[i].size = 0;
+    }
+    for (i = 0; i < l->nNodes; i++)
+    {
+        l->nodes[i].prev = l->nodes[i].next = NO_NODE;
+        l->nodes[i].list = NO_LIST;
+        l->nodes[i].fileBlock = -1;
+    }
+    l->freeList = freeList;
+}
+
+static void listRemove(policyLists_t *l, int n)
+{
+    policyNode_t *node = &l->nodes[n];
+    policyList_t *list;
+
+    if (node->list == NO_LIST) return;
+    list = &l->lists[node->list];
+    if (node->prev != NO_NODE) l->nodes[node->prev].next = node->next;
+    else list->head = node->next;
+    if (node->next != NO_NODE) l->nodes[node->next].prev = node->prev;
+    else list->tail = node->prev;
+    list->size--;
+    node->prev = node->next = NO_NODE;
+    node->list = NO_LIST;
+}
+
+static void listPushHead(policyLists_t *l, int listIndex, int n)
+{
+    policyList_t *list = &l->lists[listIndex];
+    policyNode_t *node = &l->nodes[n];
+
+    listRemove(l, n);
+    node->list = listIndex;
+    node->prev = NO_NODE;
+    node->next = list->head;
+    if (list->head != NO_NODE) l->nodes[list->head].prev = n;
+    else list->tail = n;
+    list->head = n;
+    list->size++;
+}
+
+/**
+ * Oldest node of a list accepted by evictable (cache blocks only)
+ */
+static int listOldestEvictable(policyLists_t *l, int listIndex, TC_evictable_t evictable, void *arg)
+{
+    int n;
+    for (n = l->lists[listIndex].tail; n != NO_NODE; n = l->nodes[n].prev)
+    {
+        if (evictable(n, arg)) return n;
+    }
+    return NO_NODE;
+}
+
+/**
+ * Ghost node of a list remembering fileBlock
+ */
+static int listFindGhost(policyLists_t *l, int listIndex, int fileBlock)
+{
+    int n;
+    for (n = l->lists[listIndex].head; n != NO_NODE; n = l->nodes[n].next)
+    {
+        if (l->nodes[n].fileBlock == fileBlock) return n;
+    }
+    return NO_NODE;
+}
+
+static void listDropGhost(policyLists_t *l, int n)
+{
+    l->nodes[n].fileBlock = -1;
+    listPushHead(l, l->freeList, n);
+}
+
+/**
+ * Remember fileBlock at the head of a ghost list.
+ * If no ghost node is free, the oldest ghost of the longest other list is reused.
+ */
+static void listAddGhost(policyLists_t *l, int listIndex, int fileBlock)
+{
+    int n = l->lists[l->freeList].head;
+    if (n == NO_NODE)
+    {
+        int i, longest = listIndex;
+        for (i = 0; i < MAX_LISTS; i++)
+        {
+            if (i != l->freeList && l->lists[i].tail >= l->nFrames && l->lists[i].size > l->lists[longest].size)
+                longest = i;
+        }
+        n = l->lists[longest].tail;
+        if (n == NO_NODE || n < l->nFrames) return;
+    }
+    l->nodes[n].fileBlock = fileBlock;
+    listPushHead(l, listIndex, n);
+}
+
+static void listsFree(policyLists_t *l)
+{
+    free(l->nodes);
+    l->nodes = NULL;
+}
+
+/* ------------------------------------------------------------------------
+ * CLOCK
+ * ------------------------------------------------------------------------ */
+
+typedef struct
+{
+    char *reference;
+    char *resident;
+    int hand;
+} clockState_t;
+
+static void clockHit(TC_replacementPolicy_t *policy, int cacheIndex)
+{
+    clockState_t *s = policy->state;
+    s->reference[cacheIndex] = 1;
+}
+
+static void clockAdmit(TC_replacementPolicy_t *policy, int cacheIndex, int fileBlock)
+{
+    clockState_t *s = policy->state;
+    s->resident[cacheIndex] = 1;
+    // A new block has to be referenced again to survive the next sweep
+    s->reference[cacheIndex] = 0;
+}
+
+static int clockVictim(TC_replacementPolicy_t *policy, int fileBlock, TC_evictable_t evictable, void *arg)
+{
+    clockState_t *s = policy->state;
+    int step;
+
+    // Two full turns clear every reference bit on the way
+    for (step = 0; step < 2 * policy->nFrames + 1; step++)
+    {
+        int i = s->hand;
+        s->hand = (s->hand + 1) % policy->nFrames;
+        if (!s->resident[i] || !evictable(i, arg)) continue;
+        if (s->reference[i])
+        {
+            s->reference[i] = 0;
+            continue;
+        }
+        return i;
+    }
+    return -1;
+}
+
+static void clockEvict(TC_replacementPolicy_t *policy, int cacheIndex, int fileBlock)
+{
+    clockState_t *s = policy->state;
+    s->resident[cacheIndex] = 0;
+    s->reference[cacheIndex] = 0;
+}
+
+static void clockDestroy(TC_replacementPolicy_t *policy)
+{
+    clockState_t *s = policy->state;
+    free(s->reference);
+    free(s->resident);
+    free(s);
+}
+
+static void clockCreate(TC_replacementPolicy_t *policy)
+{
+    clockState_t *s = calloc(1, sizeof (clockState_t));
+    s->reference = calloc(policy->nFrames, 1);
+    s->resident = calloc(policy->nFrames, 1);
+    s->hand = 0;
+    policy->name = "CLOCK";
+    policy->state = s;
+    policy->hit = clockHit;
+    policy->admit = clockAdmit;
+    policy->victim = clockVictim;
+    policy->evict = clockEvict;
+    policy->destroy = clockDestroy;
+}
+
+/* ------------------------------------------------------------------------
+ * LRU-K
+ * History of evicted blocks is retained for as many blocks as the cache
+ * holds, so a block coming back soon keeps its earlier references.
+ * ------------------------------------------------------------------------ */
+
+typedef struct
+{
+    uint64_t time;
+    // history[i*K + k] = time of the (k+1)-th most recent reference, 0 if none
+    uint64_t *history;
+    char *resident;
+    int nRetained;
+    int *retainedBlock;
+    uint64_t *retainedHistory;
+    int nextRetained;
+} lrukState_t;
+
+static void lrukReference(lrukState_t *s, uint64_t *history)
+{
+    memmove(&history[1], &history[0], (TC_LRUK_K - 1) * sizeof (uint64_t));
+    history[0] = ++s->time;
+}
+
+static void lrukHit(TC_replacementPolicy_t *policy, int cacheIndex)
+{
+    lrukState_t *s = policy->state;
+    lrukReference(s, &s->history[cacheIndex * TC_LRUK_K]);
+}
+
+static void lrukAdmit(TC_replacementPolicy_t *policy, int cacheIndex, int fileBlock)
+{
+    lrukState_t *s = policy->state;
+    uint64_t *history = &s->history[cacheIndex * TC_LRUK_K];
+    int i;
+
+    memset(history, 0, TC_LRUK_K * sizeof (uint64_t));
+    for (i = 0; i < s->nRetained; i++)
+    {
+        if (s->retainedBlock[i] == fileBlock)
+        {
+            memcpy(history, &s->retainedHistory[i * TC_LRUK_K], TC_LRUK_K * sizeof (uint64_t));
+            s->retainedBlock[i] = -1;
+            break;
+        }
+    }
+    lrukReference(s, history);
+    s->resident[cacheIndex] = 1;
+}
+
+static int lrukVictim(TC_replacementPolicy_t *policy, int fileBlock, TC_evictable_t evictable, void *arg)
+{
+    lrukState_t *s = policy->state;
+    int i;
+    int found = -1;
+    uint64_t foundKth = 0, foundLast = 0;
+
+    for (i = 0; i < policy->nFrames; i++)
+    {
+        uint64_t *history = &s->history[i * TC_LRUK_K];
+        // A missing K-th reference (0) means infinite backward distance
+        uint64_t kth = history[TC_LRUK_K - 1];
+        if (!s->resident[i] || !evictable(i, arg)) continue;
+        if (found == -1 || kth < foundKth || (kth == foundKth && history[0] < foundLast))
+        {
+            found = i;
+            foundKth = kth;
+            foundLast = history[0];
+        }
+    }
+    return found;
+}
+
+static void lrukEvict(TC_replacementPolicy_t *policy, int cacheIndex, int fileBlock)
+{
+    lrukState_t *s = policy->state;
+    if (fileBlock >= 0)
+    {
+        s->retainedBlock[s->nextRetained] = fileBlock;
+        memcpy(&s->retainedHistory[s->nextRetained * TC_LRUK_K], &s->history[cacheIndex * TC_LRUK_K], TC_LRUK_K * sizeof (uint64_t));
+        s->nextRetained = (s->nextRetained + 1) % s->nRetained;
+    }
+    s->resident[cacheIndex] = 0;
+}
+
+static void lrukDestroy(TC_replacementPolicy_t *policy)
+{
+    lrukState_t *s = policy->state;
+    free(s->history);
+    free(s->resident);
+    free(s->retainedBlock);
+    free(s->retainedHistory);
+    free(s);
+}
+
+static void lrukCreate(TC_replacementPolicy_t *policy)
+{
+    int i;
+    lrukState_t *s = calloc(1, sizeof (lrukState_t));
+    s->history = calloc(policy->nFrames * TC_LRUK_K, sizeof (uint64_t));
+    s->resident = calloc(policy->nFrames, 1);
+    s->nRetained = policy->nFrames;
+    s->retainedBlock = malloc(s->nRetained * sizeof (int));
+    s->retainedHistory = calloc(s->nRetained * TC_LRUK_K, sizeof (uint64_t));
+    for (i = 0; i < s->nRetained; i++) s->retainedBlock[i] = -1;
+    policy->name = "LRU-K";
+    policy->state = s;
+    policy->hit = lrukHit;
+    policy->admit = lrukAdmit;
+    policy->victim = lrukVictim;
+    policy->evict = lrukEvict;
+    policy->destroy = lrukDestroy;
+}
+
+/* ------------------------------------------------------------------------
+ * 2Q (full version: A1in FIFO, A1out ghost FIFO, Am LRU)
+ * ------------------------------------------------------------------------ */
+
+enum
+{
+    Q_A1IN, Q_A1OUT, Q_AM, Q_FREE
+};
+
+typedef struct
+{
+    policyLists_t l;
+    int kin;
+    int kout;
+} twoQState_t;
+
+static void twoQHit(TC_replacementPolicy_t *policy, int cacheIndex)
+{
+    twoQState_t *s = policy->state;
+    // Hits in A1in are correlated references and do not promote the block
+    if (s->l.nodes[cacheIndex].list == Q_AM) listPushHead(&s->l, Q_AM, cacheIndex);
+}
+
+static void twoQAdmit(TC_replacementPolicy_t *policy, int cacheIndex, int fileBlock)
+{
+    twoQState_t *s = policy->state;
+    int ghost = listFindGhost(&s->l, Q_A1OUT, fileBlock);
+    if (ghost != NO_NODE)
+    {
+        listDropGhost(&s->l, ghost);
+        listPushHead(&s->l, Q_AM, cacheIndex);
+    }
+    else
+    {
+        listPushHead(&s->l, Q_A1IN, cacheIndex);
+    }
+}
+
+static int twoQVictim(TC_replacementPolicy_t *policy, int fileBlock, TC_evictable_t evictable, void *arg)
+{
+    twoQState_t *s = policy->state;
+    int found = NO_NODE;
+
+    if (s->l.lists[Q_A1IN].size > s->kin || s->l.lists[Q_AM].size == 0)
+        found = listOldestEvictable(&s->l, Q_A1IN, evictable, arg);
+    if (found == NO_NODE)
+        found = listOldestEvictable(&s->l, Q_AM, evictable, arg);
+    if (found == NO_NODE)
+        found = listOldestEvictable(&s->l, Q_A1IN, evictable, arg);
+    return found;
+}
+
+static void twoQEvict(TC_replacementPolicy_t *policy, int cacheIndex, int fileBlock)
+{
+    twoQState_t *s = policy->state;
+    if (s->l.nodes[cacheIndex].list == Q_A1IN && fileBlock >= 0)
+    {
+        if (s->l.lists[Q_A1OUT].size >= s->kout)
+            listDropGhost(&s->l, s->l.lists[Q_A1OUT].tail);
+        listAddGhost(&s->l, Q_A1OUT, fileBlock);
+    }
+    listRemove(&s->l, cacheIndex);
+}
+
+static void twoQDestroy(TC_replacementPolicy_t *policy)
+{
+    twoQState_t *s = policy->state;
+    listsFree(&s->l);
+    free(s);
+}
+
+static void twoQCreate(TC_replacementPolicy_t *policy)
+{
+    int i;
+    twoQState_t *s = calloc(1, sizeof (twoQState_t));
+    s->kin = policy->nFrames * TC_2Q_KIN_PERCENT / 100;
+    s->kout = policy->nFrames * TC_2Q_KOUT_PERCENT / 100;
+    if (s->kin < 1) s->kin = 1;
+    if (s->kout < 1) s->kout = 1;
+    listsInit(&s->l, policy->nFrames, s->kout, Q_FREE);
+    for (i = policy->nFrames; i < s->l.nNodes; i++) listPushHead(&s->l, Q_FREE, i);
+    policy->name = "2Q";
+    policy->state = s;
+    policy->hit = twoQHit;
+    policy->admit = twoQAdmit;
+    policy->victim = twoQVictim;
+    policy->evict = twoQEvict;
+    policy->destroy = twoQDestroy;
+}
+
+/* ------------------------------------------------------------------------
+ * ARC
+ * ------------------------------------------------------------------------ */
+
+enum
+{
+    ARC_T1, ARC_T2, ARC_B1, ARC_B2, ARC_FREE
+};
+
+typedef struct
+{
+    policyLists_t l;
+    // Target size of T1
+    int p;
+} arcState_t;
+
+#define ARC_SIZE(s, list) ((s)->l.lists[list].size)
+
+/**
+ * Target size of T1 after a miss on fileBlock (ghost hits move the target)
+ */
+static int arcAdaptedTarget(arcState_t *s, int c, int fileBlock, int *ghost, int *ghostList)
+{
+    int delta;
+    *ghostList = NO_LIST;
+    *ghost = listFindGhost(&s->l, ARC_B1, fileBlock);
+    if (*ghost != NO_NODE)
+    {
+        *ghostList = ARC_B1;
+        delta = ARC_SIZE(s, ARC_B2) / ARC_SIZE(s, ARC_B1);
+        if (delta < 1) delta = 1;
+        return s->p + delta > c ? c : s->p + delta;
+    }
+    *ghost = listFindGhost(&s->l, ARC_B2, fileBlock);
+    if (*ghost != NO_NODE)
+    {
+        *ghostList = ARC_B2;
+        delta = ARC_SIZE(s, ARC_B1) / ARC_SIZE(s, ARC_B2);
+        if (delta < 1) delta = 1;
+        return s->p - delta < 0 ? 0 : s->p - delta;
+    }
+    return s->p;
+}
+
+static void arcHit(TC_replacementPolicy_t *policy, int cacheIndex)
+{
+    arcState_t *s = policy->state;
+    listPushHead(&s->l, ARC_T2, cacheIndex);
+}
+
+static void arcAdmit(TC_replacementPolicy_t *policy, int cacheIndex, int fileBlock)
+{
+    arcState_t *s = policy->state;
+    int c = policy->nFrames;
+    int ghost, ghostList;
+
+    s->p = arcAdaptedTarget(s, c, fileBlock, &ghost, &ghostList);
+    if (ghost != NO_NODE)
+    {
+        listDropGhost(&s->l, ghost);
+        listPushHead(&s->l, ARC_T2, cacheIndex);
+    }
+    else
+    {
+        listPushHead(&s->l, ARC_T1, cacheIndex);
+    }
+
+    // Keep the directory within |T1|+|B1| <= c and |T1|+|T2|+|B1|+|B2| <= 2c
+    while (ARC_SIZE(s, ARC_T1) + ARC_SIZE(s, ARC_B1) > c && ARC_SIZE(s, ARC_B1) > 0)
+        listDropGhost(&s->l, s->l.lists[ARC_B1].tail);
+    while (ARC_SIZE(s, ARC_T1) + ARC_SIZE(s, ARC_T2) + ARC_SIZE(s, ARC_B1) + ARC_SIZE(s, ARC_B2) > 2 * c && ARC_SIZE(s, ARC_B2) > 0)
+        listDropGhost(&s->l, s->l.lists[ARC_B2].tail);
+}
+
+static int arcVictim(TC_replacementPolicy_t *policy, int fileBlock, TC_evictable_t evictable, void *arg)
+{
+    arcState_t *s = policy->state;
+    int ghost, ghostList;
+    int p = arcAdaptedTarget(s, policy->nFrames, fileBlock, &ghost, &ghostList);
+    int t1 = ARC_SIZE(s, ARC_T1);
+    int found = NO_NODE;
+
+    if (t1 > 0 && (t1 > p || (ghostList == ARC_B2 && t1 == p)))
+    {
+        found = listOldestEvictable(&s->l, ARC_T1, evictable, arg);
+        if (found == NO_NODE) found = listOldestEvictable(&s->l, ARC_T2, evictable, arg);
+    }
+    else
+    {
+        found = listOldestEvictable(&s->l, ARC_T2, evictable, arg);
+        if (found == NO_NODE) found = listOldestEvictable(&s->l, ARC_T1, evictable, arg);
+    }
+    return found;
+}
+
+static void arcEvict(TC_replacementPolicy_t *policy, int cacheIndex, int fileBlock)
+{
+    arcState_t *s = policy->state;
+    int list = s->l.nodes[cacheIndex].list;
+    listRemove(&s->l, cacheIndex);
+    if (fileBlock < 0) return;
+    if (list == ARC_T1) listAddGhost(&s->l, ARC_B1, fileBlock);
+    else if (list == ARC_T2) listAddGhost(&s->l, ARC_B2, fileBlock);
+}
+
+static void arcDestroy(TC_replacementPolicy_t *policy)
+{
+    arcState_t *s = policy->state;
+    listsFree(&s->l);
+    free(s);
+}
+
+static void arcCreate(TC_replacementPolicy_t *policy)
+{
+    int i;
+    arcState_t *s = calloc(1, sizeof (arcState_t));
+    s->p = 0;
+    listsInit(&s->l, policy->nFrames, policy->nFrames + 1, ARC_FREE);
+    for (i = policy->nFrames; i < s->l.nNodes; i++) listPushHead(&s->l, ARC_FREE, i);
+    policy->name = "ARC";
+    policy->state = s;
+    policy->hit = arcHit;
+    policy->admit = arcAdmit;
+    policy->victim = arcVictim;
+    policy->evict = arcEvict;
+    policy->destroy = arcDestroy;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/**
+ * Create a replacement policy
+ * @param type Policy to use
+ * @param nFrames Number of cache blocks the policy manages
+ * @return NULL if the policy is unknown
+ */
+TC_replacementPolicy_t *TC_createPolicy(TC_policy_t type, int nFrames)
+{
+    TC_replacementPolicy_t *policy = calloc(1, sizeof (TC_replacementPolicy_t));
+    policy->nFrames = nFrames;
+    switch (type)
+    {
+    case TC_POLICY_CLOCK:
+        clockCreate(policy);
+        break;
+    case TC_POLICY_LRUK:
+        lrukCreate(policy);
+        break;
+    case TC_POLICY_2Q:
+        twoQCreate(policy);
+        break;
+    case TC_POLICY_ARC:
+        arcCreate(policy);
+        break;
+    default:
+        free(policy);
+        return NULL;
+    }
+    return policy;
+}
+
+/**
+ * Release a replacement policy
+ */
+void TC_destroyPolicy(TC_replacementPolicy_t *policy)
+{
+    if (policy == NULL) return;
+    policy->destroy(policy);
+    free(policy);
+}
+
+#ifdef	__cplusplus
+}
+#endif
@@ -0,0 +1,59 @@
+/*
+ * File:   cachePolicy.h
+ *
+ * Replacement policies for the table cache. The cache keeps the blocks and
+ * their contents; a policy only keeps the bookkeeping needed to decide which
+ * cache block is replaced when a new file block has to be read.
+ */
+
+#ifndef CACHEPOLICY_H
+#define	CACHEPOLICY_H
+
+#include "parameters.h"
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+/** Callback telling a policy whether a cache block may be replaced now
+ * @param cacheIndex Index of block on memory cache
+ * @param arg Argument given to victim()
+ * @return 1 if the block can be replaced
+ */
+typedef int (*TC_evictable_t)(int cacheIndex, void *arg);
+
+typedef struct TC_replacementPolicy TC_replacementPolicy_t;
+
+/** A replacement policy instance managing nFrames cache blocks
+ */
+struct TC_replacementPolicy
+{
+    // Human readable name of the policy
+    const char *name;
+    // Number of cache blocks managed
+    int nFrames;
+    // Policy private bookkeeping
+    void *state;
+
+    /** File block held in cache block cacheIndex has been referenced again */
+    void (*hit)(TC_replacementPolicy_t *policy, int cacheIndex);
+    /** File block fileBlock has been read into the free cache block cacheIndex */
+    void (*admit)(TC_replacementPolicy_t *policy, int cacheIndex, int fileBlock);
+    /** Choose the cache block to be replaced to make room for fileBlock.
+     * Only blocks accepted by evictable are returned; -1 if there is none */
+    int (*victim)(TC_replacementPolicy_t *policy, int fileBlock, TC_evictable_t evictable, void *arg);
+    /** Cache block cacheIndex no longer holds fileBlock (-1 if it is just dropped) */
+    void (*evict)(TC_replacementPolicy_t *policy, int cacheIndex, int fileBlock);
+    /** Release the policy bookkeeping */
+    void (*destroy)(TC_replacementPolicy_t *policy);
+};
+
+TC_replacementPolicy_t *TC_createPolicy(TC_policy_t type, int nFrames);
+void TC_destroyPolicy(TC_replacementPolicy_t *policy);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CACHEPOLICY_H */
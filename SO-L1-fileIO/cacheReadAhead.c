@@ -0,0 +1,113 @@
+/*
+ * File:   cacheReadAhead.c
+ *
+ * Sequential read-ahead. Every block fixed in the cache is matched against
+ * a small table of streams; a stream touching consecutive blocks is taken as
+ * a scan and the blocks ahead of it are prefetched asynchronously. The
+ * prefetch window starts small and doubles every time the scan consumes it,
+ * up to the window chosen when the table was opened.
+ */
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "tableCache.h"
+
+/**
+ * Initialize the stream table
+ * @param cache
+ * @param maxWindow Largest prefetch window in blocks, 0 disables read-ahead
+ */
+void initReadAhead(TC_cache_t *cache, int maxWindow)
+{
+    TC_readAhead_t *readAhead = &cache->readAhead;
+    int i;
+
+    pthread_mutex_init(&readAhead->mutex, NULL);
+    // Larger windows would evict prefetched blocks before the scan gets there
+    if (maxWindow > TC_CACHE_BLOCKS / 2) maxWindow = TC_CACHE_BLOCKS / 2;
+    readAhead->maxWindow = maxWindow;
+    readAhead->clock = 0;
+    for (i = 0; i < TC_READAHEAD_STREAMS; i++)
+    {
+        readAhead->streams[i].lastBlock = -1;
+        readAhead->streams[i].lastUse = 0;
+        readAhead->streams[i].sequential = 0;
+        readAhead->streams[i].window = TC_READAHEAD_MIN_BLOCKS < maxWindow ? TC_READAHEAD_MIN_BLOCKS : maxWindow;
+        readAhead->streams[i].prefetchEnd = 0;
+    }
+}
+
+/**
+ * Release the stream table
+ * @param cache
+ */
+void destroyReadAhead(TC_cache_t *cache)
+{
+    pthread_mutex_destroy(&cache->readAhead.mutex);
+}
+
+/**
+ * Account an access to a file block and prefetch ahead of a sequential scan
+ * @param cache
+ * @param fileBlock Block about to be fixed
+ */
+void readAheadBlock(TC_cache_t *cache, int fileBlock)
+{
+    TC_readAhead_t *readAhead = &cache->readAhead;
+    TC_readAheadStream_t *stream = NULL;
+    int first = 0, n = 0;
+    int i;
+
+    if (readAhead->maxWindow == 0) return;
+
+    pthread_mutex_lock(&readAhead->mutex);
+    readAhead->clock++;
+    for (i = 0; i < TC_READAHEAD_STREAMS; i++)
+    {
+        TC_readAheadStream_t *s = &readAhead->streams[i];
+        if (s->lastBlock == fileBlock || s->lastBlock + 1 == fileBlock)
+        {
+            stream = s;
+            break;
+        }
+        // Otherwise reuse the least recently used stream
+        if (stream == NULL || s->lastUse < stream->lastUse) stream = s;
+    }
+
+    if (stream->lastBlock + 1 == fileBlock)
+    {
+        // The scan goes on
+        stream->sequential++;
+        if (stream->sequential >= TC_READAHEAD_TRIGGER && fileBlock + stream->window / 2 >= stream->prefetchEnd)
+        {
+            // Consumed half of the window: read the next one and enlarge it
+            first = stream->prefetchEnd > fileBlock ? stream->prefetchEnd : fileBlock + 1;
+            n = stream->window;
+            stream->prefetchEnd = first + n;
+            stream->window *= 2;
+            if (stream->window > readAhead->maxWindow) stream->window = readAhead->maxWindow;
+        }
+    }
+    else if (stream->lastBlock != fileBlock)
+    {
+        // A new stream
+        stream->sequential = 0;
+        stream->window = TC_READAHEAD_MIN_BLOCKS < readAhead->maxWindow ? TC_READAHEAD_MIN_BLOCKS : readAhead->maxWindow;
+        stream->prefetchEnd = fileBlock + 1;
+    }
+    stream->lastBlock = fileBlock;
+    stream->lastUse = readAhead->clock;
+    pthread_mutex_unlock(&readAhead->mutex);
+
+    if (n > 0) TC_prefetchBlocks(first, n);
+}
+
+#ifdef	__cplusplus
+}
+#endif
@@ -0,0 +1,126 @@
+/*
+ * File:   lsmMemtable.c
+ *
+ * Memtable of the LSM storage: a skiplist of records sorted by key. A
+ * record written again replaces the one in the list. The caller serializes
+ * writers and keeps readers out while writing.
+ */
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "tableLSM.h"
+
+/**
+ * Allocate a node with a tower of the given height
+ */
+static lsmNode_t *createNode(int height)
+{
+    lsmNode_t *node = calloc(1, sizeof (lsmNode_t) + height * sizeof (lsmNode_t *));
+    node->height = height;
+    return node;
+}
+
+/**
+ * Create an empty memtable
+ * @param log Log file the entries of the memtable are written to
+ * @return
+ */
+lsmMemtable_t *lsmCreateMemtable(uint32_t log)
+{
+    lsmMemtable_t *memtable = calloc(1, sizeof (lsmMemtable_t));
+    memtable->head = createNode(TC_LSM_SKIPLIST_HEIGHT);
+    memtable->seed = log + 1;
+    memtable->firstLog = log;
+    memtable->lastLog = log;
+    return memtable;
+}
+
+/**
+ * Release a memtable and its records
+ * @param memtable
+ */
+void lsmDestroyMemtable(lsmMemtable_t *memtable)
+{
+    lsmNode_t *node = memtable->head;
+    while (node != NULL)
+    {
+        lsmNode_t *next = node->next[0];
+        free(node);
+        node = next;
+    }
+    free(memtable);
+}
+
+/**
+ * Height of a new tower: every level is reached by a quarter of the nodes
+ * of the level below
+ */
+static int randomHeight(lsmMemtable_t *memtable)
+{
+    int height = 1;
+    while (height < TC_LSM_SKIPLIST_HEIGHT && rand_r(&memtable->seed) % 4 == 0) height++;
+    return height;
+}
+
+/**
+ * Insert a record, replacing the record of the same key
+ * @param memtable
+ * @param record
+ */
+void lsmMemtablePut(lsmMemtable_t *memtable, const lsmRecord_t *record)
+{
+    lsmNode_t *update[TC_LSM_SKIPLIST_HEIGHT];
+    lsmNode_t *node = memtable->head;
+    int level, height;
+
+    for (level = TC_LSM_SKIPLIST_HEIGHT - 1; level >= 0; level--)
+    {
+        while (node->next[level] != NULL && node->next[level]->record.key < record->key)
+            node = node->next[level];
+        update[level] = node;
+    }
+    node = node->next[0];
+    if (node != NULL && node->record.key == record->key)
+    {
+        node->record = *record;
+        return;
+    }
+    height = randomHeight(memtable);
+    node = createNode(height);
+    node->record = *record;
+    for (level = 0; level < height; level++)
+    {
+        node->next[level] = update[level]->next[level];
+        update[level]->next[level] = node;
+    }
+    memtable->count++;
+}
+
+/**
+ * Look a key up
+ * @param memtable
+ * @param key
+ * @return The record of the key, NULL if it is not in the memtable
+ */
+const lsmRecord_t *lsmMemtableGet(const lsmMemtable_t *memtable, uint64_t key)
+{
+    const lsmNode_t *node = memtable->head;
+    int level;
+
+    for (level = TC_LSM_SKIPLIST_HEIGHT - 1; level >= 0; level--)
+    {
+        while (node->next[level] != NULL && node->next[level]->record.key < key)
+            node = node->next[level];
+    }
+    node = node->next[0];
+    return node != NULL && node->record.key == key ? &node->record : NULL;
+}
+
+#ifdef	__cplusplus
+}
+#endif
@@ -0,0 +1,346 @@
+/*
+ * File:   lsmRun.c
+ *
+ * Sorted runs of the LSM storage. A run file holds a header, the bloom
+ * filter of its keys and its records sorted by key. Runs are written once,
+ * sequentially, and then mapped read-only; lookups check the bloom filter
+ * and search the records with a binary search on the mapping.
+ */
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tableLSM.h"
+#include "tableIO.h"
+
+// Identifies a run file
+#define RUN_MAGIC "SODBRUN"
+
+// Version of the run file format
+#define RUN_VERSION 1
+
+// Records buffered by a run being written
+#define WRITE_BUFFER_RECORDS 256
+
+/** A run being written
+ */
+typedef struct
+{
+    int fd;
+    uint32_t number;
+    uint64_t count;
+    uint64_t *bloom;
+    uint32_t bloomWords;
+    // Position on file of the next buffered record
+    off_t offset;
+    int buffered;
+    lsmRecord_t buffer[WRITE_BUFFER_RECORDS];
+} runWriter_t;
+
+/**
+ * Name of a file of the LSM storage
+ * @param name Filled with the name
+ * @param size Size of name
+ * @param kind "run" or "log"
+ * @param number Number of the file
+ */
+void lsmFileName(char *name, size_t size, const char *kind, uint32_t number)
+{
+    snprintf(name, size, "%s.%s.%u", TC_FILENAME, kind, number);
+}
+
+/**
+ * Hash of a key for the bloom filters (the finalizer of splitmix64)
+ */
+static uint64_t hashKey(uint64_t key)
+{
+    key += 0x9e3779b97f4a7c15ULL;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+/**
+ * Set the bits of a key in a bloom filter. The hash functions are derived
+ * from two halves of a single hash.
+ */
+static void bloomAdd(uint64_t *bloom, uint64_t bits, uint64_t key)
+{
+    uint64_t h = hashKey(key);
+    uint64_t delta = (h >> 32) | 1;
+    int i;
+
+    for (i = 0; i < TC_LSM_BLOOM_HASHES; i++, h += delta)
+        bloom[(h % bits) / 64] |= 1ULL << ((h % bits) % 64);
+}
+
+/**
+ * May a key be in a bloom filter?
+ */
+static int bloomMayContain(const uint64_t *bloom, uint64_t bits, uint64_t key)
+{
+    uint64_t h = hashKey(key);
+    uint64_t delta = (h >> 32) | 1;
+    int i;
+
+    for (i = 0; i < TC_LSM_BLOOM_HASHES; i++, h += delta)
+    {
+        if ((bloom[(h % bits) / 64] & (1ULL << ((h % bits) % 64))) == 0) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Map a run file
+ * @param number Number of the run
+ * @return NULL=error
+ */
+lsmRun_t *lsmOpenRun(uint32_t number)
+{
+    char name[64];
+    lsmRun_t *run;
+    const lsmRunHeader_t *header;
+    struct stat st;
+    int fd;
+
+    lsmFileName(name, sizeof (name), "run", number);
+    fd = open(name, O_RDONLY);
+    if (fd == -1) return NULL;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof (lsmRunHeader_t))
+    {
+        close(fd);
+        return NULL;
+    }
+    run = calloc(1, sizeof (lsmRun_t));
+    run->number = number;
+    run->mapSize = st.st_size;
+    run->map = mmap(NULL, run->mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+    if (run->map == MAP_FAILED)
+    {
+        free(run);
+        return NULL;
+    }
+    header = run->map;
+    if (memcmp(header->magic, RUN_MAGIC, sizeof (RUN_MAGIC)) != 0 || header->version != RUN_VERSION ||
+            sizeof (lsmRunHeader_t) + header->bloomWords * sizeof (uint64_t) + header->count * sizeof (lsmRecord_t) > run->mapSize)
+    {
+        fprintf(stderr, "%s is not a valid run file\n", name);
+        munmap(run->map, run->mapSize);
+        free(run);
+        return NULL;
+    }
+    run->count = header->count;
+    run->bloom = (const uint64_t *) (header + 1);
+    run->bloomBits = (uint64_t) header->bloomWords * 64;
+    run->records = (const lsmRecord_t *) (run->bloom + header->bloomWords);
+    return run;
+}
+
+/**
+ * Unmap a run
+ * @param run
+ * @param removeFile 1 to delete the run file too
+ */
+void lsmCloseRun(lsmRun_t *run, int removeFile)
+{
+    munmap(run->map, run->mapSize);
+    if (removeFile)
+    {
+        char name[64];
+        lsmFileName(name, sizeof (name), "run", run->number);
+        unlink(name);
+    }
+    free(run);
+}
+
+/**
+ * Look a key up
+ * @param run
+ * @param key
+ * @return The record of the key, NULL if it is not in the run
+ */
+const lsmRecord_t *lsmRunGet(const lsmRun_t *run, uint64_t key)
+{
+    uint64_t low = 0, high = run->count;
+
+    if (run->count == 0 || !bloomMayContain(run->bloom, run->bloomBits, key)) return NULL;
+    while (low < high)
+    {
+        uint64_t middle = low + (high - low) / 2;
+        if (run->records[middle].key < key) low = middle + 1;
+        else high = middle;
+    }
+    return low < run->count && run->records[low].key == key ? &run->records[low] : NULL;
+}
+
+/**
+ * Start writing a run
+ * @param number Number of the run
+ * @param capacity Largest number of records the run will get
+ * @return NULL=error
+ */
+static runWriter_t *beginRun(uint32_t number, uint64_t capacity)
+{
+    char name[64];
+    runWriter_t *writer = malloc(sizeof (runWriter_t));
+    uint64_t bits = capacity * TC_LSM_BLOOM_BITS;
+
+    lsmFileName(name, sizeof (name), "run", number);
+    writer->fd = open(name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (writer->fd == -1)
+    {
+        free(writer);
+        return NULL;
+    }
+    writer->number = number;
+    writer->count = 0;
+    writer->bloomWords = bits < 64 ? 1 : (bits + 63) / 64;
+    writer->bloom = calloc(writer->bloomWords, sizeof (uint64_t));
+    writer->offset = sizeof (lsmRunHeader_t) + writer->bloomWords * sizeof (uint64_t);
+    writer->buffered = 0;
+    return writer;
+}
+
+/**
+ * Write the buffered records of a run
+ */
+static int writeBuffer(runWriter_t *writer)
+{
+    size_t size = writer->buffered * sizeof (lsmRecord_t);
+    if (ioWriteBlock(writer->fd, writer->buffer, size, writer->offset) == -1) return -1;
+    writer->offset += size;
+    writer->buffered = 0;
+    return 0;
+}
+
+/**
+ * Append a record to a run; keys must come in ascending order
+ */
+static int appendRun(runWriter_t *writer, const lsmRecord_t *record)
+{
+    bloomAdd(writer->bloom, (uint64_t) writer->bloomWords * 64, record->key);
+    writer->buffer[writer->buffered++] = *record;
+    writer->count++;
+    return writer->buffered == WRITE_BUFFER_RECORDS ? writeBuffer(writer) : 0;
+}
+
+/**
+ * Complete a run: write its header and bloom filter and make it durable
+ * @param writer Released
+ * @param status -1 if the run failed and has to be dropped
+ * @return The run mapped, NULL=error
+ */
+static lsmRun_t *endRun(runWriter_t *writer, int status)
+{
+    lsmRunHeader_t header;
+    struct iovec iov[2];
+    uint32_t number = writer->number;
+
+    memset(&header, 0, sizeof (header));
+    memcpy(header.magic, RUN_MAGIC, sizeof (RUN_MAGIC));
+    header.version = RUN_VERSION;
+    header.bloomWords = writer->bloomWords;
+    header.count = writer->count;
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof (header);
+    iov[1].iov_base = writer->bloom;
+    iov[1].iov_len = writer->bloomWords * sizeof (uint64_t);
+    if (status == 0 && writer->buffered > 0) status = writeBuffer(writer);
+    if (status == 0) status = ioWriteBlocks(writer->fd, iov, 2, 0);
+    if (status == 0) status = ioSync(writer->fd);
+    close(writer->fd);
+    free(writer->bloom);
+    free(writer);
+    if (status == -1)
+    {
+        char name[64];
+        lsmFileName(name, sizeof (name), "run", number);
+        unlink(name);
+        return NULL;
+    }
+    return lsmOpenRun(number);
+}
+
+/**
+ * Write the records of a memtable as a run
+ * @param memtable
+ * @param number Number of the new run
+ * @return NULL=error
+ */
+lsmRun_t *lsmWriteMemtable(const lsmMemtable_t *memtable, uint32_t number)
+{
+    runWriter_t *writer = beginRun(number, memtable->count);
+    const lsmNode_t *node;
+    int status = 0;
+
+    if (writer == NULL) return NULL;
+    for (node = memtable->head->next[0]; node != NULL && status == 0; node = node->next[0])
+        status = appendRun(writer, &node->record);
+    return endRun(writer, status);
+}
+
+/**
+ * Merge runs into a new one. A key found in several runs keeps the record
+ * of the newest run.
+ * @param runs Runs to be merged, newest first
+ * @param nRuns Number of runs
+ * @param number Number of the new run
+ * @return NULL=error
+ */
+lsmRun_t *lsmMergeRuns(lsmRun_t **runs, int nRuns, uint32_t number)
+{
+    uint64_t *position = calloc(nRuns, sizeof (uint64_t));
+    uint64_t capacity = 0, key;
+    runWriter_t *writer;
+    int status = 0;
+    int i;
+
+    for (i = 0; i < nRuns; i++)
+    {
+        capacity += runs[i]->count;
+        // Each run is read once from start to end
+        madvise(runs[i]->map, runs[i]->mapSize, MADV_SEQUENTIAL);
+    }
+    writer = beginRun(number, capacity);
+    if (writer == NULL)
+    {
+        free(position);
+        return NULL;
+    }
+    while (status == 0)
+    {
+        const lsmRecord_t *next = NULL;
+        for (i = 0; i < nRuns; i++)
+        {
+            if (position[i] == runs[i]->count) continue;
+            // On equal keys the earlier, newer run wins
+            if (next == NULL || runs[i]->records[position[i]].key < next->key)
+                next = &runs[i]->records[position[i]];
+        }
+        if (next == NULL) break;
+        key = next->key;
+        status = appendRun(writer, next);
+        // Skip the older records of the key
+        for (i = 0; i < nRuns; i++)
+        {
+            if (position[i] < runs[i]->count && runs[i]->records[position[i]].key == key) position[i]++;
+        }
+    }
+    free(position);
+    return endRun(writer, status);
+}
+
+#ifdef	__cplusplus
+}
+#endif
@@ -22,14 +22,13 @@ extern "C"
 
 void help(char **argv)
 {
-    fprintf(stderr, "Usage: %s <#entries>\n", argv[0]);
+    fprintf(stderr, "Usage: %s <#entries> [clock|lruk|2q|arc]\n", argv[0]);
     exit(1);
 }
 
 int main(int argc, char** argv)
 {
-    TC_openTable();
-    
+    TC_tableOptions_t options;
     TC_tableEntry_t entry;
     int N;
     int i;
@@ -37,6 +36,17 @@ int main(int argc, char** argv)
     if (argc < 2) help(argv);
     if (sscanf(argv[1], "%d", &N) != 1) help(argv);
 
+    TC_defaultOptions(&options);
+    if (argc > 2)
+    {
+        if (strcmp(argv[2], "clock") == 0) options.policy = TC_POLICY_CLOCK;
+        else if (strcmp(argv[2], "lruk") == 0) options.policy = TC_POLICY_LRUK;
+        else if (strcmp(argv[2], "2q") == 0) options.policy = TC_POLICY_2Q;
+        else if (strcmp(argv[2], "arc") == 0) options.policy = TC_POLICY_ARC;
+        else help(argv);
+    }
+    if (TC_openTableWithOptions(&options) == -1) return (EXIT_FAILURE);
+
     printf("Writing table\n");
     for (i = 0; i < N; i++)
     {
@@ -35,8 +35,29 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 
 # Object Files
 OBJECTFILES= \
+	${OBJECTDIR}/cacheFlusher.o \
+	${OBJECTDIR}/cachePolicy.o \
+	${OBJECTDIR}/cacheReadAhead.o \
+	${OBJECTDIR}/lsmMemtable.o \
+	${OBJECTDIR}/lsmRun.o \
 	${OBJECTDIR}/main.o \
-	${OBJECTDIR}/tableCache.o
+	${OBJECTDIR}/tableAsyncIO.o \
+	${OBJECTDIR}/tableCache.o \
+	${OBJECTDIR}/tableIO.o \
+	${OBJECTDIR}/tableLSM.o \
+	${OBJECTDIR}/tableMmap.o \
+	${OBJECTDIR}/tablePage.o
+
+# Test Directory
+TESTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}/tests
+
+# Test Files
+TESTFILES= \
+	${TESTDIR}/TestFiles/f1
+
+# Test Object Files
+TESTOBJECTFILES= \
+	${TESTDIR}/tests/tablePageTest.o
 
 
 # C Compiler Flags
@@ -53,7 +74,7 @@ FFLAGS=
 ASFLAGS=
 
 # Link Libraries and Options
-LDLIBSOPTIONS=
+LDLIBSOPTIONS=-lpthread
 
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
@@ -63,19 +84,91 @@ ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/so-l1-fileio: ${OBJECTFILES}
 	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
 	${LINK.c} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/so-l1-fileio ${OBJECTFILES} ${LDLIBSOPTIONS}
 
+${OBJECTDIR}/cacheFlusher.o: cacheFlusher.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/cacheFlusher.o cacheFlusher.c
+
+${OBJECTDIR}/cachePolicy.o: cachePolicy.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/cachePolicy.o cachePolicy.c
+
+${OBJECTDIR}/cacheReadAhead.o: cacheReadAhead.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/cacheReadAhead.o cacheReadAhead.c
+
+${OBJECTDIR}/lsmMemtable.o: lsmMemtable.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/lsmMemtable.o lsmMemtable.c
+
+${OBJECTDIR}/lsmRun.o: lsmRun.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/lsmRun.o lsmRun.c
+
 ${OBJECTDIR}/main.o: main.c 
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
 	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.c
 
+${OBJECTDIR}/tableAsyncIO.o: tableAsyncIO.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/tableAsyncIO.o tableAsyncIO.c
+
 ${OBJECTDIR}/tableCache.o: tableCache.c 
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
 	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/tableCache.o tableCache.c
 
+${OBJECTDIR}/tableIO.o: tableIO.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/tableIO.o tableIO.c
+
+${OBJECTDIR}/tableLSM.o: tableLSM.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/tableLSM.o tableLSM.c
+
+${OBJECTDIR}/tableMmap.o: tableMmap.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/tableMmap.o tableMmap.c
+
+${OBJECTDIR}/tablePage.o: tablePage.c 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/tablePage.o tablePage.c
+
 # Subprojects
 .build-subprojects:
 
+# Build Test Targets
+.build-tests-conf: .build-tests-subprojects .build-conf ${TESTFILES}
+.build-tests-subprojects:
+
+${TESTDIR}/TestFiles/f1: ${TESTDIR}/tests/tablePageTest.o $(filter-out ${OBJECTDIR}/main.o,${OBJECTFILES})
+	${MKDIR} -p ${TESTDIR}/TestFiles
+	${LINK.c} -o ${TESTDIR}/TestFiles/f1 $^ ${LDLIBSOPTIONS}
+
+${TESTDIR}/tests/tablePageTest.o: tests/tablePageTest.c
+	${MKDIR} -p ${TESTDIR}/tests
+	${RM} "$@.d"
+	$(COMPILE.c) -g -I. -MMD -MP -MF "$@.d" -o ${TESTDIR}/tests/tablePageTest.o tests/tablePageTest.c
+
+# Run Test Targets
+.test-conf:
+	@if [ "${TEST}" = "" ]; \
+	then  \
+	    ${TESTDIR}/TestFiles/f1; \
+	else  \
+	    ./${TEST}; \
+	fi
+
 # Clean Targets
 .clean-conf: ${CLEAN_SUBPROJECTS}
 	${RM} -r ${CND_BUILDDIR}/${CND_CONF}
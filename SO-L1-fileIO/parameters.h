@@ -18,14 +18,131 @@ extern "C"
 // Default name of table file name
 #define TC_FILENAME "so_dbtable.dat"
     
-// Number of entries in a table cache block
-#define TC_BLOCK_ENTRIES 4
+// Size of the pages of a new table file in bytes (a cache block holds a page)
+#define TC_DEFAULT_PAGE_SIZE 4096
 
-// Size of a table cache block in bytes
-#define TC_CACHE_BLOCK_SIZE ((TC_ENTRY_SIZE)*(TC_BLOCK_ENTRIES))
+// Smallest page size of a table file in bytes
+#define TC_MIN_PAGE_SIZE 4096
+
+// Largest page size of a table file in bytes
+#define TC_MAX_PAGE_SIZE 65536
+
+// Is the table file opened for direct I/O by TC_openTable()?
+#define TC_DEFAULT_DIRECT_IO 0
+
+// Are cache blocks backed by huge pages by TC_openTable()?
+#define TC_DEFAULT_HUGE_PAGES 0
+
+// Size of a huge page in bytes
+#define TC_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Storage of the table file used by TC_openTable()
+#define TC_DEFAULT_STORAGE TC_STORAGE_CACHE
+
+// Number of latches shared by the pages of a mapped table file
+#define TC_MMAP_LATCHES 64
+
+// Smallest growth of a mapped table file in bytes
+#define TC_MMAP_MIN_GROWTH (1024 * 1024)
+
+// Address space reserved for a mapped table file, its largest size in bytes
+#define TC_MMAP_RESERVE (1UL << 40)
+
+// Entries of the LSM memtable before it is written as a sorted run
+#define TC_LSM_MEMTABLE_ENTRIES 8192
+
+// Log records buffered before they are appended to the log file
+#define TC_LSM_LOG_BUFFER 64
+
+// Number of level 0 runs triggering their compaction into level 1
+#define TC_LSM_L0_RUNS 4
+
+// Levels of sorted runs; level 0 holds the runs written from memtables
+#define TC_LSM_LEVELS 5
+
+// Entries of level 1 triggering its compaction into level 2
+#define TC_LSM_LEVEL1_ENTRIES (4 * TC_LSM_MEMTABLE_ENTRIES)
+
+// Growth in size from a level to the next one
+#define TC_LSM_FANOUT 10
+
+// Bits of the bloom filter of a run per entry
+#define TC_LSM_BLOOM_BITS 10
+
+// Hash functions of the bloom filters
+#define TC_LSM_BLOOM_HASHES 7
+
+// Tallest tower of the memtable skiplist
+#define TC_LSM_SKIPLIST_HEIGHT 16
+
+// Number of latches shared by the blocks of an LSM table
+#define TC_LSM_LATCHES 64
+
+// Average record size the number of entries per page is derived from
+#define TC_EXPECTED_RECORD_SIZE 48
 
 // Number of blocks in RAM cache
-#define TC_CACHE_BLOCKS 4
+#define TC_CACHE_BLOCKS 64
+
+// Number of independent partitions of the cache (must divide TC_CACHE_BLOCKS)
+#define TC_CACHE_PARTITIONS 4
+
+// Number of cache blocks owned by every partition
+#define TC_PARTITION_BLOCKS ((TC_CACHE_BLOCKS)/(TC_CACHE_PARTITIONS))
+
+// Number of buckets of the page table of every partition
+#define TC_PARTITION_BUCKETS (2*(TC_PARTITION_BLOCKS))
+
+// Dirty blocks (percent of cache) above which the flusher starts writing
+#define TC_FLUSH_HIGH_PERCENT 50
+
+// Dirty blocks (percent of cache) the flusher leaves after a round
+#define TC_FLUSH_LOW_PERCENT 10
+
+// Clean unpinned blocks (percent of a partition) kept ready for misses
+#define TC_CLEAN_RESERVE_PERCENT 25
+
+// Period of the flusher checks when nobody wakes it up (milliseconds)
+#define TC_FLUSH_INTERVAL_MS 200
+
+// Maximum number of blocks transferred by a single preadv()/pwritev() call
+#define TC_FLUSH_MAX_RUN 64
+
+// Replacement policy used by TC_openTable()
+#define TC_DEFAULT_POLICY TC_POLICY_2Q
+
+// Is the background flusher started by TC_openTable()?
+#define TC_DEFAULT_BACKGROUND_FLUSH 1
+
+// Backend for asynchronous block I/O used by TC_openTable()
+#define TC_DEFAULT_IO_BACKEND TC_IO_AUTO
+
+// Maximum number of asynchronous block transfers in flight
+#define TC_IO_QUEUE_DEPTH 64
+
+// Number of threads of the thread pool I/O backend
+#define TC_IO_POOL_THREADS 4
+
+// Largest read-ahead window of a sequential scan used by TC_openTable() (in blocks)
+#define TC_DEFAULT_READAHEAD_BLOCKS 32
+
+// First read-ahead window of a new scan (in blocks)
+#define TC_READAHEAD_MIN_BLOCKS 4
+
+// Consecutive blocks accessed before a stream is taken as a scan
+#define TC_READAHEAD_TRIGGER 2
+
+// Number of scans followed at the same time
+#define TC_READAHEAD_STREAMS 8
+
+// Number of references tracked per block by LRU-K
+#define TC_LRUK_K 2
+
+// 2Q: share of the cache used by the A1in probation FIFO (percent)
+#define TC_2Q_KIN_PERCENT 25
+
+// 2Q: number of evicted blocks remembered in A1out (percent of cache)
+#define TC_2Q_KOUT_PERCENT 50
 
     
 #ifdef	__cplusplus
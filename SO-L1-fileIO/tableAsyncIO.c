@@ -0,0 +1,549 @@
+/*
+ * File:   tableAsyncIO.c
+ *
+ * Asynchronous block I/O on the table file. Requests are queued and their
+ * callbacks run when they complete, so a thread can keep many block
+ * transfers in flight. Two backends are available:
+ *  - io_uring, driven through the raw system calls: requests are pushed on
+ *    the submission ring and a completion thread reaps the completion ring.
+ *  - a pool of threads doing blocking preadv()/pwritev(), used where
+ *    io_uring is not available.
+ */
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "tableIO.h"
+
+/** A queued block transfer
+ */
+typedef struct ioRequest
+{
+    int write;
+    off_t offset;
+    ioCallback_t callback;
+    void *arg;
+    // Next request in the queue of the thread pool
+    struct ioRequest *next;
+    int n;
+    struct iovec iov[];
+} ioRequest_t;
+
+/** Shared rings of an io_uring instance
+ */
+typedef struct
+{
+    int ringFd;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    pthread_t completionThread;
+} ioUring_t;
+
+struct ioEngine
+{
+    TC_ioBackend_t backend;
+    int fd;
+    // Maximum number of requests in flight
+    int queueDepth;
+    // Protects everything below
+    pthread_mutex_t mutex;
+    // Signalled when a request completes
+    pthread_cond_t completed;
+    // Signalled when a request is queued for the thread pool
+    pthread_cond_t queued;
+    int inFlight;
+    // A request is being pushed on the submission ring
+    int submitting;
+    int stop;
+    // Queue of the thread pool
+    ioRequest_t *first, *last;
+    int nThreads;
+    pthread_t *threads;
+    ioUring_t uring;
+};
+
+/**
+ * Finish a transfer synchronously after done bytes were already moved.
+ * Reads reaching the end of file are completed with zeroes.
+ * @return -1=error
+ */
+static int ioTransferRest(int fd, ioRequest_t *request, size_t done)
+{
+    struct iovec *iov = request->iov;
+    int n = request->n;
+    off_t offset = request->offset + done;
+
+    for (;;)
+    {
+        ssize_t status;
+        // Skip what has been transferred
+        while (n > 0 && done >= iov->iov_len)
+        {
+            done -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n == 0) return 0;
+        iov->iov_base = (char *) iov->iov_base + done;
+        iov->iov_len -= done;
+
+        status = request->write ? pwritev(fd, iov, n, offset) : preadv(fd, iov, n, offset);
+        if (status == -1)
+        {
+            if (errno == EINTR)
+            {
+                done = 0;
+                continue;
+            }
+            return -1;
+        }
+        if (status == 0 && !request->write)
+        {
+            // EOF
+            for (; n > 0; iov++, n--) memset(iov->iov_base, 0, iov->iov_len);
+            return 0;
+        }
+        offset += status;
+        done = status;
+    }
+}
+
+/**
+ * Run the callback of a finished request and release its slot
+ */
+static void ioComplete(ioEngine_t *engine, ioRequest_t *request, int status)
+{
+    request->callback(request->arg, status);
+    free(request);
+    pthread_mutex_lock(&engine->mutex);
+    engine->inFlight--;
+    pthread_cond_broadcast(&engine->completed);
+    pthread_mutex_unlock(&engine->mutex);
+}
+
+/* ------------------------------------------------------------------------
+ * Thread pool backend
+ * ------------------------------------------------------------------------ */
+
+static void *ioWorkerMain(void *arg)
+{
+    ioEngine_t *engine = arg;
+    for (;;)
+    {
+        ioRequest_t *request;
+        pthread_mutex_lock(&engine->mutex);
+        while (engine->first == NULL && !engine->stop)
+            pthread_cond_wait(&engine->queued, &engine->mutex);
+        if (engine->first == NULL)
+        {
+            pthread_mutex_unlock(&engine->mutex);
+            return NULL;
+        }
+        request = engine->first;
+        engine->first = request->next;
+        if (engine->first == NULL) engine->last = NULL;
+        pthread_mutex_unlock(&engine->mutex);
+
+        ioComplete(engine, request, ioTransferRest(engine->fd, request, 0));
+    }
+}
+
+static int ioThreadsStart(ioEngine_t *engine)
+{
+    int i;
+    engine->threads = calloc(engine->nThreads, sizeof (pthread_t));
+    for (i = 0; i < engine->nThreads; i++)
+    {
+        if (pthread_create(&engine->threads[i], NULL, ioWorkerMain, engine) != 0) break;
+    }
+    engine->nThreads = i;
+    return i > 0 ? 0 : -1;
+}
+
+static void ioThreadsStop(ioEngine_t *engine)
+{
+    int i;
+    pthread_mutex_lock(&engine->mutex);
+    engine->stop = 1;
+    pthread_cond_broadcast(&engine->queued);
+    pthread_mutex_unlock(&engine->mutex);
+    for (i = 0; i < engine->nThreads; i++) pthread_join(engine->threads[i], NULL);
+    free(engine->threads);
+}
+
+static void ioThreadsSubmit(ioEngine_t *engine, ioRequest_t *request)
+{
+    request->next = NULL;
+    if (engine->last != NULL) engine->last->next = request;
+    else engine->first = request;
+    engine->last = request;
+    pthread_cond_signal(&engine->queued);
+}
+
+/* ------------------------------------------------------------------------
+ * io_uring backend
+ * ------------------------------------------------------------------------ */
+
+static int uringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static void *uringCompletionMain(void *arg)
+{
+    ioEngine_t *engine = arg;
+    ioUring_t *ring = &engine->uring;
+
+    for (;;)
+    {
+        unsigned head = __atomic_load_n(ring->cqHead, __ATOMIC_RELAXED);
+        unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+        if (head == tail)
+        {
+            if (uringEnter(ring->ringFd, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR)
+            {
+                perror("io_uring_enter");
+                return NULL;
+            }
+            continue;
+        }
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+            ioRequest_t *request = (ioRequest_t *) (uintptr_t) cqe->user_data;
+            int result = cqe->res;
+            size_t total = 0;
+            int i, status;
+
+            // A NOP without request asks the thread to finish
+            if (request == NULL)
+            {
+                __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+                return NULL;
+            }
+            for (i = 0; i < request->n; i++) total += request->iov[i].iov_len;
+            if (result < 0) status = -1;
+            else if ((size_t) result < total) status = ioTransferRest(engine->fd, request, result);
+            else status = 0;
+            __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+            ioComplete(engine, request, status);
+        }
+    }
+}
+
+/**
+ * Push a request on the submission ring. The caller holds the engine mutex,
+ * which is released while waiting for room in the kernel.
+ * @param request NULL to push a NOP that stops the completion thread
+ * @return -1=error, the entry was withdrawn and the request is not referenced
+ */
+static int uringSubmit(ioEngine_t *engine, ioRequest_t *request)
+{
+    ioUring_t *ring = &engine->uring;
+    unsigned tail, index;
+    struct io_uring_sqe *sqe;
+    int status = 0;
+
+    // One entry on the ring at a time, so a failed one can be withdrawn
+    while (engine->submitting)
+        pthread_cond_wait(&engine->completed, &engine->mutex);
+    engine->submitting = 1;
+    tail = *ring->sqTail;
+    index = tail & *ring->sqMask;
+    sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof (*sqe));
+    if (request == NULL)
+    {
+        sqe->opcode = IORING_OP_NOP;
+    }
+    else
+    {
+        sqe->opcode = request->write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = engine->fd;
+        sqe->addr = (uintptr_t) request->iov;
+        sqe->len = request->n;
+        sqe->off = request->offset;
+    }
+    sqe->user_data = (uintptr_t) request;
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    while (uringEnter(ring->ringFd, 1, 0, 0) == -1)
+    {
+        int error = errno;
+        // Once the kernel has taken the entry it owns the request until its completion
+        if (__atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) != tail) break;
+        if (error == EAGAIN || error == EBUSY)
+        {
+            // Out of resources or completion ring full: let the completion thread
+            // reap, then retry. The timeout covers a wait with nothing in flight.
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += 1000000;
+            if (until.tv_nsec >= 1000000000)
+            {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&engine->completed, &engine->mutex, &until);
+        }
+        else if (error != EINTR)
+        {
+            // Withdraw the entry, so the caller can release the request
+            __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+            errno = error;
+            status = -1;
+            break;
+        }
+    }
+    engine->submitting = 0;
+    pthread_cond_broadcast(&engine->completed);
+    return status;
+}
+
+static void uringUnmap(ioUring_t *ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != NULL && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+    if (ring->sqRing != NULL && ring->sqRing != MAP_FAILED) munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->ringFd);
+}
+
+static int uringStart(ioEngine_t *engine)
+{
+    ioUring_t *ring = &engine->uring;
+    struct io_uring_params params;
+    char *sq, *cq;
+
+    memset(&params, 0, sizeof (params));
+    // The completion ring gets twice the entries, more than requests in flight
+    ring->ringFd = uringSetup(engine->queueDepth, &params);
+    if (ring->ringFd == -1) return -1;
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED)
+    {
+        uringUnmap(ring);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cqRing = ring->sqRing;
+    else
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_CQ_RING);
+    ring->sqesSize = params.sq_entries * sizeof (struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQES);
+    if (ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        uringUnmap(ring);
+        return -1;
+    }
+
+    sq = ring->sqRing;
+    cq = ring->cqRing;
+    ring->sqHead = (unsigned *) (sq + params.sq_off.head);
+    ring->sqTail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *) (sq + params.sq_off.array);
+    ring->cqHead = (unsigned *) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    // Never more requests in flight than submission entries
+    if ((int) params.sq_entries < engine->queueDepth) engine->queueDepth = params.sq_entries;
+
+    if (pthread_create(&ring->completionThread, NULL, uringCompletionMain, engine) != 0)
+    {
+        uringUnmap(ring);
+        return -1;
+    }
+    return 0;
+}
+
+static void uringStop(ioEngine_t *engine)
+{
+    pthread_mutex_lock(&engine->mutex);
+    uringSubmit(engine, NULL);
+    pthread_mutex_unlock(&engine->mutex);
+    pthread_join(engine->uring.completionThread, NULL);
+    uringUnmap(&engine->uring);
+}
+
+/* ------------------------------------------------------------------------ */
+
+/**
+ * Create an asynchronous I/O engine for the table file
+ * @param fd Descriptor of the table file
+ * @param backend Backend to use; TC_IO_AUTO prefers io_uring
+ * @param queueDepth Maximum number of requests in flight
+ * @param nThreads Number of threads of the thread pool backend
+ * @return NULL=error
+ */
+ioEngine_t *ioCreateEngine(int fd, TC_ioBackend_t backend, int queueDepth, int nThreads)
+{
+    ioEngine_t *engine = calloc(1, sizeof (ioEngine_t));
+    engine->fd = fd;
+    engine->queueDepth = queueDepth;
+    engine->nThreads = nThreads;
+    pthread_mutex_init(&engine->mutex, NULL);
+    pthread_cond_init(&engine->completed, NULL);
+    pthread_cond_init(&engine->queued, NULL);
+
+    if (backend != TC_IO_THREADS)
+    {
+        if (uringStart(engine) == 0)
+        {
+            engine->backend = TC_IO_URING;
+            return engine;
+        }
+        if (backend == TC_IO_URING)
+        {
+            perror("io_uring not available");
+            goto error;
+        }
+    }
+    if (ioThreadsStart(engine) == 0)
+    {
+        engine->backend = TC_IO_THREADS;
+        return engine;
+    }
+
+error:
+    pthread_mutex_destroy(&engine->mutex);
+    pthread_cond_destroy(&engine->completed);
+    pthread_cond_destroy(&engine->queued);
+    free(engine);
+    return NULL;
+}
+
+/**
+ * Wait for every request in flight and release the engine
+ */
+void ioDestroyEngine(ioEngine_t *engine)
+{
+    if (engine == NULL) return;
+    ioWaitAll(engine);
+    if (engine->backend == TC_IO_URING) uringStop(engine);
+    else ioThreadsStop(engine);
+    pthread_mutex_destroy(&engine->mutex);
+    pthread_cond_destroy(&engine->completed);
+    pthread_cond_destroy(&engine->queued);
+    free(engine);
+}
+
+/**
+ * Name of the backend in use
+ */
+const char *ioEngineName(ioEngine_t *engine)
+{
+    return engine->backend == TC_IO_URING ? "io_uring" : "thread pool";
+}
+
+/**
+ * Queue a transfer of consecutive file blocks.
+ * Blocks while the queue is full.
+ */
+static int ioSubmit(ioEngine_t *engine, int write, const struct iovec *iov, int n, off_t offset, ioCallback_t callback, void *arg)
+{
+    ioRequest_t *request = malloc(sizeof (ioRequest_t) + n * sizeof (struct iovec));
+    int status = 0;
+
+    request->write = write;
+    request->offset = offset;
+    request->callback = callback;
+    request->arg = arg;
+    request->n = n;
+    memcpy(request->iov, iov, n * sizeof (struct iovec));
+
+    pthread_mutex_lock(&engine->mutex);
+    while (engine->inFlight >= engine->queueDepth)
+        pthread_cond_wait(&engine->completed, &engine->mutex);
+    engine->inFlight++;
+    if (engine->backend == TC_IO_URING) status = uringSubmit(engine, request);
+    else ioThreadsSubmit(engine, request);
+    if (status == -1) engine->inFlight--;
+    pthread_mutex_unlock(&engine->mutex);
+
+    if (status == -1) free(request);
+    return status;
+}
+
+/**
+ * Read consecutive file blocks asynchronously into several buffers.
+ * The part beyond the end of file is filled with zeroes.
+ * @param engine
+ * @param iov Buffers of the blocks (copied, the buffers must stay valid)
+ * @param n Number of buffers
+ * @param offset Position on file of the first block
+ * @param callback Called with the status (-1=error) when the read completes
+ * @param arg Argument of the callback
+ * @return -1 if the request could not be queued
+ */
+int ioSubmitRead(ioEngine_t *engine, const struct iovec *iov, int n, off_t offset, ioCallback_t callback, void *arg)
+{
+    return ioSubmit(engine, 0, iov, n, offset, callback, arg);
+}
+
+/**
+ * Write consecutive file blocks asynchronously from several buffers
+ * @param engine
+ * @param iov Buffers of the blocks (copied, the buffers must stay valid)
+ * @param n Number of buffers
+ * @param offset Position on file of the first block
+ * @param callback Called with the status (-1=error) when the write completes
+ * @param arg Argument of the callback
+ * @return -1 if the request could not be queued
+ */
+int ioSubmitWrite(ioEngine_t *engine, const struct iovec *iov, int n, off_t offset, ioCallback_t callback, void *arg)
+{
+    return ioSubmit(engine, 1, iov, n, offset, callback, arg);
+}
+
+/**
+ * Wait until no request is in flight
+ */
+void ioWaitAll(ioEngine_t *engine)
+{
+    pthread_mutex_lock(&engine->mutex);
+    while (engine->inFlight > 0)
+        pthread_cond_wait(&engine->completed, &engine->mutex);
+    pthread_mutex_unlock(&engine->mutex);
+}
+
+#ifdef	__cplusplus
+}
+#endif
@@ -1,10 +1,13 @@
-/* 
+/*
  * File:   tableCache.c
  * Author: Guillermo Prez Trabado <guille@ac.uma.es>
  *
  * Created on 11 de julio de 2018, 22:10
  */
 
+// O_DIRECT, MAP_HUGETLB
+#define _GNU_SOURCE
+
 #ifdef	__cplusplus
 extern "C"
 {
@@ -14,25 +17,32 @@ extern "C"
 #include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
 #include "tableCache.h"
+#include "tableIO.h"
+#include "tablePage.h"
 
 /** This is the variable containing the cache
  */
 static TC_cache_t *cache;
-static int fileDescriptor;
 
 /**
  * Translate the index of an entry into the file to the index of the block
  */
-#define fileIndex2blockIndex(fileIndex) ((fileIndex)/(TC_BLOCK_ENTRIES))
+#define fileIndex2blockIndex(fileIndex) ((fileIndex)/(cache->slotsPerPage))
+/**
+ * Slot of an entry inside a block
+ */
+#define fileIndex2blockOffset(fileIndex) ((fileIndex)%(cache->slotsPerPage))
 /**
- * Offset of an entry inside a block
+ * Page table bucket of a file block inside its partition
  */
-#define fileIndex2blockOffset(fileIndex) ((fileIndex)%(TC_BLOCK_ENTRIES))
+#define blockIndex2bucket(fileBlock) (((fileBlock)/(TC_CACHE_PARTITIONS))%(TC_PARTITION_BUCKETS))
 
 /**
  * Initialize the file cache
@@ -40,105 +50,178 @@ static int fileDescriptor;
  */
 void initCache(TC_cache_t *cache)
 {
-    int i;
+    int i, j;
     for (i = 0; i < TC_CACHE_BLOCKS; i++)
     {
         cache->controlBlocks[i].used = 0;
         cache->controlBlocks[i].dirty = 0;
-        cache->controlBlocks[i].ramIndex = -1;
+        cache->controlBlocks[i].ramIndex = i;
         cache->controlBlocks[i].fileIndex = -1;
+        cache->controlBlocks[i].valid = 0;
+        cache->controlBlocks[i].pinCount = 0;
+        cache->controlBlocks[i].loading = 0;
+        cache->controlBlocks[i].hashNext = -1;
+        pthread_rwlock_init(&cache->controlBlocks[i].latch, NULL);
+    }
+    for (i = 0; i < TC_CACHE_PARTITIONS; i++)
+    {
+        pthread_mutex_init(&cache->partitions[i].mutex, NULL);
+        pthread_cond_init(&cache->partitions[i].unpinned, NULL);
+        pthread_cond_init(&cache->partitions[i].loaded, NULL);
+        cache->partitions[i].firstBlock = i * TC_PARTITION_BLOCKS;
+        for (j = 0; j < TC_PARTITION_BUCKETS; j++)
+            cache->partitions[i].buckets[j] = -1;
+        cache->partitions[i].policy = NULL;
     }
 }
 
 /**
- * Flush the block indicated by cache position onto file
+ * Release the synchronization objects and policies of the cache
+ * @param cache pointer to current cache structure
  */
-int flushBlock(TC_cache_t *cache, int cacheIndex)
+static void destroyCache(TC_cache_t *cache)
 {
-    off_t offset;
-    int status;
-
-    if (cache->controlBlocks[cacheIndex].used)
+    int i;
+    for (i = 0; i < TC_CACHE_BLOCKS; i++)
+        pthread_rwlock_destroy(&cache->controlBlocks[i].latch);
+    for (i = 0; i < TC_CACHE_PARTITIONS; i++)
     {
-        if (cache->controlBlocks[cacheIndex].dirty)
-        {
-            offset = lseek(fileDescriptor, cache->controlBlocks[cacheIndex].fileIndex*TC_CACHE_BLOCK_SIZE, SEEK_SET);
-            if (offset == (off_t) - 1) return -1;
-            status = write(fileDescriptor, &(cache->dataBlocks[cacheIndex]), TC_CACHE_BLOCK_SIZE);
-            if (status == -1) return -1;
-            printf("Cache block %d flushed to file block %d\n", cacheIndex, cache->controlBlocks[cacheIndex].fileIndex);
-            cache->controlBlocks[cacheIndex].dirty = 0;
-            return 0;
-        }
+        pthread_mutex_destroy(&cache->partitions[i].mutex);
+        pthread_cond_destroy(&cache->partitions[i].unpinned);
+        pthread_cond_destroy(&cache->partitions[i].loaded);
+        TC_destroyPolicy(cache->partitions[i].policy);
     }
-    else return -1;
 }
 
 /**
- * Read file block into cache block indicated by cache position
+ * Flush the block indicated by cache position onto file.
+ * The caller must hold the latch of the block in any mode.
  */
-int readBlock(TC_cache_t *cache, int fileBlock, int cacheIndex)
+int flushBlock(TC_cache_t *cache, int cacheIndex)
 {
-    off_t offset;
-    int status;
-
-    if (cache->controlBlocks[cacheIndex].dirty)
-    {
-        if (flushBlock(cache, cacheIndex) == -1) return -1;
-    }
-    else
-    {
-        cache->controlBlocks[cacheIndex].used = 1;
-        cache->controlBlocks[cacheIndex].dirty = 0;
-        cache->controlBlocks[cacheIndex].fileIndex = fileBlock;
-        // Seek to file position
-        offset = lseek(fileDescriptor, fileBlock*TC_CACHE_BLOCK_SIZE, SEEK_SET);
-        if (offset == (off_t) - 1) return -1;
-        // Read data
-        status = read(fileDescriptor, &(cache->dataBlocks[cacheIndex]), TC_CACHE_BLOCK_SIZE);
-        // If EOF, fill buffer with zeroes
-        if (status < TC_CACHE_BLOCK_SIZE)
-        {
-            memset((void *) &(cache->dataBlocks[cacheIndex]), 0, TC_CACHE_BLOCK_SIZE);
-        }
-        // Else check if error
-        if (status == -1) return -1;
-        cache->controlBlocks[cacheIndex].dirty = 0;
+    // Nothing to write for unused or clean blocks
+    if (!cache->controlBlocks[cacheIndex].used || !isBlockDirty(&cache->controlBlocks[cacheIndex]))
         return 0;
-    }
+
+    if (ioWriteBlock(cache->fileDescriptor, blockData(cache, cacheIndex), cache->pageSize, blockOffset(cache, cache->controlBlocks[cacheIndex].fileIndex)) == -1)
+        return -1;
+    printf("Cache block %d flushed to file block %d\n", cacheIndex, cache->controlBlocks[cacheIndex].fileIndex);
+    setBlockDirty(&cache->controlBlocks[cacheIndex], 0);
+    __atomic_sub_fetch(&cache->dirtyBlocks, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * Mark a block as modified.
+ * The caller must hold the latch of the block in exclusive mode.
+ */
+void markBlockDirty(TC_cache_t *cache, int cacheIndex)
+{
+    if (isBlockDirty(&cache->controlBlocks[cacheIndex])) return;
+    setBlockDirty(&cache->controlBlocks[cacheIndex], 1);
+    if (__atomic_add_fetch(&cache->dirtyBlocks, 1, __ATOMIC_RELAXED) * 100 > TC_FLUSH_HIGH_PERCENT * TC_CACHE_BLOCKS)
+        wakeFlusher(cache);
 }
 
 /**
- * Find file block in cache
+ * Read file block into cache block indicated by cache position.
+ * The caller must hold the latch of the block in exclusive mode.
+ */
+int readBlock(TC_cache_t *cache, int fileBlock, int cacheIndex)
+{
+    return ioReadBlock(cache->fileDescriptor, blockData(cache, cacheIndex), cache->pageSize, blockOffset(cache, fileBlock));
+}
+
+/**
+ * Find file block in the page table of its partition.
+ * The caller must hold the partition mutex.
  * @param cache
  * @param fileBlock
  * @return -1 if not present
  */
 int findBlockInCache(TC_cache_t *cache, int fileBlock)
 {
+    TC_cachePartition_t *partition = &cache->partitions[blockIndex2partition(fileBlock)];
     int i;
-    for (i = 0; i < TC_CACHE_BLOCKS; i++)
+    for (i = partition->buckets[blockIndex2bucket(fileBlock)]; i != -1; i = cache->controlBlocks[i].hashNext)
     {
-        if (cache->controlBlocks[i].used && cache->controlBlocks[i].fileIndex == fileBlock)
+        if (cache->controlBlocks[i].fileIndex == fileBlock)
             return i;
     }
     return -1;
 }
 
 /**
- * Find free block in cache
- * @param cache
- * @return Index of block
+ * Add a cache block to the page table of its partition
  */
-int findFreeBlockInCache(TC_cache_t *cache)
+static void insertBlockInPageTable(TC_cache_t *cache, TC_cachePartition_t *partition, int cacheIndex)
 {
-    static int lastdirtystart = 0;
+    int *bucket = &partition->buckets[blockIndex2bucket(cache->controlBlocks[cacheIndex].fileIndex)];
+    cache->controlBlocks[cacheIndex].hashNext = *bucket;
+    *bucket = cacheIndex;
+}
 
+/**
+ * Remove a cache block from the page table of its partition
+ */
+static void removeBlockFromPageTable(TC_cache_t *cache, TC_cachePartition_t *partition, int cacheIndex)
+{
+    int *link = &partition->buckets[blockIndex2bucket(cache->controlBlocks[cacheIndex].fileIndex)];
+    while (*link != -1)
+    {
+        if (*link == cacheIndex)
+        {
+            *link = cache->controlBlocks[cacheIndex].hashNext;
+            break;
+        }
+        link = &cache->controlBlocks[*link].hashNext;
+    }
+    cache->controlBlocks[cacheIndex].hashNext = -1;
+}
+
+/**
+ * Only blocks nobody has fixed may be replaced
+ * @param localIndex Index of the block inside the partition
+ * @param arg Partition
+ */
+static int unpinnedBlockEvictable(int localIndex, void *arg)
+{
+    TC_cachePartition_t *partition = arg;
+    return cache->controlBlocks[partition->firstBlock + localIndex].pinCount == 0;
+}
+
+/**
+ * Only clean blocks nobody has fixed may be replaced
+ * @param localIndex Index of the block inside the partition
+ * @param arg Partition
+ */
+static int cleanBlockEvictable(int localIndex, void *arg)
+{
+    TC_cachePartition_t *partition = arg;
+    TC_cacheBlockCntl_t *cntl = &cache->controlBlocks[partition->firstBlock + localIndex];
+    return cntl->pinCount == 0 && !isBlockDirty(cntl);
+}
+
+/**
+ * Find free block in the partition of a file block.
+ * The caller must hold the partition mutex, which may be released meanwhile
+ * when the caller has to wait.
+ * With the flusher running only clean blocks are replaced, otherwise a
+ * dirty victim is written by the calling thread.
+ * @param cache
+ * @param fileBlock File block that will be read into the returned block
+ * @param wait 0 to give up instead of waiting for a clean block
+ * @return Index of block, -1 if the caller must look the block up again
+ */
+int findFreeBlockInCache(TC_cache_t *cache, int fileBlock, int wait)
+{
+    TC_cachePartition_t *partition = &cache->partitions[blockIndex2partition(fileBlock)];
+    TC_cacheBlockCntl_t *cntl;
     int i;
     int found = -1;
 
     // Return any unused block
-    for (i = 0; i < TC_CACHE_BLOCKS; i++)
+    for (i = partition->firstBlock; i < partition->firstBlock + TC_PARTITION_BLOCKS; i++)
     {
         if (!cache->controlBlocks[i].used)
         {
@@ -148,97 +231,715 @@ int findFreeBlockInCache(TC_cache_t *cache)
         }
     }
 
-    // If not, return any clean block
+    // If not, let the replacement policy choose a clean unpinned one
     if (found == -1)
     {
-        int j;
-        for (j = lastdirtystart; j < TC_CACHE_BLOCKS + lastdirtystart; j++)
+        int local = partition->policy->victim(partition->policy, fileBlock, cleanBlockEvictable, partition);
+        if (local == -1 && (cache->flusher.running || !wait))
+        {
+            // Every unpinned block is dirty: let the flusher clean some
+            wakeFlusher(cache);
+            if (wait) pthread_cond_wait(&partition->unpinned, &partition->mutex);
+            return -1;
+        }
+        if (local == -1)
+            local = partition->policy->victim(partition->policy, fileBlock, unpinnedBlockEvictable, partition);
+        if (local == -1)
+        {
+            // Everything is fixed, wait until some block is released
+            pthread_cond_wait(&partition->unpinned, &partition->mutex);
+            return -1;
+        }
+        found = partition->firstBlock + local;
+        cntl = &cache->controlBlocks[found];
+        if (isBlockDirty(cntl))
+        {
+            // Clean it without blocking the partition and let the caller retry
+            cntl->pinCount++;
+            pthread_mutex_unlock(&partition->mutex);
+            pthread_rwlock_rdlock(&cntl->latch);
+            printf("Dirty cache block %d (file block %i) cleaned for replacement\n", found, cntl->fileIndex);
+            flushBlock(cache, found);
+            pthread_rwlock_unlock(&cntl->latch);
+            pthread_mutex_lock(&partition->mutex);
+            cntl->pinCount--;
+            return -1;
+        }
+        printf("Clean cache block %d (file block %i) replaced by %s\n", found, cntl->fileIndex, partition->policy->name);
+        removeBlockFromPageTable(cache, partition, found);
+        partition->policy->evict(partition->policy, found - partition->firstBlock, cntl->fileIndex);
+    }
+    cache->controlBlocks[found].used = 1;
+    cache->controlBlocks[found].valid = 0;
+    cache->controlBlocks[found].fileIndex = -1;
+    return found;
+}
+
+/**
+ * Drop a pin on a cache block
+ */
+static void unpinBlock(TC_cachePartition_t *partition, int cacheIndex)
+{
+    pthread_mutex_lock(&partition->mutex);
+    if (--cache->controlBlocks[cacheIndex].pinCount == 0)
+        pthread_cond_signal(&partition->unpinned);
+    pthread_mutex_unlock(&partition->mutex);
+}
+
+/**
+ * Fix a file block in the cache, reading it from file on a miss.
+ * The block stays in the cache and latched in the given mode until
+ * TC_unfixBlock() is called. Blocks ahead of a sequential scan of shared
+ * fixes are prefetched.
+ * @param cache
+ * @param fileBlock Index of block on file
+ * @param mode Shared latch for reading or exclusive latch for writing
+ * @param fixed Handle of the fixed block
+ * @return -1=error
+ */
+static int cacheFixBlock(TC_cache_t *cache, int fileBlock, TC_latchMode_t mode, TC_fixedBlock_t *fixed)
+{
+    TC_cachePartition_t *partition = &cache->partitions[blockIndex2partition(fileBlock)];
+    TC_cacheBlockCntl_t *cntl;
+    int cacheIndex;
+
+    // Only readers are followed: prefetched blocks would compete for clean
+    // blocks with the dirty ones left behind by writers
+    if (mode == TC_LATCH_SHARED) readAheadBlock(cache, fileBlock);
+    for (;;)
+    {
+        pthread_mutex_lock(&partition->mutex);
+        cacheIndex = findBlockInCache(cache, fileBlock);
+        if (cacheIndex != -1)
+        {
+            // Hit: pin it so that it is not replaced while waiting for the latch
+            cntl = &cache->controlBlocks[cacheIndex];
+            cntl->pinCount++;
+            partition->policy->hit(partition->policy, cacheIndex - partition->firstBlock);
+            // Being read asynchronously: wait for the read instead of issuing another
+            while (cntl->loading)
+                pthread_cond_wait(&partition->loaded, &partition->mutex);
+            pthread_mutex_unlock(&partition->mutex);
+            if (mode == TC_LATCH_EXCLUSIVE) pthread_rwlock_wrlock(&cntl->latch);
+            else pthread_rwlock_rdlock(&cntl->latch);
+            // The thread reading it may have failed
+            if (cntl->valid && cntl->fileIndex == fileBlock) break;
+            pthread_rwlock_unlock(&cntl->latch);
+            unpinBlock(partition, cacheIndex);
+            continue;
+        }
+
+        // Miss: take a free block and read the file block into it
+        cacheIndex = findFreeBlockInCache(cache, fileBlock, 1);
+        if (cacheIndex == -1)
+        {
+            pthread_mutex_unlock(&partition->mutex);
+            continue;
+        }
+        cntl = &cache->controlBlocks[cacheIndex];
+        // Unpinned blocks are not latched by anybody, so this always succeeds
+        if (pthread_rwlock_trywrlock(&cntl->latch) != 0)
+        {
+            cntl->used = 0;
+            pthread_mutex_unlock(&partition->mutex);
+            continue;
+        }
+        cntl->fileIndex = fileBlock;
+        cntl->pinCount = 1;
+        insertBlockInPageTable(cache, partition, cacheIndex);
+        pthread_mutex_unlock(&partition->mutex);
+
+        if (readBlock(cache, fileBlock, cacheIndex) == -1)
         {
-            i = j % TC_CACHE_BLOCKS;
-            if (cache->controlBlocks[i].used && !cache->controlBlocks[i].dirty)
+            pthread_mutex_lock(&partition->mutex);
+            removeBlockFromPageTable(cache, partition, cacheIndex);
+            cntl->used = 0;
+            cntl->fileIndex = -1;
+            cntl->pinCount--;
+            pthread_cond_signal(&partition->unpinned);
+            pthread_mutex_unlock(&partition->mutex);
+            pthread_rwlock_unlock(&cntl->latch);
+            return -1;
+        }
+        pthread_mutex_lock(&partition->mutex);
+        cntl->valid = 1;
+        partition->policy->admit(partition->policy, cacheIndex - partition->firstBlock, fileBlock);
+        pthread_mutex_unlock(&partition->mutex);
+        if (mode == TC_LATCH_SHARED)
+        {
+            // The block is pinned, so it is still there after relatching
+            pthread_rwlock_unlock(&cntl->latch);
+            pthread_rwlock_rdlock(&cntl->latch);
+        }
+        break;
+    }
+
+    fixed->cacheIndex = cacheIndex;
+    fixed->fileBlock = fileBlock;
+    fixed->mode = mode;
+    fixed->page = blockData(cache, cacheIndex);
+    return 0;
+}
+
+/**
+ * Fix the block holding an entry
+ * @param fileIndex Index of entry into file.
+ * @param mode Shared latch for reading or exclusive latch for writing
+ * @param fixed Handle of the fixed block
+ * @return Slot of the entry inside the page of the block, -1=error
+ */
+int TC_fixEntry(int fileIndex, TC_latchMode_t mode, TC_fixedBlock_t *fixed)
+{
+    if (TC_fixBlock(fileIndex2blockIndex(fileIndex), mode, fixed) == -1) return -1;
+    return fileIndex2blockOffset(fileIndex);
+}
+
+/**
+ * Copy an entry out of a fixed block
+ * @param fixed Handle of the fixed block
+ * @param slot Slot of the entry inside the page
+ * @param entry Filled with the entry
+ */
+void TC_getEntry(const TC_fixedBlock_t *fixed, int slot, TC_tableEntry_t *entry)
+{
+    cache->storage->getEntry(cache, fixed, slot, entry);
+}
+
+/**
+ * Store an entry in a block fixed in exclusive mode
+ * @param fixed Handle of the fixed block
+ * @param slot Slot of the entry inside the page
+ * @param entry
+ * @return -1=error
+ */
+int TC_putEntry(TC_fixedBlock_t *fixed, int slot, const TC_tableEntry_t *entry)
+{
+    return cache->storage->putEntry(cache, fixed, slot, entry);
+}
+
+/**
+ * Copy an entry out of a slotted page, reading it from the overflow file
+ * if its slot is forwarded. The latch of the page covers the overflow entry.
+ * @param overflowFd Descriptor of the overflow file
+ * @param page
+ * @param pageSize Size of the page in bytes
+ * @param slotsPerPage Entries per data page
+ * @param fileIndex Index of entry into file
+ * @param entry Filled with the entry
+ * @return -1=error
+ */
+static int readPageEntry(int overflowFd, const void *page, int pageSize, int slotsPerPage, int fileIndex, TC_tableEntry_t *entry)
+{
+    if (TC_pageGetEntry(page, pageSize, slotsPerPage, fileIndex % slotsPerPage, entry) == 0) return 0;
+    return ioReadBlock(overflowFd, entry, TC_ENTRY_SIZE, (off_t) fileIndex * TC_ENTRY_SIZE);
+}
+
+/**
+ * Store an entry in a slotted page, forwarding it to the overflow file if
+ * the page has no room for it
+ * @param overflowFd Descriptor of the overflow file
+ * @param page
+ * @param pageSize Size of the page in bytes
+ * @param slotsPerPage Entries per data page
+ * @param fileIndex Index of entry into file
+ * @param entry
+ * @return -1=error
+ */
+static int writePageEntry(int overflowFd, void *page, int pageSize, int slotsPerPage, int fileIndex, const TC_tableEntry_t *entry)
+{
+    int slot = fileIndex % slotsPerPage;
+
+    if (TC_pagePutEntry(page, pageSize, slotsPerPage, slot, entry) == 0) return 0;
+    if (errno != ENOSPC) return -1;
+    // The entry is on the overflow file before the page points to it
+    if (ioWriteBlock(overflowFd, entry, TC_ENTRY_SIZE, (off_t) fileIndex * TC_ENTRY_SIZE) == -1) return -1;
+    TC_pageForwardEntry(page, pageSize, slotsPerPage, slot);
+    return 0;
+}
+
+/**
+ * Copy an entry out of a fixed slotted page
+ * @param cache
+ * @param fixed Handle of the fixed block
+ * @param slot Slot of the entry inside the page
+ * @param entry Filled with the entry, zeroes if its overflow entry cannot
+ * be read
+ */
+void pageGetEntry(TC_cache_t *cache, const TC_fixedBlock_t *fixed, int slot, TC_tableEntry_t *entry)
+{
+    int fileIndex = fixed->fileBlock * cache->slotsPerPage + slot;
+
+    if (readPageEntry(cache->overflowDescriptor, fixed->page, cache->pageSize, cache->slotsPerPage, fileIndex, entry) == -1)
+    {
+        perror("Error reading overflow entry");
+        memset(entry, 0, sizeof (TC_tableEntry_t));
+    }
+}
+
+/**
+ * Store an entry in a slotted page fixed in exclusive mode
+ * @param cache
+ * @param fixed Handle of the fixed block
+ * @param slot Slot of the entry inside the page
+ * @param entry
+ * @return -1=error
+ */
+int pagePutEntry(TC_cache_t *cache, TC_fixedBlock_t *fixed, int slot, const TC_tableEntry_t *entry)
+{
+    int fileIndex = fixed->fileBlock * cache->slotsPerPage + slot;
+
+    return writePageEntry(cache->overflowDescriptor, fixed->page, cache->pageSize, cache->slotsPerPage, fileIndex, entry);
+}
+
+/**
+ * Release a block fixed by cacheFixBlock()
+ * @param cache
+ * @param fixed Handle of the fixed block
+ * @param dirty 1 if the entries were modified (requires exclusive latch)
+ */
+static void cacheUnfixBlock(TC_cache_t *cache, TC_fixedBlock_t *fixed, int dirty)
+{
+    TC_cacheBlockCntl_t *cntl = &cache->controlBlocks[fixed->cacheIndex];
+    if (dirty) markBlockDirty(cache, fixed->cacheIndex);
+    pthread_rwlock_unlock(&cntl->latch);
+    unpinBlock(&cache->partitions[blockIndex2partition(fixed->fileBlock)], fixed->cacheIndex);
+}
+
+/**
+ * Write a block fixed in exclusive mode to file while still latched
+ * @param cache
+ * @param fixed Handle of the fixed block
+ * @return -1=error
+ */
+static int cacheWriteBlock(TC_cache_t *cache, TC_fixedBlock_t *fixed)
+{
+    markBlockDirty(cache, fixed->cacheIndex);
+    return flushBlock(cache, fixed->cacheIndex);
+}
+
+/**
+ * Fix a file block. The block stays in memory and latched in the given
+ * mode until TC_unfixBlock() is called. A thread may hold several blocks
+ * fixed, also while a mapped table file grows to fix a block past its end;
+ * with a mapped file, blocks equal modulo TC_MMAP_LATCHES share a latch and
+ * cannot be fixed together if either is exclusive.
+ * @param fileBlock Index of block on file
+ * @param mode Shared latch for reading or exclusive latch for writing
+ * @param fixed Handle of the fixed block
+ * @return -1=error
+ */
+int TC_fixBlock(int fileBlock, TC_latchMode_t mode, TC_fixedBlock_t *fixed)
+{
+    return cache->storage->fixBlock(cache, fileBlock, mode, fixed);
+}
+
+/**
+ * Release a block fixed by TC_fixBlock()
+ * @param fixed Handle of the fixed block
+ * @param dirty 1 if the entries were modified (requires exclusive latch)
+ */
+void TC_unfixBlock(TC_fixedBlock_t *fixed, int dirty)
+{
+    cache->storage->unfixBlock(cache, fixed, dirty);
+    fixed->page = NULL;
+}
+
+/** Consecutive file blocks reserved in the cache and filled together
+ */
+typedef struct
+{
+    int firstFileBlock;
+    int n;
+    int cacheIndex[TC_FLUSH_MAX_RUN];
+} loadRun_t;
+
+/**
+ * Reserve a cache block for a file block that is not cached, without
+ * waiting for one. The block is pinned and marked as loading, so threads
+ * fixing it wait until publishBlocks() is called.
+ * @param fileBlock Index of block on file
+ * @return Index of block, -1 if the block is cached or there is no clean block
+ */
+static int reserveBlock(int fileBlock)
+{
+    TC_cachePartition_t *partition = &cache->partitions[blockIndex2partition(fileBlock)];
+    int cacheIndex;
+
+    pthread_mutex_lock(&partition->mutex);
+    cacheIndex = findBlockInCache(cache, fileBlock);
+    if (cacheIndex == -1) cacheIndex = findFreeBlockInCache(cache, fileBlock, 0);
+    else cacheIndex = -1;
+    // Unpinned blocks are not latched by anybody; the latch is not kept,
+    // readers wait on the loading flag instead
+    if (cacheIndex != -1)
+    {
+        TC_cacheBlockCntl_t *cntl = &cache->controlBlocks[cacheIndex];
+        cntl->fileIndex = fileBlock;
+        cntl->pinCount = 1;
+        cntl->loading = 1;
+        insertBlockInPageTable(cache, partition, cacheIndex);
+    }
+    pthread_mutex_unlock(&partition->mutex);
+    return cacheIndex;
+}
+
+/**
+ * Make the reserved blocks of a run available once filled, or drop them
+ * @param run
+ * @param status 0 if the blocks hold the file blocks, -1=error
+ */
+static void publishBlocks(loadRun_t *run, int status)
+{
+    int i;
+
+    for (i = 0; i < run->n; i++)
+    {
+        TC_cacheBlockCntl_t *cntl = &cache->controlBlocks[run->cacheIndex[i]];
+        TC_cachePartition_t *partition = &cache->partitions[cacheIndex2partition(run->cacheIndex[i])];
+
+        pthread_mutex_lock(&partition->mutex);
+        if (status == 0)
+        {
+            cntl->valid = 1;
+            partition->policy->admit(partition->policy, run->cacheIndex[i] - partition->firstBlock, cntl->fileIndex);
+        }
+        else
+        {
+            removeBlockFromPageTable(cache, partition, run->cacheIndex[i]);
+            cntl->used = 0;
+            cntl->fileIndex = -1;
+        }
+        cntl->loading = 0;
+        cntl->pinCount--;
+        pthread_cond_broadcast(&partition->loaded);
+        pthread_cond_signal(&partition->unpinned);
+        pthread_mutex_unlock(&partition->mutex);
+    }
+}
+
+/**
+ * Completion of an asynchronous read
+ */
+static void prefetchDone(void *arg, int status)
+{
+    loadRun_t *run = arg;
+    publishBlocks(run, status);
+    if (status == 0)
+        printf("File blocks %d-%d prefetched\n", run->firstFileBlock, run->firstFileBlock + run->n - 1);
+    free(run);
+}
+
+/**
+ * Submit the asynchronous read of a run of reserved blocks.
+ * The run belongs to the completion from now on.
+ * @return Number of blocks submitted, -1=error
+ */
+static int submitPrefetch(loadRun_t *run)
+{
+    struct iovec iov[TC_FLUSH_MAX_RUN];
+    int i, n = run->n;
+
+    for (i = 0; i < run->n; i++)
+    {
+        iov[i].iov_base = blockData(cache, run->cacheIndex[i]);
+        iov[i].iov_len = cache->pageSize;
+    }
+    if (ioSubmitRead(cache->io, iov, run->n, blockOffset(cache, run->firstFileBlock), prefetchDone, run) == -1)
+    {
+        prefetchDone(run, -1);
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * Start reading file blocks into the cache without waiting for them.
+ * Blocks already cached are skipped, and so are blocks with no clean block
+ * to be replaced right now. Threads fixing a block being read wait for its
+ * read to complete. Adjacent blocks are read with a single request.
+ * @param cache
+ * @param firstFileBlock Index on file of the first block
+ * @param nBlocks Number of blocks
+ * @return Number of blocks whose read was started, -1=error
+ */
+static int cachePrefetchBlocks(TC_cache_t *cache, int firstFileBlock, int nBlocks)
+{
+    loadRun_t *run = NULL;
+    int fileBlock, n, submitted = 0, status = 0;
+
+    if (cache->io == NULL) return 0;
+    for (fileBlock = firstFileBlock; fileBlock < firstFileBlock + nBlocks; fileBlock++)
+    {
+        int cacheIndex = reserveBlock(fileBlock);
+
+        // Submit the run when it cannot grow any more
+        if (run != NULL && (cacheIndex == -1 || run->n == TC_FLUSH_MAX_RUN))
+        {
+            if ((n = submitPrefetch(run)) == -1) status = -1;
+            else submitted += n;
+            run = NULL;
+        }
+        if (cacheIndex == -1) continue;
+        if (run == NULL)
+        {
+            run = malloc(sizeof (loadRun_t));
+            run->firstFileBlock = fileBlock;
+            run->n = 0;
+        }
+        run->cacheIndex[run->n++] = cacheIndex;
+    }
+    if (run != NULL)
+    {
+        if ((n = submitPrefetch(run)) == -1) status = -1;
+        else submitted += n;
+    }
+    return status == -1 ? -1 : submitted;
+}
+
+/**
+ * Start reading file blocks into memory without waiting for them
+ * @param firstFileBlock Index on file of the first block
+ * @param nBlocks Number of blocks
+ * @return Number of blocks whose read was started, -1=error
+ */
+int TC_prefetchBlocks(int firstFileBlock, int nBlocks)
+{
+    return cache->storage->prefetchBlocks(cache, firstFileBlock, nBlocks);
+}
+
+/**
+ * Tell how the table is going to be accessed
+ * @param access Sequential scans, random lookups or no particular pattern
+ * @return -1=error
+ */
+int TC_adviseAccess(TC_access_t access)
+{
+    return cache->storage->advise(cache, access);
+}
+
+/**
+ * Is a file block in the cache?
+ */
+static int isBlockCached(int fileBlock)
+{
+    TC_cachePartition_t *partition = &cache->partitions[blockIndex2partition(fileBlock)];
+    int cached;
+    pthread_mutex_lock(&partition->mutex);
+    cached = findBlockInCache(cache, fileBlock) != -1;
+    pthread_mutex_unlock(&partition->mutex);
+    return cached;
+}
+
+/**
+ * Read a range of consecutive entries. Every block is looked up once; with
+ * the block cache, runs of whole blocks missing from the cache are read from
+ * file with a single call, without going through the cache.
+ * @param firstIndex Index into file of the first entry
+ * @param n Number of entries
+ * @param entries Array of n entries
+ * @return -1=error
+ */
+int TC_readEntries(int firstIndex, int n, TC_tableEntry_t *entries)
+{
+    int index = firstIndex;
+    int end = firstIndex + n;
+
+    while (index < end)
+    {
+        int fileBlock = fileIndex2blockIndex(index);
+        int offset = fileIndex2blockOffset(index);
+        int count = cache->slotsPerPage - offset;
+        int blocks = 0;
+        int i;
+        TC_fixedBlock_t fixed;
+
+        if (offset == 0 && cache->storage == &TC_cacheStorage)
+        {
+            while (blocks < TC_FLUSH_MAX_RUN && index + (blocks + 1) * cache->slotsPerPage <= end && !isBlockCached(fileBlock + blocks))
+                blocks++;
+        }
+        if (blocks > 0)
+        {
+            char *pages;
+            // Aligned for direct I/O
+            if (posix_memalign((void **) &pages, TC_MIN_PAGE_SIZE, (size_t) blocks * cache->pageSize) != 0) return -1;
+            if (ioReadBlock(cache->fileDescriptor, pages, (size_t) blocks * cache->pageSize, blockOffset(cache, fileBlock)) == -1)
+            {
+                free(pages);
+                return -1;
+            }
+            for (i = 0; i < blocks * cache->slotsPerPage; i++)
             {
-                printf("Clean cache block %d (file block %i) replaced\n", i, cache->controlBlocks[i].fileIndex);
-                found = i;
-                lastdirtystart = (lastdirtystart + 1) % TC_CACHE_BLOCKS;
-                break;
+                if (readPageEntry(cache->overflowDescriptor, pages + (size_t) (i / cache->slotsPerPage) * cache->pageSize, cache->pageSize, cache->slotsPerPage, index + i, &entries[index - firstIndex + i]) == -1)
+                {
+                    free(pages);
+                    return -1;
+                }
             }
+            free(pages);
+            index += blocks * cache->slotsPerPage;
+            continue;
         }
+
+        if (count > end - index) count = end - index;
+        if (TC_fixBlock(fileBlock, TC_LATCH_SHARED, &fixed) == -1) return -1;
+        for (i = 0; i < count; i++)
+            TC_getEntry(&fixed, offset + i, &entries[index - firstIndex + i]);
+        TC_unfixBlock(&fixed, 0);
+        index += count;
     }
+    return 0;
+}
 
-    // If not, clean any dirty block and return it
-    if (found == -1)
+/**
+ * Write a range of consecutive entries. Every block is looked up once; with
+ * the block cache, runs of whole blocks missing from the cache are built in
+ * cache blocks without reading them and written through with a single
+ * pwritev() call.
+ * Partial and cached blocks are left dirty in the cache, so the entries are
+ * durable after TC_flushAllBlocks().
+ * @param firstIndex Index into file of the first entry
+ * @param n Number of entries
+ * @param entries Array of n entries
+ * @return -1=error
+ */
+int TC_writeEntries(int firstIndex, int n, const TC_tableEntry_t *entries)
+{
+    int index = firstIndex;
+    int end = firstIndex + n;
+
+    while (index < end)
     {
-        int j;
-        for (j = lastdirtystart; j < TC_CACHE_BLOCKS + lastdirtystart; j++)
+        int fileBlock = fileIndex2blockIndex(index);
+        int offset = fileIndex2blockOffset(index);
+        int count = cache->slotsPerPage - offset;
+        int i, status = 0;
+        TC_fixedBlock_t fixed;
+        loadRun_t run;
+
+        run.firstFileBlock = fileBlock;
+        run.n = 0;
+        if (offset == 0 && cache->storage == &TC_cacheStorage)
+        {
+            while (run.n < TC_FLUSH_MAX_RUN && index + (run.n + 1) * cache->slotsPerPage <= end)
+            {
+                int cacheIndex = reserveBlock(fileBlock + run.n);
+                if (cacheIndex == -1) break;
+                run.cacheIndex[run.n++] = cacheIndex;
+            }
+        }
+        if (run.n > 0)
         {
-            i = j % TC_CACHE_BLOCKS;
-            if (cache->controlBlocks[i].used && cache->controlBlocks[i].dirty)
+            struct iovec iov[TC_FLUSH_MAX_RUN];
+            for (i = 0; i < run.n && status == 0; i++)
             {
-                printf("Dirty cache block %d (file block %i) replaced\n", i, cache->controlBlocks[i].fileIndex);
-                flushBlock(cache, i);
-                found = i;
-                break;
+                char *page = blockData(cache, run.cacheIndex[i]);
+                int slot;
+                memset(page, 0, cache->pageSize);
+                for (slot = 0; slot < cache->slotsPerPage && status == 0; slot++)
+                {
+                    int entryIndex = index + i * cache->slotsPerPage + slot;
+                    status = writePageEntry(cache->overflowDescriptor, page, cache->pageSize, cache->slotsPerPage, entryIndex, &entries[entryIndex - firstIndex]);
+                }
+                iov[i].iov_base = page;
+                iov[i].iov_len = cache->pageSize;
             }
+            if (status == 0)
+                status = ioWriteBlocks(cache->fileDescriptor, iov, run.n, blockOffset(cache, fileBlock));
+            publishBlocks(&run, status);
+            if (status == -1) return -1;
+            printf("File blocks %d-%d written through\n", fileBlock, fileBlock + run.n - 1);
+            index += run.n * cache->slotsPerPage;
+            continue;
         }
-        lastdirtystart = (lastdirtystart + 1) % TC_CACHE_BLOCKS;
+
+        if (count > end - index) count = end - index;
+        if (TC_fixBlock(fileBlock, TC_LATCH_EXCLUSIVE, &fixed) == -1) return -1;
+        for (i = 0; i < count && status == 0; i++)
+            status = TC_putEntry(&fixed, offset + i, &entries[index - firstIndex + i]);
+        // Entries stored before an error are kept
+        TC_unfixBlock(&fixed, 1);
+        if (status == -1) return -1;
+        index += count;
     }
-    cache->controlBlocks[found].used = 1;
-    cache->controlBlocks[found].fileIndex = -1;
-    return found;
+    return 0;
 }
 
 /**
- * Write an entry to the file asynchronously. It copies the entry to the cache and marks the entry as dirty.
+ * Write an entry by fixing its block. With sync the block is written while
+ * still latched and the entry is durable when the call returns.
+ * @param cache
  * @param fileIndex Index of entry into file.
  * @param entry Pointer to entry.
+ * @param sync 1 to make the entry durable
  * @return -1=error
  */
-int TC_writeEntryAsync(int fileIndex, TC_tableEntry_t * entry)
+int pageWriteEntry(TC_cache_t *cache, int fileIndex, const TC_tableEntry_t *entry, int sync)
 {
-    int cacheIndex;
-    int fileBlock = fileIndex2blockIndex(fileIndex);
-    // Find block in cache
-    cacheIndex = findBlockInCache(cache, fileBlock);
-    // If not found, read it onto a cache block
-    if (cacheIndex == -1)
+    TC_fixedBlock_t fixed;
+    int status;
+    // Find block in cache or read it onto a cache block
+    int slot = TC_fixEntry(fileIndex, TC_LATCH_EXCLUSIVE, &fixed);
+    if (slot == -1) return -1;
+    // Copy entry to cache
+    if (TC_putEntry(&fixed, slot, entry) == -1)
     {
-        cacheIndex = findFreeBlockInCache(cache);
-        cache->controlBlocks[cacheIndex].fileIndex = fileBlock;
-        if (readBlock(cache, fileBlock, cacheIndex) == -1) return -1;
+        TC_unfixBlock(&fixed, 0);
+        return -1;
     }
-    // Copy entry to cache
-    memcpy(&cache->dataBlocks[cacheIndex].entries[fileIndex2blockOffset(fileIndex)], entry, TC_ENTRY_SIZE);
-    // Mark block as dirty
-    cache->controlBlocks[cacheIndex].dirty = 1;
+    if (!sync)
+    {
+        // Mark block as dirty
+        TC_unfixBlock(&fixed, 1);
+        return 0;
+    }
+    // Write it while still latched
+    status = cache->storage->writeBlock(cache, &fixed);
+    TC_unfixBlock(&fixed, 0);
+    if (status == -1) return -1;
+    return ioSync(cache->fileDescriptor);
+}
+
+/**
+ * Read an entry by fixing its block
+ * @param cache
+ * @param fileIndex Index of entry into file.
+ * @param entry Pointer to entry.
+ * @return -1=error
+ */
+int pageReadEntry(TC_cache_t *cache, int fileIndex, TC_tableEntry_t *entry)
+{
+    TC_fixedBlock_t fixed;
+    // Find block in cache or read it onto a cache block
+    int slot = TC_fixEntry(fileIndex, TC_LATCH_SHARED, &fixed);
+    if (slot == -1) return -1;
+    // Copy entry from cache
+    TC_getEntry(&fixed, slot, entry);
+    TC_unfixBlock(&fixed, 0);
     return 0;
 }
 
 /**
- * Write an entry to the file asynchronously. It copies the entry to the cache and writes the entry.
+ * Write an entry to the file asynchronously. It copies the entry to the cache and marks the entry as dirty.
+ * @param fileIndex Index of entry into file.
+ * @param entry Pointer to entry.
+ * @return -1=error
+ */
+int TC_writeEntryAsync(int fileIndex, TC_tableEntry_t * entry)
+{
+    return cache->storage->writeEntry(cache, fileIndex, entry, 0);
+}
+
+/**
+ * Write an entry to the file synchronously. It copies the entry to the cache and writes the entry.
+ * The entry is durable when the call returns, so this is a commit point.
  * @param fileIndex Index of entry into file.
  * @param entry Pointer to entry.
  * @return -1=error
  */
 int TC_writeEntrySync(int fileIndex, TC_tableEntry_t * entry)
 {
-    int cacheIndex;
-    int fileBlock = fileIndex2blockIndex(fileIndex);
-    // Find block in cache
-    cacheIndex = findBlockInCache(cache, fileBlock);
-    // If not found, read it onto a cache block
-    if (cacheIndex == -1)
-    {
-        cacheIndex = findFreeBlockInCache(cache);
-        cache->controlBlocks[cacheIndex].fileIndex = fileBlock;
-        if (readBlock(cache, fileBlock, cacheIndex) == -1) return -1;
-    }
-    // Copy entry to cache
-    memcpy(entry, (const void *) &cache->dataBlocks[cacheIndex].entries[fileIndex2blockOffset(fileIndex)], TC_ENTRY_SIZE);
-    // Mark block as dirty
-    cache->controlBlocks[cacheIndex].dirty = 1;
-    // Flush the block
-    flushBlock(cache, cacheIndex);
-    return 0;
+    return cache->storage->writeEntry(cache, fileIndex, entry, 1);
 }
 
 /**
@@ -249,64 +950,385 @@ int TC_writeEntrySync(int fileIndex, TC_tableEntry_t * entry)
  */
 int TC_readEntry(int fileIndex, TC_tableEntry_t *entry)
 {
-    int cacheIndex;
-    int fileBlock = fileIndex2blockIndex(fileIndex);
-    // Find block in cache
-    cacheIndex = findBlockInCache(cache, fileBlock);
-    // If not found, read it onto a cache block
-    if (cacheIndex == -1)
+    return cache->storage->readEntry(cache, fileIndex, entry);
+}
+
+/**
+ * Fill table options with the defaults of parameters.h
+ * @param options
+ */
+void TC_defaultOptions(TC_tableOptions_t *options)
+{
+    options->policy = TC_DEFAULT_POLICY;
+    options->backgroundFlush = TC_DEFAULT_BACKGROUND_FLUSH;
+    options->ioBackend = TC_DEFAULT_IO_BACKEND;
+    options->readAheadBlocks = TC_DEFAULT_READAHEAD_BLOCKS;
+    options->pageSize = TC_DEFAULT_PAGE_SIZE;
+    options->slotsPerPage = 0;
+    options->directIO = TC_DEFAULT_DIRECT_IO;
+    options->hugePages = TC_DEFAULT_HUGE_PAGES;
+    options->storage = TC_DEFAULT_STORAGE;
+}
+
+/**
+ * Write the header page of a table file in the current format
+ * @param fd Descriptor of the table file
+ * @param pageSize Size of every page in bytes
+ * @param slotsPerPage Entries per data page
+ * @return -1=error
+ */
+static int createFileHeader(int fd, int pageSize, int slotsPerPage)
+{
+    char *page = calloc(1, pageSize);
+    int status;
+
+    TC_initFileHeader((TC_fileHeader_t *) page, pageSize, slotsPerPage);
+    if (TC_checkFileHeader((TC_fileHeader_t *) page) == -1)
     {
-        cacheIndex = findFreeBlockInCache(cache);
-        cache->controlBlocks[cacheIndex].fileIndex = fileBlock;
-        if (readBlock(cache, fileBlock, cacheIndex) == -1) return -1;
+        fprintf(stderr, "Invalid page layout: %d bytes per page, %d entries per page\n", pageSize, slotsPerPage);
+        free(page);
+        return -1;
     }
-    // Copy entry from cache
-    memcpy(entry, (const void *) &cache->dataBlocks[cacheIndex].entries[fileIndex2blockOffset(fileIndex)], TC_ENTRY_SIZE);
+    status = ioWriteBlock(fd, page, pageSize, 0);
+    free(page);
+    if (status == -1) return -1;
+    return ioSync(fd);
+}
+
+/**
+ * Rewrite a table file of version 0, made of fixed size entries without
+ * header, in the current format. The new file replaces the old one.
+ * @param fd Descriptor of the old file, replaced by the new one
+ * @param size Size of the old file in bytes
+ * @param pageSize Size of every page of the new file in bytes
+ * @param slotsPerPage Entries per data page of the new file
+ * @return -1=error
+ */
+static int upgradeLegacyFile(int *fd, off_t size, int pageSize, int slotsPerPage)
+{
+    int nEntries = size / TC_ENTRY_SIZE;
+    char *page = malloc(pageSize);
+    TC_tableEntry_t entry, empty;
+    int newFd, overflowFd, i, status = 0;
+
+    newFd = open(TC_FILENAME ".new", O_RDWR | O_CREAT | O_TRUNC, S_IRWXU);
+    if (newFd == -1)
+    {
+        free(page);
+        return -1;
+    }
+    // Written without O_DSYNC: synced once before the new file replaces the old one
+    overflowFd = open(TC_OVERFLOW_FILENAME, O_RDWR | O_CREAT | O_TRUNC, S_IRWXU);
+    if (overflowFd == -1)
+    {
+        close(newFd);
+        unlink(TC_FILENAME ".new");
+        free(page);
+        return -1;
+    }
+    if (createFileHeader(newFd, pageSize, slotsPerPage) == -1) status = -1;
+    memset(&empty, 0, sizeof (empty));
+    for (i = 0; i < nEntries && status == 0; i++)
+    {
+        if (i % slotsPerPage == 0) memset(page, 0, pageSize);
+        if (ioReadBlock(*fd, &entry, TC_ENTRY_SIZE, (off_t) i * TC_ENTRY_SIZE) == -1) status = -1;
+        // Entries never written stay empty slots
+        else if (memcmp(&entry, &empty, TC_ENTRY_SIZE) != 0)
+            status = writePageEntry(overflowFd, page, pageSize, slotsPerPage, i, &entry);
+        if (status == 0 && (i % slotsPerPage == slotsPerPage - 1 || i == nEntries - 1))
+            status = ioWriteBlock(newFd, page, pageSize, (off_t) (i / slotsPerPage + 1) * pageSize);
+    }
+    free(page);
+    if (status == 0) status = ioSync(overflowFd);
+    close(overflowFd);
+    if (status == -1 || ioSync(newFd) == -1 || rename(TC_FILENAME ".new", TC_FILENAME) == -1)
+    {
+        close(newFd);
+        unlink(TC_FILENAME ".new");
+        return -1;
+    }
+    close(*fd);
+    *fd = newFd;
+    printf("Table file upgraded to format version %d (%d entries)\n", TC_FILE_VERSION, nEntries);
+    return 0;
+}
+
+/**
+ * Read the page layout of the table file, creating the header page of a
+ * new file with the layout of the options
+ * @param options Options of the cache
+ * @return -1=error
+ */
+static int loadFileHeader(const TC_tableOptions_t *options)
+{
+    TC_fileHeader_t header;
+    struct stat st;
+    // Long texts that do not fit are forwarded to the overflow file
+    int slotsPerPage = options->slotsPerPage;
+    if (slotsPerPage == 0) slotsPerPage = TC_slotsPerPage(options->pageSize, TC_EXPECTED_RECORD_SIZE);
+
+    if (fstat(cache->fileDescriptor, &st) == -1) return -1;
+    if (st.st_size == 0)
+    {
+        // Overflow entries of a table file removed are stale
+        unlink(TC_OVERFLOW_FILENAME);
+        if (createFileHeader(cache->fileDescriptor, options->pageSize, slotsPerPage) == -1) return -1;
+    }
+    if (ioReadBlock(cache->fileDescriptor, &header, sizeof (header), 0) == -1) return -1;
+    if (memcmp(header.magic, TC_FILE_MAGIC, sizeof (TC_FILE_MAGIC)) != 0 && st.st_size % TC_ENTRY_SIZE == 0)
+    {
+        if (upgradeLegacyFile(&cache->fileDescriptor, st.st_size, options->pageSize, slotsPerPage) == -1)
+        {
+            perror("Error upgrading table file");
+            return -1;
+        }
+        if (ioReadBlock(cache->fileDescriptor, &header, sizeof (header), 0) == -1) return -1;
+    }
+    if (TC_checkFileHeader(&header) == -1)
+    {
+        fprintf(stderr, "%s is not a table file of format version %d\n", TC_FILENAME, TC_FILE_VERSION);
+        return -1;
+    }
+    // Older readers would take forwarded slots for empty ones
+    if (header.version < TC_FILE_VERSION && createFileHeader(cache->fileDescriptor, header.pageSize, header.slotsPerPage) == -1)
+        return -1;
+    cache->pageSize = header.pageSize;
+    cache->slotsPerPage = header.slotsPerPage;
+    printf("Table file with %d byte pages of %d entries\n", cache->pageSize, cache->slotsPerPage);
     return 0;
 }
 
 /**
- * Initialize cache for table
- * @return 
+ * Allocate the memory of the cache blocks, aligned for direct I/O
+ * @param hugePages 1 to back the blocks with huge pages if possible
+ * @return -1=error
+ */
+static int allocDataBlocks(int hugePages)
+{
+    size_t size = (size_t) TC_CACHE_BLOCKS * cache->pageSize;
+
+    cache->dataBlocksMapped = 0;
+    if (hugePages)
+    {
+        // Pages reserved for the hugetlbfs pool first, transparent huge pages otherwise
+        size_t hugeSize = (size + TC_HUGE_PAGE_SIZE - 1) / TC_HUGE_PAGE_SIZE * TC_HUGE_PAGE_SIZE;
+        void *blocks = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (blocks != MAP_FAILED)
+        {
+            cache->dataBlocks = blocks;
+            cache->dataBlocksMapped = hugeSize;
+            printf("Cache blocks on %zu bytes of huge pages\n", hugeSize);
+            return 0;
+        }
+        if (posix_memalign((void **) &cache->dataBlocks, TC_HUGE_PAGE_SIZE, hugeSize) != 0) return -1;
+        if (madvise(cache->dataBlocks, hugeSize, MADV_HUGEPAGE) == -1)
+            fprintf(stderr, "Huge pages not available for cache blocks\n");
+        return 0;
+    }
+    return posix_memalign((void **) &cache->dataBlocks, TC_MIN_PAGE_SIZE, size) != 0 ? -1 : 0;
+}
+
+/**
+ * Release the memory of the cache blocks
+ */
+static void freeDataBlocks()
+{
+    if (cache->dataBlocksMapped) munmap(cache->dataBlocks, cache->dataBlocksMapped);
+    else free(cache->dataBlocks);
+}
+
+/**
+ * Make transfers on the table file bypass the page cache of the OS, so
+ * blocks are cached only once. Cache blocks and file offsets are multiples
+ * of the page size, which meets the alignment required by O_DIRECT.
+ * @return -1 if the file system does not support it
+ */
+static int enableDirectIO()
+{
+    int flags = fcntl(cache->fileDescriptor, F_GETFL);
+    if (flags == -1 || fcntl(cache->fileDescriptor, F_SETFL, flags | O_DIRECT) == -1) return -1;
+    printf("Direct I/O on table file\n");
+    return 0;
+}
+
+/**
+ * Initialize cache for table with default options
+ * @return
  */
 int TC_openTable()
 {
-    fileDescriptor = -1;
-    cache = calloc(1, sizeof (TC_cache_t));
+    TC_tableOptions_t options;
+    TC_defaultOptions(&options);
+    return TC_openTableWithOptions(&options);
+}
+
+/**
+ * Set up the block cache of the table file
+ * @param cache
+ * @param options Options of the cache
+ * @return -1=error
+ */
+static int cacheOpen(TC_cache_t *cache, const TC_tableOptions_t *options)
+{
+    int i;
     initCache(cache);
-    fileDescriptor = open(TC_FILENAME, O_SYNC | O_RDWR | O_CREAT, S_IRWXU);
-    if (fileDescriptor == -1)
+    for (i = 0; i < TC_CACHE_PARTITIONS; i++)
+    {
+        cache->partitions[i].policy = TC_createPolicy(options->policy, TC_PARTITION_BLOCKS);
+        if (cache->partitions[i].policy == NULL)
+        {
+            fprintf(stderr, "Unknown replacement policy %d\n", options->policy);
+            destroyCache(cache);
+            return -1;
+        }
+    }
+    // The page size of the file sets the size of the cache blocks
+    if (allocDataBlocks(options->hugePages) == -1)
+    {
+        destroyCache(cache);
+        return -1;
+    }
+    if (options->directIO && enableDirectIO() == -1)
+        fprintf(stderr, "Direct I/O not supported for %s, using the page cache of the OS\n", TC_FILENAME);
+    cache->io = ioCreateEngine(cache->fileDescriptor, options->ioBackend, TC_IO_QUEUE_DEPTH, TC_IO_POOL_THREADS);
+    if (cache->io == NULL)
+        fprintf(stderr, "Asynchronous I/O not available, blocks are read and written synchronously\n");
+    else
+        printf("Asynchronous I/O through %s\n", ioEngineName(cache->io));
+    // Prefetching needs the asynchronous reads
+    initReadAhead(cache, cache->io != NULL ? options->readAheadBlocks : 0);
+    if (options->backgroundFlush && startFlusher(cache) == -1)
+    {
+        fprintf(stderr, "Background flusher not started, dirty blocks are written on replacement\n");
+    }
+    return 0;
+}
+
+/**
+ * Flush all blocks of the cache and make them durable
+ * @param cache
+ * @return -1=error
+ */
+static int cacheFlush(TC_cache_t *cache)
+{
+    if (writeBackBlocks(cache, TC_CACHE_BLOCKS, 1) == -1) return -1;
+    return ioSync(cache->fileDescriptor);
+}
+
+/**
+ * Flush the cache and release it
+ * @param cache
+ */
+static void cacheClose(TC_cache_t *cache)
+{
+    stopFlusher(cache);
+    cacheFlush(cache);
+    // Let prefetches in flight complete before the cache goes away
+    ioDestroyEngine(cache->io);
+    destroyReadAhead(cache);
+    destroyCache(cache);
+    freeDataBlocks();
+}
+
+/**
+ * Access hints need nothing from the block cache: scans are detected by
+ * the read-ahead
+ */
+static int cacheAdvise(TC_cache_t *cache, TC_access_t access)
+{
+    return 0;
+}
+
+/** Table file accessed through the block cache
+ */
+const TC_storageOps_t TC_cacheStorage = {
+    "block cache",
+    cacheOpen,
+    cacheFixBlock,
+    cacheUnfixBlock,
+    pageGetEntry,
+    pagePutEntry,
+    cacheWriteBlock,
+    pageReadEntry,
+    pageWriteEntry,
+    cachePrefetchBlocks,
+    cacheAdvise,
+    cacheFlush,
+    cacheClose
+};
+
+/**
+ * Open the table
+ * @param options Options of the table
+ * @return
+ */
+int TC_openTableWithOptions(const TC_tableOptions_t *options)
+{
+    cache = calloc(1, sizeof (TC_cache_t));
+    switch (options->storage)
+    {
+    case TC_STORAGE_MMAP:
+        cache->storage = &TC_mmapStorage;
+        break;
+    case TC_STORAGE_LSM:
+        cache->storage = &TC_lsmStorage;
+        break;
+    default:
+        cache->storage = &TC_cacheStorage;
+    }
+    // Writes are made durable at TC_flushAllBlocks() and TC_writeEntrySync()
+    cache->fileDescriptor = open(TC_FILENAME, O_RDWR | O_CREAT, S_IRWXU);
+    if (cache->fileDescriptor == -1)
     {
         perror("Error opening file\n");
+        free(cache);
+        cache = NULL;
+        return -1;
+    }
+    if (loadFileHeader(options) == -1)
+    {
+        close(cache->fileDescriptor);
+        free(cache);
+        cache = NULL;
         return -1;
     }
+    // Forwarded entries are durable before their pages point to them
+    cache->overflowDescriptor = open(TC_OVERFLOW_FILENAME, O_RDWR | O_CREAT | O_DSYNC, S_IRWXU);
+    if (cache->overflowDescriptor == -1 || cache->storage->open(cache, options) == -1)
+    {
+        if (cache->overflowDescriptor == -1) perror("Error opening overflow file\n");
+        else close(cache->overflowDescriptor);
+        close(cache->fileDescriptor);
+        free(cache);
+        cache = NULL;
+        return -1;
+    }
+    printf("Table stored through %s\n", cache->storage->name);
     return 0;
 }
 
 /**
- * Close and remove cache for table
- * @return 
+ * Close the table, flushing every modified block
+ * @return
  */
 int TC_closeTable()
 {
-    TC_flushAllBlocks();
+    cache->storage->close(cache);
+    close(cache->overflowDescriptor);
+    close(cache->fileDescriptor);
     free(cache);
-    close(fileDescriptor);
+    cache = NULL;
     return 0;
 }
 
 /**
- * Flush all blocks of the file cache
- * @param 
- * @return 
+ * Flush all modified blocks of the table and make them durable
+ * @param
+ * @return
  */
 int TC_flushAllBlocks()
 {
-    int i;
-    for (i = 0; i < TC_CACHE_BLOCKS; i++)
-    {
-        if (flushBlock(cache, i) == -1) return -1;
-    }
+    return cache->storage->flush(cache);
 }
 
 #ifdef	__cplusplus
@@ -8,7 +8,10 @@
 #ifndef TABLECACHE_H
 #define	TABLECACHE_H
 
+#include <pthread.h>
 #include "parameters.h"
+#include "cachePolicy.h"
+#include "tableIO.h"
 
 #ifdef	__cplusplus
 extern "C"
@@ -18,13 +21,6 @@ extern "C"
 
 //#pragma pack(1)
 
-/** Structure for a cache block made of TC_BLOCK_ENTRIES table entries
- */
-typedef struct
-{
-    TC_tableEntry_t entries[TC_BLOCK_ENTRIES];
-} TC_cacheBlock_t;
-
 /** Control structure for a single cache block
  */
 typedef struct
@@ -37,15 +33,208 @@ typedef struct
     int ramIndex;
     // Index of block on file (in blocks)
     int fileIndex;
+    // Has the file block been read into the cache block?
+    int valid;
+    // Number of threads having the block fixed (protected by partition mutex)
+    int pinCount;
+    // Is an asynchronous read filling the block? (protected by partition mutex)
+    int loading;
+    // Next cache block in the same page table bucket
+    int hashNext;
+    // Shared latch for readers, exclusive latch for writers of the block contents
+    pthread_rwlock_t latch;
 } TC_cacheBlockCntl_t;
 
-/** The cache of the table
+/** A partition of the cache. File blocks are spread over partitions and
+ * every partition owns its cache blocks, page table and replacement policy,
+ * so threads working on different partitions never share a lock.
+ */
+typedef struct
+{
+    // Protects page table, policy, used/fileIndex/pinCount of owned blocks
+    pthread_mutex_t mutex;
+    // Signalled when a block of the partition gets unpinned
+    pthread_cond_t unpinned;
+    // Signalled when an asynchronous read of a block of the partition completes
+    pthread_cond_t loaded;
+    // First cache block owned by the partition
+    int firstBlock;
+    // Page table: first cache block of every bucket chain (-1 if empty)
+    int buckets[TC_PARTITION_BUCKETS];
+    // Policy choosing the block to be replaced (indexes relative to firstBlock)
+    TC_replacementPolicy_t *policy;
+} TC_cachePartition_t;
+
+/** Background thread writing dirty blocks ahead of replacement
+ */
+typedef struct
+{
+    pthread_t thread;
+    // Protects the fields below
+    pthread_mutex_t mutex;
+    // Signalled to request a write back round
+    pthread_cond_t wakeup;
+    // Is the thread running?
+    int running;
+    // Has the thread been asked to finish?
+    int stop;
+    // Has a foreground thread asked for clean blocks?
+    int requested;
+} TC_flusher_t;
+
+/** An access stream followed by the read-ahead
+ */
+typedef struct
+{
+    // Last file block accessed by the stream
+    int lastBlock;
+    // Number of consecutive blocks accessed in a row
+    int sequential;
+    // Blocks prefetched next time (in blocks)
+    int window;
+    // First file block not prefetched yet
+    int prefetchEnd;
+    // Time of last access, to replace the least recently used stream
+    unsigned long lastUse;
+} TC_readAheadStream_t;
+
+/** Detection of sequential scans
  */
 typedef struct
+{
+    // Protects the fields below
+    pthread_mutex_t mutex;
+    // Largest prefetch window (in blocks), 0 if read-ahead is disabled
+    int maxWindow;
+    // Number of accesses seen
+    unsigned long clock;
+    TC_readAheadStream_t streams[TC_READAHEAD_STREAMS];
+} TC_readAhead_t;
+
+/** The table file mapped into memory
+ */
+typedef struct
+{
+    // Start of the mapping, header page included
+    char *base;
+    // Bytes of address space reserved at base, the mapping never moves
+    size_t reserved;
+    // Bytes mapped, a multiple of the page size (read atomically)
+    size_t size;
+    // Serializes growth and advice of the mapping
+    pthread_mutex_t grow;
+    // Latches of the pages, page i uses latch i % TC_MMAP_LATCHES
+    pthread_rwlock_t latches[TC_MMAP_LATCHES];
+    // Access pattern advised for the whole mapping
+    TC_access_t access;
+} TC_mapping_t;
+
+typedef struct TC_cache TC_cache_t;
+
+/** How the pages of the table file are brought into memory. Public calls
+ * on fixed blocks and on the whole table are dispatched through it.
+ */
+typedef struct
+{
+    // Human readable name of the storage
+    const char *name;
+
+    /** Set up the storage of the open table file */
+    int (*open)(TC_cache_t *cache, const TC_tableOptions_t *options);
+    /** Fix a file block latched in the given mode */
+    int (*fixBlock)(TC_cache_t *cache, int fileBlock, TC_latchMode_t mode, TC_fixedBlock_t *fixed);
+    /** Release a fixed block, modified if dirty */
+    void (*unfixBlock)(TC_cache_t *cache, TC_fixedBlock_t *fixed, int dirty);
+    /** Copy an entry out of a fixed block */
+    void (*getEntry)(TC_cache_t *cache, const TC_fixedBlock_t *fixed, int slot, TC_tableEntry_t *entry);
+    /** Store an entry in a block fixed in exclusive mode */
+    int (*putEntry)(TC_cache_t *cache, TC_fixedBlock_t *fixed, int slot, const TC_tableEntry_t *entry);
+    /** Write a block fixed in exclusive mode to file */
+    int (*writeBlock)(TC_cache_t *cache, TC_fixedBlock_t *fixed);
+    /** Read a single entry */
+    int (*readEntry)(TC_cache_t *cache, int fileIndex, TC_tableEntry_t *entry);
+    /** Write a single entry, durable when the call returns if sync */
+    int (*writeEntry)(TC_cache_t *cache, int fileIndex, const TC_tableEntry_t *entry, int sync);
+    /** Start reading file blocks without waiting for them */
+    int (*prefetchBlocks)(TC_cache_t *cache, int firstFileBlock, int nBlocks);
+    /** Tune the storage for an access pattern */
+    int (*advise)(TC_cache_t *cache, TC_access_t access);
+    /** Write every modified block and make them durable */
+    int (*flush)(TC_cache_t *cache);
+    /** Flush and release the storage */
+    void (*close)(TC_cache_t *cache);
+} TC_storageOps_t;
+
+extern const TC_storageOps_t TC_cacheStorage;
+extern const TC_storageOps_t TC_mmapStorage;
+extern const TC_storageOps_t TC_lsmStorage;
+
+/** The cache of the table
+ */
+struct TC_cache
 {
     TC_cacheBlockCntl_t controlBlocks[TC_CACHE_BLOCKS];
-    TC_cacheBlock_t dataBlocks[TC_CACHE_BLOCKS];
-} TC_cache_t;
+    // Memory of the cache blocks, pageSize bytes each
+    char *dataBlocks;
+    // Bytes mapped for the cache blocks, 0 if they come from the heap
+    size_t dataBlocksMapped;
+    TC_cachePartition_t partitions[TC_CACHE_PARTITIONS];
+    // Descriptor of the table file
+    int fileDescriptor;
+    // Descriptor of the overflow file, written synchronously
+    int overflowDescriptor;
+    // Page layout of the table file, read from its header page
+    int pageSize;
+    int slotsPerPage;
+    // Number of dirty blocks (updated atomically)
+    int dirtyBlocks;
+    TC_flusher_t flusher;
+    // Engine for asynchronous reads and writes (NULL if not available)
+    ioEngine_t *io;
+    TC_readAhead_t readAhead;
+    // Block cache, mapped file or LSM tree
+    const TC_storageOps_t *storage;
+    // The table file mapped into memory (mapped storage only)
+    TC_mapping_t mapping;
+    // Memtable and sorted runs (LSM storage only)
+    struct TC_lsm *lsm;
+};
+
+/**
+ * Memory of a cache block
+ */
+#define blockData(cache, cacheIndex) ((cache)->dataBlocks + (size_t) (cacheIndex) * (cache)->pageSize)
+/**
+ * Position on file of a file block; the header page comes first
+ */
+#define blockOffset(cache, fileBlock) ((off_t) ((fileBlock) + 1) * (cache)->pageSize)
+/**
+ * Partition of the cache in charge of a file block
+ */
+#define blockIndex2partition(fileBlock) ((fileBlock)%(TC_CACHE_PARTITIONS))
+/**
+ * Partition of the cache owning a cache block
+ */
+#define cacheIndex2partition(cacheIndex) ((cacheIndex)/(TC_PARTITION_BLOCKS))
+/**
+ * The dirty flag is changed under the block latch but also checked by
+ * threads holding only the partition mutex, so it is accessed atomically
+ */
+#define isBlockDirty(cntl) __atomic_load_n(&(cntl)->dirty, __ATOMIC_ACQUIRE)
+#define setBlockDirty(cntl, value) __atomic_store_n(&(cntl)->dirty, (value), __ATOMIC_RELEASE)
+
+void pageGetEntry(TC_cache_t *cache, const TC_fixedBlock_t *fixed, int slot, TC_tableEntry_t *entry);
+int pagePutEntry(TC_cache_t *cache, TC_fixedBlock_t *fixed, int slot, const TC_tableEntry_t *entry);
+int pageReadEntry(TC_cache_t *cache, int fileIndex, TC_tableEntry_t *entry);
+int pageWriteEntry(TC_cache_t *cache, int fileIndex, const TC_tableEntry_t *entry, int sync);
+void markBlockDirty(TC_cache_t *cache, int cacheIndex);
+int writeBackBlocks(TC_cache_t *cache, int maxBlocks, int wait);
+int startFlusher(TC_cache_t *cache);
+void stopFlusher(TC_cache_t *cache);
+void wakeFlusher(TC_cache_t *cache);
+void initReadAhead(TC_cache_t *cache, int maxWindow);
+void destroyReadAhead(TC_cache_t *cache);
+void readAheadBlock(TC_cache_t *cache, int fileBlock);
 
 #ifdef	__cplusplus
 }
@@ -28,12 +28,121 @@ typedef struct
     char text[TC_TEXT_SIZE];
 } TC_tableEntry_t;
 
+/** Replacement policies available for the table cache
+ */
+typedef enum
+{
+    // Second chance over a circular list of blocks
+    TC_POLICY_CLOCK,
+    // Evict the block with the largest backward K-distance
+    TC_POLICY_LRUK,
+    // FIFO probation queue in front of an LRU main queue
+    TC_POLICY_2Q,
+    // Adaptive Replacement Cache balancing recency and frequency
+    TC_POLICY_ARC
+} TC_policy_t;
+
+/** Backends for asynchronous block I/O
+ */
+typedef enum
+{
+    // io_uring if the kernel supports it, the thread pool otherwise
+    TC_IO_AUTO,
+    // Linux io_uring submission and completion rings
+    TC_IO_URING,
+    // Threads doing blocking positional reads and writes
+    TC_IO_THREADS
+} TC_ioBackend_t;
+
+/** How the table file is accessed
+ */
+typedef enum
+{
+    // Pages copied into the block cache of the table
+    TC_STORAGE_CACHE,
+    // File mapped into memory, cached by the page cache of the OS
+    TC_STORAGE_MMAP,
+    // Log-structured merge tree: a memtable and sorted runs written sequentially
+    TC_STORAGE_LSM
+} TC_storage_t;
+
+/** Expected access pattern of the table
+ */
+typedef enum
+{
+    // No particular pattern
+    TC_ACCESS_NORMAL,
+    // Scans of consecutive entries
+    TC_ACCESS_SEQUENTIAL,
+    // Lookups of single entries
+    TC_ACCESS_RANDOM
+} TC_access_t;
+
+/** Options selected when the table is opened
+ */
+typedef struct
+{
+    // Replacement policy of the block cache
+    TC_policy_t policy;
+    // Write dirty blocks from a background thread (0 = only on replacement)
+    int backgroundFlush;
+    // Backend for asynchronous reads and writes of blocks
+    TC_ioBackend_t ioBackend;
+    // Largest read-ahead window of sequential scans in blocks (0 = no read-ahead)
+    int readAheadBlocks;
+    // Page size of a new table file in bytes, a power of two from 4 to 64 KiB
+    int pageSize;
+    // Entries per page of a new table file (0 = derived from the page size)
+    int slotsPerPage;
+    // Bypass the page cache of the OS with O_DIRECT, so blocks are cached once
+    int directIO;
+    // Back the cache blocks with huge pages
+    int hugePages;
+    // Block cache, memory-mapped file or LSM tree
+    TC_storage_t storage;
+} TC_tableOptions_t;
+
+/** Latch modes for a block fixed in the cache
+ */
+typedef enum
+{
+    // Many threads may read the block at the same time
+    TC_LATCH_SHARED,
+    // A single thread may read and modify the block
+    TC_LATCH_EXCLUSIVE
+} TC_latchMode_t;
+
+/** A block fixed in the cache. The block cannot be replaced and its
+ * page stays valid until the block is unfixed.
+ */
+typedef struct
+{
+    // Index of block on memory cache (latch stripe with a mapped file)
+    int cacheIndex;
+    // Index of block on file (in blocks)
+    int fileBlock;
+    TC_latchMode_t mode;
+    // Slotted page held by the block, accessed with TC_getEntry()/TC_putEntry()
+    void *page;
+} TC_fixedBlock_t;
+
+void TC_defaultOptions(TC_tableOptions_t *options);
 int TC_openTable();
+int TC_openTableWithOptions(const TC_tableOptions_t *options);
 int TC_flushAllBlocks();
 int TC_writeEntryAsync(int fileIndex, TC_tableEntry_t * entry);
 int TC_writeEntrySync(int fileIndex, TC_tableEntry_t * entry);
 int TC_readEntry(int fileIndex, TC_tableEntry_t *entry);
+int TC_readEntries(int firstIndex, int n, TC_tableEntry_t *entries);
+int TC_writeEntries(int firstIndex, int n, const TC_tableEntry_t *entries);
 int TC_closeTable();
+int TC_fixBlock(int fileBlock, TC_latchMode_t mode, TC_fixedBlock_t *fixed);
+int TC_fixEntry(int fileIndex, TC_latchMode_t mode, TC_fixedBlock_t *fixed);
+void TC_unfixBlock(TC_fixedBlock_t *fixed, int dirty);
+void TC_getEntry(const TC_fixedBlock_t *fixed, int slot, TC_tableEntry_t *entry);
+int TC_putEntry(TC_fixedBlock_t *fixed, int slot, const TC_tableEntry_t *entry);
+int TC_prefetchBlocks(int firstFileBlock, int nBlocks);
+int TC_adviseAccess(TC_access_t access);
 
 #ifdef	__cplusplus
 }
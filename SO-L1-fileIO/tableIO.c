@@ -0,0 +1,147 @@
+/*
+ * File:   tableIO.c
+ *
+ * Positional block I/O on the table file. Offsets are in bytes, the layout
+ * of pages in the file is up to the caller.
+ */
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "tableIO.h"
+
+/**
+ * Read a file block. The part of the block beyond the end of file is
+ * filled with zeroes.
+ * @param fd Descriptor of the table file
+ * @param buffer Buffer of size bytes
+ * @param size Size of the block in bytes
+ * @param offset Position of the block on file
+ * @return -1=error
+ */
+int ioReadBlock(int fd, void *buffer, size_t size, off_t offset)
+{
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = size;
+    return ioReadBlocks(fd, &iov, 1, offset);
+}
+
+/**
+ * Read consecutive file blocks into several buffers with preadv(),
+ * resuming after partial reads. The part beyond the end of file is filled
+ * with zeroes.
+ * @param fd Descriptor of the table file
+ * @param iov Buffers of the blocks (modified on partial reads)
+ * @param n Number of buffers
+ * @param offset Position on file of the first block
+ * @return -1=error
+ */
+int ioReadBlocks(int fd, struct iovec *iov, int n, off_t offset)
+{
+    while (n > 0)
+    {
+        ssize_t status = preadv(fd, iov, n, offset);
+        if (status == -1)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        // EOF
+        if (status == 0)
+        {
+            for (; n > 0; iov++, n--) memset(iov->iov_base, 0, iov->iov_len);
+            break;
+        }
+        offset += status;
+        // Skip the buffers already read
+        while (n > 0 && (size_t) status >= iov->iov_len)
+        {
+            status -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0)
+        {
+            iov->iov_base = (char *) iov->iov_base + status;
+            iov->iov_len -= status;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Write a file block
+ * @param fd Descriptor of the table file
+ * @param buffer Buffer of size bytes
+ * @param size Size of the block in bytes
+ * @param offset Position of the block on file
+ * @return -1=error
+ */
+int ioWriteBlock(int fd, const void *buffer, size_t size, off_t offset)
+{
+    struct iovec iov;
+    iov.iov_base = (void *) buffer;
+    iov.iov_len = size;
+    return ioWriteBlocks(fd, &iov, 1, offset);
+}
+
+/**
+ * Write consecutive file blocks from several buffers with pwritev(),
+ * resuming after partial writes
+ * @param fd Descriptor of the table file
+ * @param iov Buffers of the blocks (modified on partial writes)
+ * @param n Number of buffers
+ * @param offset Position on file of the first block
+ * @return -1=error
+ */
+int ioWriteBlocks(int fd, struct iovec *iov, int n, off_t offset)
+{
+    while (n > 0)
+    {
+        ssize_t status = pwritev(fd, iov, n, offset);
+        if (status == -1)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        offset += status;
+        // Skip the buffers already written
+        while (n > 0 && (size_t) status >= iov->iov_len)
+        {
+            status -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0)
+        {
+            iov->iov_base = (char *) iov->iov_base + status;
+            iov->iov_len -= status;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Make every block written so far durable
+ * @param fd Descriptor of the table file
+ * @return -1=error
+ */
+int ioSync(int fd)
+{
+    while (fdatasync(fd) == -1)
+    {
+        if (errno != EINTR) return -1;
+    }
+    return 0;
+}
+
+#ifdef	__cplusplus
+}
+#endif
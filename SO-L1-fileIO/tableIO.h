@@ -0,0 +1,48 @@
+/*
+ * File:   tableIO.h
+ *
+ * Block I/O on the table file. All transfers are positional (pread/pwrite),
+ * so threads never share a file offset and may do I/O at the same time.
+ * Writes are not durable until ioSync() is called.
+ * An I/O engine keeps many transfers in flight and reports their completion
+ * through callbacks run by a thread of the engine.
+ */
+
+#ifndef TABLEIO_H
+#define	TABLEIO_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "parameters.h"
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+int ioReadBlock(int fd, void *buffer, size_t size, off_t offset);
+int ioReadBlocks(int fd, struct iovec *iov, int n, off_t offset);
+int ioWriteBlock(int fd, const void *buffer, size_t size, off_t offset);
+int ioWriteBlocks(int fd, struct iovec *iov, int n, off_t offset);
+int ioSync(int fd);
+
+/** Called when an asynchronous transfer completes
+ * @param arg Argument given when the transfer was submitted
+ * @param status 0=done, -1=error
+ */
+typedef void (*ioCallback_t)(void *arg, int status);
+
+typedef struct ioEngine ioEngine_t;
+
+ioEngine_t *ioCreateEngine(int fd, TC_ioBackend_t backend, int queueDepth, int nThreads);
+void ioDestroyEngine(ioEngine_t *engine);
+const char *ioEngineName(ioEngine_t *engine);
+int ioSubmitRead(ioEngine_t *engine, const struct iovec *iov, int n, off_t offset, ioCallback_t callback, void *arg);
+int ioSubmitWrite(ioEngine_t *engine, const struct iovec *iov, int n, off_t offset, ioCallback_t callback, void *arg);
+void ioWaitAll(ioEngine_t *engine);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* TABLEIO_H */
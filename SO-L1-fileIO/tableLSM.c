@@ -0,0 +1,877 @@
+/*
+ * File:   tableLSM.c
+ *
+ * Log-structured merge storage of the table. Entries are appended to a
+ * log and kept in the memtable; a full memtable becomes immutable and a
+ * background thread writes it as a level 0 run. When level 0 collects
+ * TC_LSM_L0_RUNS runs they are merged into the single run of level 1, and
+ * every level holding more than its share is merged into the next one.
+ * The manifest records the runs of every level and the first log not yet
+ * written to a run; it is replaced atomically after every change.
+ *
+ * Lookups search the memtable, the immutable memtable and the runs from
+ * the newest to the oldest. Fixed blocks are arrays of entries built from
+ * lookups; entries modified in them are written back on unfix.
+ */
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "tableCache.h"
+#include "tableLSM.h"
+
+// Name of the manifest
+#define MANIFEST_NAME TC_FILENAME ".lsm"
+
+// Identifies the manifest
+#define MANIFEST_MAGIC "SODBLSM"
+
+// Version of the manifest format
+#define MANIFEST_VERSION 1
+
+/** Header of the manifest, followed by a manifestRun_t for every run
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    // First log whose entries are not in any run
+    uint32_t firstLog;
+    // Number of the next run to be written
+    uint32_t nextRun;
+    uint32_t nRuns;
+} manifestHeader_t;
+
+/** A run listed by the manifest, level 0 runs newest first
+ */
+typedef struct
+{
+    uint32_t level;
+    uint32_t number;
+} manifestRun_t;
+
+/** State of the LSM storage
+ */
+struct TC_lsm
+{
+    // Held shared by lookups, exclusive to change the memtable or the runs
+    pthread_rwlock_t state;
+    // Memtable taking new entries
+    lsmMemtable_t *memtable;
+    // Full memtable being written as a run (NULL if none)
+    lsmMemtable_t *immutable;
+    // Runs of every level, newest first
+    lsmRun_t *levels[TC_LSM_LEVELS];
+    // Log of the memtable and records waiting to be appended to it
+    int logFd;
+    int logBuffered;
+    lsmRecord_t logBuffer[TC_LSM_LOG_BUFFER];
+    // Access pattern advised for the runs
+    TC_access_t access;
+    // Latches of the blocks, block i uses latch i % TC_LSM_LATCHES
+    pthread_rwlock_t latches[TC_LSM_LATCHES];
+
+    // Fields below are only changed by the compaction thread
+    uint32_t firstLog;
+    uint32_t nextRun;
+
+    pthread_t thread;
+    // Protects the fields below
+    pthread_mutex_t mutex;
+    // Signalled when there is compaction work or the thread has to stop
+    pthread_cond_t wakeup;
+    // Signalled when the immutable memtable has been written
+    pthread_cond_t written;
+    // Is the thread running?
+    int running;
+    // Has the thread been asked to finish?
+    int stop;
+    // Has the thread given up after an error?
+    int failed;
+};
+
+/**
+ * Number of entries of the runs of a level
+ */
+static uint64_t levelEntries(const lsmRun_t *run)
+{
+    uint64_t entries = 0;
+    for (; run != NULL; run = run->next) entries += run->count;
+    return entries;
+}
+
+/**
+ * Entries a level may hold before it is merged into the next one
+ */
+static uint64_t levelCapacity(int level)
+{
+    uint64_t capacity = TC_LSM_LEVEL1_ENTRIES;
+    while (--level > 0) capacity *= TC_LSM_FANOUT;
+    return capacity;
+}
+
+/**
+ * Level to be merged into the next one, -1 if none
+ */
+static int levelToCompact(struct TC_lsm *lsm)
+{
+    int level, runs = 0;
+    const lsmRun_t *run;
+
+    for (run = lsm->levels[0]; run != NULL; run = run->next) runs++;
+    if (runs >= TC_LSM_L0_RUNS) return 0;
+    // The last level grows without limit
+    for (level = 1; level < TC_LSM_LEVELS - 1; level++)
+    {
+        if (levelEntries(lsm->levels[level]) > levelCapacity(level)) return level;
+    }
+    return -1;
+}
+
+/**
+ * Replace the manifest with the given runs
+ * @param levels Runs of every level
+ * @param firstLog First log whose entries are not in any run
+ * @param nextRun Number of the next run
+ * @return -1=error
+ */
+static int writeManifest(lsmRun_t **levels, uint32_t firstLog, uint32_t nextRun)
+{
+    manifestHeader_t header;
+    manifestRun_t *runs;
+    const lsmRun_t *run;
+    int fd, level, status;
+
+    memset(&header, 0, sizeof (header));
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof (MANIFEST_MAGIC));
+    header.version = MANIFEST_VERSION;
+    header.firstLog = firstLog;
+    header.nextRun = nextRun;
+    for (level = 0; level < TC_LSM_LEVELS; level++)
+    {
+        for (run = levels[level]; run != NULL; run = run->next) header.nRuns++;
+    }
+    runs = malloc((header.nRuns + 1) * sizeof (manifestRun_t));
+    header.nRuns = 0;
+    for (level = 0; level < TC_LSM_LEVELS; level++)
+    {
+        for (run = levels[level]; run != NULL; run = run->next)
+        {
+            runs[header.nRuns].level = level;
+            runs[header.nRuns].number = run->number;
+            header.nRuns++;
+        }
+    }
+    // Written aside and renamed, so a crash leaves the old or the new one
+    fd = open(MANIFEST_NAME ".new", O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+    {
+        free(runs);
+        return -1;
+    }
+    status = ioWriteBlock(fd, &header, sizeof (header), 0);
+    if (status == 0) status = ioWriteBlock(fd, runs, header.nRuns * sizeof (manifestRun_t), sizeof (header));
+    if (status == 0) status = ioSync(fd);
+    close(fd);
+    free(runs);
+    if (status == 0) status = rename(MANIFEST_NAME ".new", MANIFEST_NAME);
+    return status;
+}
+
+/**
+ * Read the manifest and map the runs it lists
+ * @param lsm
+ * @return -1=error
+ */
+static int loadManifest(struct TC_lsm *lsm)
+{
+    manifestHeader_t header;
+    manifestRun_t run;
+    lsmRun_t *last[TC_LSM_LEVELS];
+    uint32_t i;
+    int fd, status = 0;
+
+    memset(last, 0, sizeof (last));
+    fd = open(MANIFEST_NAME, O_RDONLY);
+    if (fd == -1)
+    {
+        // A new table
+        lsm->firstLog = 0;
+        lsm->nextRun = 0;
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (ioReadBlock(fd, &header, sizeof (header), 0) == -1 || memcmp(header.magic, MANIFEST_MAGIC, sizeof (MANIFEST_MAGIC)) != 0 ||
+            header.version != MANIFEST_VERSION)
+    {
+        fprintf(stderr, "%s is not a manifest of format version %d\n", MANIFEST_NAME, MANIFEST_VERSION);
+        close(fd);
+        return -1;
+    }
+    lsm->firstLog = header.firstLog;
+    lsm->nextRun = header.nextRun;
+    for (i = 0; i < header.nRuns && status == 0; i++)
+    {
+        lsmRun_t *mapped;
+        status = ioReadBlock(fd, &run, sizeof (run), sizeof (header) + i * sizeof (run));
+        if (status == -1) break;
+        mapped = run.level < TC_LSM_LEVELS ? lsmOpenRun(run.number) : NULL;
+        if (mapped == NULL)
+        {
+            fprintf(stderr, "Run %u of level %u missing\n", run.number, run.level);
+            status = -1;
+            break;
+        }
+        // Kept in the order of the manifest
+        if (last[run.level] == NULL) lsm->levels[run.level] = mapped;
+        else last[run.level]->next = mapped;
+        last[run.level] = mapped;
+    }
+    close(fd);
+    return status;
+}
+
+/**
+ * Append the buffered log records to the log of the memtable
+ * @param lsm Held exclusive
+ * @return -1=error
+ */
+static int writeLog(struct TC_lsm *lsm)
+{
+    ssize_t size = lsm->logBuffered * sizeof (lsmRecord_t);
+    const char *buffer = (const char *) lsm->logBuffer;
+
+    while (size > 0)
+    {
+        ssize_t written = write(lsm->logFd, buffer, size);
+        if (written == -1)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buffer += written;
+        size -= written;
+    }
+    lsm->logBuffered = 0;
+    return 0;
+}
+
+/**
+ * Open a log for appending
+ * @param number Number of the log
+ * @return Descriptor, -1=error
+ */
+static int openLog(uint32_t number)
+{
+    char name[64];
+    lsmFileName(name, sizeof (name), "log", number);
+    return open(name, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+}
+
+/**
+ * Load the logs not written to runs into the memtable. The last log is
+ * cut after its last whole record, left by a crash in the middle of a write.
+ * @param lsm
+ * @return -1=error
+ */
+static int replayLogs(struct TC_lsm *lsm)
+{
+    uint32_t number = lsm->firstLog;
+
+    lsm->memtable = lsmCreateMemtable(number);
+    for (;; number++)
+    {
+        char name[64];
+        lsmRecord_t record;
+        off_t offset = 0;
+        struct stat st;
+        int fd;
+
+        lsmFileName(name, sizeof (name), "log", number);
+        fd = open(name, O_RDWR);
+        if (fd == -1) break;
+        if (fstat(fd, &st) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+        for (; offset + (off_t) sizeof (record) <= st.st_size; offset += sizeof (record))
+        {
+            if (ioReadBlock(fd, &record, sizeof (record), offset) == -1)
+            {
+                close(fd);
+                return -1;
+            }
+            lsmMemtablePut(lsm->memtable, &record);
+        }
+        if (offset != st.st_size && ftruncate(fd, offset) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+        close(fd);
+        lsm->memtable->lastLog = number;
+    }
+    if (lsm->memtable->count > 0)
+        printf("%d entries recovered from the logs\n", lsm->memtable->count);
+    lsm->logFd = openLog(lsm->memtable->lastLog);
+    return lsm->logFd == -1 ? -1 : 0;
+}
+
+/**
+ * Delete the logs of a memtable
+ */
+static void removeLogs(const lsmMemtable_t *memtable)
+{
+    uint32_t number;
+    for (number = memtable->firstLog; number <= memtable->lastLog; number++)
+    {
+        char name[64];
+        lsmFileName(name, sizeof (name), "log", number);
+        unlink(name);
+    }
+}
+
+/**
+ * Apply the advised access pattern to a run
+ */
+static void adviseRun(struct TC_lsm *lsm, lsmRun_t *run)
+{
+    int advice = MADV_NORMAL;
+    if (lsm->access == TC_ACCESS_SEQUENTIAL) advice = MADV_SEQUENTIAL;
+    else if (lsm->access == TC_ACCESS_RANDOM) advice = MADV_RANDOM;
+    madvise(run->map, run->mapSize, advice);
+}
+
+/**
+ * Write the immutable memtable as a level 0 run
+ * @param lsm
+ * @return -1=error
+ */
+static int writeImmutable(struct TC_lsm *lsm)
+{
+    lsmMemtable_t *immutable = lsm->immutable;
+    lsmRun_t *levels[TC_LSM_LEVELS];
+    lsmRun_t *run;
+
+    // Only this thread changes the immutable memtable and the runs
+    run = lsmWriteMemtable(immutable, lsm->nextRun);
+    if (run == NULL) return -1;
+    memcpy(levels, lsm->levels, sizeof (levels));
+    run->next = levels[0];
+    levels[0] = run;
+    if (writeManifest(levels, immutable->lastLog + 1, lsm->nextRun + 1) == -1)
+    {
+        lsmCloseRun(run, 1);
+        return -1;
+    }
+    adviseRun(lsm, run);
+
+    pthread_rwlock_wrlock(&lsm->state);
+    lsm->levels[0] = run;
+    lsm->firstLog = immutable->lastLog + 1;
+    lsm->nextRun++;
+    pthread_mutex_lock(&lsm->mutex);
+    lsm->immutable = NULL;
+    pthread_cond_broadcast(&lsm->written);
+    pthread_mutex_unlock(&lsm->mutex);
+    pthread_rwlock_unlock(&lsm->state);
+
+    printf("Memtable of %d entries written as run %u\n", immutable->count, run->number);
+    removeLogs(immutable);
+    lsmDestroyMemtable(immutable);
+    return 0;
+}
+
+/**
+ * Merge the runs of a level and the run of the next level into a new run
+ * of the next level
+ * @param lsm
+ * @param level
+ * @return -1=error
+ */
+static int compactLevel(struct TC_lsm *lsm, int level)
+{
+    lsmRun_t *levels[TC_LSM_LEVELS];
+    lsmRun_t **inputs;
+    lsmRun_t *merged, *run;
+    int nInputs = 0, i;
+
+    for (i = level; i <= level + 1; i++)
+    {
+        for (run = lsm->levels[i]; run != NULL; run = run->next) nInputs++;
+    }
+    inputs = malloc(nInputs * sizeof (lsmRun_t *));
+    // Newest first: the level, then the next one
+    nInputs = 0;
+    for (i = level; i <= level + 1; i++)
+    {
+        for (run = lsm->levels[i]; run != NULL; run = run->next) inputs[nInputs++] = run;
+    }
+    merged = lsmMergeRuns(inputs, nInputs, lsm->nextRun);
+    if (merged == NULL)
+    {
+        free(inputs);
+        return -1;
+    }
+    memcpy(levels, lsm->levels, sizeof (levels));
+    levels[level] = NULL;
+    levels[level + 1] = merged;
+    if (writeManifest(levels, lsm->firstLog, lsm->nextRun + 1) == -1)
+    {
+        lsmCloseRun(merged, 1);
+        free(inputs);
+        return -1;
+    }
+    adviseRun(lsm, merged);
+
+    pthread_rwlock_wrlock(&lsm->state);
+    memcpy(lsm->levels, levels, sizeof (levels));
+    lsm->nextRun++;
+    pthread_rwlock_unlock(&lsm->state);
+
+    printf("Level %d compacted into run %u of level %d, %lu entries\n", level, merged->number, level + 1, (unsigned long) merged->count);
+    // No lookup can be using the merged runs any more
+    for (i = 0; i < nInputs; i++)
+        lsmCloseRun(inputs[i], 1);
+    free(inputs);
+    return 0;
+}
+
+/**
+ * Background thread writing full memtables as runs and merging levels
+ */
+static void *compactionMain(void *arg)
+{
+    struct TC_lsm *lsm = arg;
+    int status = 0;
+
+    pthread_mutex_lock(&lsm->mutex);
+    while (!lsm->stop && status == 0)
+    {
+        int level = levelToCompact(lsm);
+        int immutable = lsm->immutable != NULL;
+
+        if (!immutable && level == -1)
+        {
+            pthread_cond_wait(&lsm->wakeup, &lsm->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&lsm->mutex);
+        // Writers wait for the immutable memtable, so it goes first; a
+        // single merge follows so level 0 cannot grow without limit
+        if (immutable && (status = writeImmutable(lsm)) == -1)
+            perror("Error writing memtable");
+        level = levelToCompact(lsm);
+        if (status == 0 && level != -1 && (status = compactLevel(lsm, level)) == -1)
+            perror("Error compacting runs");
+        pthread_mutex_lock(&lsm->mutex);
+    }
+    if (status == -1)
+    {
+        // Writers stop waiting for memtables to be written
+        lsm->failed = 1;
+        pthread_cond_broadcast(&lsm->written);
+    }
+    pthread_mutex_unlock(&lsm->mutex);
+    return NULL;
+}
+
+/**
+ * Store records in the memtable and append them to the log. A full
+ * memtable is handed to the compaction thread, waiting for the previous one
+ * to be written first.
+ * @param lsm
+ * @param records
+ * @param n Number of records
+ * @param sync 1 to make the records durable before returning
+ * @return -1=error
+ */
+static int putRecords(struct TC_lsm *lsm, const lsmRecord_t *records, int n, int sync)
+{
+    int i, status = 0;
+
+    pthread_rwlock_wrlock(&lsm->state);
+    while (lsm->memtable->count >= TC_LSM_MEMTABLE_ENTRIES)
+    {
+        int failed;
+        pthread_mutex_lock(&lsm->mutex);
+        failed = lsm->failed;
+        pthread_mutex_unlock(&lsm->mutex);
+        // Without compaction the memtable grows, its entries are in the log
+        if (failed) break;
+        if (lsm->immutable == NULL)
+        {
+            lsmMemtable_t *memtable = lsmCreateMemtable(lsm->memtable->lastLog + 1);
+            int logFd = openLog(memtable->firstLog);
+            if (logFd == -1 || writeLog(lsm) == -1)
+            {
+                if (logFd != -1) close(logFd);
+                lsmDestroyMemtable(memtable);
+                pthread_rwlock_unlock(&lsm->state);
+                return -1;
+            }
+            close(lsm->logFd);
+            lsm->logFd = logFd;
+            pthread_mutex_lock(&lsm->mutex);
+            lsm->immutable = lsm->memtable;
+            lsm->memtable = memtable;
+            pthread_cond_signal(&lsm->wakeup);
+            pthread_mutex_unlock(&lsm->mutex);
+            break;
+        }
+        // Stall until the compaction thread catches up
+        pthread_rwlock_unlock(&lsm->state);
+        pthread_mutex_lock(&lsm->mutex);
+        while (lsm->immutable != NULL && !lsm->failed)
+            pthread_cond_wait(&lsm->written, &lsm->mutex);
+        pthread_mutex_unlock(&lsm->mutex);
+        pthread_rwlock_wrlock(&lsm->state);
+    }
+    for (i = 0; i < n && status == 0; i++)
+    {
+        lsmMemtablePut(lsm->memtable, &records[i]);
+        lsm->logBuffer[lsm->logBuffered++] = records[i];
+        if (lsm->logBuffered == TC_LSM_LOG_BUFFER) status = writeLog(lsm);
+    }
+    if (status == 0 && sync)
+    {
+        status = writeLog(lsm);
+        if (status == 0) status = ioSync(lsm->logFd);
+    }
+    pthread_rwlock_unlock(&lsm->state);
+    return status;
+}
+
+/**
+ * Look an entry up from the newest to the oldest place it may be in
+ * @param lsm Held shared
+ * @param key Index of the entry
+ * @param entry Filled with the entry, zeroes if it was never written
+ */
+static void getRecord(struct TC_lsm *lsm, uint64_t key, TC_tableEntry_t *entry)
+{
+    const lsmRecord_t *record = lsmMemtableGet(lsm->memtable, key);
+    int level;
+
+    if (record == NULL && lsm->immutable != NULL) record = lsmMemtableGet(lsm->immutable, key);
+    for (level = 0; level < TC_LSM_LEVELS && record == NULL; level++)
+    {
+        const lsmRun_t *run;
+        for (run = lsm->levels[level]; run != NULL && record == NULL; run = run->next)
+            record = lsmRunGet(run, key);
+    }
+    if (record != NULL) *entry = record->entry;
+    else memset(entry, 0, sizeof (TC_tableEntry_t));
+}
+
+/**
+ * Open the memtable and the runs of the table
+ * @param cache
+ * @param options Options of the table; cache options do not apply
+ * @return -1=error
+ */
+static int lsmOpen(TC_cache_t *cache, const TC_tableOptions_t *options)
+{
+    struct TC_lsm *lsm = calloc(1, sizeof (struct TC_lsm));
+    int level, i;
+
+    if (loadManifest(lsm) == -1 || replayLogs(lsm) == -1)
+    {
+        perror("Error opening LSM table");
+        for (level = 0; level < TC_LSM_LEVELS; level++)
+        {
+            while (lsm->levels[level] != NULL)
+            {
+                lsmRun_t *next = lsm->levels[level]->next;
+                lsmCloseRun(lsm->levels[level], 0);
+                lsm->levels[level] = next;
+            }
+        }
+        if (lsm->memtable != NULL) lsmDestroyMemtable(lsm->memtable);
+        free(lsm);
+        return -1;
+    }
+    lsm->access = TC_ACCESS_NORMAL;
+    pthread_rwlock_init(&lsm->state, NULL);
+    for (i = 0; i < TC_LSM_LATCHES; i++)
+        pthread_rwlock_init(&lsm->latches[i], NULL);
+    pthread_mutex_init(&lsm->mutex, NULL);
+    pthread_cond_init(&lsm->wakeup, NULL);
+    pthread_cond_init(&lsm->written, NULL);
+    if (pthread_create(&lsm->thread, NULL, compactionMain, lsm) != 0)
+    {
+        fprintf(stderr, "Compaction thread not started, the memtable grows without limit\n");
+        lsm->failed = 1;
+    }
+    else lsm->running = 1;
+    cache->lsm = lsm;
+    for (level = 0; level < TC_LSM_LEVELS; level++)
+    {
+        if (lsm->levels[level] != NULL)
+            printf("Level %d: %lu entries\n", level, (unsigned long) levelEntries(lsm->levels[level]));
+    }
+    return 0;
+}
+
+/**
+ * Fix a block: its entries are copied into an array, followed by a copy
+ * telling which entries are modified when it is unfixed
+ * @param cache
+ * @param fileBlock Index of block on file
+ * @param mode Shared latch for reading or exclusive latch for writing
+ * @param fixed Handle of the fixed block
+ * @return -1=error
+ */
+static int lsmFixBlock(TC_cache_t *cache, int fileBlock, TC_latchMode_t mode, TC_fixedBlock_t *fixed)
+{
+    struct TC_lsm *lsm = cache->lsm;
+    int latch = fileBlock % TC_LSM_LATCHES;
+    TC_tableEntry_t *entries = malloc(2 * cache->slotsPerPage * sizeof (TC_tableEntry_t));
+    int slot;
+
+    if (entries == NULL) return -1;
+    if (mode == TC_LATCH_EXCLUSIVE) pthread_rwlock_wrlock(&lsm->latches[latch]);
+    else pthread_rwlock_rdlock(&lsm->latches[latch]);
+    pthread_rwlock_rdlock(&lsm->state);
+    for (slot = 0; slot < cache->slotsPerPage; slot++)
+        getRecord(lsm, (uint64_t) fileBlock * cache->slotsPerPage + slot, &entries[slot]);
+    pthread_rwlock_unlock(&lsm->state);
+    if (mode == TC_LATCH_EXCLUSIVE)
+        memcpy(entries + cache->slotsPerPage, entries, cache->slotsPerPage * sizeof (TC_tableEntry_t));
+    fixed->cacheIndex = latch;
+    fixed->fileBlock = fileBlock;
+    fixed->mode = mode;
+    fixed->page = entries;
+    return 0;
+}
+
+/**
+ * Write the entries of a fixed block changed since it was fixed or last
+ * written
+ * @param cache
+ * @param fixed Handle of a block fixed in exclusive mode
+ * @param sync 1 to make them durable
+ * @return -1=error
+ */
+static int putChangedEntries(TC_cache_t *cache, TC_fixedBlock_t *fixed, int sync)
+{
+    TC_tableEntry_t *entries = fixed->page;
+    TC_tableEntry_t *original = entries + cache->slotsPerPage;
+    lsmRecord_t *records = malloc(cache->slotsPerPage * sizeof (lsmRecord_t));
+    int slot, n = 0, status;
+
+    for (slot = 0; slot < cache->slotsPerPage; slot++)
+    {
+        if (memcmp(&entries[slot], &original[slot], sizeof (TC_tableEntry_t)) == 0) continue;
+        records[n].key = (uint64_t) fixed->fileBlock * cache->slotsPerPage + slot;
+        records[n].entry = entries[slot];
+        original[slot] = entries[slot];
+        n++;
+    }
+    status = n > 0 || sync ? putRecords(cache->lsm, records, n, sync) : 0;
+    free(records);
+    return status;
+}
+
+/**
+ * Release a fixed block, writing its modified entries
+ * @param cache
+ * @param fixed Handle of the fixed block
+ * @param dirty 1 if the entries were modified (requires exclusive latch)
+ */
+static void lsmUnfixBlock(TC_cache_t *cache, TC_fixedBlock_t *fixed, int dirty)
+{
+    if (dirty && putChangedEntries(cache, fixed, 0) == -1)
+        perror("Error writing entries");
+    pthread_rwlock_unlock(&cache->lsm->latches[fixed->cacheIndex]);
+    free(fixed->page);
+}
+
+/**
+ * Copy an entry out of a fixed block
+ */
+static void lsmGetEntry(TC_cache_t *cache, const TC_fixedBlock_t *fixed, int slot, TC_tableEntry_t *entry)
+{
+    *entry = ((const TC_tableEntry_t *) fixed->page)[slot];
+}
+
+/**
+ * Store an entry in a block fixed in exclusive mode. Entries are not packed
+ * into pages, so the block never runs out of room.
+ */
+static int lsmPutEntry(TC_cache_t *cache, TC_fixedBlock_t *fixed, int slot, const TC_tableEntry_t *entry)
+{
+    ((TC_tableEntry_t *) fixed->page)[slot] = *entry;
+    return 0;
+}
+
+/**
+ * Make the modified entries of a block fixed in exclusive mode durable
+ */
+static int lsmWriteBlock(TC_cache_t *cache, TC_fixedBlock_t *fixed)
+{
+    return putChangedEntries(cache, fixed, 1);
+}
+
+/**
+ * Read an entry
+ * @param cache
+ * @param fileIndex Index of entry into file.
+ * @param entry Pointer to entry.
+ * @return 0
+ */
+static int lsmReadEntry(TC_cache_t *cache, int fileIndex, TC_tableEntry_t *entry)
+{
+    pthread_rwlock_rdlock(&cache->lsm->state);
+    getRecord(cache->lsm, fileIndex, entry);
+    pthread_rwlock_unlock(&cache->lsm->state);
+    return 0;
+}
+
+/**
+ * Write an entry to the log and the memtable, latching its block so the
+ * write does not fall in the middle of an update of the fixed block
+ * @param cache
+ * @param fileIndex Index of entry into file.
+ * @param entry Pointer to entry.
+ * @param sync 1 to make the entry durable
+ * @return -1=error
+ */
+static int lsmWriteEntry(TC_cache_t *cache, int fileIndex, const TC_tableEntry_t *entry, int sync)
+{
+    pthread_rwlock_t *latch = &cache->lsm->latches[(fileIndex / cache->slotsPerPage) % TC_LSM_LATCHES];
+    lsmRecord_t record;
+    int status;
+
+    record.key = fileIndex;
+    record.entry = *entry;
+    pthread_rwlock_wrlock(latch);
+    status = putRecords(cache->lsm, &record, 1, sync);
+    pthread_rwlock_unlock(latch);
+    return status;
+}
+
+/**
+ * Runs are mapped and read on demand; nothing is read ahead
+ */
+static int lsmPrefetchBlocks(TC_cache_t *cache, int firstFileBlock, int nBlocks)
+{
+    return 0;
+}
+
+/**
+ * Advise the kernel of the access pattern of the runs
+ * @param cache
+ * @param access
+ * @return 0
+ */
+static int lsmAdvise(TC_cache_t *cache, TC_access_t access)
+{
+    struct TC_lsm *lsm = cache->lsm;
+    int level;
+
+    // Exclusive, so runs written meanwhile get the new advice
+    pthread_rwlock_wrlock(&lsm->state);
+    lsm->access = access;
+    for (level = 0; level < TC_LSM_LEVELS; level++)
+    {
+        lsmRun_t *run;
+        for (run = lsm->levels[level]; run != NULL; run = run->next) adviseRun(lsm, run);
+    }
+    pthread_rwlock_unlock(&lsm->state);
+    return 0;
+}
+
+/**
+ * Make every entry written so far durable: runs are durable when they are
+ * written, so only the log has to be synced
+ * @param cache
+ * @return -1=error
+ */
+static int lsmFlush(TC_cache_t *cache)
+{
+    struct TC_lsm *lsm = cache->lsm;
+    int status;
+
+    pthread_rwlock_wrlock(&lsm->state);
+    status = writeLog(lsm);
+    if (status == 0) status = ioSync(lsm->logFd);
+    pthread_rwlock_unlock(&lsm->state);
+    return status;
+}
+
+/**
+ * Stop the compaction thread and release the table. The memtables are
+ * recovered from their logs when the table is opened again.
+ * @param cache
+ */
+static void lsmClose(TC_cache_t *cache)
+{
+    struct TC_lsm *lsm = cache->lsm;
+    int level, i;
+
+    if (lsm->running)
+    {
+        pthread_mutex_lock(&lsm->mutex);
+        lsm->stop = 1;
+        pthread_cond_signal(&lsm->wakeup);
+        pthread_mutex_unlock(&lsm->mutex);
+        pthread_join(lsm->thread, NULL);
+        lsm->running = 0;
+    }
+
+    lsmFlush(cache);
+    close(lsm->logFd);
+    lsmDestroyMemtable(lsm->memtable);
+    if (lsm->immutable != NULL) lsmDestroyMemtable(lsm->immutable);
+    for (level = 0; level < TC_LSM_LEVELS; level++)
+    {
+        while (lsm->levels[level] != NULL)
+        {
+            lsmRun_t *next = lsm->levels[level]->next;
+            lsmCloseRun(lsm->levels[level], 0);
+            lsm->levels[level] = next;
+        }
+    }
+    pthread_rwlock_destroy(&lsm->state);
+    for (i = 0; i < TC_LSM_LATCHES; i++)
+        pthread_rwlock_destroy(&lsm->latches[i]);
+    pthread_mutex_destroy(&lsm->mutex);
+    pthread_cond_destroy(&lsm->wakeup);
+    pthread_cond_destroy(&lsm->written);
+    free(lsm);
+    cache->lsm = NULL;
+}
+
+/** Table stored as a log-structured merge tree
+ */
+const TC_storageOps_t TC_lsmStorage = {
+    "LSM tree",
+    lsmOpen,
+    lsmFixBlock,
+    lsmUnfixBlock,
+    lsmGetEntry,
+    lsmPutEntry,
+    lsmWriteBlock,
+    lsmReadEntry,
+    lsmWriteEntry,
+    lsmPrefetchBlocks,
+    lsmAdvise,
+    lsmFlush,
+    lsmClose
+};
+
+#ifdef	__cplusplus
+}
+#endif
@@ -0,0 +1,101 @@
+/*
+ * File:   tableLSM.h
+ *
+ * Pieces of the log-structured merge storage. Entries are keyed by their
+ * index into the table. Writes go to a write-ahead log and to the memtable,
+ * a skiplist in memory; a full memtable is written as an immutable sorted
+ * run and background compaction merges runs level by level, so the table
+ * is only ever written sequentially. Every run carries a bloom filter on
+ * the keys it holds, so lookups skip most runs without searching them.
+ */
+
+#ifndef TABLELSM_H
+#define	TABLELSM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "parameters.h"
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+/** An entry of the table and its index, as stored in logs and runs
+ */
+typedef struct
+{
+    uint64_t key;
+    TC_tableEntry_t entry;
+} lsmRecord_t;
+
+/** Node of the memtable skiplist
+ */
+typedef struct lsmNode
+{
+    lsmRecord_t record;
+    // Levels of the tower of the node
+    int height;
+    struct lsmNode *next[];
+} lsmNode_t;
+
+/** Entries written since the last run, sorted by key
+ */
+typedef struct
+{
+    // Tower of full height before the first node
+    lsmNode_t *head;
+    // Number of distinct keys
+    int count;
+    // State of the random heights of new towers
+    unsigned int seed;
+    // Log files holding the entries of the memtable
+    uint32_t firstLog;
+    uint32_t lastLog;
+} lsmMemtable_t;
+
+/** Header at the start of a run file
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    // Words of 64 bits of the bloom filter following the header
+    uint32_t bloomWords;
+    // Records following the bloom filter, sorted by key
+    uint64_t count;
+} lsmRunHeader_t;
+
+/** An immutable sorted run, mapped read-only
+ */
+typedef struct lsmRun
+{
+    // Number in the name of the run file
+    uint32_t number;
+    uint64_t count;
+    const uint64_t *bloom;
+    uint64_t bloomBits;
+    const lsmRecord_t *records;
+    void *map;
+    size_t mapSize;
+    // Next older run of the same level
+    struct lsmRun *next;
+} lsmRun_t;
+
+lsmMemtable_t *lsmCreateMemtable(uint32_t log);
+void lsmDestroyMemtable(lsmMemtable_t *memtable);
+void lsmMemtablePut(lsmMemtable_t *memtable, const lsmRecord_t *record);
+const lsmRecord_t *lsmMemtableGet(const lsmMemtable_t *memtable, uint64_t key);
+
+void lsmFileName(char *name, size_t size, const char *kind, uint32_t number);
+lsmRun_t *lsmOpenRun(uint32_t number);
+void lsmCloseRun(lsmRun_t *run, int removeFile);
+const lsmRecord_t *lsmRunGet(const lsmRun_t *run, uint64_t key);
+lsmRun_t *lsmWriteMemtable(const lsmMemtable_t *memtable, uint32_t number);
+lsmRun_t *lsmMergeRuns(lsmRun_t **runs, int nRuns, uint32_t number);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* TABLELSM_H */
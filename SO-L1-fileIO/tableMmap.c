@@ -0,0 +1,291 @@
+/*
+ * File:   tableMmap.c
+ *
+ * Table file mapped into memory. Pages are used in place from the shared
+ * mapping, so the page cache of the OS is the only cache of the table and
+ * modified pages are written back by the kernel, or by msync() at
+ * checkpoints. The address space of the largest file is reserved when it is
+ * opened and writing past the end of the file grows it with ftruncate(),
+ * mapping the new pages in place: the mapping never moves, so growing it
+ * does not wait for fixed pages and a thread may hold any number of fixes.
+ */
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "tableCache.h"
+
+/** Page of zeroes returned for blocks beyond the end of the file: an empty
+ * page, like the ones read past the end by the block cache
+ */
+static char zeroPage[TC_MAX_PAGE_SIZE] __attribute__((aligned(TC_MIN_PAGE_SIZE)));
+
+/**
+ * madvise() advice for an access pattern
+ */
+static int accessAdvice(TC_access_t access)
+{
+    switch (access)
+    {
+    case TC_ACCESS_SEQUENTIAL:
+        return MADV_SEQUENTIAL;
+    case TC_ACCESS_RANDOM:
+        return MADV_RANDOM;
+    default:
+        return MADV_NORMAL;
+    }
+}
+
+/**
+ * Map the table file
+ * @param cache
+ * @param options Options of the table; cache options do not apply
+ * @return -1=error
+ */
+static int mmapOpen(TC_cache_t *cache, const TC_tableOptions_t *options)
+{
+    TC_mapping_t *mapping = &cache->mapping;
+    struct stat st;
+    int i;
+
+    if (options->directIO)
+        fprintf(stderr, "Direct I/O does not apply to a mapped table file\n");
+    if (fstat(cache->fileDescriptor, &st) == -1) return -1;
+    // Only whole pages are mapped
+    mapping->size = (st.st_size + cache->pageSize - 1) / cache->pageSize * cache->pageSize;
+    if ((off_t) mapping->size != st.st_size && ftruncate(cache->fileDescriptor, mapping->size) == -1) return -1;
+    // Reserve inaccessible address space, less if the system refuses so much
+    mapping->reserved = TC_MMAP_RESERVE;
+    do
+    {
+        mapping->base = mmap(NULL, mapping->reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    } while (mapping->base == MAP_FAILED && (mapping->reserved /= 2) >= mapping->size && mapping->reserved > 0);
+    if (mapping->base == MAP_FAILED
+        || mmap(mapping->base, mapping->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, cache->fileDescriptor, 0) == MAP_FAILED)
+    {
+        perror("Error mapping table file");
+        if (mapping->base != MAP_FAILED) munmap(mapping->base, mapping->reserved);
+        return -1;
+    }
+    mapping->access = TC_ACCESS_NORMAL;
+    pthread_mutex_init(&mapping->grow, NULL);
+    for (i = 0; i < TC_MMAP_LATCHES; i++)
+        pthread_rwlock_init(&mapping->latches[i], NULL);
+    printf("Table file mapped, %zu bytes\n", mapping->size);
+    return 0;
+}
+
+/**
+ * Grow the file and the mapping to hold at least end bytes. The mapping
+ * grows geometrically so appending pages seldom extends it. Pages in use
+ * stay where they are, only the reserved address space after them is mapped.
+ * @param cache
+ * @param end Bytes needed
+ * @return -1=error, with errno EFBIG beyond the reserved address space
+ */
+static int growMapping(TC_cache_t *cache, size_t end)
+{
+    TC_mapping_t *mapping = &cache->mapping;
+    int status = 0;
+
+    pthread_mutex_lock(&mapping->grow);
+    // Another thread may have grown it meanwhile
+    if (end > mapping->size)
+    {
+        size_t newSize = mapping->size * 2;
+
+        if (newSize < mapping->size + TC_MMAP_MIN_GROWTH) newSize = mapping->size + TC_MMAP_MIN_GROWTH;
+        if (newSize < end) newSize = end;
+        newSize = (newSize + cache->pageSize - 1) / cache->pageSize * cache->pageSize;
+        if (newSize > mapping->reserved) newSize = mapping->reserved;
+        if (newSize < end)
+        {
+            errno = EFBIG;
+            status = -1;
+        }
+        else if (ftruncate(cache->fileDescriptor, newSize) == -1)
+        {
+            status = -1;
+        }
+        else if (mmap(mapping->base + mapping->size, newSize - mapping->size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_FIXED, cache->fileDescriptor, mapping->size) == MAP_FAILED)
+        {
+            status = -1;
+        }
+        else
+        {
+            madvise(mapping->base + mapping->size, newSize - mapping->size, accessAdvice(mapping->access));
+            // Pages are usable by other threads once the size covers them
+            __atomic_store_n(&mapping->size, newSize, __ATOMIC_RELEASE);
+            printf("Table file mapping grown to %zu bytes\n", newSize);
+        }
+    }
+    pthread_mutex_unlock(&mapping->grow);
+    return status;
+}
+
+/**
+ * Fix a page of the mapped file. Blocks beyond the end of the file are
+ * read as an empty page and created when fixed in exclusive mode.
+ * @param cache
+ * @param fileBlock Index of block on file
+ * @param mode Shared latch for reading or exclusive latch for writing
+ * @param fixed Handle of the fixed block
+ * @return -1=error
+ */
+static int mmapFixBlock(TC_cache_t *cache, int fileBlock, TC_latchMode_t mode, TC_fixedBlock_t *fixed)
+{
+    TC_mapping_t *mapping = &cache->mapping;
+    size_t end = blockOffset(cache, fileBlock) + cache->pageSize;
+    int latch = fileBlock % TC_MMAP_LATCHES;
+
+    while (end > __atomic_load_n(&mapping->size, __ATOMIC_ACQUIRE))
+    {
+        if (mode == TC_LATCH_SHARED)
+        {
+            fixed->cacheIndex = -1;
+            fixed->fileBlock = fileBlock;
+            fixed->mode = mode;
+            fixed->page = zeroPage;
+            return 0;
+        }
+        if (growMapping(cache, end) == -1)
+        {
+            perror("Error growing table file");
+            return -1;
+        }
+    }
+    if (mode == TC_LATCH_EXCLUSIVE) pthread_rwlock_wrlock(&mapping->latches[latch]);
+    else pthread_rwlock_rdlock(&mapping->latches[latch]);
+    fixed->cacheIndex = latch;
+    fixed->fileBlock = fileBlock;
+    fixed->mode = mode;
+    fixed->page = mapping->base + blockOffset(cache, fileBlock);
+    return 0;
+}
+
+/**
+ * Release a page fixed by mmapFixBlock(). Modified pages are written back
+ * by the kernel.
+ * @param cache
+ * @param fixed Handle of the fixed block
+ * @param dirty Unused
+ */
+static void mmapUnfixBlock(TC_cache_t *cache, TC_fixedBlock_t *fixed, int dirty)
+{
+    // Empty page beyond the end of the file
+    if (fixed->cacheIndex == -1) return;
+    pthread_rwlock_unlock(&cache->mapping.latches[fixed->cacheIndex]);
+}
+
+/**
+ * Write a page fixed in exclusive mode to file
+ * @param cache
+ * @param fixed Handle of the fixed block
+ * @return -1=error
+ */
+static int mmapWriteBlock(TC_cache_t *cache, TC_fixedBlock_t *fixed)
+{
+    return msync(fixed->page, cache->pageSize, MS_SYNC);
+}
+
+/**
+ * Ask the kernel to read pages of the file ahead
+ * @param cache
+ * @param firstFileBlock Index on file of the first block
+ * @param nBlocks Number of blocks
+ * @return Number of blocks whose read was started, -1=error
+ */
+static int mmapPrefetchBlocks(TC_cache_t *cache, int firstFileBlock, int nBlocks)
+{
+    TC_mapping_t *mapping = &cache->mapping;
+    size_t start = blockOffset(cache, firstFileBlock);
+    size_t length = (size_t) nBlocks * cache->pageSize;
+    size_t size = __atomic_load_n(&mapping->size, __ATOMIC_ACQUIRE);
+    int status;
+
+    if (start >= size) return 0;
+    if (start + length > size) length = size - start;
+    status = madvise(mapping->base + start, length, MADV_WILLNEED);
+    return status == -1 ? -1 : (int) (length / cache->pageSize);
+}
+
+/**
+ * Advise the kernel of the access pattern: read-ahead for scans, none for
+ * point lookups
+ * @param cache
+ * @param access
+ * @return -1=error
+ */
+static int mmapAdvise(TC_cache_t *cache, TC_access_t access)
+{
+    TC_mapping_t *mapping = &cache->mapping;
+    int status;
+
+    // So a growing mapping does not miss the new advice
+    pthread_mutex_lock(&mapping->grow);
+    mapping->access = access;
+    status = madvise(mapping->base, mapping->size, accessAdvice(access));
+    pthread_mutex_unlock(&mapping->grow);
+    return status;
+}
+
+/**
+ * Checkpoint: write every modified page and wait for it
+ * @param cache
+ * @return -1=error
+ */
+static int mmapFlush(TC_cache_t *cache)
+{
+    TC_mapping_t *mapping = &cache->mapping;
+
+    return msync(mapping->base, __atomic_load_n(&mapping->size, __ATOMIC_ACQUIRE), MS_SYNC);
+}
+
+/**
+ * Flush and unmap the table file
+ * @param cache
+ */
+static void mmapClose(TC_cache_t *cache)
+{
+    TC_mapping_t *mapping = &cache->mapping;
+    int i;
+
+    mmapFlush(cache);
+    // The file mapping and the rest of the reservation
+    munmap(mapping->base, mapping->reserved);
+    pthread_mutex_destroy(&mapping->grow);
+    for (i = 0; i < TC_MMAP_LATCHES; i++)
+        pthread_rwlock_destroy(&mapping->latches[i]);
+}
+
+/** Table file mapped into memory
+ */
+const TC_storageOps_t TC_mmapStorage = {
+    "memory-mapped file",
+    mmapOpen,
+    mmapFixBlock,
+    mmapUnfixBlock,
+    pageGetEntry,
+    pagePutEntry,
+    mmapWriteBlock,
+    pageReadEntry,
+    pageWriteEntry,
+    mmapPrefetchBlocks,
+    mmapAdvise,
+    mmapFlush,
+    mmapClose
+};
+
+#ifdef	__cplusplus
+}
+#endif
@@ -0,0 +1,198 @@
+/*
+ * File:   tablePage.c
+ *
+ * Slotted pages of the table file. A record holds the id and used fields
+ * of an entry followed by its text without the unused tail, so short texts
+ * take little room in the page.
+ */
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include "tablePage.h"
+
+// Bytes of a record before its text
+#define RECORD_HEADER_SIZE (2 * sizeof (uint64_t))
+
+/**
+ * Directory of a page
+ */
+#define pageSlots(page) ((TC_pageSlot_t *) ((char *) (page) + sizeof (TC_pageHeader_t)))
+/**
+ * First byte after the directory of a page
+ */
+#define directoryEnd(slotsPerPage) (sizeof (TC_pageHeader_t) + (slotsPerPage) * sizeof (TC_pageSlot_t))
+
+/**
+ * Validate the header page of a table file
+ * @param header
+ * @return 0 if the file can be used, -1 otherwise
+ */
+int TC_checkFileHeader(const TC_fileHeader_t *header)
+{
+    if (memcmp(header->magic, TC_FILE_MAGIC, sizeof (TC_FILE_MAGIC)) != 0) return -1;
+    if (header->version < 1 || header->version > TC_FILE_VERSION) return -1;
+    if (header->pageSize < TC_MIN_PAGE_SIZE || header->pageSize > TC_MAX_PAGE_SIZE) return -1;
+    // Page sizes are powers of two
+    if ((header->pageSize & (header->pageSize - 1)) != 0) return -1;
+    if (header->slotsPerPage < 1) return -1;
+    if (directoryEnd(header->slotsPerPage) + RECORD_HEADER_SIZE + TC_TEXT_SIZE > header->pageSize) return -1;
+    return 0;
+}
+
+/**
+ * Fill the header page of a new table file
+ * @param header
+ * @param pageSize Size of every page in bytes
+ * @param slotsPerPage Entries per data page
+ */
+void TC_initFileHeader(TC_fileHeader_t *header, int pageSize, int slotsPerPage)
+{
+    memset(header, 0, sizeof (TC_fileHeader_t));
+    memcpy(header->magic, TC_FILE_MAGIC, sizeof (TC_FILE_MAGIC));
+    header->version = TC_FILE_VERSION;
+    header->pageSize = pageSize;
+    header->slotsPerPage = slotsPerPage;
+}
+
+/**
+ * Number of entries per data page fitting records of a given size
+ * @param pageSize Size of every page in bytes
+ * @param recordSize Average size of the records in bytes
+ */
+int TC_slotsPerPage(int pageSize, int recordSize)
+{
+    return (pageSize - sizeof (TC_pageHeader_t)) / (sizeof (TC_pageSlot_t) + recordSize);
+}
+
+/**
+ * Copy an entry out of a page
+ * @param page
+ * @param pageSize Size of the page in bytes
+ * @param slotsPerPage Entries per data page
+ * @param slot Slot of the entry in the page
+ * @param entry Filled with the entry; zeroes if it was never written or
+ * was forwarded
+ * @return 1 if the entry was forwarded to the overflow file, 0 otherwise
+ */
+int TC_pageGetEntry(const void *page, int pageSize, int slotsPerPage, int slot, TC_tableEntry_t *entry)
+{
+    const TC_pageSlot_t *s = &pageSlots(page)[slot];
+    const char *record = (const char *) page + s->offset;
+
+    memset(entry, 0, sizeof (TC_tableEntry_t));
+    if (s->length == TC_SLOT_FORWARDED) return 1;
+    // Never written, or not a record written by TC_pagePutEntry()
+    if (s->length < RECORD_HEADER_SIZE || s->length > RECORD_HEADER_SIZE + TC_TEXT_SIZE) return 0;
+    memcpy(&entry->id, record, sizeof (uint64_t));
+    memcpy(&entry->used, record + sizeof (uint64_t), sizeof (uint64_t));
+    memcpy(entry->text, record + RECORD_HEADER_SIZE, s->length - RECORD_HEADER_SIZE);
+    return 0;
+}
+
+/**
+ * Bytes of the record of a slot in its page
+ */
+static int recordLength(const TC_pageSlot_t *s)
+{
+    return s->length == TC_SLOT_FORWARDED ? 0 : s->length;
+}
+
+/**
+ * Pack the records of a page at its end, dropping the garbage
+ */
+static void compactPage(void *page, int pageSize, int slotsPerPage)
+{
+    TC_pageHeader_t *header = page;
+    TC_pageSlot_t *slots = pageSlots(page);
+    char *copy = malloc(pageSize);
+    int end = pageSize;
+    int i;
+
+    memcpy(copy, page, pageSize);
+    for (i = 0; i < slotsPerPage; i++)
+    {
+        if (recordLength(&slots[i]) == 0) continue;
+        end -= slots[i].length;
+        memcpy((char *) page + end, copy + slots[i].offset, slots[i].length);
+        slots[i].offset = end;
+    }
+    header->recordStart = end;
+    header->garbage = 0;
+    free(copy);
+}
+
+/**
+ * Store an entry in a page, replacing the one in its slot
+ * @param page
+ * @param pageSize Size of the page in bytes
+ * @param slotsPerPage Entries per data page
+ * @param slot Slot of the entry in the page
+ * @param entry
+ * @return -1 with errno ENOSPC if the record does not fit in the page,
+ * which is left unchanged: the caller forwards the entry
+ */
+int TC_pagePutEntry(void *page, int pageSize, int slotsPerPage, int slot, const TC_tableEntry_t *entry)
+{
+    TC_pageHeader_t *header = page;
+    TC_pageSlot_t *s = &pageSlots(page)[slot];
+    int length = RECORD_HEADER_SIZE + strnlen(entry->text, TC_TEXT_SIZE);
+    int current = recordLength(s);
+    char *record;
+
+    if (header->recordStart == 0) header->recordStart = pageSize;
+    if (length > current)
+    {
+        int contiguous = header->recordStart - directoryEnd(slotsPerPage);
+        if (length > contiguous + (int) header->garbage + current)
+        {
+            errno = ENOSPC;
+            return -1;
+        }
+        // Drop the old record and take room below the lowest record
+        header->garbage += current;
+        s->length = 0;
+        if (length > contiguous) compactPage(page, pageSize, slotsPerPage);
+        header->recordStart -= length;
+        s->offset = header->recordStart;
+    }
+    else
+    {
+        // Shrink in place
+        header->garbage += current - length;
+    }
+    s->length = length;
+    record = (char *) page + s->offset;
+    memcpy(record, &entry->id, sizeof (uint64_t));
+    memcpy(record + sizeof (uint64_t), &entry->used, sizeof (uint64_t));
+    memcpy(record + RECORD_HEADER_SIZE, entry->text, length - RECORD_HEADER_SIZE);
+    return 0;
+}
+
+/**
+ * Mark the entry of a slot as moved to the overflow file, dropping its
+ * record from the page
+ * @param page
+ * @param pageSize Size of the page in bytes
+ * @param slotsPerPage Entries per data page
+ * @param slot Slot of the entry in the page
+ */
+void TC_pageForwardEntry(void *page, int pageSize, int slotsPerPage, int slot)
+{
+    TC_pageHeader_t *header = page;
+    TC_pageSlot_t *s = &pageSlots(page)[slot];
+
+    if (header->recordStart == 0) header->recordStart = pageSize;
+    header->garbage += recordLength(s);
+    s->offset = 0;
+    s->length = TC_SLOT_FORWARDED;
+}
+
+#ifdef	__cplusplus
+}
+#endif
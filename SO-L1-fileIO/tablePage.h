@@ -0,0 +1,84 @@
+/*
+ * File:   tablePage.h
+ *
+ * On-disk format of the table file. The file starts with a header page
+ * recording the format version and the page layout chosen when the table
+ * was created; data pages follow. Every data page is a slotted page: a
+ * directory of slotsPerPage slots after the page header and the records,
+ * of variable length, packed from the end of the page backwards.
+ * Entry i of the table lives in slot i % slotsPerPage of data page
+ * i / slotsPerPage. A page of zeroes is a valid page with empty slots.
+ * The number of slots is derived from an average record size, so a page
+ * can run out of room for long texts: an entry that does not fit is moved
+ * to the overflow file, at i * TC_ENTRY_SIZE, and its slot is marked as
+ * forwarded.
+ */
+
+#ifndef TABLEPAGE_H
+#define	TABLEPAGE_H
+
+#include <stdint.h>
+#include "parameters.h"
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+// Identifies a table file
+#define TC_FILE_MAGIC "SODBTBL"
+
+// Version of the on-disk format written by this code (1 had no forwarded
+// slots, it is read as it is)
+#define TC_FILE_VERSION 2
+
+// Entries moved out of their pages, one full entry per index of the table
+#define TC_OVERFLOW_FILENAME TC_FILENAME ".ovf"
+
+// Length of a slot whose entry lives in the overflow file
+#define TC_SLOT_FORWARDED 0xFFFF
+
+/** Header page at the start of the table file
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    // Size of every page of the file in bytes, header page included
+    uint32_t pageSize;
+    // Number of entries stored in every data page
+    uint32_t slotsPerPage;
+} TC_fileHeader_t;
+
+/** Header at the start of every data page
+ */
+typedef struct
+{
+    // Offset of the lowest record of the page, 0 for an empty page
+    uint32_t recordStart;
+    // Bytes of the record area left unused by shrunk or dropped records
+    uint32_t garbage;
+} TC_pageHeader_t;
+
+/** Slot of the page directory locating an entry
+ */
+typedef struct
+{
+    uint16_t offset;
+    // Bytes of the record, 0 if the entry was never written,
+    // TC_SLOT_FORWARDED if it was moved to the overflow file
+    uint16_t length;
+} TC_pageSlot_t;
+
+int TC_checkFileHeader(const TC_fileHeader_t *header);
+void TC_initFileHeader(TC_fileHeader_t *header, int pageSize, int slotsPerPage);
+int TC_slotsPerPage(int pageSize, int recordSize);
+int TC_pageGetEntry(const void *page, int pageSize, int slotsPerPage, int slot, TC_tableEntry_t *entry);
+int TC_pagePutEntry(void *page, int pageSize, int slotsPerPage, int slot, const TC_tableEntry_t *entry);
+void TC_pageForwardEntry(void *page, int pageSize, int slotsPerPage, int slot);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* TABLEPAGE_H */
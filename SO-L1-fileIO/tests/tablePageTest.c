@@ -0,0 +1,319 @@
+/*
+ * File:   tablePageTest.c
+ *
+ * Tests of the slotted pages of the table file: short records pack more
+ * entries per page than fixed size entries, every entry with the longest
+ * text is stored, in its page or forwarded, and pages fixed stay usable
+ * while the file grows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tableDB.h"
+#include "tablePage.h"
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+// Entries written through the table, several pages of them
+#define N_ENTRIES 1000
+
+static int failed = 0;
+
+static void fail(const char *test, const char *message, int index)
+{
+    printf("%%TEST_FAILED%% time=0 testname=%s (tablePageTest) message=%s at %d\n", test, message, index);
+    failed = 1;
+}
+
+/**
+ * Fill an entry with a text of the full width of the field
+ */
+static void fullWidthEntry(int index, TC_tableEntry_t *entry)
+{
+    memset(entry, 0, sizeof (*entry));
+    entry->id = index;
+    entry->used = 1;
+    memset(entry->text, 'a' + index % 26, TC_TEXT_SIZE - 1);
+}
+
+/**
+ * Fill an entry with a text of a few characters
+ */
+static void shortEntry(int index, TC_tableEntry_t *entry)
+{
+    memset(entry, 0, sizeof (*entry));
+    entry->id = index;
+    entry->used = 1;
+    snprintf(entry->text, TC_TEXT_SIZE, "e%d", index);
+}
+
+/**
+ * Remove the files of the table
+ */
+static void removeTable()
+{
+    unlink(TC_FILENAME);
+    unlink(TC_OVERFLOW_FILENAME);
+}
+
+static void testPageFullWidth()
+{
+    int pageSize = TC_DEFAULT_PAGE_SIZE;
+    int slotsPerPage = TC_slotsPerPage(pageSize, TC_ENTRY_SIZE);
+    char *page = calloc(1, pageSize);
+    TC_tableEntry_t entry, read;
+    int i;
+
+    for (i = 0; i < slotsPerPage; i++)
+    {
+        fullWidthEntry(i, &entry);
+        if (TC_pagePutEntry(page, pageSize, slotsPerPage, i, &entry) == -1) fail("testPageFullWidth", "put failed", i);
+    }
+    // Shrink every other record and grow it back, so the page has to be compacted
+    for (i = 0; i < slotsPerPage; i += 2)
+    {
+        fullWidthEntry(i, &entry);
+        entry.text[1] = '\0';
+        if (TC_pagePutEntry(page, pageSize, slotsPerPage, i, &entry) == -1) fail("testPageFullWidth", "shrink failed", i);
+    }
+    for (i = 0; i < slotsPerPage; i += 2)
+    {
+        fullWidthEntry(i, &entry);
+        if (TC_pagePutEntry(page, pageSize, slotsPerPage, i, &entry) == -1) fail("testPageFullWidth", "regrow failed", i);
+    }
+    for (i = 0; i < slotsPerPage; i++)
+    {
+        fullWidthEntry(i, &entry);
+        TC_pageGetEntry(page, pageSize, slotsPerPage, i, &read);
+        if (memcmp(&entry, &read, sizeof (entry)) != 0) fail("testPageFullWidth", "wrong entry", i);
+    }
+    free(page);
+}
+
+static void testPageForward()
+{
+    int pageSize = TC_DEFAULT_PAGE_SIZE;
+    int slotsPerPage = TC_slotsPerPage(pageSize, TC_EXPECTED_RECORD_SIZE);
+    char *page = calloc(1, pageSize);
+    TC_tableEntry_t entry, read;
+    int i, forwarded = 0;
+
+    for (i = 0; i < slotsPerPage; i++)
+    {
+        fullWidthEntry(i, &entry);
+        if (TC_pagePutEntry(page, pageSize, slotsPerPage, i, &entry) == -1)
+        {
+            TC_pageForwardEntry(page, pageSize, slotsPerPage, i);
+            forwarded++;
+        }
+    }
+    if (forwarded == 0) fail("testPageForward", "no entry forwarded", slotsPerPage);
+    for (i = 0; i < slotsPerPage; i++)
+    {
+        fullWidthEntry(i, &entry);
+        if (TC_pageGetEntry(page, pageSize, slotsPerPage, i, &read) == 0 && memcmp(&entry, &read, sizeof (entry)) != 0)
+            fail("testPageForward", "wrong entry", i);
+    }
+    // Shrinking the entries in the page makes room for the forwarded ones
+    for (i = 0; i < slotsPerPage; i++)
+    {
+        shortEntry(i, &entry);
+        if (TC_pagePutEntry(page, pageSize, slotsPerPage, i, &entry) == -1) fail("testPageForward", "short put failed", i);
+    }
+    for (i = 0; i < slotsPerPage; i++)
+    {
+        shortEntry(i, &entry);
+        if (TC_pageGetEntry(page, pageSize, slotsPerPage, i, &read) != 0 || memcmp(&entry, &read, sizeof (entry)) != 0)
+            fail("testPageForward", "short entry not in the page", i);
+    }
+    free(page);
+}
+
+static void testTableShortRecords()
+{
+    TC_tableOptions_t options;
+    TC_tableEntry_t entry, read;
+    TC_fileHeader_t header;
+    struct stat st;
+    FILE *file;
+    int i;
+
+    removeTable();
+    TC_defaultOptions(&options);
+    if (TC_openTableWithOptions(&options) == -1)
+    {
+        fail("testTableShortRecords", "open failed", 0);
+        return;
+    }
+    for (i = 0; i < N_ENTRIES; i++)
+    {
+        shortEntry(i, &entry);
+        if (TC_writeEntryAsync(i, &entry) == -1) fail("testTableShortRecords", "write failed", i);
+    }
+    TC_closeTable();
+
+    file = fopen(TC_FILENAME, "rb");
+    if (file == NULL || fread(&header, sizeof (header), 1, file) != 1)
+    {
+        fail("testTableShortRecords", "header not read", 0);
+    }
+    else
+    {
+        if (header.slotsPerPage <= header.pageSize / TC_ENTRY_SIZE)
+            fail("testTableShortRecords", "no more entries per page than fixed size entries", header.slotsPerPage);
+        if (stat(TC_FILENAME, &st) == -1 || st.st_size >= (off_t) N_ENTRIES * TC_ENTRY_SIZE)
+            fail("testTableShortRecords", "file not smaller than fixed size entries", (int) st.st_size);
+        if (stat(TC_OVERFLOW_FILENAME, &st) == -1 || st.st_size != 0)
+            fail("testTableShortRecords", "short entries forwarded", (int) st.st_size);
+    }
+    if (file != NULL) fclose(file);
+
+    if (TC_openTableWithOptions(&options) == -1)
+    {
+        fail("testTableShortRecords", "reopen failed", 0);
+        return;
+    }
+    for (i = 0; i < N_ENTRIES; i++)
+    {
+        shortEntry(i, &entry);
+        if (TC_readEntry(i, &read) == -1 || memcmp(&entry, &read, sizeof (entry)) != 0)
+            fail("testTableShortRecords", "wrong entry", i);
+    }
+    TC_closeTable();
+    removeTable();
+}
+
+static void testTableFullWidth(TC_storage_t storage)
+{
+    TC_tableOptions_t options;
+    TC_tableEntry_t entry, read;
+    struct stat st;
+    int i;
+
+    removeTable();
+    TC_defaultOptions(&options);
+    options.storage = storage;
+    if (TC_openTableWithOptions(&options) == -1)
+    {
+        fail("testTableFullWidth", "open failed", 0);
+        return;
+    }
+    for (i = 0; i < N_ENTRIES; i++)
+    {
+        fullWidthEntry(i, &entry);
+        if (TC_writeEntrySync(i, &entry) == -1) fail("testTableFullWidth", "write failed", i);
+    }
+    TC_closeTable();
+    // Pages sized for short records cannot hold every full-width entry
+    if (stat(TC_OVERFLOW_FILENAME, &st) == -1 || st.st_size == 0) fail("testTableFullWidth", "no entry forwarded", 0);
+
+    if (TC_openTableWithOptions(&options) == -1)
+    {
+        fail("testTableFullWidth", "reopen failed", 0);
+        return;
+    }
+    for (i = 0; i < N_ENTRIES; i++)
+    {
+        fullWidthEntry(i, &entry);
+        if (TC_readEntry(i, &read) == -1 || memcmp(&entry, &read, sizeof (entry)) != 0)
+            fail("testTableFullWidth", "wrong entry", i);
+    }
+    TC_closeTable();
+    removeTable();
+}
+
+static void testMmapGrowWhileFixed()
+{
+    TC_tableOptions_t options;
+    TC_tableEntry_t entry, read;
+    TC_fixedBlock_t first, last;
+    // Past the first growth of the mapping, with a latch other than block 0's
+    int lastBlock = 2 * TC_MMAP_MIN_GROWTH / TC_DEFAULT_PAGE_SIZE + 1;
+
+    removeTable();
+    TC_defaultOptions(&options);
+    options.storage = TC_STORAGE_MMAP;
+    if (TC_openTableWithOptions(&options) == -1)
+    {
+        fail("testMmapGrowWhileFixed", "open failed", 0);
+        return;
+    }
+    fullWidthEntry(0, &entry);
+    TC_writeEntrySync(0, &entry);
+    // A deadlock ends the test
+    alarm(10);
+    if (TC_fixBlock(0, TC_LATCH_SHARED, &first) == -1)
+    {
+        fail("testMmapGrowWhileFixed", "fix failed", 0);
+    }
+    else
+    {
+        if (TC_fixBlock(lastBlock, TC_LATCH_EXCLUSIVE, &last) == -1)
+        {
+            fail("testMmapGrowWhileFixed", "fix past the end failed", lastBlock);
+        }
+        else
+        {
+            if (TC_putEntry(&last, 0, &entry) == -1) fail("testMmapGrowWhileFixed", "put failed", lastBlock);
+            TC_unfixBlock(&last, 1);
+        }
+        // The page fixed before the growth is still in place
+        TC_getEntry(&first, 0, &read);
+        if (memcmp(&entry, &read, sizeof (entry)) != 0) fail("testMmapGrowWhileFixed", "wrong entry", 0);
+        TC_unfixBlock(&first, 0);
+    }
+    alarm(0);
+    TC_closeTable();
+    removeTable();
+}
+
+int main(int argc, char** argv)
+{
+    char dir[] = "/tmp/tablePageTestXXXXXX";
+
+    // The table file is created in the working directory
+    if (mkdtemp(dir) == NULL || chdir(dir) == -1)
+    {
+        perror("tablePageTest");
+        return (EXIT_FAILURE);
+    }
+
+    printf("%%SUITE_STARTING%% tablePageTest\n");
+    printf("%%SUITE_STARTED%%\n");
+
+    printf("%%TEST_STARTED%% testPageFullWidth (tablePageTest)\n");
+    testPageFullWidth();
+    printf("%%TEST_FINISHED%% time=0 testPageFullWidth (tablePageTest)\n");
+
+    printf("%%TEST_STARTED%% testPageForward (tablePageTest)\n");
+    testPageForward();
+    printf("%%TEST_FINISHED%% time=0 testPageForward (tablePageTest)\n");
+
+    printf("%%TEST_STARTED%% testTableShortRecords (tablePageTest)\n");
+    testTableShortRecords();
+    printf("%%TEST_FINISHED%% time=0 testTableShortRecords (tablePageTest)\n");
+
+    printf("%%TEST_STARTED%% testTableFullWidth (tablePageTest)\n");
+    testTableFullWidth(TC_STORAGE_CACHE);
+    testTableFullWidth(TC_STORAGE_MMAP);
+    printf("%%TEST_FINISHED%% time=0 testTableFullWidth (tablePageTest)\n");
+
+    printf("%%TEST_STARTED%% testMmapGrowWhileFixed (tablePageTest)\n");
+    testMmapGrowWhileFixed();
+    printf("%%TEST_FINISHED%% time=0 testMmapGrowWhileFixed (tablePageTest)\n");
+
+    printf("%%SUITE_FINISHED%% time=0\n");
+
+    rmdir(dir);
+    return failed ? (EXIT_FAILURE) : (EXIT_SUCCESS);
+}
+
+#ifdef	__cplusplus
+}
+#endif
@@ -0,0 +1,111 @@
+#ifndef SQL_LEXER_H_
+#define SQL_LEXER_H_
+
+#include <stdbool.h>
+#include "table.h"
+
+/*
+ * Single-pass tokenizer for the SQL subset of SQL_parser.h
+ *
+ * The lexer scans the query once, from left to right, producing one token
+ * at a time on demand. Tokens don't copy anything: they hold the offset and
+ * length of their text in the original query string, which is never modified.
+ * Words are classified as keywords while they are scanned, so the parser can
+ * dispatch on the first keyword without trying every statement in turn.
+ */
+
+typedef enum
+{
+	TOKEN_END, // end of the query
+	TOKEN_WORD,
+	TOKEN_NUMBER,
+	TOKEN_STRING, // text in single quotes, quotes included
+	TOKEN_STAR,
+	TOKEN_COMMA,
+	TOKEN_LPAREN,
+	TOKEN_RPAREN,
+	TOKEN_PLUS,
+	TOKEN_MINUS,
+	TOKEN_SLASH,
+	TOKEN_PARAM,  // ? placeholder of a prepared query
+	TOKEN_ASSIGN, // =
+	TOKEN_EQUAL,  // ==
+	TOKEN_LOWER,
+	TOKEN_LOWER_OR_EQUAL,
+	TOKEN_GREATER,
+	TOKEN_GREATER_OR_EQUAL,
+	TOKEN_INVALID
+} TokenType;
+
+typedef enum
+{
+	KW_NONE, // a word that isn't a keyword, e.g. a field name
+	KW_SELECT,
+	KW_INSERT,
+	KW_DELETE,
+	KW_UPDATE,
+	KW_SET,
+	KW_WHERE,
+	KW_PREPARE,
+	KW_EXECUTE,
+	KW_AS,
+	KW_AND,
+	KW_OR,
+	KW_NOT,
+	KW_COUNT,
+	KW_SUM,
+	KW_AVG,
+	KW_MIN,
+	KW_MAX,
+	KW_GROUP,
+	KW_BY,
+	KW_ORDER,
+	KW_ASC,
+	KW_DESC,
+	KW_LIMIT,
+	KW_OFFSET,
+	KW_VALUES
+} Keyword;
+
+typedef struct
+{
+	TokenType type;
+	Keyword keyword; // only for TOKEN_WORD
+	int start;		 // offset of the token text in the query
+	int len;
+} Token;
+
+typedef struct
+{
+	const char *sql;
+	int pos;	   // offset of the first character not scanned yet
+	Token current; // lookahead token
+} Lexer;
+
+// start scanning sql, the first token becomes the current one
+void lexer_init(Lexer *lexer, const char *sql);
+
+// scan the next token into current
+void lexer_advance(Lexer *lexer);
+
+// if the current token has the given type, consume it and return true
+bool lexer_accept(Lexer *lexer, TokenType type);
+
+// if the current token is the given keyword, consume it and return true
+bool lexer_accept_keyword(Lexer *lexer, Keyword keyword);
+
+// first character of the text of a token
+#define TOKEN_TEXT(lexer, token) ((lexer)->sql + (token)->start)
+
+// if the token is a field name, store its id and return true
+bool token_to_field(const Lexer *lexer, const Token *token, FieldId *field);
+
+/*
+ * Numeric literals are converted straight from the query text, without copies.
+ * The sign is a separate TOKEN_MINUS and is passed as negative.
+ * They return false if the token isn't a literal of the type or its value overflows.
+ */
+bool token_to_int(const Lexer *lexer, const Token *token, bool negative, int *val);
+bool token_to_double(const Lexer *lexer, const Token *token, bool negative, double *val);
+
+#endif /* SQL_LEXER_H_ */
@@ -2,6 +2,7 @@
 #define SQL_PARSER_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "table.h"
 
 /*
@@ -15,22 +16,55 @@
  * 
  * --- SQL commands ---
  * 
- * SELECT * [WHERE <field_name> <= >= < > == <value> ]
+ * SELECT * | <field_name>[, <field_name>...] [WHERE <field_name> <= >= < > == <value> ]
  * for example: 
  *      SELECT *    // selects the whole table
  *      SELECT * WHERE age >= 18     // get all adults    
+ *      SELECT id, name WHERE age >= 18     // only ids and names of all adults
  * 
- * INSERT VALUE(<id>,<age>,<height>,'<name>')
+ * The columns of a SELECT may instead all be aggregates: COUNT(*), COUNT(<field_name>),
+ * SUM, AVG, MIN or MAX(<field_name>), then the result is a single row
+ * for example:
+ *      SELECT COUNT(*), AVG(height) WHERE age >= 18
+ * 
+ * GROUP BY <field_name> after the WHERE gives a row of aggregates for every value of
+ * the field; the field itself may be a column too
+ * for example:
+ *      SELECT age, AVG(height) GROUP BY age
+ * 
+ * A SELECT without aggregates may end with ORDER BY <field_name> [ASC|DESC] and/or
+ * LIMIT <n> [OFFSET <m>]
+ * for example:
+ *      SELECT name, height ORDER BY height DESC LIMIT 10    // the 10 tallest
+ * 
+ * Every WHERE takes a predicate: comparisons combined with AND, OR, NOT and parentheses,
+ * AND binding tighter than OR
+ * for example:
+ *      SELECT * WHERE age >= 18 AND (name == 'Joe' OR NOT height < 170)
+ * 
+ * INSERT [VALUES] (<id>,<age>,<height>,'<name>')[, (...)...]
  * for example:
  *      INSERT(2, 21, 180.23, 'Joe Brown')
+ *      INSERT VALUES (2, 21, 180.23, 'Joe Brown'), (3, 35, 175.5, 'Ann Smith')
  * 
  * DELETE WHERE <field_name> <= >= < > == <value>
  * for example:
  *      DELETE WHERE id == 2
  * 
- * UPDATE SET field=value WHERE <field_name> <= >= < > == <value>
+ * UPDATE SET <field_name>=<value>[, <field_name>=<value>...] WHERE <predicate>
  * for example:
  *      UPDATE SET height=183.3 WHERE id == 15    // update record number 15
+ * The value of a numeric field may be an expression with + - * / and parentheses
+ * over literals and the numeric fields of the record, which hold their values
+ * from before the update
+ * for example:
+ *      UPDATE SET age=age+1, height=height*1.1 WHERE age < 18
+ * 
+ * PREPARE <name> AS <statement with ? in place of values>
+ * EXECUTE <name>(<value>, ...)
+ * for example:
+ *      PREPARE ins AS INSERT(?, ?, ?, ?)
+ *      EXECUTE ins(2, 21, 180.23, 'Joe Brown')
  * 
  * 
  * 
@@ -67,27 +101,139 @@ typedef struct
     FieldVal fieldVal;
 } Constraint;
 
+#define MAX_CONSTRAINTS 8
+#define MAX_PREDICATE_NODES 16
+
+typedef enum
+{
+    PREDICATE_CONSTRAINT,
+    PREDICATE_AND,
+    PREDICATE_OR,
+    PREDICATE_NOT
+} PredicateOp;
+
+/*
+ * Node of a predicate tree. Nodes refer to each other by their index in the
+ * predicate, so a predicate has no pointers and can be copied into a message.
+ */
 typedef struct
 {
-    bool all;
-    Constraint constraint;
+    signed char op;
+    signed char arg;  // index of the constraint, or of the first child
+    signed char next; // index of the next child of the parent, -1 for the last
+} PredicateNode;
+
+/*
+ * Predicate of a WHERE clause. AND and OR nodes take any number of children,
+ * which the parser orders by estimated selectivity and cost so that evaluation,
+ * which stops at the first child deciding the result, does the least work.
+ */
+typedef struct
+{
+    signed char root; // -1 for no predicate, satisfied by every record
+    signed char num_nodes;
+    signed char num_constraints;
+    PredicateNode nodes[MAX_PREDICATE_NODES];
+    Constraint constraints[MAX_CONSTRAINTS];
+} Predicate;
+
+#define MAX_COLUMNS 8
+
+typedef enum
+{
+    AGG_NONE, // the value of the field
+    AGG_COUNT,
+    AGG_SUM,
+    AGG_AVG,
+    AGG_MIN,
+    AGG_MAX
+} Aggregate;
+
+typedef struct
+{
+    Aggregate aggregate;
+    FieldId field; // ID for COUNT(*)
+} Column;
+
+typedef struct
+{
+    bool all; // no WHERE
+    Predicate where;
+    // columns of the result, in order; * stands for all of them in the order of T_Record
+    int num_columns;
+    Column columns[MAX_COLUMNS];
+    bool aggregate; // rows of the result aggregate records, all columns but group_by are aggregates
+    bool grouped;
+    FieldId group_by;
+    bool ordered;
+    FieldId order_by;
+    bool descending;
+    bool limited;
+    int limit;
+    int offset; // rows skipped, 0 without OFFSET
 } Select_Query;
 
+#define MAX_INSERT_RECORDS 32
+
 typedef struct
 {
-    T_Record record;
+    int num_records;
+    T_Record records[MAX_INSERT_RECORDS];
 } Insert_Query;
 
 typedef struct
 {
-    Constraint constraint;
+    Predicate where;
 } Delete_Query;
 
+#define MAX_ASSIGNMENTS 4 // every field at most once
+#define MAX_EXPRESSION_NODES 16
+
+typedef enum
+{
+    EXPRESSION_VALUE,
+    EXPRESSION_FIELD,
+    EXPRESSION_ADD,
+    EXPRESSION_SUBTRACT,
+    EXPRESSION_MULTIPLY,
+    EXPRESSION_DIVIDE
+} ExpressionOp;
+
+/*
+ * Node of the expression of an assignment. Like the nodes of a predicate, they
+ * refer to their operands by index, so the query has no pointers.
+ */
+typedef struct
+{
+    signed char op;
+    signed char left;  // operands of an arithmetic node
+    signed char right;
+    FieldId field;     // of EXPRESSION_FIELD
+    union {
+        int i;
+        double d;
+    } value;           // of EXPRESSION_VALUE, in the type of the assigned field
+} ExpressionNode;
+
+/*
+ * An expression is computed in the type of the field it is assigned to: in ints,
+ * where / truncates, for ID and AGE, which only take int literals, and in doubles
+ * for HEIGHT. NAME takes a string instead.
+ */
 typedef struct
 {
     FieldId fieldId;
-    FieldVal val;
-    Constraint constraint;
+    signed char expression; // root node, -1 for NAME
+} Assignment;
+
+typedef struct
+{
+    int num_assignments;
+    Assignment assignments[MAX_ASSIGNMENTS];
+    char name[MAX_STR_LEN]; // value of the NAME assignment
+    signed char num_nodes;
+    ExpressionNode nodes[MAX_EXPRESSION_NODES];
+    Predicate where;
 } Update_Query;
 
 
@@ -121,12 +267,14 @@ typedef struct
  * bool parse_{select, insert, update, delete} methods take sql_srt and pointer to allocated query
  * structure. They try to parse the SQL request, and:
  *  - if parsing is successful, SQL_Query structure is filled with the parsed data and true is returned.
- *  - if parsing fails, false is returned and the struct is left unchanged
+ *  - if parsing fails, false is returned and the content of the struct is undefined
+ * The SQL string is never modified.
  * 
+ * parse_SQL scans the query once with the lexer of SQL_lexer.h and picks the statement
+ * from its first keyword, instead of trying every parse_* method in turn.
 */
 
-// subroutine used by parse_{select, insert, delete, update}
-// parses the part "WHERE age >= 10"
+// parses a single comparison "WHERE age >= 10"
 bool parse_constraint(char *constraint_str, Constraint *c);
 
 bool parse_select(char *sql_str, Select_Query *query);
@@ -136,4 +284,67 @@ bool parse_update(char *sql_str, Update_Query *query);
 
 bool parse_SQL(char *sql_str, SQL_Query *query);
 
+/*
+ * --- Prepared statements ---
+ * A prepared query is a parsed query with "?" placeholders in place of some values.
+ * Each placeholder is a parameter, which records the type of its value and the offset
+ * of the value in the query, so executing a prepared query only parses the values
+ * and copies them into a copy of the query.
+ */
+
+#define MAX_PARAMS 16
+#define MAX_STATEMENT_NAME 32
+#define MAX_PREPARED 16
+
+typedef enum
+{
+    PARAM_INT,
+    PARAM_COUNT, // an int that can't be negative
+    PARAM_DOUBLE,
+    PARAM_STRING
+} ParamType;
+
+typedef struct
+{
+    ParamType type;
+    size_t offset; // of the value in SQL_Query
+} Param;
+
+typedef struct
+{
+    SQL_Query query; // the values of the parameters are undefined
+    int num_params;
+    Param params[MAX_PARAMS];
+} Prepared_Query;
+
+typedef struct
+{
+    char name[MAX_STATEMENT_NAME];
+    Prepared_Query prepared;
+} Prepared_Statement;
+
+// statements prepared on a client connection
+typedef struct
+{
+    int count;
+    Prepared_Statement statements[MAX_PREPARED];
+} Prepared_Statements;
+
+typedef enum
+{
+    PARSE_FAILED,
+    PARSE_QUERY,    // query is filled
+    PARSE_PREPARED  // a statement was prepared, there is no query to run
+} Parse_Result;
+
+// parses a statement that may contain placeholders
+bool parse_prepared(char *sql_str, Prepared_Query *prepared);
+
+/*
+ * parse_session_SQL parses a line of a client connection: PREPARE stores the named
+ * statement into statements, replacing the one of the same name, EXECUTE binds the
+ * values to a stored statement, and any other query is parsed as in parse_SQL.
+ */
+Parse_Result parse_session_SQL(char *sql_str, Prepared_Statements *statements, SQL_Query *query);
+
 #endif /* SQL_PARSER_H_ */
@@ -0,0 +1,32 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "SQL_parser.h"
+#include "table.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Running state of the columns of an aggregate query, one per column.
+ * Records are added one at a time while scanning; partial states of
+ * separate scans of the same query can be merged into one.
+ */
+typedef struct
+{
+    long count;         // records added
+    long long int_sum;  // SUM and AVG of ID and AGE
+    double double_sum;  // SUM and AVG of HEIGHT
+    FieldVal value;     // MIN or MAX so far, or the field of the first record for AGG_NONE
+} Aggregate_State;
+
+void aggregate_init(Aggregate_State *states, Select_Query *query);
+void aggregate_add(Aggregate_State *states, Select_Query *query, T_Record *rec);
+void aggregate_merge(Aggregate_State *states, Aggregate_State *partial, Select_Query *query);
+
+/*
+ * Appends the result row to str, columns separated by ';'
+ * Returns false and leaves str unchanged if the row doesn't fit in size
+ */
+bool aggregate_to_str(Aggregate_State *states, Select_Query *query, char *str, size_t size, size_t *len);
+
+#endif
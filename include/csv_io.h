@@ -0,0 +1,48 @@
+#ifndef CSV_IO_H
+#define CSV_IO_H
+
+#include "table.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Bulk load and dump of the table with CSV files, one record per line:
+ * id,age,height,name
+ *
+ * Both run as a client of a running transaction manager, which owns the table,
+ * and skip the protocol engine: queries are sent as parsed messages straight to
+ * the query queue. The work is split among one thread per CPU, each with its own
+ * results queue, so several batches are in the transaction manager at a time.
+ *
+ * Import maps the file and gives every thread a chunk of whole lines, which it
+ * parses into multi-row INSERTs. Rows of the same id in different chunks may be
+ * written in any order.
+ *
+ * Export gives every thread a range of ids, which it reads with SELECTs; the
+ * chunks are written to the file in id order.
+ *
+ * Both return 0 on success, print the counts of records, and errors to stderr.
+ */
+int csv_import(const char *path);
+int csv_export(const char *path);
+
+// first byte of a line at or after pos, where a chunk of the file starts
+size_t csv_line_start(const char *data, size_t size, size_t pos);
+
+/*
+ * Returns the end of the line at *p, without its new line, and moves *p to the
+ * next one. The last line of a chunk may have no new line.
+ */
+const char *csv_next_line(const char **p, const char *end);
+
+// parses a line without its new line, the name is the rest of the line
+bool csv_parse_record(const char *line, const char *end, T_Record *rec);
+
+/*
+ * Writes the lines of a SELECT result to out as CSV lines, out holds at least
+ * strlen(result) bytes. Returns the bytes written, adds the lines to num_lines
+ * and sets last_id to the id of the last one (unchanged if there is none).
+ */
+size_t csv_from_result(const char *result, char *out, long *num_lines, int *last_id);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include "SQL_parser.h"
+#include "table.h"
+#include <stdbool.h>
+
+/*
+ * Applies the assignments of an UPDATE to a record. Every expression sees the
+ * values of the record from before the update, then all the new values are stored.
+ * Returns false and leaves the record unchanged if an expression divides by zero
+ * or its value doesn't fit the field, or if the id changes: records are stored at
+ * the position of their id, so an update can't move them.
+ */
+bool apply_assignments(Update_Query *query, T_Record *rec);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef GROUP_BY_H
+#define GROUP_BY_H
+
+#include "aggregate.h"
+#include "SQL_parser.h"
+#include "table.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * Hash aggregation for GROUP BY
+ *
+ * Records are added to an open addressing hash table of groups keyed by the value
+ * of the grouped field, linear probing. The table grows up to the memory budget;
+ * when a new group doesn't fit anymore, the groups are sorted by key and appended
+ * to a temporary file as a sorted run, and the table starts over empty. The result
+ * merges the runs, combining the partial aggregates of equal keys, so the groups
+ * always come out ordered by key. The runs are read back in batches that share
+ * the memory budget. Tables filled by separate threads are merged the same way,
+ * the sorted groups of a table that never spilled being one more run.
+ */
+
+#define GROUP_MEMORY_BUDGET (1 << 20)
+
+typedef struct
+{
+    bool used;
+    uint64_t hash;
+    FieldVal key;
+    Aggregate_State states[MAX_COLUMNS];
+} Group;
+
+// groups spilled to the temporary file, sorted by key
+typedef struct
+{
+    off_t start; // offset in the file
+    size_t count;
+} Group_Run;
+
+typedef struct
+{
+    Select_Query *query;
+    size_t memory_budget;
+    size_t max_capacity; // largest table within the memory budget
+    Group *groups;
+    size_t capacity; // power of two
+    size_t count;
+    FILE *spill_file; // created by the first spill
+    off_t spill_size;
+    Group_Run *runs;
+    int num_runs;
+} Group_Table;
+
+void group_table_init(Group_Table *table, Select_Query *query, size_t memory_budget);
+void group_table_add(Group_Table *table, T_Record *rec);
+
+/*
+ * Appends a row for every group to str, ordered by key, as many as fit in size
+ * The table is emptied.
+ */
+void group_table_to_str(Group_Table *table, char *str, size_t size, size_t *len);
+
+/*
+ * Same for the groups of several tables of the same query, e.g. filled by separate
+ * threads, with the partial aggregates of equal keys combined. The tables are emptied.
+ */
+void group_tables_to_str(Group_Table *tables, int num_tables, char *str, size_t size, size_t *len);
+
+void group_table_destroy(Group_Table *table);
+
+#endif
@@ -25,10 +25,27 @@ void open_table();
 
 
 
+bool valid_register_id(int id);
+
 T_PersistRecord* access_register_read(int id);
 T_PersistRecord* access_register_write(int id);
 void release_register(int id);
 
+/*
+ * Write-lock the records of a batch in one step. ids is sorted in place and
+ * every id is locked once, in increasing order, so that concurrent batches
+ * can't deadlock. Returns the number of distinct ids, left at the start of ids,
+ * which release_registers takes.
+ */
+int access_registers_write(int *ids, int count);
+void release_registers(int *ids, int count);
+
+/*
+ * Record of the id, without locking it
+ * The caller must hold its lock.
+ */
+T_PersistRecord* get_register(int id);
+
 /*
  * Move to the next used record 
  * When id=-1 is given, return first record
@@ -36,4 +53,10 @@ void release_register(int id);
  */
 T_PersistRecord* get_next_record(int id, bool write_lock);
 
+/*
+ * Like get_next_record, within the slots [first, end)
+ * When id=-1 is given, return the first record of the slots
+ */
+T_PersistRecord* get_next_record_in(int id, int first, int end, bool write_lock);
+
 #endif // IN_MEMORY_DB_H
\ No newline at end of file
@@ -0,0 +1,36 @@
+#ifndef ORDER_BY_H
+#define ORDER_BY_H
+
+#include "SQL_parser.h"
+#include "table.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Sorts the records of a SELECT with ORDER BY
+ *
+ * With a LIMIT only the first offset + limit records of the order can be part of
+ * the result, so the sorter keeps at most that many: a heap with the last of them
+ * at the top, which every better record replaces. Without a LIMIT every record is
+ * kept and sorted at the end. Either way the records are allocated as they come.
+ */
+typedef struct
+{
+    FieldId field;
+    bool descending;
+    bool bounded;
+    size_t bound; // records kept at most if bounded, offset + limit
+    size_t capacity; // records that fit in records
+    size_t count;
+    T_Record *records;
+} Sorter;
+
+void sorter_init(Sorter *sorter, Select_Query *query);
+void sorter_add(Sorter *sorter, T_Record *rec);
+
+// sorts the records kept, returns them in the order of the query
+T_Record *sorter_finish(Sorter *sorter, size_t *count);
+
+void sorter_destroy(Sorter *sorter);
+
+#endif
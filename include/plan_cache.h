@@ -0,0 +1,60 @@
+#ifndef PLAN_CACHE_H_
+#define PLAN_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "SQL_parser.h"
+
+/*
+ * Cache of parsed query shapes of a client connection
+ *
+ * Clients send few distinct query shapes with varying literals. Every line is
+ * fingerprinted by a single scan with the lexer: the tokens are joined by single
+ * spaces and every literal (number, negative number or string) becomes a "?".
+ * The fingerprint is looked up in a bounded LRU cache of prepared queries; a hit
+ * only binds the literals of the line to the parameters of the cached query,
+ * a miss parses the fingerprint as a prepared query and caches it.
+ *
+ * PREPARE and EXECUTE lines, and lines that can't be fingerprinted, bypass the
+ * cache and go to parse_session_SQL.
+ */
+
+#define PLAN_CACHE_SIZE 32
+#define PLAN_CACHE_BUCKETS 64 // power of two
+// every token may gain a separator
+#define MAX_FINGERPRINT_LEN (2 * MAX_QUERY_LEN)
+
+typedef struct
+{
+	uint64_t hash;
+	char fingerprint[MAX_FINGERPRINT_LEN];
+	Prepared_Query prepared;
+	int bucket_next; // next entry of the same bucket, -1 ends the chain
+	int lru_prev;	 // more recently used entry, -1 for the most recent
+	int lru_next;	 // less recently used entry, -1 for the least recent
+} Plan_Cache_Entry;
+
+typedef struct
+{
+	int count;
+	int buckets[PLAN_CACHE_BUCKETS]; // first entry of every bucket, -1 if empty
+	int lru_first;
+	int lru_last;
+	Plan_Cache_Entry entries[PLAN_CACHE_SIZE];
+
+	// counters for tuning the size of the cache
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	unsigned long bypasses;
+} Plan_Cache;
+
+void plan_cache_init(Plan_Cache *cache);
+
+/*
+ * Parses a line of a client connection like parse_session_SQL, going through
+ * the cache for plain queries
+ */
+Parse_Result plan_cache_parse(Plan_Cache *cache, Prepared_Statements *statements, char *sql_str, SQL_Query *query);
+
+#endif /* PLAN_CACHE_H_ */
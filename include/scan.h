@@ -0,0 +1,39 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "in_memory_db.h"
+
+/*
+ * Parallel scans of the table
+ *
+ * The slots of the table are split into morsels of MORSEL_SIZE consecutive slots.
+ * A scan gives every worker thread a deque of consecutive morsels. A worker takes
+ * the morsels of its own deque from the front, in slot order, and once it is
+ * empty steals from the back of the deques of the others, so that workers held up
+ * by locks or costly predicates don't hold up the whole scan.
+ *
+ * A scan of a single morsel, or on a single CPU, runs in the calling thread alone.
+ */
+
+#define MORSEL_SIZE 1024
+#define NUM_MORSELS ((NUM_RECORDS + MORSEL_SIZE - 1) / MORSEL_SIZE)
+#define MAX_SCAN_WORKERS 16
+
+/*
+ * Scans the slots [first, end) of a morsel, e.g. with get_next_record_in.
+ * worker identifies the thread, it is below MAX_SCAN_WORKERS, so per-worker state
+ * needs no locking.
+ */
+typedef void (*Morsel_Func)(void *arg, int worker, int morsel, int first, int end);
+
+// runs func on every morsel of the table, returns once all of them are done
+void scan_morsels(Morsel_Func func, void *arg);
+
+/*
+ * Same for the slots [first, end) in morsels of morsel_size slots, numbered from 0
+ * at first, with at most max_workers threads whatever the number of CPUs (0 for
+ * one per CPU).
+ */
+void scan_slots(Morsel_Func func, void *arg, int first, int end, int morsel_size, int max_workers);
+
+#endif
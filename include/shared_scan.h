@@ -0,0 +1,81 @@
+#ifndef SHARED_SCAN_H
+#define SHARED_SCAN_H
+
+#include "query_mq.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Concurrent queries sharing a single pass over the slots [0, num_slots)
+ *
+ * The scan goes round the slots a chunk at a time, and every chunk is scanned for
+ * all the queries on the scan at once. The first query starts the scan, the ones
+ * arriving while it is in progress join it at its current position, and every
+ * query leaves once the scan has gone all the way round, back to where it joined.
+ * The lines of a query are split at that position and put back in slot order at
+ * the end.
+ *
+ * The threads of the queries on the scan take turns scanning: the one scanning
+ * leaves once its own query is done, and another one takes over.
+ */
+
+#define MAX_SHARED_QUERIES 32
+
+// lines of a part of the slots, as many as fit in a result message
+typedef struct
+{
+    char str[RESULT_MSG_SIZE];
+    size_t len;
+    bool full;
+} Shared_Lines;
+
+// a query on the shared scan
+typedef struct
+{
+    void *query;
+    int start;          // slot where the query joined the scan
+    int remaining;      // slots the scan still has to go through for the query
+    Shared_Lines head;  // lines of the slots before start, scanned last
+    Shared_Lines tail;  // lines of the slots from start, scanned first
+    bool done;
+} Shared_Query;
+
+/*
+ * Scans the slots [first, end) for the queries on the scan, appending the lines of
+ * every query in slot order to shared_query_lines(). Called without the lock of the
+ * scan, by one thread at a time.
+ */
+typedef void (*Shared_Chunk_Func)(void *arg, Shared_Query **queries, int count, int first, int end);
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // a query is done, or nobody is scanning
+    int num_slots;
+    int chunk_size;         // slots scanned between two looks at the queries that joined
+    Shared_Chunk_Func scan_chunk;
+    void *arg;
+    bool scanning;
+    int position;           // first slot of the next chunk
+    int count;
+    Shared_Query *queries[MAX_SHARED_QUERIES];
+} Shared_Scan;
+
+#define SHARED_SCAN_INITIALIZER(num_slots, chunk_size, scan_chunk, arg) \
+    {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, (num_slots), (chunk_size), (scan_chunk), (arg)}
+
+/*
+ * Runs the query on the shared scan, starting it if no other query is on it, and
+ * writes its lines to result. Returns false if the scan has no room for the query,
+ * which has to scan on its own instead.
+ */
+bool shared_scan_run(Shared_Scan *scan, void *query, char *result);
+
+// the lines of the query the line of a slot goes to
+Shared_Lines *shared_query_lines(Shared_Query *sq, int slot);
+
+// appends whole lines to lines, until one doesn't fit and they are full
+void shared_lines_append(Shared_Lines *lines, const char *str, size_t len);
+
+#endif
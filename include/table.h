@@ -7,7 +7,7 @@
 #define AGE_STR "AGE"
 #define NAME_STR "NAME"
 #define HEIGHT_STR "HEIGHT"
-#define MAX_QUERY_LEN 100
+#define MAX_QUERY_LEN 4096 // long enough for a multi-row INSERT
 #define MAX_STR_LEN 100
 
 typedef enum 
@@ -0,0 +1,418 @@
+#include "SQL_lexer.h"
+#include "table.h"
+#include <stdbool.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+
+static bool word_equals(const char *word, int len, const char *str, int str_len)
+{
+	return len == str_len && memcmp(word, str, len) == 0;
+}
+
+#define WORD_EQUALS(word, len, STR) word_equals(word, len, STR, sizeof(STR) - 1)
+
+/*
+ * classify a word; the length and first character narrow it down to at most
+ * a couple of keywords, so each word is compared against few candidates
+ */
+static Keyword classify_word(const char *word, int len)
+{
+	switch (word[0])
+	{
+	case 'S':
+		if (len == 6)
+			return WORD_EQUALS(word, len, "SELECT") ? KW_SELECT : KW_NONE;
+		if (WORD_EQUALS(word, len, "SUM"))
+			return KW_SUM;
+		return WORD_EQUALS(word, len, "SET") ? KW_SET : KW_NONE;
+	case 'I':
+		return WORD_EQUALS(word, len, "INSERT") ? KW_INSERT : KW_NONE;
+	case 'D':
+		if (len == 4)
+			return WORD_EQUALS(word, len, "DESC") ? KW_DESC : KW_NONE;
+		return WORD_EQUALS(word, len, "DELETE") ? KW_DELETE : KW_NONE;
+	case 'U':
+		return WORD_EQUALS(word, len, "UPDATE") ? KW_UPDATE : KW_NONE;
+	case 'W':
+		return WORD_EQUALS(word, len, WHERE_STR) ? KW_WHERE : KW_NONE;
+	case 'P':
+		return WORD_EQUALS(word, len, "PREPARE") ? KW_PREPARE : KW_NONE;
+	case 'E':
+		return WORD_EQUALS(word, len, "EXECUTE") ? KW_EXECUTE : KW_NONE;
+	case 'A':
+		if (len == 2)
+			return WORD_EQUALS(word, len, "AS") ? KW_AS : KW_NONE;
+		if (WORD_EQUALS(word, len, "AVG"))
+			return KW_AVG;
+		if (WORD_EQUALS(word, len, "ASC"))
+			return KW_ASC;
+		return WORD_EQUALS(word, len, "AND") ? KW_AND : KW_NONE;
+	case 'O':
+		if (len == 2)
+			return WORD_EQUALS(word, len, "OR") ? KW_OR : KW_NONE;
+		if (len == 5)
+			return WORD_EQUALS(word, len, "ORDER") ? KW_ORDER : KW_NONE;
+		return WORD_EQUALS(word, len, "OFFSET") ? KW_OFFSET : KW_NONE;
+	case 'L':
+		return WORD_EQUALS(word, len, "LIMIT") ? KW_LIMIT : KW_NONE;
+	case 'V':
+		return WORD_EQUALS(word, len, "VALUES") ? KW_VALUES : KW_NONE;
+	case 'N':
+		return WORD_EQUALS(word, len, "NOT") ? KW_NOT : KW_NONE;
+	case 'C':
+		return WORD_EQUALS(word, len, "COUNT") ? KW_COUNT : KW_NONE;
+	case 'G':
+		return WORD_EQUALS(word, len, "GROUP") ? KW_GROUP : KW_NONE;
+	case 'B':
+		return WORD_EQUALS(word, len, "BY") ? KW_BY : KW_NONE;
+	case 'M':
+		if (WORD_EQUALS(word, len, "MIN"))
+			return KW_MIN;
+		return WORD_EQUALS(word, len, "MAX") ? KW_MAX : KW_NONE;
+	default:
+		return KW_NONE;
+	}
+}
+
+void lexer_advance(Lexer *lexer)
+{
+	const char *sql = lexer->sql;
+	int pos = lexer->pos;
+	Token *token = &lexer->current;
+
+	while (isspace((unsigned char)sql[pos]))
+		pos++;
+
+	token->start = pos;
+	token->keyword = KW_NONE;
+
+	char c = sql[pos];
+	if (c == '\0')
+	{
+		token->type = TOKEN_END;
+	}
+	else if (isalpha((unsigned char)c) || c == '_')
+	{
+		while (isalnum((unsigned char)sql[pos]) || sql[pos] == '_')
+			pos++;
+		token->type = TOKEN_WORD;
+		token->keyword = classify_word(sql + token->start, pos - token->start);
+	}
+	else if (isdigit((unsigned char)c))
+	{
+		while (isdigit((unsigned char)sql[pos]))
+			pos++;
+		if (sql[pos] == '.')
+		{
+			pos++;
+			while (isdigit((unsigned char)sql[pos]))
+				pos++;
+		}
+		// exponent, only if digits follow
+		int exp_pos = pos + 1;
+		if (sql[exp_pos] == '+' || sql[exp_pos] == '-')
+			exp_pos++;
+		if ((sql[pos] == 'e' || sql[pos] == 'E') && isdigit((unsigned char)sql[exp_pos]))
+		{
+			pos = exp_pos;
+			while (isdigit((unsigned char)sql[pos]))
+				pos++;
+		}
+		token->type = TOKEN_NUMBER;
+	}
+	else if (c == '\'')
+	{
+		pos++;
+		while (sql[pos] != '\'' && sql[pos] != '\0')
+			pos++;
+
+		if (sql[pos] == '\0') // didn't find closing quote
+		{
+			token->type = TOKEN_INVALID;
+		}
+		else
+		{
+			pos++;
+			token->type = TOKEN_STRING;
+		}
+	}
+	else
+	{
+		pos++;
+		switch (c)
+		{
+		case '*':
+			token->type = TOKEN_STAR;
+			break;
+		case ',':
+			token->type = TOKEN_COMMA;
+			break;
+		case '(':
+			token->type = TOKEN_LPAREN;
+			break;
+		case ')':
+			token->type = TOKEN_RPAREN;
+			break;
+		case '+':
+			token->type = TOKEN_PLUS;
+			break;
+		case '-':
+			token->type = TOKEN_MINUS;
+			break;
+		case '/':
+			token->type = TOKEN_SLASH;
+			break;
+		case '?':
+			token->type = TOKEN_PARAM;
+			break;
+		case '=':
+			token->type = TOKEN_ASSIGN;
+			if (sql[pos] == '=')
+			{
+				pos++;
+				token->type = TOKEN_EQUAL;
+			}
+			break;
+		case '<':
+			token->type = TOKEN_LOWER;
+			if (sql[pos] == '=')
+			{
+				pos++;
+				token->type = TOKEN_LOWER_OR_EQUAL;
+			}
+			break;
+		case '>':
+			token->type = TOKEN_GREATER;
+			if (sql[pos] == '=')
+			{
+				pos++;
+				token->type = TOKEN_GREATER_OR_EQUAL;
+			}
+			break;
+		default:
+			token->type = TOKEN_INVALID;
+		}
+	}
+
+	token->len = pos - token->start;
+	lexer->pos = pos;
+}
+
+void lexer_init(Lexer *lexer, const char *sql)
+{
+	lexer->sql = sql;
+	lexer->pos = 0;
+	lexer_advance(lexer);
+}
+
+bool lexer_accept(Lexer *lexer, TokenType type)
+{
+	if (lexer->current.type != type)
+		return false;
+
+	lexer_advance(lexer);
+	return true;
+}
+
+bool lexer_accept_keyword(Lexer *lexer, Keyword keyword)
+{
+	if (lexer->current.type != TOKEN_WORD || lexer->current.keyword != keyword)
+		return false;
+
+	lexer_advance(lexer);
+	return true;
+}
+
+bool token_to_field(const Lexer *lexer, const Token *token, FieldId *field)
+{
+	const char *word = TOKEN_TEXT(lexer, token);
+
+	if (token->type != TOKEN_WORD || token->keyword != KW_NONE)
+		return false;
+
+	if (WORD_EQUALS(word, token->len, ID_STR))
+		*field = ID;
+	else if (WORD_EQUALS(word, token->len, AGE_STR))
+		*field = AGE;
+	else if (WORD_EQUALS(word, token->len, HEIGHT_STR))
+		*field = HEIGHT;
+	else if (WORD_EQUALS(word, token->len, NAME_STR))
+		*field = NAME;
+	else
+		return false;
+
+	return true;
+}
+
+bool token_to_int(const Lexer *lexer, const Token *token, bool negative, int *val)
+{
+	const char *digits = TOKEN_TEXT(lexer, token);
+	// INT_MIN has no positive counterpart
+	unsigned int limit = negative ? (unsigned int)INT_MAX + 1 : INT_MAX;
+	unsigned int magnitude = 0;
+
+	if (token->type != TOKEN_NUMBER)
+		return false;
+
+	for (int i = 0; i < token->len; i++)
+	{
+		// decimal point or exponent
+		if (!isdigit((unsigned char)digits[i]))
+			return false;
+
+		unsigned int digit = digits[i] - '0';
+		if (magnitude > (limit - digit) / 10)
+			return false; // overflow
+		magnitude = magnitude * 10 + digit;
+	}
+
+	*val = negative ? (int)(0 - magnitude) : (int)magnitude;
+	return true;
+}
+
+// powers of ten exactly representable as doubles
+static const double exact_powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+#define MAX_EXACT_POWER 22
+#define MAX_EXACT_MANTISSA (UINT64_C(1) << 53)
+// longest literal converted by strtod from a stack buffer
+#define MAX_SLOW_LITERAL 64
+
+/*
+ * Converts with strtod, which rounds correctly in every case; used when the
+ * fast path can't be exact
+ */
+static bool slow_to_double(const char *text, int len, double *val)
+{
+	char stack_buffer[MAX_SLOW_LITERAL + 1];
+	char *buffer = len <= MAX_SLOW_LITERAL ? stack_buffer : malloc(len + 1);
+
+	if (buffer == NULL)
+		return false;
+
+	memcpy(buffer, text, len);
+	buffer[len] = '\0';
+	*val = strtod(buffer, NULL);
+
+	if (buffer != stack_buffer)
+		free(buffer);
+
+	return !isinf(*val);
+}
+
+bool token_to_double(const Lexer *lexer, const Token *token, bool negative, double *val)
+{
+	const char *text = TOKEN_TEXT(lexer, token);
+	const char *end = text + token->len;
+	const char *p = text;
+	uint64_t mantissa = 0;
+	int significant = 0;
+	int exponent = 0;
+	bool truncated = false;
+
+	if (token->type != TOKEN_NUMBER)
+		return false;
+
+	// digits of the mantissa; only the first 19 significant ones fit
+	for (bool fraction = false; p < end && (isdigit((unsigned char)*p) || (*p == '.' && !fraction)); p++)
+	{
+		if (*p == '.')
+		{
+			fraction = true;
+			continue;
+		}
+		if (mantissa == 0 && *p == '0')
+		{
+			if (fraction)
+				exponent--;
+			continue;
+		}
+		if (significant < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			significant++;
+			if (fraction)
+				exponent--;
+		}
+		else
+		{
+			truncated |= *p != '0';
+			if (!fraction)
+				exponent++;
+		}
+	}
+
+	if (p < end)
+	{
+		// exponent, the lexer guarantees digits follow
+		bool exp_negative = false;
+		int exp_value = 0;
+		p++;
+		if (*p == '+' || *p == '-')
+			exp_negative = *p++ == '-';
+		for (; p < end; p++)
+		{
+			if (exp_value < 100000)
+				exp_value = exp_value * 10 + (*p - '0');
+		}
+		exponent += exp_negative ? -exp_value : exp_value;
+	}
+
+	/*
+	 * Clinger's fast path: when the mantissa and the power of ten are both
+	 * exact doubles, a single correctly rounded multiplication or division
+	 * gives the correctly rounded result
+	 */
+	if (!truncated && mantissa <= MAX_EXACT_MANTISSA && exponent >= -MAX_EXACT_POWER)
+	{
+		double result = (double)mantissa;
+		bool exact = true;
+
+		if (exponent < 0)
+		{
+			result /= exact_powers_of_ten[-exponent];
+		}
+		else if (exponent <= MAX_EXACT_POWER)
+		{
+			result *= exact_powers_of_ten[exponent];
+		}
+		else
+		{
+			// move the excess of the power into the mantissa while it stays exact
+			uint64_t shifted = mantissa;
+			int excess = exponent - MAX_EXACT_POWER;
+			while (excess > 0 && shifted <= MAX_EXACT_MANTISSA / 10)
+			{
+				shifted *= 10;
+				excess--;
+			}
+			exact = excess == 0;
+			result = (double)shifted * exact_powers_of_ten[MAX_EXACT_POWER];
+		}
+
+		if (exact)
+		{
+			*val = negative ? -result : result;
+			return true;
+		}
+	}
+
+	if (mantissa == 0 && !truncated)
+	{
+		*val = negative ? -0.0 : 0.0;
+		return true;
+	}
+
+	if (!slow_to_double(text, token->len, val))
+		return false; // overflow
+
+	if (negative)
+		*val = -*val;
+	return true;
+}
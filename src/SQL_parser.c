@@ -1,4 +1,5 @@
 #include "SQL_parser.h"
+#include "SQL_lexer.h"
 #include "table.h"
 #include <stdbool.h>
 #include <ctype.h>
@@ -7,369 +8,878 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <unistd.h>
+#include <math.h>
 
 /*
-static void toUpperStr(char *str)
+ * The parser works on the tokens of SQL_lexer.h. Every parse_* routine below
+ * consumes the tokens of its part of the query and returns false as soon as
+ * a token doesn't fit, so each query is scanned exactly once.
+ *
+ * The routines that parse a value take the prepared query being built, if
+ * any; where it isn't NULL, a "?" placeholder is accepted in place of the value
+ * and its type and place in the query are recorded for binding it later.
+ */
+
+// if the current token is a placeholder, record the value at val as a parameter
+static bool parse_param(Lexer *lexer, Prepared_Query *prepared, ParamType type, void *val)
 {
-	int i = 0;
-	while (str[i] != '\0')
-	{
-		str[i] = toupper(str[i]);
-		i++;
-	}
+	if (prepared == NULL || lexer->current.type != TOKEN_PARAM || prepared->num_params == MAX_PARAMS)
+		return false;
+
+	Param *param = &prepared->params[prepared->num_params++];
+	param->type = type;
+	param->offset = (char *)val - (char *)&prepared->query;
+
+	lexer_advance(lexer);
+	return true;
 }
-*/
 
-static char *trimWhitespace(char *str)
+static bool parse_string(Lexer *lexer, Prepared_Query *prepared, char *content)
 {
-	char *end;
+	if (parse_param(lexer, prepared, PARAM_STRING, content))
+		return true;
 
-	// Trim leading space
-	while (isspace(*str))
-		str++;
+	const Token *token = &lexer->current;
+	if (token->type != TOKEN_STRING)
+		return false;
 
-	if (*str == 0) // All spaces?
-		return str;
+	// strip the quotes
+	int len = token->len - 2;
+	if (len >= MAX_STR_LEN)
+		return false;
 
-	// Trim trailing space
-	end = str + strlen(str) - 1;
+	memcpy(content, TOKEN_TEXT(lexer, token) + 1, len);
+	content[len] = '\0';
 
-	while (end > str && isspace(*end))
-		end--;
-	// Write new null terminator character
+	lexer_advance(lexer);
+	return true;
+}
 
-	// end[1] = '\0';
+static bool parse_int(Lexer *lexer, Prepared_Query *prepared, int *val)
+{
+	if (parse_param(lexer, prepared, PARAM_INT, val))
+		return true;
 
-	return str;
+	bool negative = lexer_accept(lexer, TOKEN_MINUS);
+
+	if (!token_to_int(lexer, &lexer->current, negative, val))
+		return false;
+
+	lexer_advance(lexer);
+	return true;
 }
 
-bool parseSpace(char **str)
+// parses a number of rows, which can't be negative
+static bool parse_count(Lexer *lexer, Prepared_Query *prepared, int *val)
 {
-	// at least one space is mandatory
-	if (isspace(**str))
-	{
-		while (isspace(**str))
-			(*str)++;
+	if (parse_param(lexer, prepared, PARAM_COUNT, val))
 		return true;
-	}
-	return false;
+
+	if (!token_to_int(lexer, &lexer->current, false, val))
+		return false;
+
+	lexer_advance(lexer);
+	return true;
 }
 
-bool parse_string_in_quotes(char **parsed_str, char *content)
+static bool parse_double(Lexer *lexer, Prepared_Query *prepared, double *val)
 {
-	char *next_char = *parsed_str;
-	if (*next_char != '\'')
+	if (parse_param(lexer, prepared, PARAM_DOUBLE, val))
+		return true;
+
+	bool negative = lexer_accept(lexer, TOKEN_MINUS);
+
+	if (!token_to_double(lexer, &lexer->current, negative, val))
 		return false;
 
-	next_char++;
+	lexer_advance(lexer);
+	return true;
+}
 
-	while (*next_char != '\'' && *next_char != 0)
+static bool parse_comparator(Lexer *lexer, Comparator *comparator)
+{
+	// parse the < > <= >= ==
+	switch (lexer->current.type)
 	{
-		*content = *next_char;
-		content++;
-		next_char++;
+	case TOKEN_LOWER:
+		*comparator = LOWER;
+		break;
+	case TOKEN_LOWER_OR_EQUAL:
+		*comparator = LOWER_OR_EQUAL;
+		break;
+	case TOKEN_GREATER:
+		*comparator = GREATER;
+		break;
+	case TOKEN_GREATER_OR_EQUAL:
+		*comparator = GREATER_OR_EQUAL;
+		break;
+	case TOKEN_EQUAL:
+		*comparator = EQUAL;
+		break;
+	default:
+		return false;
 	}
 
-	if (*next_char == 0) // didn't find closing quote
+	lexer_advance(lexer);
+	return true;
+}
+
+static bool parse_field(Lexer *lexer, FieldId *field)
+{
+	if (!token_to_field(lexer, &lexer->current, field))
 		return false;
 
-	*content = '\0';
+	lexer_advance(lexer);
+	return true;
+}
 
-	// point string pointer to first char after the closing quote
-	*parsed_str = next_char + 1;
+// parses a literal of the type of the field
+static bool parse_field_value(Lexer *lexer, Prepared_Query *prepared, FieldId field, FieldVal *val)
+{
+	switch (field)
+	{
+	case ID:
+		return parse_int(lexer, prepared, &val->id);
+	case AGE:
+		return parse_int(lexer, prepared, &val->age);
+	case HEIGHT:
+		return parse_double(lexer, prepared, &val->height);
+	case NAME:
+		return parse_string(lexer, prepared, val->name);
+	}
 
-	return true;
+	return false;
 }
 
-/*
- * if parsed_str starts with searched_str, then return true and shift the parsed_str pointer to the first character after the match 
- * otherwise return false and don't modify the parsed_str pointer
- */
-static bool parse_str(char **parsed_str, char *searched_str)
+// parses "age >= 10"
+static bool parse_comparison(Lexer *lexer, Prepared_Query *prepared, Constraint *c)
 {
+	return parse_field(lexer, &c->fieldId) && parse_comparator(lexer, &c->comparator) && parse_field_value(lexer, prepared, c->fieldId, &c->fieldVal);
+}
+
+// adds a node to the predicate, returns its index or -1 if the predicate is full
+static int add_node(Predicate *where, PredicateOp op, int arg)
+{
+	if (where->num_nodes == MAX_PREDICATE_NODES)
+		return -1;
+
+	PredicateNode *node = &where->nodes[(int)where->num_nodes];
+	node->op = op;
+	node->arg = arg;
+	node->next = -1;
+	return where->num_nodes++;
+}
+
+// appends child to the children of parent; the children of a child of the same op are taken over instead
+static void add_child(Predicate *where, int parent, int child)
+{
+	int first = where->nodes[child].op == where->nodes[parent].op ? where->nodes[child].arg : child;
+	signed char *link = &where->nodes[parent].arg;
+
+	while (*link != -1)
+		link = &where->nodes[(int)*link].next;
+	*link = first;
+}
+
+static bool parse_disjunction(Lexer *lexer, Prepared_Query *prepared, Predicate *where, int *node);
 
-	char *next_char = *parsed_str;
-	while (*searched_str != 0)
+// parses a comparison, a negation or a parenthesized predicate
+static bool parse_factor(Lexer *lexer, Prepared_Query *prepared, Predicate *where, int *node)
+{
+	if (lexer_accept_keyword(lexer, KW_NOT))
 	{
-		if (*next_char == 0)
+		int child;
+		if (!parse_factor(lexer, prepared, where, &child))
 			return false;
 
-		// comparing character by character
-		if (*next_char != *searched_str)
+		// NOT NOT x is x
+		if (where->nodes[child].op == PREDICATE_NOT)
 		{
-			return false;
+			*node = where->nodes[child].arg;
+			return true;
 		}
-
-		// move to the next char
-		next_char++;
-		searched_str++;
+		*node = add_node(where, PREDICATE_NOT, child);
+		return *node != -1;
 	}
 
-	*parsed_str = next_char;
-	return true;
+	if (lexer_accept(lexer, TOKEN_LPAREN))
+		return parse_disjunction(lexer, prepared, where, node) && lexer_accept(lexer, TOKEN_RPAREN);
+
+	if (where->num_constraints == MAX_CONSTRAINTS)
+		return false;
+
+	int constraint = where->num_constraints++;
+	*node = add_node(where, PREDICATE_CONSTRAINT, constraint);
+	return *node != -1 && parse_comparison(lexer, prepared, &where->constraints[constraint]);
 }
 
-static void parse_token(char **parsed_str, char *word)
+// parses factors joined by op; keyword is the keyword of op, parse_operand parses a factor
+static bool parse_list(Lexer *lexer, Prepared_Query *prepared, Predicate *where, int *node, PredicateOp op, Keyword keyword,
+					   bool (*parse_operand)(Lexer *, Prepared_Query *, Predicate *, int *))
 {
-	*parsed_str = trimWhitespace(*parsed_str);
+	int first;
+	if (!parse_operand(lexer, prepared, where, &first))
+		return false;
+
+	if (lexer->current.type != TOKEN_WORD || lexer->current.keyword != keyword)
+	{
+		*node = first;
+		return true;
+	}
+
+	*node = add_node(where, op, -1);
+	if (*node == -1)
+		return false;
+	add_child(where, *node, first);
 
-	while (**parsed_str != 0 && !isspace(**parsed_str))
+	while (lexer_accept_keyword(lexer, keyword))
 	{
-		*word = **parsed_str;
-		word++;
-		(*parsed_str)++;
+		int child;
+		if (!parse_operand(lexer, prepared, where, &child))
+			return false;
+		add_child(where, *node, child);
 	}
+	return true;
+}
+
+static bool parse_conjunction(Lexer *lexer, Prepared_Query *prepared, Predicate *where, int *node)
+{
+	return parse_list(lexer, prepared, where, node, PREDICATE_AND, KW_AND, parse_factor);
+}
 
-	*word = '\0';
+static bool parse_disjunction(Lexer *lexer, Prepared_Query *prepared, Predicate *where, int *node)
+{
+	return parse_list(lexer, prepared, where, node, PREDICATE_OR, KW_OR, parse_conjunction);
 }
 
-static bool parse_number(char **parsed_str, char *digits, bool decimal)
+/*
+ * Estimates of a predicate: the fraction of records satisfying it and the
+ * expected cost of evaluating it on a record, in comparisons of numbers
+ */
+typedef struct
 {
+	double selectivity;
+	double cost;
+} Estimate;
 
-	int decimal_dots = 0;
-	int char_n = 0;
+// no statistics are kept, so these are the classic guesses for an equality and a range
+#define EQUAL_SELECTIVITY 0.1
+#define RANGE_SELECTIVITY (1.0 / 3)
+// comparing strings of up to MAX_STR_LEN characters
+#define STRING_COMPARISON_COST 4.0
+
+/*
+ * Rank of a child of an AND or OR: its cost per record it decides the parent
+ * for, i.e. per record that fails it under AND or satisfies it under OR.
+ * Evaluating the children by increasing rank minimizes the expected cost.
+ */
+static double rank(PredicateOp op, Estimate estimate)
+{
+	double decisive = op == PREDICATE_AND ? 1 - estimate.selectivity : estimate.selectivity;
+	return decisive > 0 ? estimate.cost / decisive : HUGE_VAL;
+}
 
-	while (**parsed_str != 0 && (isdigit(**parsed_str) || (decimal && **parsed_str == '.' && decimal_dots++ == 0)))
+// orders the children of every AND and OR under node, returns the estimates of node
+static Estimate order_predicate(Predicate *where, int node)
+{
+	PredicateNode *n = &where->nodes[node];
+	Estimate estimate;
+
+	switch (n->op)
+	{
+	case PREDICATE_CONSTRAINT:
 	{
-		*digits = **parsed_str;
-		digits++;
-		(*parsed_str)++;
-		char_n++;
+		const Constraint *c = &where->constraints[(int)n->arg];
+		estimate.selectivity = c->comparator == EQUAL ? EQUAL_SELECTIVITY : RANGE_SELECTIVITY;
+		estimate.cost = c->fieldId == NAME ? STRING_COMPARISON_COST : 1.0;
+		return estimate;
+	}
+	case PREDICATE_NOT:
+		estimate = order_predicate(where, n->arg);
+		estimate.selectivity = 1 - estimate.selectivity;
+		return estimate;
 	}
 
-	*digits = '\0';
+	int children[MAX_PREDICATE_NODES];
+	Estimate estimates[MAX_PREDICATE_NODES];
+	int count = 0;
 
-	if (char_n == 0)
-		return false;
+	// insertion sort of the children by rank
+	for (int child = n->arg; child != -1; child = where->nodes[child].next)
+	{
+		Estimate e = order_predicate(where, child);
+		int i = count++;
+		for (; i > 0 && rank(n->op, estimates[i - 1]) > rank(n->op, e); i--)
+		{
+			children[i] = children[i - 1];
+			estimates[i] = estimates[i - 1];
+		}
+		children[i] = child;
+		estimates[i] = e;
+	}
 
-	return true;
+	// relink them in that order, accumulating the estimates
+	signed char *link = &n->arg;
+	double reached = 1.0; // fraction of records that get to evaluate the child
+	estimate.selectivity = n->op == PREDICATE_AND ? 1.0 : 0.0;
+	estimate.cost = 0.0;
+	for (int i = 0; i < count; i++)
+	{
+		*link = children[i];
+		link = &where->nodes[children[i]].next;
+
+		estimate.cost += reached * estimates[i].cost;
+		if (n->op == PREDICATE_AND)
+		{
+			estimate.selectivity *= estimates[i].selectivity;
+			reached = estimate.selectivity;
+		}
+		else
+		{
+			estimate.selectivity += (1 - estimate.selectivity) * estimates[i].selectivity;
+			reached = 1 - estimate.selectivity;
+		}
+	}
+	*link = -1;
+
+	return estimate;
 }
 
-static bool parse_int(char **parsed_str, int *val)
+// parses "WHERE age >= 10 AND NOT (name == 'Joe' OR height < 170)"
+static bool parse_where(Lexer *lexer, Prepared_Query *prepared, Predicate *where)
 {
-	char *backup = *parsed_str;
-	char int_str[20];
+	int root;
 
-	parse_number(parsed_str, int_str, false);
-	if (sscanf(int_str, "%d", val) < 1)
-	{
+	where->root = -1;
+	where->num_nodes = 0;
+	where->num_constraints = 0;
+
+	if (!lexer_accept_keyword(lexer, KW_WHERE) || !parse_disjunction(lexer, prepared, where, &root))
 		return false;
-		*parsed_str = backup;
-	}
+
+	order_predicate(where, root);
+	where->root = root;
 	return true;
 }
 
-static bool parse_double(char **parsed_str, double *val)
+// parses what follows "SELECT"
+// parses "name", "COUNT(*)" or "AVG(height)"
+static bool parse_column(Lexer *lexer, Column *column)
 {
-	char *backup = *parsed_str;
-	char double_str[20];
+	if (lexer->current.type != TOKEN_WORD)
+		return false;
 
-	parse_number(parsed_str, double_str, true);
-	if (sscanf(double_str, "%lf", val) < 1)
+	switch (lexer->current.keyword)
 	{
+	case KW_NONE:
+		column->aggregate = AGG_NONE;
+		return parse_field(lexer, &column->field);
+	case KW_COUNT:
+		column->aggregate = AGG_COUNT;
+		break;
+	case KW_SUM:
+		column->aggregate = AGG_SUM;
+		break;
+	case KW_AVG:
+		column->aggregate = AGG_AVG;
+		break;
+	case KW_MIN:
+		column->aggregate = AGG_MIN;
+		break;
+	case KW_MAX:
+		column->aggregate = AGG_MAX;
+		break;
+	default:
 		return false;
-		*parsed_str = backup;
 	}
-	return true;
-}
-
-bool parse_constraint(char *constraint_str, Constraint *c)
-{
-	constraint_str = trimWhitespace(constraint_str);	
+	lexer_advance(lexer);
 
-	int MAX_TOKEN_LEN = 15;
-	if (!parse_str(&constraint_str, WHERE_STR))
+	if (!lexer_accept(lexer, TOKEN_LPAREN))
 		return false;
 
-	constraint_str = trimWhitespace(constraint_str);
+	if (column->aggregate == AGG_COUNT && lexer_accept(lexer, TOKEN_STAR))
+		column->field = ID;
+	else if (!parse_field(lexer, &column->field))
+		return false;
 
-	char field_name[MAX_TOKEN_LEN];
-	parse_token(&constraint_str, field_name);
+	// names can't be added up
+	if ((column->aggregate == AGG_SUM || column->aggregate == AGG_AVG) && column->field == NAME)
+		return false;
 
-	char comp_str[MAX_TOKEN_LEN];
-	parse_token(&constraint_str, comp_str);
+	return lexer_accept(lexer, TOKEN_RPAREN);
+}
 
-	// parse the < > <= >= ==
-	if (strcmp(comp_str, "<") == 0)
+// parses "*", "id, name" or "COUNT(*), MAX(age)"
+static bool parse_columns(Lexer *lexer, Select_Query *query)
+{
+	if (lexer_accept(lexer, TOKEN_STAR))
 	{
-		c->comparator = LOWER;
+		FieldId all[] = {ID, AGE, HEIGHT, NAME};
+		query->num_columns = sizeof(all) / sizeof(all[0]);
+		for (int i = 0; i < query->num_columns; i++)
+		{
+			query->columns[i].aggregate = AGG_NONE;
+			query->columns[i].field = all[i];
+		}
+		query->aggregate = false;
+		return true;
 	}
-	else if (strcmp(comp_str, "<=") == 0)
+
+	int num_aggregates = 0;
+	query->num_columns = 0;
+	do
 	{
-		c->comparator = LOWER_OR_EQUAL;
-	}
-	else if (strcmp(comp_str, ">") == 0)
+		if (query->num_columns == MAX_COLUMNS || !parse_column(lexer, &query->columns[query->num_columns]))
+			return false;
+		if (query->columns[query->num_columns].aggregate != AGG_NONE)
+			num_aggregates++;
+		query->num_columns++;
+	} while (lexer_accept(lexer, TOKEN_COMMA));
+
+	query->aggregate = num_aggregates > 0;
+	return true;
+}
+
+// true if the fields of the columns can be shown for the rows of the result
+static bool check_columns(Select_Query *query)
+{
+	for (int i = 0; i < query->num_columns; i++)
 	{
-		c->comparator = GREATER;
+		Column *column = &query->columns[i];
+		if (column->aggregate != AGG_NONE)
+			continue;
+
+		// a single row can't hold the fields of every record, a group only has one value of the grouped field
+		if (query->aggregate && !(query->grouped && column->field == query->group_by))
+			return false;
 	}
-	else if (strcmp(comp_str, ">=") == 0)
+	return true;
+}
+
+static bool parse_select_body(Lexer *lexer, Prepared_Query *prepared, Select_Query *query)
+{
+	if (!parse_columns(lexer, query))
+		return false;
+
+	query->all = !(lexer->current.type == TOKEN_WORD && lexer->current.keyword == KW_WHERE);
+	if (query->all)
+		query->where.root = -1;
+	else if (!parse_where(lexer, prepared, &query->where))
+		return false;
+
+	query->grouped = lexer_accept_keyword(lexer, KW_GROUP);
+	if (query->grouped)
 	{
-		c->comparator = GREATER_OR_EQUAL;
+		if (!lexer_accept_keyword(lexer, KW_BY) || !parse_field(lexer, &query->group_by))
+			return false;
+		// every row of the result is a group
+		query->aggregate = true;
 	}
-	else if (strcmp(comp_str, "==") == 0)
+
+	query->ordered = lexer_accept_keyword(lexer, KW_ORDER);
+	if (query->ordered)
 	{
-		c->comparator = EQUAL;
+		if (!lexer_accept_keyword(lexer, KW_BY) || !parse_field(lexer, &query->order_by))
+			return false;
+		query->descending = lexer_accept_keyword(lexer, KW_DESC);
+		if (!query->descending)
+			lexer_accept_keyword(lexer, KW_ASC);
 	}
-	else
+
+	query->limited = lexer_accept_keyword(lexer, KW_LIMIT);
+	query->offset = 0;
+	if (query->limited)
 	{
-		return false;
+		if (!parse_count(lexer, prepared, &query->limit))
+			return false;
+		if (lexer_accept_keyword(lexer, KW_OFFSET) && !parse_count(lexer, prepared, &query->offset))
+			return false;
 	}
 
-	constraint_str = trimWhitespace(constraint_str);
+	// aggregate rows come out in the order of their groups
+	if (query->aggregate && (query->ordered || query->limited))
+		return false;
 
-	if (strcmp(field_name, ID_STR) == 0)
-	{
-		c->fieldId = ID;
+	return lexer_accept(lexer, TOKEN_END) && check_columns(query);
+}
 
-		return parse_int(&constraint_str, &c->fieldVal.id);
-	}
-	else if (strcmp(field_name, NAME_STR) == 0)
-	{
-		c->fieldId = NAME;
-		return parse_string_in_quotes(&constraint_str, c->fieldVal.name);
-	}
-	else if (strcmp(field_name, AGE_STR) == 0)
+// parses a record "(2, 21, 168.23, 'Joe Brown')"
+static bool parse_record(Lexer *lexer, Prepared_Query *prepared, T_Record *record)
+{
+	return lexer_accept(lexer, TOKEN_LPAREN) && parse_int(lexer, prepared, &record->id) && lexer_accept(lexer, TOKEN_COMMA) && parse_int(lexer, prepared, &record->age) && lexer_accept(lexer, TOKEN_COMMA) && parse_double(lexer, prepared, &record->height) && lexer_accept(lexer, TOKEN_COMMA) && parse_string(lexer, prepared, record->name) && lexer_accept(lexer, TOKEN_RPAREN);
+}
+
+// parses what follows "INSERT", e.g. "VALUES (2, 21, 168.23, 'Joe Brown'), (3, 35, 175.5, 'Ann Smith')"
+static bool parse_insert_body(Lexer *lexer, Prepared_Query *prepared, Insert_Query *query)
+{
+	lexer_accept_keyword(lexer, KW_VALUES);
+
+	query->num_records = 0;
+	do
 	{
-		c->fieldId = AGE;
-		return parse_int(&constraint_str, &c->fieldVal.age);
-	}
-	else if (strcmp(field_name, HEIGHT_STR) == 0)
+		if (query->num_records == MAX_INSERT_RECORDS || !parse_record(lexer, prepared, &query->records[query->num_records]))
+			return false;
+		query->num_records++;
+	} while (lexer_accept(lexer, TOKEN_COMMA));
+
+	return lexer_accept(lexer, TOKEN_END);
+}
+
+// parses what follows "DELETE"
+static bool parse_delete_body(Lexer *lexer, Prepared_Query *prepared, Delete_Query *query)
+{
+	return parse_where(lexer, prepared, &query->where) && lexer_accept(lexer, TOKEN_END);
+}
+
+// adds a node to the expressions of the update, returns its index or -1 if they are full
+static int add_expression_node(Update_Query *query, ExpressionOp op, int left, int right)
+{
+	if (query->num_nodes == MAX_EXPRESSION_NODES)
+		return -1;
+
+	ExpressionNode *node = &query->nodes[(int)query->num_nodes];
+	node->op = op;
+	node->left = left;
+	node->right = right;
+	return query->num_nodes++;
+}
+
+// parses a literal of the type of the assigned field
+static bool parse_expression_value(Lexer *lexer, Prepared_Query *prepared, Update_Query *query, FieldId type, int *node)
+{
+	if ((*node = add_expression_node(query, EXPRESSION_VALUE, -1, -1)) == -1)
+		return false;
+
+	ExpressionNode *value = &query->nodes[*node];
+	if (type == HEIGHT)
+		return parse_double(lexer, prepared, &value->value.d);
+	return parse_int(lexer, prepared, &value->value.i);
+}
+
+static bool parse_expression(Lexer *lexer, Prepared_Query *prepared, Update_Query *query, FieldId type, int *node);
+
+// parses a literal, a numeric field, a negation or a parenthesized expression
+static bool parse_operand(Lexer *lexer, Prepared_Query *prepared, Update_Query *query, FieldId type, int *node)
+{
+	FieldId field;
+
+	if (token_to_field(lexer, &lexer->current, &field))
 	{
-		c->fieldId = HEIGHT;
-		return parse_double(&constraint_str, &c->fieldVal.height);
+		if (field == NAME || (*node = add_expression_node(query, EXPRESSION_FIELD, -1, -1)) == -1)
+			return false;
+		query->nodes[*node].field = field;
+		lexer_advance(lexer);
+		return true;
 	}
-	else
+
+	if (lexer_accept(lexer, TOKEN_LPAREN))
+		return parse_expression(lexer, prepared, query, type, node) && lexer_accept(lexer, TOKEN_RPAREN);
+
+	if (lexer->current.type == TOKEN_MINUS)
 	{
-		return false;
+		Lexer next = *lexer;
+		lexer_advance(&next);
+
+		// the minus of a negative literal is parsed with the literal, -x is 0 - x
+		if (next.current.type != TOKEN_NUMBER)
+		{
+			int zero, operand;
+
+			*lexer = next;
+			if ((zero = add_expression_node(query, EXPRESSION_VALUE, -1, -1)) == -1 || !parse_operand(lexer, prepared, query, type, &operand))
+				return false;
+
+			if (type == HEIGHT)
+				query->nodes[zero].value.d = 0;
+			else
+				query->nodes[zero].value.i = 0;
+			return (*node = add_expression_node(query, EXPRESSION_SUBTRACT, zero, operand)) != -1;
+		}
 	}
 
-	// unreachable, make compiler happy
-	return true;
+	return parse_expression_value(lexer, prepared, query, type, node);
 }
 
-/*
-static bool startsWith(const char *pre, const char *str)
+// parses operands combined with * and /
+static bool parse_term(Lexer *lexer, Prepared_Query *prepared, Update_Query *query, FieldId type, int *node)
 {
-	return strncmp(pre, str, strlen(pre)) == 0;
+	if (!parse_operand(lexer, prepared, query, type, node))
+		return false;
+
+	for (;;)
+	{
+		ExpressionOp op;
+		int right;
+
+		if (lexer_accept(lexer, TOKEN_STAR))
+			op = EXPRESSION_MULTIPLY;
+		else if (lexer_accept(lexer, TOKEN_SLASH))
+			op = EXPRESSION_DIVIDE;
+		else
+			return true;
+
+		if (!parse_operand(lexer, prepared, query, type, &right) || (*node = add_expression_node(query, op, *node, right)) == -1)
+			return false;
+	}
 }
-*/
 
-bool parse_select(char *sql_str, Select_Query *query)
+// parses terms combined with + and -, both bind from left to right
+static bool parse_expression(Lexer *lexer, Prepared_Query *prepared, Update_Query *query, FieldId type, int *node)
 {
-	sql_str = trimWhitespace(sql_str);
-	char *PREFIX = "SELECT *";
-	if (strcmp(sql_str, PREFIX) == 0)
+	if (!parse_term(lexer, prepared, query, type, node))
+		return false;
+
+	for (;;)
 	{
-		query->all = true;
-		return true;
+		ExpressionOp op;
+		int right;
+
+		if (lexer_accept(lexer, TOKEN_PLUS))
+			op = EXPRESSION_ADD;
+		else if (lexer_accept(lexer, TOKEN_MINUS))
+			op = EXPRESSION_SUBTRACT;
+		else
+			return true;
+
+		if (!parse_term(lexer, prepared, query, type, &right) || (*node = add_expression_node(query, op, *node, right)) == -1)
+			return false;
 	}
+}
 
-	query->all = false;
+// parses "AGE=AGE+1"
+static bool parse_assignment(Lexer *lexer, Prepared_Query *prepared, Update_Query *query)
+{
+	Assignment *assignment = &query->assignments[query->num_assignments];
+	int root;
 
-	if (parse_str(&sql_str, PREFIX))
+	if (query->num_assignments == MAX_ASSIGNMENTS || !parse_field(lexer, &assignment->fieldId) || !lexer_accept(lexer, TOKEN_ASSIGN))
+		return false;
+
+	// a field is assigned at most once
+	for (int i = 0; i < query->num_assignments; i++)
 	{
-		sql_str = trimWhitespace(sql_str);
-		return parse_constraint(sql_str, &query->constraint);
+		if (query->assignments[i].fieldId == assignment->fieldId)
+			return false;
 	}
+	query->num_assignments++;
 
-	return false;
+	if (assignment->fieldId == NAME)
+	{
+		assignment->expression = -1;
+		return parse_string(lexer, prepared, query->name);
+	}
+
+	if (!parse_expression(lexer, prepared, query, assignment->fieldId, &root))
+		return false;
+	assignment->expression = root;
+	return true;
 }
 
-static bool parse_comma_delim(char **sql_str)
+// parses what follows "UPDATE", e.g. "SET HEIGHT=183.3, AGE=AGE+1 WHERE ID == 15"
+static bool parse_update_body(Lexer *lexer, Prepared_Query *prepared, Update_Query *query)
 {
+	query->num_assignments = 0;
+	query->num_nodes = 0;
 
-	char *backup_p = *sql_str;
+	if (!lexer_accept_keyword(lexer, KW_SET))
+		return false;
 
-	*sql_str = trimWhitespace(*sql_str);
-	// printf("delim_str:\n%s\n", *sql_str);
-	if (parse_str(sql_str, ","))
+	do
 	{
-		*sql_str = trimWhitespace(*sql_str);
-		return true;
-	}
+		if (!parse_assignment(lexer, prepared, query))
+			return false;
+	} while (lexer_accept(lexer, TOKEN_COMMA));
 
-	*sql_str = backup_p;
-	return false;
+	return parse_where(lexer, prepared, &query->where) && lexer_accept(lexer, TOKEN_END);
+}
+
+bool parse_constraint(char *constraint_str, Constraint *c)
+{
+	Lexer lexer;
+	lexer_init(&lexer, constraint_str);
+	return lexer_accept_keyword(&lexer, KW_WHERE) && parse_comparison(&lexer, NULL, c) && lexer_accept(&lexer, TOKEN_END);
+}
+
+bool parse_select(char *sql_str, Select_Query *query)
+{
+	Lexer lexer;
+	lexer_init(&lexer, sql_str);
+	return lexer_accept_keyword(&lexer, KW_SELECT) && parse_select_body(&lexer, NULL, query);
 }
 
 bool parse_insert(char *sql_str, Insert_Query *query)
 {
 	// Example:
 	// INSERT(2, 21, 168.23, 'Joe Brown')
-	return parse_str(&sql_str, "INSERT(") && parse_int(&sql_str, &query->record.id) && parse_comma_delim(&sql_str) && parse_int(&sql_str, &query->record.age) && parse_comma_delim(&sql_str) && parse_double(&sql_str, &query->record.height) && parse_comma_delim(&sql_str) && parse_string_in_quotes(&sql_str, query->record.name) && parse_str(&sql_str, ")") && *sql_str == 0;
+	Lexer lexer;
+	lexer_init(&lexer, sql_str);
+	return lexer_accept_keyword(&lexer, KW_INSERT) && parse_insert_body(&lexer, NULL, query);
 }
 
 bool parse_delete(char *sql_str, Delete_Query *query)
 {
-	char *PREFIX = "DELETE ";
-	if (parse_str(&sql_str, PREFIX))
-	{
-		return parse_constraint(sql_str, &query->constraint);
-		return true;
-	}
-
-	return false;
+	Lexer lexer;
+	lexer_init(&lexer, sql_str);
+	return lexer_accept_keyword(&lexer, KW_DELETE) && parse_delete_body(&lexer, NULL, query);
 }
+
 bool parse_update(char *sql_str, Update_Query *query)
 {
 	// Example:
 	// UPDATE SET HEIGHT=183.3 WHERE ID == 15
+	Lexer lexer;
+	lexer_init(&lexer, sql_str);
+	return lexer_accept_keyword(&lexer, KW_UPDATE) && parse_update_body(&lexer, NULL, query);
+}
 
-	char* PREFIX = "UPDATE SET ";
-	if(!parse_str(&sql_str, PREFIX)) {
+// parses a statement, starting at its first keyword
+static bool parse_statement(Lexer *lexer, Prepared_Query *prepared, SQL_Query *query)
+{
+	if (lexer->current.type != TOKEN_WORD)
 		return false;
-	}
-
-	// Parse the set-field
-	if(parse_str(&sql_str, ID_STR "=") && parse_int(&sql_str, &query->val.id)) {
-		query->fieldId=ID;
 
-	} else if (parse_str(&sql_str, AGE_STR "=") && parse_int(&sql_str, &query->val.id)) {
-		query->fieldId=AGE;
-			
-	} else if (parse_str(&sql_str, HEIGHT_STR "=") && parse_double(&sql_str, &query->val.height)) {
-		query->fieldId=HEIGHT;
+	// the first keyword decides the only statement that may match
+	Keyword keyword = lexer->current.keyword;
+	lexer_advance(lexer);
 
-	} else if (parse_str(&sql_str, NAME_STR "=")) {
-		query->fieldId=NAME;
-		sql_str = trimWhitespace(sql_str);
-		if(!parse_string_in_quotes(&sql_str, query->val.name)) {
-			return false;
-		}
-	} else {
+	switch (keyword)
+	{
+	case KW_SELECT:
+		query->type = SELECT;
+		return parse_select_body(lexer, prepared, &query->query.select_q);
+	case KW_INSERT:
+		query->type = INSERT;
+		return parse_insert_body(lexer, prepared, &query->query.insert_q);
+	case KW_DELETE:
+		query->type = DELETE;
+		return parse_delete_body(lexer, prepared, &query->query.delete_q);
+	case KW_UPDATE:
+		query->type = UPDATE;
+		return parse_update_body(lexer, prepared, &query->query.update_q);
+	default:
 		return false;
-	} 
-	
-	return parse_constraint(sql_str, &query->constraint);
-
-	return false;
+	}
 }
 
 bool parse_SQL(char *sql_str, SQL_Query *query)
 {
+	Lexer lexer;
+	lexer_init(&lexer, sql_str);
+	return parse_statement(&lexer, NULL, query);
+}
 
-	// modifies sql_str!
-	sql_str = trimWhitespace(sql_str);
+bool parse_prepared(char *sql_str, Prepared_Query *prepared)
+{
+	Lexer lexer;
+	lexer_init(&lexer, sql_str);
+	prepared->num_params = 0;
+	return parse_statement(&lexer, prepared, &prepared->query);
+}
 
-	if (parse_insert(sql_str, &query->query.insert_q))
-	{
-		query->type = INSERT;
-	}
-	else if (parse_select(sql_str, &query->query.select_q))
+// the statement of the given name, NULL if there is none
+static Prepared_Statement *find_statement(Prepared_Statements *statements, const Lexer *lexer, const Token *name)
+{
+	for (int i = 0; i < statements->count; i++)
 	{
-		query->type = SELECT;
+		Prepared_Statement *statement = &statements->statements[i];
+		if (strlen(statement->name) == (size_t)name->len && memcmp(statement->name, TOKEN_TEXT(lexer, name), name->len) == 0)
+			return statement;
 	}
-	else if (parse_delete(sql_str, &query->query.delete_q))
-	{
-		query->type = DELETE;
-	}
-	else if (parse_update(sql_str, &query->query.update_q))
+	return NULL;
+}
+
+// parses what follows "PREPARE", e.g. "ins AS INSERT(?, ?, ?, ?)"
+static bool parse_prepare_body(Lexer *lexer, Prepared_Statements *statements)
+{
+	Token name = lexer->current;
+	if (name.type != TOKEN_WORD || name.keyword != KW_NONE || name.len >= MAX_STATEMENT_NAME)
+		return false;
+	lexer_advance(lexer);
+
+	if (!lexer_accept_keyword(lexer, KW_AS))
+		return false;
+
+	// parse into a scratch statement, so a failure keeps the previous one of the name
+	Prepared_Query prepared = {.num_params = 0};
+	if (!parse_statement(lexer, &prepared, &prepared.query))
+		return false;
+
+	Prepared_Statement *statement = find_statement(statements, lexer, &name);
+	if (statement == NULL)
 	{
-		query->type = UPDATE;
+		if (statements->count == MAX_PREPARED)
+			return false;
+		statement = &statements->statements[statements->count++];
+		memcpy(statement->name, TOKEN_TEXT(lexer, &name), name.len);
+		statement->name[name.len] = '\0';
 	}
-	else
-	{
+	statement->prepared = prepared;
+	return true;
+}
+
+// parses what follows "EXECUTE", e.g. "ins(2, 21, 168.23, 'Joe Brown')"
+static bool parse_execute_body(Lexer *lexer, Prepared_Statements *statements, SQL_Query *query)
+{
+	if (lexer->current.type != TOKEN_WORD)
+		return false;
+
+	Prepared_Statement *statement = find_statement(statements, lexer, &lexer->current);
+	if (statement == NULL)
+		return false;
+	lexer_advance(lexer);
+
+	const Prepared_Query *prepared = &statement->prepared;
+	*query = prepared->query;
+
+	// without parameters the parentheses are optional
+	if (prepared->num_params == 0 && lexer_accept(lexer, TOKEN_END))
+		return true;
+
+	if (!lexer_accept(lexer, TOKEN_LPAREN))
 		return false;
+
+	// only the values are parsed, straight into their place in the query
+	for (int i = 0; i < prepared->num_params; i++)
+	{
+		const Param *param = &prepared->params[i];
+		void *val = (char *)query + param->offset;
+
+		if (i > 0 && !lexer_accept(lexer, TOKEN_COMMA))
+			return false;
+
+		bool parsed = false;
+		switch (param->type)
+		{
+		case PARAM_INT:
+			parsed = parse_int(lexer, NULL, val);
+			break;
+		case PARAM_COUNT:
+			parsed = parse_count(lexer, NULL, val);
+			break;
+		case PARAM_DOUBLE:
+			parsed = parse_double(lexer, NULL, val);
+			break;
+		case PARAM_STRING:
+			parsed = parse_string(lexer, NULL, val);
+			break;
+		}
+		if (!parsed)
+			return false;
 	}
-	return true;
+
+	return lexer_accept(lexer, TOKEN_RPAREN) && lexer_accept(lexer, TOKEN_END);
+}
+
+Parse_Result parse_session_SQL(char *sql_str, Prepared_Statements *statements, SQL_Query *query)
+{
+	Lexer lexer;
+	lexer_init(&lexer, sql_str);
+
+	if (lexer_accept_keyword(&lexer, KW_PREPARE))
+		return parse_prepare_body(&lexer, statements) ? PARSE_PREPARED : PARSE_FAILED;
+
+	if (lexer_accept_keyword(&lexer, KW_EXECUTE))
+		return parse_execute_body(&lexer, statements, query) ? PARSE_QUERY : PARSE_FAILED;
+
+	return parse_statement(&lexer, NULL, query) ? PARSE_QUERY : PARSE_FAILED;
 }
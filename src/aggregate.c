@@ -0,0 +1,159 @@
+#include "aggregate.h"
+#include "compare.h"
+#include "SQL_parser.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+void aggregate_init(Aggregate_State *states, Select_Query *query)
+{
+    memset(states, 0, query->num_columns * sizeof(Aggregate_State));
+}
+
+/*
+ * Values are passed as pointers to the field, in a T_Record or a FieldVal,
+ * so that adding a record doesn't copy its name unless it's kept
+ */
+static void copy_value(FieldVal *val, void *field_ptr, FieldId field)
+{
+    if (field == NAME)
+        strcpy(val->name, field_ptr);
+    else if (field == HEIGHT)
+        val->height = *(double *)field_ptr;
+    else
+        val->id = *(int *)field_ptr;
+}
+
+// true if the value at a goes before the value at b
+static bool value_lower(void *a, void *b, FieldId field)
+{
+    switch (field)
+    {
+    case ID:
+    case AGE:
+        return int_cmp(LOWER, *(int *)a, *(int *)b);
+    case HEIGHT:
+        return double_cmp(LOWER, *(double *)a, *(double *)b);
+    case NAME:
+        return string_cmp(LOWER, a, b);
+    }
+    return false;
+}
+
+// adds count records summing to int_sum/double_sum, with the value at field_ptr as their minimum or maximum
+static void add_to_state(Aggregate_State *state, Column *column, long count, long long int_sum, double double_sum, void *field_ptr)
+{
+    switch (column->aggregate)
+    {
+    case AGG_SUM:
+    case AGG_AVG:
+        state->int_sum += int_sum;
+        state->double_sum += double_sum;
+        break;
+    case AGG_MIN:
+        if (state->count == 0 || value_lower(field_ptr, &state->value, column->field))
+            copy_value(&state->value, field_ptr, column->field);
+        break;
+    case AGG_MAX:
+        if (state->count == 0 || value_lower(&state->value, field_ptr, column->field))
+            copy_value(&state->value, field_ptr, column->field);
+        break;
+    case AGG_NONE:
+        if (state->count == 0)
+            copy_value(&state->value, field_ptr, column->field);
+        break;
+    case AGG_COUNT:
+        break;
+    }
+
+    state->count += count;
+}
+
+void aggregate_add(Aggregate_State *states, Select_Query *query, T_Record *rec)
+{
+    for (int i = 0; i < query->num_columns; i++)
+    {
+        Column *column = &query->columns[i];
+        long long int_sum = 0;
+        double double_sum = 0;
+
+        if (column->aggregate == AGG_SUM || column->aggregate == AGG_AVG)
+        {
+            if (column->field == HEIGHT)
+                double_sum = rec->height;
+            else
+                int_sum = column->field == ID ? rec->id : rec->age;
+        }
+
+        add_to_state(&states[i], column, 1, int_sum, double_sum, get_col_by_id(rec, column->field));
+    }
+}
+
+void aggregate_merge(Aggregate_State *states, Aggregate_State *partial, Select_Query *query)
+{
+    for (int i = 0; i < query->num_columns; i++)
+    {
+        if (partial[i].count > 0)
+            add_to_state(&states[i], &query->columns[i], partial[i].count, partial[i].int_sum, partial[i].double_sum, &partial[i].value);
+    }
+}
+
+static int state_to_str(Aggregate_State *state, Column *column, char *str, size_t size)
+{
+    if (column->aggregate == AGG_COUNT)
+        return snprintf(str, size, "%ld", state->count);
+
+    // the aggregates of no records
+    if (state->count == 0)
+        return snprintf(str, size, "NULL");
+
+    switch (column->aggregate)
+    {
+    case AGG_SUM:
+        if (column->field == HEIGHT)
+            return snprintf(str, size, "%lf", state->double_sum);
+        return snprintf(str, size, "%lld", state->int_sum);
+    case AGG_AVG:
+        if (column->field == HEIGHT)
+            return snprintf(str, size, "%lf", state->double_sum / state->count);
+        return snprintf(str, size, "%lf", (double)state->int_sum / state->count);
+    default:
+        switch (column->field)
+        {
+        case ID:
+            return snprintf(str, size, "%d", state->value.id);
+        case AGE:
+            return snprintf(str, size, "%d", state->value.age);
+        case HEIGHT:
+            return snprintf(str, size, "%lf", state->value.height);
+        case NAME:
+            return snprintf(str, size, "%s", state->value.name);
+        }
+    }
+    return 0;
+}
+
+bool aggregate_to_str(Aggregate_State *states, Select_Query *query, char *str, size_t size, size_t *len)
+{
+    size_t end = *len;
+
+    for (int i = 0; i < query->num_columns && end < size; i++)
+    {
+        if (i > 0)
+            str[end++] = ';';
+        if (end < size)
+            end += state_to_str(&states[i], &query->columns[i], str + end, size - end);
+    }
+
+    // room for the new line and the terminating zero
+    if (end + 1 >= size)
+    {
+        str[*len] = '\0';
+        return false;
+    }
+
+    str[end++] = '\n';
+    str[end] = '\0';
+    *len = end;
+    return true;
+}
@@ -101,3 +101,44 @@ bool satisfy_constraint(T_Record *rec, Constraint *c)
     return false;
 }
 
+static bool satisfy_node(T_Record *rec, Predicate *p, int node)
+{
+    PredicateNode *n = &p->nodes[node];
+    int child;
+
+    switch (n->op)
+    {
+    case PREDICATE_CONSTRAINT:
+        return satisfy_constraint(rec, &p->constraints[(int)n->arg]);
+
+    case PREDICATE_NOT:
+        return !satisfy_node(rec, p, n->arg);
+
+    case PREDICATE_AND:
+        // the first child not satisfied decides
+        for (child = n->arg; child != -1; child = p->nodes[child].next)
+        {
+            if (!satisfy_node(rec, p, child))
+                return false;
+        }
+        return true;
+
+    case PREDICATE_OR:
+        // the first child satisfied decides
+        for (child = n->arg; child != -1; child = p->nodes[child].next)
+        {
+            if (satisfy_node(rec, p, child))
+                return true;
+        }
+        return false;
+
+    default:
+        perror("Invalid predicate");
+        exit(EXIT_FAILURE);
+    }
+}
+
+bool satisfy_predicate(T_Record *rec, Predicate *p)
+{
+    return p->root == -1 || satisfy_node(rec, p, p->root);
+}
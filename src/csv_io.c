@@ -0,0 +1,502 @@
+#define _GNU_SOURCE // gettid
+#include "csv_io.h"
+#include "SQL_parser.h"
+#include "in_memory_db.h"
+#include "query_mq.h"
+#include "table.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <mqueue.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CSV_THREADS 64
+#define MAX_CSV_FIELD 32 // longest number of a line
+#define REPLY_TIMEOUT 10 // seconds per query, the queue outlives a transaction manager that stopped
+
+// a thread talking to the transaction manager
+typedef struct
+{
+    mqd_t query_mq;
+    mqd_t result_mq;
+    int id; // the transaction manager replies to the queue of this id
+    char result_name[sizeof(RESULTS_QUEUE_NAME) + 10];
+} Csv_Client;
+
+typedef struct
+{
+    pthread_t thread;
+    mqd_t query_mq;
+    const char *start; // whole lines of the mapped file
+    const char *end;
+    long inserted;
+    long rejected; // malformed lines and ids out of the table
+    bool failed;
+} Import_Chunk;
+
+typedef struct
+{
+    pthread_t thread;
+    mqd_t query_mq;
+    int first_id;
+    int end_id; // first id of the next range
+    char *lines;
+    size_t len;
+    size_t capacity;
+    long exported;
+    bool failed;
+} Export_Range;
+
+static int num_threads(int max)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpus > MAX_CSV_THREADS)
+        cpus = MAX_CSV_THREADS;
+    if (cpus > max)
+        cpus = max;
+    return cpus < 1 ? 1 : cpus;
+}
+
+static void client_open(Csv_Client *client, mqd_t query_mq)
+{
+    struct mq_attr attr = RESULT_QUEUE_ATTR;
+
+    client->query_mq = query_mq;
+    client->id = gettid();
+    sprintf(client->result_name, "%s.%d", RESULTS_QUEUE_NAME, client->id);
+    client->result_mq = mq_open(client->result_name, O_CREAT | O_RDONLY, QUEUE_PERMS, &attr);
+    CHECK((mqd_t)-1 != client->result_mq);
+}
+
+static void client_close(Csv_Client *client)
+{
+    mq_close(client->result_mq);
+    mq_unlink(client->result_name);
+}
+
+// sends the query to the transaction manager and waits for its result
+static bool client_query(Csv_Client *client, SQL_Query *query, char *result)
+{
+    query_msg_t query_msg;
+    struct timespec deadline;
+
+    query_msg.pid = client->id;
+    query_msg.query = *query;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += REPLY_TIMEOUT;
+
+    if (mq_timedsend(client->query_mq, (const char *)&query_msg, QUERY_MSG_SIZE, 0, &deadline) == -1)
+    {
+        perror("Transaction manager not responding, mq_timedsend");
+        return false;
+    }
+
+    while (mq_timedreceive(client->result_mq, result, RESULT_MSG_SIZE, NULL, &deadline) == -1)
+    {
+        if (errno != EINTR)
+        {
+            perror("Transaction manager not responding, mq_timedreceive");
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Copies the text up to the next comma of the line into field and moves p past
+ * the comma. Returns false if there is no comma or the field is empty or too long.
+ */
+static bool next_field(const char **p, const char *end, char *field)
+{
+    const char *comma = memchr(*p, ',', end - *p);
+    size_t len;
+
+    if (comma == NULL || (len = comma - *p) == 0 || len > MAX_CSV_FIELD)
+        return false;
+
+    memcpy(field, *p, len);
+    field[len] = '\0';
+    *p = comma + 1;
+    return true;
+}
+
+static bool next_int(const char **p, const char *end, int *val)
+{
+    char field[MAX_CSV_FIELD + 1];
+    char *tail;
+
+    if (!next_field(p, end, field))
+        return false;
+
+    errno = 0;
+    long l = strtol(field, &tail, 10);
+    if (*tail != '\0' || errno != 0 || l < INT_MIN || l > INT_MAX)
+        return false;
+
+    *val = l;
+    return true;
+}
+
+static bool next_double(const char **p, const char *end, double *val)
+{
+    char field[MAX_CSV_FIELD + 1];
+    char *tail;
+
+    if (!next_field(p, end, field))
+        return false;
+
+    *val = strtod(field, &tail);
+    return *tail == '\0' && isfinite(*val);
+}
+
+bool csv_parse_record(const char *line, const char *end, T_Record *rec)
+{
+    const char *p = line;
+
+    if (end > line && end[-1] == '\r')
+        end--;
+
+    if (!next_int(&p, end, &rec->id) || !next_int(&p, end, &rec->age) || !next_double(&p, end, &rec->height))
+        return false;
+
+    size_t len = end - p;
+    if (len >= MAX_STR_LEN)
+        return false;
+
+    memcpy(rec->name, p, len);
+    rec->name[len] = '\0';
+    return true;
+}
+
+// inserts the records of the batch, which is empty afterwards
+static bool insert_batch(Csv_Client *client, Import_Chunk *chunk, SQL_Query *query)
+{
+    Insert_Query *insert = &query->query.insert_q;
+    char result[RESULT_MSG_SIZE];
+
+    if (!client_query(client, query, result))
+        return false;
+
+    // a batch is written entirely or not at all
+    if (strncmp(result, "Insert failed", strlen("Insert failed")) == 0)
+        chunk->rejected += insert->num_records;
+    else
+        chunk->inserted += insert->num_records;
+
+    insert->num_records = 0;
+    return true;
+}
+
+static void *import_chunk(void *arg)
+{
+    Import_Chunk *chunk = arg;
+    Csv_Client client;
+    SQL_Query query;
+    Insert_Query *insert = &query.query.insert_q;
+    const char *next = chunk->start;
+
+    client_open(&client, chunk->query_mq);
+    query.type = INSERT;
+    insert->num_records = 0;
+
+    while (next < chunk->end && !chunk->failed)
+    {
+        const char *line = next;
+        const char *eol = csv_next_line(&next, chunk->end);
+
+        // blank lines are skipped
+        if (eol > line)
+        {
+            T_Record *rec = &insert->records[insert->num_records];
+
+            // ids the table can't hold would fail the whole batch, they are left out
+            if (csv_parse_record(line, eol, rec) && valid_register_id(rec->id))
+                insert->num_records++;
+            else
+                chunk->rejected++;
+        }
+
+        if (insert->num_records == MAX_INSERT_RECORDS)
+            chunk->failed = !insert_batch(&client, chunk, &query);
+    }
+
+    if (insert->num_records > 0 && !chunk->failed)
+        chunk->failed = !insert_batch(&client, chunk, &query);
+
+    client_close(&client);
+    return NULL;
+}
+
+size_t csv_line_start(const char *data, size_t size, size_t pos)
+{
+    if (pos == 0)
+        return 0;
+
+    const char *eol = memchr(data + pos - 1, '\n', size - pos + 1);
+    return eol != NULL ? (size_t)(eol - data) + 1 : size;
+}
+
+const char *csv_next_line(const char **p, const char *end)
+{
+    const char *eol = memchr(*p, '\n', end - *p);
+
+    if (eol == NULL)
+    {
+        *p = end;
+        return end;
+    }
+    *p = eol + 1;
+    return eol;
+}
+
+static mqd_t open_query_mq()
+{
+    // the queue of a running transaction manager, its message size is the one of this binary
+    mqd_t query_mq = mq_open(QUERY_QUEUE_NAME, O_WRONLY);
+
+    if (query_mq == (mqd_t)-1)
+        perror("Transaction manager not running, mq_open");
+    return query_mq;
+}
+
+int csv_import(const char *path)
+{
+    Import_Chunk chunks[MAX_CSV_THREADS];
+    long inserted = 0;
+    long rejected = 0;
+    bool failed = false;
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        perror(path);
+        if (fd != -1)
+            close(fd);
+        return 1;
+    }
+
+    size_t size = st.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        printf("Imported 0 records, rejected 0 lines\n");
+        return 0;
+    }
+
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+
+    mqd_t query_mq = open_query_mq();
+    if (query_mq == (mqd_t)-1)
+    {
+        munmap((void *)data, size);
+        return 1;
+    }
+
+    int n = num_threads(MAX_CSV_THREADS);
+    size_t start = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        size_t end = i + 1 == n ? size : csv_line_start(data, size, (i + 1) * size / n);
+
+        if (end < start)
+            end = start;
+
+        chunks[i].query_mq = query_mq;
+        chunks[i].start = data + start;
+        chunks[i].end = data + end;
+        chunks[i].inserted = 0;
+        chunks[i].rejected = 0;
+        chunks[i].failed = false;
+        CHECK(pthread_create(&chunks[i].thread, NULL, import_chunk, &chunks[i]) == 0);
+
+        start = end;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        pthread_join(chunks[i].thread, NULL);
+        inserted += chunks[i].inserted;
+        rejected += chunks[i].rejected;
+        failed |= chunks[i].failed;
+    }
+
+    mq_close(query_mq);
+    munmap((void *)data, size);
+
+    printf("Imported %ld records, rejected %ld lines\n", inserted, rejected);
+    return failed ? 1 : 0;
+}
+
+static bool reserve(Export_Range *range, size_t len)
+{
+    if (range->len + len <= range->capacity)
+        return true;
+
+    size_t capacity = range->capacity == 0 ? RESULT_MSG_SIZE : range->capacity;
+    while (capacity < range->len + len)
+        capacity *= 2;
+
+    char *lines = realloc(range->lines, capacity);
+    if (lines == NULL)
+        return false;
+
+    range->lines = lines;
+    range->capacity = capacity;
+    return true;
+}
+
+// the fields of a result line are separated by ';', the name may hold more of them
+size_t csv_from_result(const char *result, char *out, long *num_lines, int *last_id)
+{
+    size_t total = 0;
+
+    for (const char *line = result; *line != '\0';)
+    {
+        const char *eol = strchr(line, '\n');
+        size_t len = eol != NULL ? (size_t)(eol - line) + 1 : strlen(line);
+        int separators = 0;
+
+        memcpy(out + total, line, len);
+        for (size_t i = 0; i < len && separators < 3; i++)
+        {
+            if (out[total + i] == ';')
+            {
+                out[total + i] = ',';
+                separators++;
+            }
+        }
+
+        *last_id = atoi(line);
+        (*num_lines)++;
+        total += len;
+        line += len;
+    }
+
+    return total;
+}
+
+// appends the lines of a SELECT result as CSV, returns the id of the last one
+static int append_result(Export_Range *range, const char *result)
+{
+    int last_id = range->first_id;
+
+    range->len += csv_from_result(result, range->lines + range->len, &range->exported, &last_id);
+    return last_id;
+}
+
+static void *export_range(void *arg)
+{
+    Export_Range *range = arg;
+    Csv_Client client;
+    SQL_Query query;
+    char sql[64];
+    char result[RESULT_MSG_SIZE];
+    int next_id = range->first_id;
+
+    client_open(&client, range->query_mq);
+
+    // a result message holds a limited number of lines, the range is read by as many SELECTs as needed
+    while (next_id < range->end_id)
+    {
+        snprintf(sql, sizeof(sql), "SELECT * WHERE ID >= %d AND ID < %d", next_id, range->end_id);
+        CHECK(parse_SQL(sql, &query));
+
+        if (!client_query(&client, &query, result) || !reserve(range, strlen(result)))
+        {
+            range->failed = true;
+            break;
+        }
+        if (result[0] == '\0')
+            break;
+
+        next_id = append_result(range, result) + 1;
+    }
+
+    client_close(&client);
+    return NULL;
+}
+
+int csv_export(const char *path)
+{
+    Export_Range ranges[MAX_CSV_THREADS];
+    long exported = 0;
+    bool failed = false;
+
+    mqd_t query_mq = open_query_mq();
+    if (query_mq == (mqd_t)-1)
+        return 1;
+
+    int n = num_threads(NUM_RECORDS);
+
+    for (int i = 0; i < n; i++)
+    {
+        ranges[i].query_mq = query_mq;
+        ranges[i].first_id = (long)i * NUM_RECORDS / n;
+        ranges[i].end_id = (long)(i + 1) * NUM_RECORDS / n;
+        ranges[i].lines = NULL;
+        ranges[i].len = 0;
+        ranges[i].capacity = 0;
+        ranges[i].exported = 0;
+        ranges[i].failed = false;
+        CHECK(pthread_create(&ranges[i].thread, NULL, export_range, &ranges[i]) == 0);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        pthread_join(ranges[i].thread, NULL);
+        failed |= ranges[i].failed;
+    }
+    mq_close(query_mq);
+
+    FILE *file = failed ? NULL : fopen(path, "w");
+    if (!failed && file == NULL)
+    {
+        perror(path);
+        failed = true;
+    }
+
+    // the ranges in id order
+    for (int i = 0; i < n; i++)
+    {
+        if (file != NULL && fwrite(ranges[i].lines, 1, ranges[i].len, file) != ranges[i].len)
+        {
+            perror(path);
+            failed = true;
+        }
+        exported += ranges[i].exported;
+        free(ranges[i].lines);
+    }
+
+    if (file != NULL && fclose(file) != 0)
+    {
+        perror(path);
+        failed = true;
+    }
+
+    if (failed)
+        return 1;
+
+    printf("Exported %ld records\n", exported);
+    return 0;
+}
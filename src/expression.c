@@ -0,0 +1,130 @@
+#include "expression.h"
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+static bool eval_double(Update_Query *query, int node, T_Record *rec, double *val);
+
+static bool eval_int(Update_Query *query, int node, T_Record *rec, int *val)
+{
+    ExpressionNode *n = &query->nodes[node];
+    int left, right;
+    double d;
+
+    switch (n->op)
+    {
+    case EXPRESSION_VALUE:
+        *val = n->value.i;
+        return true;
+    case EXPRESSION_FIELD:
+        if (n->field != HEIGHT)
+        {
+            *val = *(int *)get_col_by_id(rec, n->field);
+            return true;
+        }
+        // truncated, like a double assigned to an int
+        d = rec->height;
+        if (!(d > INT_MIN - 1.0 && d < INT_MAX + 1.0))
+            return false;
+        *val = (int)d;
+        return true;
+    }
+
+    if (!eval_int(query, n->left, rec, &left) || !eval_int(query, n->right, rec, &right))
+        return false;
+
+    switch (n->op)
+    {
+    case EXPRESSION_ADD:
+        return !__builtin_add_overflow(left, right, val);
+    case EXPRESSION_SUBTRACT:
+        return !__builtin_sub_overflow(left, right, val);
+    case EXPRESSION_MULTIPLY:
+        return !__builtin_mul_overflow(left, right, val);
+    case EXPRESSION_DIVIDE:
+        if (right == 0 || (left == INT_MIN && right == -1))
+            return false;
+        *val = left / right;
+        return true;
+    }
+    return false;
+}
+
+static bool eval_double(Update_Query *query, int node, T_Record *rec, double *val)
+{
+    ExpressionNode *n = &query->nodes[node];
+    double left, right;
+
+    switch (n->op)
+    {
+    case EXPRESSION_VALUE:
+        *val = n->value.d;
+        return true;
+    case EXPRESSION_FIELD:
+        *val = n->field == HEIGHT ? rec->height : *(int *)get_col_by_id(rec, n->field);
+        return true;
+    }
+
+    if (!eval_double(query, n->left, rec, &left) || !eval_double(query, n->right, rec, &right))
+        return false;
+
+    switch (n->op)
+    {
+    case EXPRESSION_ADD:
+        *val = left + right;
+        break;
+    case EXPRESSION_SUBTRACT:
+        *val = left - right;
+        break;
+    case EXPRESSION_MULTIPLY:
+        *val = left * right;
+        break;
+    case EXPRESSION_DIVIDE:
+        if (right == 0)
+            return false;
+        *val = left / right;
+        break;
+    default:
+        return false;
+    }
+
+    // overflow to infinity
+    return isfinite(*val);
+}
+
+bool apply_assignments(Update_Query *query, T_Record *rec)
+{
+    T_Record updated = *rec;
+
+    for (int i = 0; i < query->num_assignments; i++)
+    {
+        Assignment *assignment = &query->assignments[i];
+        bool ok = true;
+
+        switch (assignment->fieldId)
+        {
+        case ID:
+            ok = eval_int(query, assignment->expression, rec, &updated.id);
+            break;
+        case AGE:
+            ok = eval_int(query, assignment->expression, rec, &updated.age);
+            break;
+        case HEIGHT:
+            ok = eval_double(query, assignment->expression, rec, &updated.height);
+            break;
+        case NAME:
+            strcpy(updated.name, query->name);
+            break;
+        }
+
+        if (!ok)
+            return false;
+    }
+
+    if (updated.id != rec->id)
+        return false;
+
+    *rec = updated;
+    return true;
+}
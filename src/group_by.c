@@ -0,0 +1,369 @@
+#define _GNU_SOURCE // qsort_r
+#include "group_by.h"
+#include "aggregate.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#define INITIAL_CAPACITY 16
+
+/*
+ * Keys are passed as pointers to the field, in a T_Record or a FieldVal,
+ * so a record's name is only copied when it starts a new group
+ */
+static uint64_t hash_key(void *key, FieldId field)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    switch (field)
+    {
+    case ID:
+    case AGE:
+        hash = (uint32_t) * (int *)key;
+        break;
+    case HEIGHT:
+    {
+        // 0.0 and -0.0 are the same group
+        double height = *(double *)key == 0 ? 0 : *(double *)key;
+        memcpy(&hash, &height, sizeof(hash));
+        break;
+    }
+    case NAME:
+        // FNV-1a
+        for (unsigned char *c = key; *c != '\0'; c++)
+        {
+            hash ^= *c;
+            hash *= 1099511628211ULL;
+        }
+        break;
+    }
+
+    // finalizer of splitmix64, spreads the bits of near keys over the table
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+// negative, zero or positive as the key at a goes before, equals or goes after the key at b
+static int compare_keys(const void *a, const void *b, FieldId field)
+{
+    switch (field)
+    {
+    case ID:
+    case AGE:
+        return (*(int *)a > *(int *)b) - (*(int *)a < *(int *)b);
+    case HEIGHT:
+        return (*(double *)a > *(double *)b) - (*(double *)a < *(double *)b);
+    case NAME:
+        return strcmp(a, b);
+    }
+    return 0;
+}
+
+static int compare_groups(const void *a, const void *b, void *field)
+{
+    return compare_keys(&((Group *)a)->key, &((Group *)b)->key, *(FieldId *)field);
+}
+
+static void copy_key(FieldVal *dst, void *key, FieldId field)
+{
+    if (field == NAME)
+        strcpy(dst->name, key);
+    else if (field == HEIGHT)
+        dst->height = *(double *)key;
+    else
+        dst->id = *(int *)key;
+}
+
+void group_table_init(Group_Table *table, Select_Query *query, size_t memory_budget)
+{
+    table->query = query;
+    table->memory_budget = memory_budget;
+    table->max_capacity = INITIAL_CAPACITY;
+    while (table->max_capacity * 2 * sizeof(Group) <= memory_budget)
+        table->max_capacity *= 2;
+    table->capacity = INITIAL_CAPACITY;
+    table->count = 0;
+    table->groups = calloc(table->capacity, sizeof(Group));
+    CHECK(table->groups != NULL);
+    table->spill_file = NULL;
+    table->spill_size = 0;
+    table->runs = NULL;
+    table->num_runs = 0;
+}
+
+void group_table_destroy(Group_Table *table)
+{
+    if (table->spill_file != NULL)
+        fclose(table->spill_file);
+    free(table->runs);
+    free(table->groups);
+}
+
+// moves the groups to the start of the table, sorted by key, returns their number
+static size_t sort_groups(Group_Table *table)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < table->capacity; i++)
+    {
+        if (table->groups[i].used)
+            table->groups[count++] = table->groups[i];
+    }
+    qsort_r(table->groups, count, sizeof(Group), compare_groups, &table->query->group_by);
+
+    return count;
+}
+
+static void clear(Group_Table *table)
+{
+    for (size_t i = 0; i < table->capacity; i++)
+        table->groups[i].used = false;
+    table->count = 0;
+}
+
+// appends the groups to the spill file as a new sorted run and empties the table
+static void spill(Group_Table *table)
+{
+    size_t count = sort_groups(table);
+    size_t bytes = count * sizeof(Group);
+
+    if (table->spill_file == NULL)
+    {
+        table->spill_file = tmpfile();
+        CHECK(table->spill_file != NULL);
+    }
+    CHECK(pwrite(fileno(table->spill_file), table->groups, bytes, table->spill_size) == (ssize_t)bytes);
+
+    table->runs = realloc(table->runs, (table->num_runs + 1) * sizeof(Group_Run));
+    CHECK(table->runs != NULL);
+    table->runs[table->num_runs].start = table->spill_size;
+    table->runs[table->num_runs].count = count;
+    table->num_runs++;
+    table->spill_size += bytes;
+
+    clear(table);
+}
+
+/*
+ * Reads a sorted run in batches, so the merge doesn't take a system call per group.
+ * The groups of a table that never spilled are a run already in memory.
+ */
+typedef struct
+{
+    int fd;         // spill file of the run, -1 if it is in memory
+    Group_Run rest; // the part of the run still on file
+    Group *batch;
+    size_t next;
+    size_t count;
+} Run_Reader;
+
+// the next group of the run, NULL at the end of the run
+static Group *run_head(Run_Reader *reader, size_t batch_size)
+{
+    if (reader->next == reader->count)
+    {
+        size_t count = reader->rest.count < batch_size ? reader->rest.count : batch_size;
+        size_t bytes = count * sizeof(Group);
+
+        if (count == 0)
+            return NULL;
+        CHECK(pread(reader->fd, reader->batch, bytes, reader->rest.start) == (ssize_t)bytes);
+        reader->rest.start += bytes;
+        reader->rest.count -= count;
+        reader->next = 0;
+        reader->count = count;
+    }
+    return &reader->batch[reader->next];
+}
+
+// slot of the key: its group, or the free slot where its group goes
+static Group *probe(Group_Table *table, void *key, uint64_t hash)
+{
+    size_t mask = table->capacity - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        Group *group = &table->groups[i];
+        if (!group->used || (group->hash == hash && compare_keys(&group->key, key, table->query->group_by) == 0))
+            return group;
+    }
+}
+
+static void grow(Group_Table *table)
+{
+    Group *old = table->groups;
+    size_t old_capacity = table->capacity;
+
+    table->capacity *= 2;
+    table->groups = calloc(table->capacity, sizeof(Group));
+    CHECK(table->groups != NULL);
+
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old[i].used)
+            *probe(table, &old[i].key, old[i].hash) = old[i];
+    }
+    free(old);
+}
+
+void group_table_add(Group_Table *table, T_Record *rec)
+{
+    Select_Query *query = table->query;
+    void *key = get_col_by_id(rec, query->group_by);
+    uint64_t hash = hash_key(key, query->group_by);
+    Group *group = probe(table, key, hash);
+
+    if (!group->used)
+    {
+        // keep the load factor under 3/4
+        if (4 * (table->count + 1) > 3 * table->capacity)
+        {
+            if (table->capacity < table->max_capacity)
+                grow(table);
+            else
+                spill(table);
+            group = probe(table, key, hash);
+        }
+
+        group->used = true;
+        group->hash = hash;
+        copy_key(&group->key, key, query->group_by);
+        aggregate_init(group->states, query);
+        table->count++;
+    }
+
+    aggregate_add(group->states, query, rec);
+}
+
+// merges the sorted runs, combining the groups of equal keys
+static void merge_runs(Select_Query *query, Run_Reader *readers, int num_readers, size_t batch_size,
+                       char *str, size_t size, size_t *len)
+{
+    Group current;
+    bool has_current = false;
+    bool full = false;
+
+    for (;;)
+    {
+        Group *min = NULL;
+        int min_run = -1;
+        for (int i = 0; i < num_readers; i++)
+        {
+            Group *head = run_head(&readers[i], batch_size);
+            if (head != NULL && (min == NULL || compare_keys(&head->key, &min->key, query->group_by) < 0))
+            {
+                min = head;
+                min_run = i;
+            }
+        }
+        if (min == NULL)
+            break;
+
+        if (has_current && compare_keys(&current.key, &min->key, query->group_by) == 0)
+        {
+            aggregate_merge(current.states, min->states, query);
+        }
+        else
+        {
+            if (has_current && !aggregate_to_str(current.states, query, str, size, len))
+            {
+                full = true;
+                break;
+            }
+            current = *min;
+            has_current = true;
+        }
+
+        readers[min_run].next++;
+    }
+
+    if (has_current && !full)
+        aggregate_to_str(current.states, query, str, size, len);
+}
+
+void group_tables_to_str(Group_Table *tables, int num_tables, char *str, size_t size, size_t *len)
+{
+    int num_readers = 0;
+    int num_spilled = 0;
+
+    if (num_tables == 0)
+        return;
+    if (num_tables == 1 && tables[0].num_runs == 0)
+    {
+        // already all in memory, nothing to combine
+        size_t count = sort_groups(&tables[0]);
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!aggregate_to_str(tables[0].groups[i].states, tables[0].query, str, size, len))
+                break; // the result is full
+        }
+        clear(&tables[0]);
+        return;
+    }
+
+    // a table that spilled is all written out, its runs are read back from the file
+    for (int t = 0; t < num_tables; t++)
+    {
+        if (tables[t].num_runs > 0)
+        {
+            spill(&tables[t]);
+            num_spilled += tables[t].num_runs;
+            num_readers += tables[t].num_runs;
+        }
+        else
+        {
+            num_readers++;
+        }
+    }
+
+    // the batches of the runs on file share the memory budget
+    size_t batch_size = num_spilled == 0 ? 0 : tables[0].memory_budget / sizeof(Group) / num_spilled;
+    if (batch_size == 0)
+        batch_size = 1;
+    Run_Reader *readers = malloc(num_readers * sizeof(Run_Reader));
+    Group *batches = malloc(num_spilled * batch_size * sizeof(Group));
+    CHECK(readers != NULL && (num_spilled == 0 || batches != NULL));
+
+    int r = 0, b = 0;
+    for (int t = 0; t < num_tables; t++)
+    {
+        Group_Table *table = &tables[t];
+        if (table->num_runs == 0)
+        {
+            readers[r].fd = -1;
+            readers[r].rest.start = 0;
+            readers[r].rest.count = 0;
+            readers[r].batch = table->groups;
+            readers[r].next = 0;
+            readers[r].count = sort_groups(table);
+            r++;
+            continue;
+        }
+        for (int i = 0; i < table->num_runs; i++, r++)
+        {
+            readers[r].fd = fileno(table->spill_file);
+            readers[r].rest = table->runs[i];
+            readers[r].batch = &batches[b++ * batch_size];
+            readers[r].next = 0;
+            readers[r].count = 0;
+        }
+    }
+    merge_runs(tables[0].query, readers, num_readers, batch_size, str, size, len);
+
+    for (int t = 0; t < num_tables; t++)
+        clear(&tables[t]);
+    free(batches);
+    free(readers);
+}
+
+void group_table_to_str(Group_Table *table, char *str, size_t size, size_t *len)
+{
+    group_tables_to_str(table, 1, str, size, len);
+}
@@ -5,6 +5,13 @@
 #include <stdio.h>
 #include <util.h>
 
+// every lock and release, too slow and too contended for scans of many records
+#ifdef DEBUG_LOCKS
+#define LOCK_LOG(...) printf(__VA_ARGS__)
+#else
+#define LOCK_LOG(...)
+#endif
+
 static table_t db_table = NULL;
 static pthread_mutex_t db_table_lock = PTHREAD_MUTEX_INITIALIZER;
 
@@ -33,7 +40,13 @@ void open_table()
 
 T_PersistRecord *get_next_record(int id, bool write_lock)
 {
-    CHECK(id >= -1 && id < NUM_RECORDS);
+    return get_next_record_in(id, 0, NUM_RECORDS, write_lock);
+}
+
+T_PersistRecord *get_next_record_in(int id, int first, int end, bool write_lock)
+{
+    CHECK(first >= 0 && first <= end && end <= NUM_RECORDS);
+    CHECK(id == -1 || (id >= first && id < end));
 
     T_PersistRecord *prec;
     T_PersistRecord *(*access_reg_func)(int);
@@ -47,33 +60,32 @@ T_PersistRecord *get_next_record(int id, bool write_lock)
         access_reg_func = &access_register_read;
     }
 
-    for (int i = id; i < NUM_RECORDS; i++)
+    if (id == -1)
     {
-        if (i > -1)
-        {
-            release_register(i);
-        }
-
-        if (i + 1 == NUM_RECORDS)
-        { // no next record
-            return NULL;
-        }
+        id = first - 1;
+    }
+    else
+    {
+        release_register(id);
+    }
 
-        prec = access_reg_func(i + 1);
+    for (int i = id + 1; i < end; i++)
+    {
+        prec = access_reg_func(i);
         if (prec->used)
         {
             return prec;
         }
+        release_register(i);
     }
 
-
-    // make compiler happy
+    // no next record
     return NULL;
 }
 
 T_PersistRecord *access_register_read(int id)
 {
-    printf("Locking read %d\n", id);
+    LOCK_LOG("Locking read %d\n", id);
     int result = pthread_rwlock_rdlock(&db_table[id].rw_lock);
     CHECK(result == 0);
 
@@ -82,7 +94,7 @@ T_PersistRecord *access_register_read(int id)
 
 T_PersistRecord *access_register_write(int id)
 {
-    printf("Locking write %d\n", id);
+    LOCK_LOG("Locking write %d\n", id);
     int result = pthread_rwlock_wrlock(&db_table[id].rw_lock);
     CHECK(result == 0);
     return &db_table[id];
@@ -90,6 +102,46 @@ T_PersistRecord *access_register_write(int id)
 
 void release_register(int id)
 {
-    printf("Releasing %d\n", id);
+    LOCK_LOG("Releasing %d\n", id);
     pthread_rwlock_unlock(&db_table[id].rw_lock);
 }
+
+bool valid_register_id(int id)
+{
+    return id >= 0 && id < NUM_RECORDS;
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+    return *(int *)a - *(int *)b;
+}
+
+int access_registers_write(int *ids, int count)
+{
+    int distinct = 0;
+
+    qsort(ids, count, sizeof(int), compare_ids);
+
+    for (int i = 0; i < count; i++)
+    {
+        if (distinct > 0 && ids[distinct - 1] == ids[i])
+            continue;
+        ids[distinct++] = ids[i];
+        access_register_write(ids[i]);
+    }
+
+    return distinct;
+}
+
+void release_registers(int *ids, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        release_register(ids[i]);
+    }
+}
+
+T_PersistRecord *get_register(int id)
+{
+    return &db_table[id];
+}
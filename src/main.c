@@ -1,5 +1,6 @@
 #include "pc_main.h"
 #include "transaction_mg.h"
+#include "csv_io.h"
 #include <stdio.h>
 #include <string.h>
 #include "SQL_parser.h"
@@ -13,11 +14,24 @@ static void print_usage()
    printf("$ ./simple-db pc\n\n");
 
    printf("To start transaction manager:\n");
-   printf("$ ./simple-db tm\n");
+   printf("$ ./simple-db tm\n\n");
+
+   printf("To load or dump the table of a running transaction manager:\n");
+   printf("$ ./simple-db import <file.csv>\n");
+   printf("$ ./simple-db export <file.csv>\n");
 }
 
 int main(int argc, char **argv)
 {
+   if (argc == 3 && strcmp(argv[1], "import") == 0)
+   {
+      return csv_import(argv[2]);
+   }
+   else if (argc == 3 && strcmp(argv[1], "export") == 0)
+   {
+      return csv_export(argv[2]);
+   }
+
    if (argc != 2)
    {
       print_usage();
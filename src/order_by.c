@@ -0,0 +1,141 @@
+#define _GNU_SOURCE // qsort_r
+#include "order_by.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define INITIAL_CAPACITY 16
+
+// negative, zero or positive as a goes before, with or after b in the order of the sorter
+static int compare_records(const void *a, const void *b, void *arg)
+{
+    Sorter *sorter = arg;
+    const T_Record *r1 = a;
+    const T_Record *r2 = b;
+    int cmp = 0;
+
+    switch (sorter->field)
+    {
+    case ID:
+        cmp = (r1->id > r2->id) - (r1->id < r2->id);
+        break;
+    case AGE:
+        cmp = (r1->age > r2->age) - (r1->age < r2->age);
+        break;
+    case HEIGHT:
+        cmp = (r1->height > r2->height) - (r1->height < r2->height);
+        break;
+    case NAME:
+        cmp = strcmp(r1->name, r2->name);
+        break;
+    }
+
+    return sorter->descending ? -cmp : cmp;
+}
+
+void sorter_init(Sorter *sorter, Select_Query *query)
+{
+    sorter->field = query->order_by;
+    sorter->descending = query->descending;
+    sorter->bounded = query->limited;
+    sorter->bound = sorter->bounded ? (size_t)query->offset + query->limit : 0;
+    sorter->capacity = 0;
+    sorter->count = 0;
+    sorter->records = NULL;
+}
+
+void sorter_destroy(Sorter *sorter)
+{
+    free(sorter->records);
+}
+
+/*
+ * Makes room for one more record. The array grows with the records added, never
+ * past the bound, so a large LIMIT costs no more than the records that are there.
+ */
+static void grow(Sorter *sorter)
+{
+    size_t capacity = sorter->capacity == 0 ? INITIAL_CAPACITY : 2 * sorter->capacity;
+
+    if (sorter->bounded && capacity > sorter->bound)
+        capacity = sorter->bound;
+    sorter->records = realloc(sorter->records, capacity * sizeof(T_Record));
+    CHECK(sorter->records != NULL);
+    sorter->capacity = capacity;
+}
+
+static void swap(T_Record *a, T_Record *b)
+{
+    T_Record tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+// moves the record at i up the heap while it goes after its parent
+static void sift_up(Sorter *sorter, size_t i)
+{
+    while (i > 0)
+    {
+        size_t parent = (i - 1) / 2;
+        if (compare_records(&sorter->records[i], &sorter->records[parent], sorter) <= 0)
+            break;
+        swap(&sorter->records[i], &sorter->records[parent]);
+        i = parent;
+    }
+}
+
+// moves the record at i down the heap while a child goes after it
+static void sift_down(Sorter *sorter, size_t i)
+{
+    for (;;)
+    {
+        size_t last = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+
+        if (left < sorter->count && compare_records(&sorter->records[left], &sorter->records[last], sorter) > 0)
+            last = left;
+        if (right < sorter->count && compare_records(&sorter->records[right], &sorter->records[last], sorter) > 0)
+            last = right;
+        if (last == i)
+            return;
+
+        swap(&sorter->records[i], &sorter->records[last]);
+        i = last;
+    }
+}
+
+void sorter_add(Sorter *sorter, T_Record *rec)
+{
+    if (!sorter->bounded)
+    {
+        if (sorter->count == sorter->capacity)
+            grow(sorter);
+        sorter->records[sorter->count++] = *rec;
+        return;
+    }
+
+    if (sorter->count < sorter->bound)
+    {
+        if (sorter->count == sorter->capacity)
+            grow(sorter);
+        sorter->records[sorter->count] = *rec;
+        sift_up(sorter, sorter->count++);
+    }
+    else if (sorter->bound > 0 && compare_records(rec, &sorter->records[0], sorter) < 0)
+    {
+        // the record goes before the last one kept, which drops out
+        sorter->records[0] = *rec;
+        sift_down(sorter, 0);
+    }
+}
+
+T_Record *sorter_finish(Sorter *sorter, size_t *count)
+{
+    if (sorter->count > 1)
+        qsort_r(sorter->records, sorter->count, sizeof(T_Record), compare_records, sorter);
+    *count = sorter->count;
+    return sorter->records;
+}
@@ -12,6 +12,7 @@
 #include <errno.h>
 #include <mqueue.h>
 #include "SQL_parser.h"
+#include "plan_cache.h"
 #include "table.h"
 #include "pc_main.h"
 #include "query_mq.h"
@@ -19,6 +20,18 @@
 
 static mqd_t query_mq;
 
+// statements prepared by the client of this process
+static Prepared_Statements prepared_statements;
+
+// shapes of the queries of the client of this process
+static Plan_Cache plan_cache;
+
+static void print_plan_cache_stats()
+{
+	printf("Plan cache: %lu hits, %lu misses, %lu evictions, %lu bypasses\n",
+		   plan_cache.hits, plan_cache.misses, plan_cache.evictions, plan_cache.bypasses);
+}
+
 static void open_query_mq()
 {
 	/* open the mail queue */
@@ -64,6 +77,15 @@ static void childSignalHandler(int s)
 	}
 }
 
+/*
+ * Bytes received from the client of this process and not returned by readLine
+ * yet; reading a socket a byte at a time costs a system call per byte, which
+ * dominates for long lines like multi-row INSERTs
+ */
+static char recv_buffer[MAX_QUERY_LEN];
+static size_t recv_pos;
+static size_t recv_len;
+
 static ssize_t readLine(int fd, void *buffer, size_t n)
 {
 	ssize_t numRead; /* # of bytes fetched by last read() */
@@ -82,36 +104,42 @@ static ssize_t readLine(int fd, void *buffer, size_t n)
 	totRead = 0;
 	for (;;)
 	{
-		numRead = read(fd, &ch, 1);
-
-		if (numRead == -1)
+		if (recv_pos == recv_len)
 		{
-			if (errno == EINTR) /* Interrupted --> restart read() */
-				continue;
-			else
-				return -1; /* Some other error */
-		}
-		else if (numRead == 0)
-		{					  /* EOF */
-			if (totRead == 0) /* No bytes read; return 0 */
-				return 0;
-			else /* Some bytes read; add '\0' */
-				break;
-		}
-		else
-		{ /* 'numRead' must be 1 if we get here */
-			if (totRead < n - 1)
-			{ /* Discard > (n - 1) bytes */
-				totRead++;
-				*buf++ = ch;
-			}
+			numRead = read(fd, recv_buffer, sizeof(recv_buffer));
 
-			if (ch == '\n')
+			if (numRead == -1)
 			{
-				*(buf - 1) = '\0';
-				totRead--;
-				break;
+				if (errno == EINTR) /* Interrupted --> restart read() */
+					continue;
+				else
+					return -1; /* Some other error */
 			}
+			else if (numRead == 0)
+			{					  /* EOF */
+				if (totRead == 0) /* No bytes read; return 0 */
+					return 0;
+				else /* Some bytes read; add '\0' */
+					break;
+			}
+
+			recv_pos = 0;
+			recv_len = numRead;
+		}
+
+		ch = recv_buffer[recv_pos++];
+
+		if (totRead < n - 1)
+		{ /* Discard > (n - 1) bytes */
+			totRead++;
+			*buf++ = ch;
+		}
+
+		if (ch == '\n')
+		{
+			*(buf - 1) = '\0';
+			totRead--;
+			break;
 		}
 	}
 
@@ -160,6 +188,7 @@ static void handle_client_query(int client_fd)
 	if (recv_res == -1)
 	{
 		perror("Connection closed.");
+		print_plan_cache_stats();
 		close(client_fd);
 		exit(EXIT_SUCCESS);
 	}
@@ -167,6 +196,7 @@ static void handle_client_query(int client_fd)
 	{
 		/* empty line ends session */
 		printf("Client ended connection.\n");
+		print_plan_cache_stats();
 		close(client_fd);
 		exit(EXIT_SUCCESS);
 	}
@@ -176,19 +206,22 @@ static void handle_client_query(int client_fd)
 	query_msg_t query_msg;
 	query_msg.pid = getpid();
 
-	if (parse_SQL(sqlCommand, &query_msg.query))
+	switch (plan_cache_parse(&plan_cache, &prepared_statements, sqlCommand, &query_msg.query))
 	{
+	case PARSE_QUERY:
 		// send_to_client(client_fd, "SQL query successfully parsed!\n");
 		mq_send(query_mq, (const char *)&query_msg, QUERY_MSG_SIZE, 0);
 
 		// wait for a query result from transaction_mg and pass it to client socket
 		handle_result(client_fd);
-
-	}
-	else
-	{
+		break;
+	case PARSE_PREPARED:
+		send_to_client(client_fd, "Prepare OK\n");
+		break;
+	case PARSE_FAILED:
 		printf("Invalid SQL query!\n");
 		send_to_client(client_fd, "Invalid SQL query!\n");
+		break;
 	}
 }
 
@@ -286,6 +319,7 @@ int protocol_engine()
 
 			printf("Incoming connection from %s:%d\n", clientIP, clientPort);
 			open_query_mq();
+			plan_cache_init(&plan_cache);
 
 			for (;;)
 			{
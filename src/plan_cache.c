@@ -0,0 +1,250 @@
+#include "plan_cache.h"
+#include "SQL_lexer.h"
+#include "SQL_parser.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// a literal of the line, in the place of a "?" of its fingerprint
+typedef struct
+{
+	Token token;
+	bool negative;
+} Literal;
+
+void plan_cache_init(Plan_Cache *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+	for (int i = 0; i < PLAN_CACHE_BUCKETS; i++)
+		cache->buckets[i] = -1;
+	cache->lru_first = -1;
+	cache->lru_last = -1;
+}
+
+// FNV-1a
+static uint64_t hash_fingerprint(const char *fingerprint, int len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (int i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)fingerprint[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool append(char *fingerprint, int *len, const char *text, int text_len)
+{
+	// room for a separator and the terminating zero
+	if (*len + text_len + 2 > MAX_FINGERPRINT_LEN)
+		return false;
+
+	if (*len > 0)
+		fingerprint[(*len)++] = ' ';
+	memcpy(fingerprint + *len, text, text_len);
+	*len += text_len;
+	fingerprint[*len] = '\0';
+	return true;
+}
+
+/*
+ * Builds the fingerprint of the query and collects its literals. Returns false
+ * if the query has to bypass the cache.
+ */
+static bool fingerprint_query(Lexer *lexer, char *fingerprint, int *len, Literal *literals, int *num_literals)
+{
+	*len = 0;
+	*num_literals = 0;
+	fingerprint[0] = '\0';
+
+	if (lexer->current.keyword == KW_PREPARE || lexer->current.keyword == KW_EXECUTE)
+		return false;
+
+	// a minus right after an operand is a binary minus, not the sign of a literal
+	bool after_operand = false;
+
+	for (; lexer->current.type != TOKEN_END; lexer_advance(lexer))
+	{
+		Token *token = &lexer->current;
+		bool negative = false;
+
+		if (token->type == TOKEN_INVALID || token->type == TOKEN_PARAM)
+			return false; // the cache would change how they fail
+
+		if (token->type == TOKEN_MINUS && !after_operand)
+		{
+			Lexer next = *lexer;
+			lexer_advance(&next);
+			if (next.current.type == TOKEN_NUMBER)
+			{
+				*lexer = next;
+				negative = true;
+			}
+		}
+
+		if (token->type == TOKEN_NUMBER || token->type == TOKEN_STRING)
+		{
+			if (*num_literals == MAX_PARAMS || !append(fingerprint, len, "?", 1))
+				return false;
+			literals[*num_literals].token = *token;
+			literals[*num_literals].negative = negative;
+			(*num_literals)++;
+		}
+		else if (!append(fingerprint, len, TOKEN_TEXT(lexer, token), token->len))
+		{
+			return false;
+		}
+
+		after_operand = token->type == TOKEN_NUMBER || token->type == TOKEN_STRING || token->type == TOKEN_RPAREN || (token->type == TOKEN_WORD && token->keyword == KW_NONE);
+	}
+
+	return true;
+}
+
+// copies the literals into their parameters in a copy of the prepared query
+static bool bind_literals(const Prepared_Query *prepared, const Lexer *lexer, const Literal *literals, int num_literals, SQL_Query *query)
+{
+	if (prepared->num_params != num_literals)
+		return false;
+
+	*query = prepared->query;
+
+	for (int i = 0; i < num_literals; i++)
+	{
+		const Param *param = &prepared->params[i];
+		const Token *token = &literals[i].token;
+		void *val = (char *)query + param->offset;
+
+		switch (param->type)
+		{
+		case PARAM_INT:
+			if (!token_to_int(lexer, token, literals[i].negative, val))
+				return false;
+			break;
+		case PARAM_COUNT:
+			if (literals[i].negative || !token_to_int(lexer, token, false, val))
+				return false;
+			break;
+		case PARAM_DOUBLE:
+			if (!token_to_double(lexer, token, literals[i].negative, val))
+				return false;
+			break;
+		case PARAM_STRING:
+			// strip the quotes
+			if (token->type != TOKEN_STRING || token->len - 2 >= MAX_STR_LEN)
+				return false;
+			memcpy(val, TOKEN_TEXT(lexer, token) + 1, token->len - 2);
+			((char *)val)[token->len - 2] = '\0';
+			break;
+		}
+	}
+
+	return true;
+}
+
+static void lru_unlink(Plan_Cache *cache, int index)
+{
+	Plan_Cache_Entry *entry = &cache->entries[index];
+
+	if (entry->lru_prev != -1)
+		cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+	else
+		cache->lru_first = entry->lru_next;
+
+	if (entry->lru_next != -1)
+		cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+	else
+		cache->lru_last = entry->lru_prev;
+}
+
+static void lru_push_front(Plan_Cache *cache, int index)
+{
+	Plan_Cache_Entry *entry = &cache->entries[index];
+
+	entry->lru_prev = -1;
+	entry->lru_next = cache->lru_first;
+	if (cache->lru_first != -1)
+		cache->entries[cache->lru_first].lru_prev = index;
+	else
+		cache->lru_last = index;
+	cache->lru_first = index;
+}
+
+static Plan_Cache_Entry *lookup(Plan_Cache *cache, uint64_t hash, const char *fingerprint)
+{
+	for (int i = cache->buckets[hash % PLAN_CACHE_BUCKETS]; i != -1; i = cache->entries[i].bucket_next)
+	{
+		Plan_Cache_Entry *entry = &cache->entries[i];
+		if (entry->hash == hash && strcmp(entry->fingerprint, fingerprint) == 0)
+		{
+			lru_unlink(cache, i);
+			lru_push_front(cache, i);
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+// takes a free entry, or the least recently used one once the cache is full
+static int take_entry(Plan_Cache *cache)
+{
+	if (cache->count < PLAN_CACHE_SIZE)
+		return cache->count++;
+
+	int index = cache->lru_last;
+	Plan_Cache_Entry *entry = &cache->entries[index];
+	int *link = &cache->buckets[entry->hash % PLAN_CACHE_BUCKETS];
+
+	while (*link != index)
+		link = &cache->entries[*link].bucket_next;
+	*link = entry->bucket_next;
+
+	lru_unlink(cache, index);
+	cache->evictions++;
+	return index;
+}
+
+static void insert(Plan_Cache *cache, uint64_t hash, const char *fingerprint, const Prepared_Query *prepared)
+{
+	int index = take_entry(cache);
+	Plan_Cache_Entry *entry = &cache->entries[index];
+	int *bucket = &cache->buckets[hash % PLAN_CACHE_BUCKETS];
+
+	entry->hash = hash;
+	strcpy(entry->fingerprint, fingerprint);
+	entry->prepared = *prepared;
+	entry->bucket_next = *bucket;
+	*bucket = index;
+	lru_push_front(cache, index);
+}
+
+Parse_Result plan_cache_parse(Plan_Cache *cache, Prepared_Statements *statements, char *sql_str, SQL_Query *query)
+{
+	char fingerprint[MAX_FINGERPRINT_LEN];
+	Literal literals[MAX_PARAMS];
+	int len, num_literals;
+	Lexer lexer;
+
+	lexer_init(&lexer, sql_str);
+	if (!fingerprint_query(&lexer, fingerprint, &len, literals, &num_literals))
+	{
+		cache->bypasses++;
+		return parse_session_SQL(sql_str, statements, query);
+	}
+
+	uint64_t hash = hash_fingerprint(fingerprint, len);
+	Plan_Cache_Entry *entry = lookup(cache, hash, fingerprint);
+	if (entry != NULL)
+	{
+		cache->hits++;
+		return bind_literals(&entry->prepared, &lexer, literals, num_literals, query) ? PARSE_QUERY : PARSE_FAILED;
+	}
+
+	cache->misses++;
+	Prepared_Query prepared;
+	if (!parse_prepared(fingerprint, &prepared))
+		return PARSE_FAILED;
+
+	insert(cache, hash, fingerprint, &prepared);
+	return bind_literals(&prepared, &lexer, literals, num_literals, query) ? PARSE_QUERY : PARSE_FAILED;
+}
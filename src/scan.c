@@ -0,0 +1,144 @@
+#include "scan.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// morsels not taken yet of a worker
+typedef struct
+{
+    pthread_mutex_t lock;
+    int front; // next morsel of the owner
+    int back;  // end of the morsels, thieves take the one before
+} Morsel_Deque;
+
+typedef struct
+{
+    Morsel_Func func;
+    void *arg;
+    int first; // first slot of morsel 0
+    int end;
+    int morsel_size;
+    int num_morsels;
+    int num_workers;
+    Morsel_Deque deques[MAX_SCAN_WORKERS];
+} Scan;
+
+typedef struct
+{
+    Scan *scan;
+    int worker;
+    pthread_t thread;
+} Scan_Worker;
+
+static bool take_front(Morsel_Deque *deque, int *morsel)
+{
+    bool taken = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->front < deque->back)
+    {
+        *morsel = deque->front++;
+        taken = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return taken;
+}
+
+static bool steal_back(Morsel_Deque *deque, int *morsel)
+{
+    bool taken = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->front < deque->back)
+    {
+        *morsel = --deque->back;
+        taken = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return taken;
+}
+
+static void run_morsel(Scan *scan, int worker, int morsel)
+{
+    int first = scan->first + morsel * scan->morsel_size;
+    int end = first + scan->morsel_size < scan->end ? first + scan->morsel_size : scan->end;
+
+    scan->func(scan->arg, worker, morsel, first, end);
+}
+
+static void *scan_worker(void *arg)
+{
+    Scan_Worker *worker = arg;
+    Scan *scan = worker->scan;
+    int morsel;
+
+    while (take_front(&scan->deques[worker->worker], &morsel))
+        run_morsel(scan, worker->worker, morsel);
+
+    // no morsel is ever added, the scan is over once every deque is found empty
+    for (int i = 1; i < scan->num_workers; i++)
+    {
+        int victim = (worker->worker + i) % scan->num_workers;
+
+        while (steal_back(&scan->deques[victim], &morsel))
+            run_morsel(scan, worker->worker, morsel);
+    }
+
+    return NULL;
+}
+
+void scan_morsels(Morsel_Func func, void *arg)
+{
+    scan_slots(func, arg, 0, NUM_RECORDS, MORSEL_SIZE, 0);
+}
+
+void scan_slots(Morsel_Func func, void *arg, int first, int end, int morsel_size, int max_workers)
+{
+    Scan scan;
+    Scan_Worker workers[MAX_SCAN_WORKERS];
+
+    scan.func = func;
+    scan.arg = arg;
+    scan.first = first;
+    scan.end = end;
+    scan.morsel_size = morsel_size;
+    scan.num_morsels = end > first ? (end - first + morsel_size - 1) / morsel_size : 0;
+    scan.num_workers = max_workers > 0 ? max_workers : sysconf(_SC_NPROCESSORS_ONLN);
+    if (scan.num_workers > MAX_SCAN_WORKERS)
+        scan.num_workers = MAX_SCAN_WORKERS;
+    if (scan.num_workers > scan.num_morsels)
+        scan.num_workers = scan.num_morsels;
+
+    if (scan.num_workers <= 1)
+    {
+        for (int morsel = 0; morsel < scan.num_morsels; morsel++)
+            run_morsel(&scan, 0, morsel);
+        return;
+    }
+
+    for (int i = 0; i < scan.num_workers; i++)
+    {
+        Morsel_Deque *deque = &scan.deques[i];
+
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->front = (long)i * scan.num_morsels / scan.num_workers;
+        deque->back = (long)(i + 1) * scan.num_morsels / scan.num_workers;
+        workers[i].scan = &scan;
+        workers[i].worker = i;
+    }
+
+    // the calling thread is the first worker
+    for (int i = 1; i < scan.num_workers; i++)
+        CHECK(pthread_create(&workers[i].thread, NULL, scan_worker, &workers[i]) == 0);
+    scan_worker(&workers[0]);
+    for (int i = 1; i < scan.num_workers; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    for (int i = 0; i < scan.num_workers; i++)
+        pthread_mutex_destroy(&scan.deques[i].lock);
+}
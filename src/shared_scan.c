@@ -0,0 +1,113 @@
+#include "shared_scan.h"
+#include <stdio.h>
+#include <string.h>
+
+Shared_Lines *shared_query_lines(Shared_Query *sq, int slot)
+{
+    return slot >= sq->start ? &sq->tail : &sq->head;
+}
+
+void shared_lines_append(Shared_Lines *lines, const char *str, size_t len)
+{
+    const char *end = str + len;
+
+    for (const char *line = str; line < end && !lines->full;)
+    {
+        size_t line_len = (const char *)memchr(line, '\n', end - line) + 1 - line;
+
+        // one byte is left for the '\0'
+        if (lines->len + line_len >= RESULT_MSG_SIZE)
+        {
+            lines->full = true;
+            break;
+        }
+        memcpy(lines->str + lines->len, line, line_len);
+        lines->len += line_len;
+        lines->str[lines->len] = '\0';
+        line += line_len;
+    }
+}
+
+// scans chunks for all the queries on the scan until the query of the thread is done, the lock is held
+static void drive(Shared_Scan *scan, Shared_Query *own)
+{
+    Shared_Query *queries[MAX_SHARED_QUERIES];
+
+    while (!own->done)
+    {
+        // queries joining from now on start with the next chunk
+        int count = scan->count;
+        int first = scan->position;
+        int end = first + scan->chunk_size < scan->num_slots ? first + scan->chunk_size : scan->num_slots;
+
+        memcpy(queries, scan->queries, count * sizeof(Shared_Query *));
+        scan->position = end % scan->num_slots;
+        pthread_mutex_unlock(&scan->lock);
+
+        scan->scan_chunk(scan->arg, queries, count, first, end);
+
+        pthread_mutex_lock(&scan->lock);
+        for (int i = 0; i < count; i++)
+        {
+            if ((queries[i]->remaining -= end - first) > 0)
+                continue;
+
+            queries[i]->done = true;
+            for (int j = 0; j < scan->count; j++)
+            {
+                if (scan->queries[j] == queries[i])
+                {
+                    scan->queries[j] = scan->queries[--scan->count];
+                    break;
+                }
+            }
+        }
+        pthread_cond_broadcast(&scan->changed);
+    }
+}
+
+bool shared_scan_run(Shared_Scan *scan, void *query, char *result)
+{
+    Shared_Query sq;
+
+    pthread_mutex_lock(&scan->lock);
+
+    if (scan->count == MAX_SHARED_QUERIES)
+    {
+        pthread_mutex_unlock(&scan->lock);
+        return false;
+    }
+
+    sq.query = query;
+    sq.start = scan->position;
+    sq.remaining = scan->num_slots;
+    sq.head.str[0] = sq.tail.str[0] = '\0';
+    sq.head.len = sq.tail.len = 0;
+    sq.head.full = sq.tail.full = false;
+    sq.done = false;
+    scan->queries[scan->count++] = &sq;
+    printf("Query joined the shared scan at slot %d, %d queries on it\n", sq.start, scan->count);
+
+    while (!sq.done)
+    {
+        if (scan->scanning)
+        {
+            pthread_cond_wait(&scan->changed, &scan->lock);
+            continue;
+        }
+
+        scan->scanning = true;
+        drive(scan, &sq);
+        scan->scanning = false;
+        pthread_cond_broadcast(&scan->changed);
+    }
+
+    pthread_mutex_unlock(&scan->lock);
+
+    // the lines before the slot where the query joined go first
+    if (!sq.head.full)
+        shared_lines_append(&sq.head, sq.tail.str, sq.tail.len);
+    memcpy(result, sq.head.str, sq.head.len + 1);
+
+    return true;
+}
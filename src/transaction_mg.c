@@ -12,6 +12,12 @@
 #include <pthread.h>
 #include "in_memory_db.h"
 #include "compare.h"
+#include "aggregate.h"
+#include "group_by.h"
+#include "order_by.h"
+#include "expression.h"
+#include "scan.h"
+#include "shared_scan.h"
 #include <stdbool.h>
 
 // TODO using threads, maybe not necesary to register signal handlers
@@ -46,124 +52,591 @@ static void connectToStorageEngine()
     open_table();
 }
 
-static void record_to_str(T_Record *rec, char *str)
+// appends the value of the field to str, returns the number of characters it takes
+static int field_to_str(T_Record *rec, FieldId field, char *str, size_t size)
 {
-    // id;age;height;name
-
-    char buffer[sizeof(T_Record)];
+    switch (field)
+    {
+    case ID:
+        return snprintf(str, size, "%d", rec->id);
+    case AGE:
+        return snprintf(str, size, "%d", rec->age);
+    case HEIGHT:
+        return snprintf(str, size, "%lf", rec->height);
+    case NAME:
+        return snprintf(str, size, "%s", rec->name);
+    }
+    return 0;
+}
 
-    sprintf(buffer, "%d", rec->id);
-    strcpy(str, buffer);
-    strcat(str, ";");
+/*
+ * Appends the line of the record to str, only the given columns, separated by ';'
+ * Returns false and leaves str unchanged if the line doesn't fit in size
+ */
+static bool record_to_str(T_Record *rec, Column *columns, int num_columns, char *str, size_t size, size_t *len)
+{
+    size_t end = *len;
 
-    sprintf(buffer, "%d", rec->age);
-    strcat(str, buffer);
-    strcat(str, ";");
+    for (int i = 0; i < num_columns && end < size; i++)
+    {
+        if (i > 0)
+            str[end++] = ';';
+        if (end < size)
+            end += field_to_str(rec, columns[i].field, str + end, size - end);
+    }
 
-    sprintf(buffer, "%lf", rec->height);
-    strcat(str, buffer);
-    strcat(str, ";");
+    // room for the new line and the terminating zero
+    if (end + 1 >= size)
+    {
+        str[*len] = '\0';
+        return false;
+    }
 
-    strcat(str, rec->name);
+    str[end++] = '\n';
+    str[end] = '\0';
+    *len = end;
+    return true;
 }
 
-static void handle_select_query(Select_Query *query, char *result)
+// a table of groups per worker, each within the memory budget
+typedef struct
 {
+    Select_Query *query;
+    bool used[MAX_SCAN_WORKERS];
+    Group_Table tables[MAX_SCAN_WORKERS];
+} Group_Scan;
+
+static void group_morsel(void *arg, int worker, int morsel, int first, int end)
+{
+    Group_Scan *scan = arg;
+    Select_Query *query = scan->query;
+    Group_Table *groups = &scan->tables[worker];
     T_PersistRecord *prec;
     int id = -1;
 
-    // there is some overhead when representing numbers as strings
-    char rec_str[sizeof(T_Record) + 100];
+    if (!scan->used[worker])
+    {
+        group_table_init(groups, query, GROUP_MEMORY_BUDGET);
+        scan->used[worker] = true;
+    }
 
-    while ((prec = get_next_record(id, false)) != NULL)
+    while ((prec = get_next_record_in(id, first, end, false)) != NULL)
     {
-        if(query->all || satisfy_constraint(&prec->record, &query->constraint)) {
-            record_to_str(&prec->record, rec_str);
-            strcat(result, rec_str);
-            strcat(result, "\n");
+        if(query->all || satisfy_predicate(&prec->record, &query->where)) {
+            group_table_add(groups, &prec->record);
         }
 
         // move onto the next record
         id = prec->record.id;
     }
+}
+
+// aggregates every group in the scan, the result has a row per group
+static void handle_group_query(Select_Query *query, char *result)
+{
+    Group_Scan scan = {query};
+    Group_Table tables[MAX_SCAN_WORKERS];
+    int num_tables = 0;
+    size_t len = 0;
 
+    scan_morsels(group_morsel, &scan);
+
+    // the groups of the workers are combined by key, whichever morsels they took
+    for (int i = 0; i < MAX_SCAN_WORKERS; i++)
+    {
+        if (scan.used[i])
+            tables[num_tables++] = scan.tables[i];
+    }
+
+    result[0] = '\0';
+    group_tables_to_str(tables, num_tables, result, RESULT_MSG_SIZE, &len);
+    for (int i = 0; i < num_tables; i++)
+    {
+        group_table_destroy(&tables[i]);
+    }
 }
 
-static void handle_delete_query(Delete_Query *query, char *result)
+// partial aggregates of every morsel, merged in slot order so the result doesn't depend on the workers
+typedef struct
+{
+    Select_Query *query;
+    Aggregate_State (*states)[MAX_COLUMNS];
+} Aggregate_Scan;
+
+static void aggregate_morsel(void *arg, int worker, int morsel, int first, int end)
 {
-    
+    Aggregate_Scan *scan = arg;
+    Aggregate_State *states = scan->states[morsel];
+    Select_Query *query = scan->query;
     T_PersistRecord *prec;
     int id = -1;
-    int deleted_num = 0;
 
-    while ((prec = get_next_record(id, true)) != NULL)
+    aggregate_init(states, query);
+
+    while ((prec = get_next_record_in(id, first, end, false)) != NULL)
     {
-        
-        if(satisfy_constraint(&prec->record, &query->constraint)) {
-            prec->used = false;    
-            deleted_num++;
+        if(query->all || satisfy_predicate(&prec->record, &query->where)) {
+            aggregate_add(states, query, &prec->record);
         }
 
         // move onto the next record
         id = prec->record.id;
     }
+}
 
-    sprintf(result, "Deleted %d records\n", deleted_num);
+// computes the aggregates in the scan, the result is a single row whatever the size of the table
+static void handle_aggregate_query(Select_Query *query, char *result)
+{
+    Aggregate_State states[MAX_COLUMNS];
+    Aggregate_Scan scan = {query, malloc(NUM_MORSELS * sizeof(*scan.states))};
+    size_t len = 0;
+
+    CHECK(scan.states != NULL);
+    scan_morsels(aggregate_morsel, &scan);
+
+    aggregate_init(states, query);
+    for (int i = 0; i < NUM_MORSELS; i++)
+    {
+        aggregate_merge(states, scan.states[i], query);
+    }
+    free(scan.states);
+
+    result[0] = '\0';
+    aggregate_to_str(states, query, result, RESULT_MSG_SIZE, &len);
 }
 
-static void handle_insert_query(Insert_Query *query, char *result)
+// a sorter per worker, bounded by the LIMIT like the merged one
+typedef struct
 {
-    T_PersistRecord* prec = access_register_write(query->record.id);
+    Select_Query *query;
+    bool used[MAX_SCAN_WORKERS];
+    Sorter sorters[MAX_SCAN_WORKERS];
+} Sort_Scan;
 
-    prec->used = true;
-    prec->record.id = query->record.id;
-    prec->record.age = query->record.age;
-    prec->record.height = query->record.height;
-    strcpy(prec->record.name, query->record.name);
+static void sort_morsel(void *arg, int worker, int morsel, int first, int end)
+{
+    Sort_Scan *scan = arg;
+    Select_Query *query = scan->query;
+    Sorter *sorter = &scan->sorters[worker];
+    T_PersistRecord *prec;
+    int id = -1;
 
-    sprintf(result, "Insert OK: %d;%d;%lf;%s\n", prec->record.id, prec->record.age, prec->record.height, prec->record.name);
+    if (!scan->used[worker])
+    {
+        sorter_init(sorter, query);
+        scan->used[worker] = true;
+    }
 
-    release_register(query->record.id);
-    
+    while ((prec = get_next_record_in(id, first, end, false)) != NULL)
+    {
+        if(query->all || satisfy_predicate(&prec->record, &query->where)) {
+            sorter_add(sorter, &prec->record);
+        }
 
+        // move onto the next record
+        id = prec->record.id;
+    }
 }
 
-static void handle_update_query(Update_Query *query, char *result)
+// keeps the records of the result in a sorter, then formats them in order
+static void handle_sorted_query(Select_Query *query, char *result)
+{
+    Sort_Scan scan = {query};
+    Sorter sorter;
+    T_Record *records;
+    size_t count, len = 0;
+
+    scan_morsels(sort_morsel, &scan);
+
+    // the records of a single worker are all there is to sort
+    int used = 0, last_used = 0;
+    for (int i = 0; i < MAX_SCAN_WORKERS; i++)
+    {
+        if (scan.used[i])
+        {
+            used++;
+            last_used = i;
+        }
+    }
+
+    if (used == 1)
+    {
+        sorter = scan.sorters[last_used];
+    }
+    else
+    {
+        sorter_init(&sorter, query);
+        for (int i = 0; i < MAX_SCAN_WORKERS; i++)
+        {
+            if (!scan.used[i])
+                continue;
+            for (size_t j = 0; j < scan.sorters[i].count; j++)
+            {
+                sorter_add(&sorter, &scan.sorters[i].records[j]);
+            }
+            sorter_destroy(&scan.sorters[i]);
+        }
+    }
+
+    records = sorter_finish(&sorter, &count);
+
+    result[0] = '\0';
+    for (size_t i = query->offset; i < count; i++)
+    {
+        if (!record_to_str(&records[i], query->columns, query->num_columns, result, RESULT_MSG_SIZE, &len))
+            break; // the result message is full
+    }
+
+    sorter_destroy(&sorter);
+}
+
+// lines of a morsel of a plain SELECT
+typedef struct
+{
+    char *lines;
+    size_t len;
+    size_t capacity;
+    bool done;
+} Select_Morsel;
+
+/*
+ * The rows of a plain SELECT are returned in slot order: the lines of a morsel
+ * are merged into the result once the morsels before it are. Once the result is
+ * complete, the morsels not scanned yet are skipped.
+ */
+typedef struct
+{
+    Select_Query *query;
+    char *result;
+    size_t len;
+    int skipped;
+    int returned;
+    bool complete;   // the result message is full, or has all the rows of the LIMIT
+    int next_morsel; // first morsel not merged yet
+    pthread_mutex_t lock;
+    Select_Morsel morsels[NUM_MORSELS];
+} Select_Scan;
+
+// makes room for one more line, any line fits in a result message
+static void morsel_reserve(Select_Morsel *m)
+{
+    if (m->capacity - m->len < RESULT_MSG_SIZE) {
+        m->capacity = m->capacity == 0 ? RESULT_MSG_SIZE : 2 * m->capacity;
+        m->lines = realloc(m->lines, m->capacity);
+        CHECK(m->lines != NULL);
+    }
+}
+
+// merges the lines of the morsel into the result, the lock of the scan is held
+static void merge_morsel(Select_Scan *scan, Select_Morsel *morsel)
+{
+    Select_Query *query = scan->query;
+    char *line = morsel->lines;
+    char *end = morsel->lines + morsel->len;
+
+    while (line < end && !scan->complete)
+    {
+        size_t line_len = (char *)memchr(line, '\n', end - line) + 1 - line;
+
+        if (scan->skipped < query->offset) {
+            scan->skipped++;
+        } else if (scan->len + line_len >= RESULT_MSG_SIZE) {
+            __atomic_store_n(&scan->complete, true, __ATOMIC_RELAXED);
+        } else {
+            memcpy(scan->result + scan->len, line, line_len);
+            scan->len += line_len;
+            scan->result[scan->len] = '\0';
+            __atomic_store_n(&scan->complete, query->limited && ++scan->returned == query->limit, __ATOMIC_RELAXED);
+        }
+
+        line += line_len;
+    }
+}
+
+static void select_morsel(void *arg, int worker, int morsel, int first, int end)
 {
+    Select_Scan *scan = arg;
+    Select_Query *query = scan->query;
+    Select_Morsel *m = &scan->morsels[morsel];
     T_PersistRecord *prec;
     int id = -1;
-    int updated_num = 0;
+    long count = 0;
+    size_t offset_len = 0; // of the lines the OFFSET may skip
 
-    while ((prec = get_next_record(id, true)) != NULL)
+    while (!__atomic_load_n(&scan->complete, __ATOMIC_RELAXED) && (prec = get_next_record_in(id, first, end, false)) != NULL)
     {
-        if(satisfy_constraint(&prec->record, &query->constraint)) {
-            switch (query->fieldId)
-            {
-            case ID:
-                prec->record.id = query->val.id; 
-                break;
-            
-            case AGE:
-                prec->record.age = query->val.age; 
-                break;
-            
-            case HEIGHT:
-                prec->record.height = query->val.height; 
-                break;
-            
-            case NAME:
-                strcpy(prec->record.name, query->val.name);
+        // only the requested columns are formatted, while the record is locked
+        if(query->all || satisfy_predicate(&prec->record, &query->where)) {
+            morsel_reserve(m);
+            record_to_str(&prec->record, query->columns, query->num_columns, m->lines, m->capacity, &m->len);
+
+            if (++count == query->offset)
+                offset_len = m->len;
+
+            // past the OFFSET, the morsel alone completes the result, whatever the morsels before it hold
+            if (count >= query->offset &&
+                ((query->limited && count - query->offset >= query->limit) || m->len - offset_len >= RESULT_MSG_SIZE)) {
+                release_register(prec->record.id);
                 break;
             }
+        }
 
-            updated_num++;
+        // move onto the next record
+        id = prec->record.id;
+    }
+
+    pthread_mutex_lock(&scan->lock);
+    m->done = true;
+    while (scan->next_morsel < NUM_MORSELS && scan->morsels[scan->next_morsel].done)
+    {
+        Select_Morsel *next = &scan->morsels[scan->next_morsel++];
+
+        merge_morsel(scan, next);
+        free(next->lines);
+        next->lines = NULL;
+    }
+    pthread_mutex_unlock(&scan->lock);
+}
+
+#define SHARED_SCAN_MORSEL 256
+#define SHARED_SCAN_CHUNK (MAX_SCAN_WORKERS * SHARED_SCAN_MORSEL)
+
+/*
+ * A chunk of the shared scan is split into morsels run by the scan workers, so a
+ * SELECT alone on the scan is as parallel as one scanning on its own. The lines of
+ * every query are kept per morsel and appended in slot order once the chunk is done.
+ * Only the thread driving the scan uses the chunk, the buffers are kept for the next one.
+ */
+typedef struct
+{
+    Shared_Query **queries;
+    int count;
+    Select_Morsel lines[SHARED_SCAN_CHUNK / SHARED_SCAN_MORSEL][MAX_SHARED_QUERIES];
+} Shared_Chunk;
+
+// every record of the morsel is locked once and checked against all the plain SELECTs on the scan
+static void shared_morsel(void *arg, int worker, int morsel, int first, int end)
+{
+    Shared_Chunk *chunk = arg;
+    Select_Morsel *lines = chunk->lines[morsel];
+    T_PersistRecord *prec;
+    int id = -1;
+
+    for (int i = 0; i < chunk->count; i++)
+        lines[i].len = 0;
+
+    while ((prec = get_next_record_in(id, first, end, false)) != NULL)
+    {
+        for (int i = 0; i < chunk->count; i++)
+        {
+            Select_Query *query = chunk->queries[i]->query;
+            Select_Morsel *m = &lines[i];
+
+            // lines past a result message are never returned
+            if (m->len >= RESULT_MSG_SIZE || shared_query_lines(chunk->queries[i], first)->full)
+                continue;
+            if (query->all || satisfy_predicate(&prec->record, &query->where)) {
+                morsel_reserve(m);
+                record_to_str(&prec->record, query->columns, query->num_columns, m->lines, m->capacity, &m->len);
+            }
+        }
+
+        // move onto the next record
+        id = prec->record.id;
+    }
+}
+
+static void scan_shared_chunk(void *arg, Shared_Query **queries, int count, int first, int end)
+{
+    Shared_Chunk *chunk = arg;
+
+    chunk->queries = queries;
+    chunk->count = count;
+    scan_slots(shared_morsel, chunk, first, end, SHARED_SCAN_MORSEL, 0);
+
+    for (int morsel = 0; morsel * SHARED_SCAN_MORSEL < end - first; morsel++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            Select_Morsel *m = &chunk->lines[morsel][i];
+
+            shared_lines_append(shared_query_lines(queries[i], first + morsel * SHARED_SCAN_MORSEL), m->lines, m->len);
+        }
+    }
+}
+
+// concurrent plain SELECTs without LIMIT or OFFSET share a single pass over the table
+static Shared_Chunk shared_chunk;
+static Shared_Scan shared_scan = SHARED_SCAN_INITIALIZER(NUM_RECORDS, SHARED_SCAN_CHUNK, scan_shared_chunk, &shared_chunk);
+
+static void handle_select_query(Select_Query *query, char *result)
+{
+    Select_Scan *scan;
+
+    if (query->grouped)
+    {
+        handle_group_query(query, result);
+        return;
+    }
+    if (query->aggregate)
+    {
+        handle_aggregate_query(query, result);
+        return;
+    }
+
+    // the scan already returns the records by increasing id, records are stored at the position of their id
+    if (query->ordered && !(query->order_by == ID && !query->descending))
+    {
+        handle_sorted_query(query, result);
+        return;
+    }
+
+    result[0] = '\0';
+    if (query->limited && query->limit == 0)
+        return;
+
+    // a LIMIT or OFFSET stops the scan of the query early, it doesn't share it
+    if (!query->limited && query->offset == 0 && shared_scan_run(&shared_scan, query, result))
+        return;
+
+    scan = calloc(1, sizeof(Select_Scan));
+    CHECK(scan != NULL);
+    scan->query = query;
+    scan->result = result;
+    pthread_mutex_init(&scan->lock, NULL);
+
+    scan_morsels(select_morsel, scan);
+
+    pthread_mutex_destroy(&scan->lock);
+    free(scan);
+}
+
+typedef struct
+{
+    Delete_Query *query;
+    int deleted[MAX_SCAN_WORKERS];
+} Delete_Scan;
+
+static void delete_morsel(void *arg, int worker, int morsel, int first, int end)
+{
+    Delete_Scan *scan = arg;
+    T_PersistRecord *prec;
+    int id = -1;
+
+    while ((prec = get_next_record_in(id, first, end, true)) != NULL)
+    {
+        if(satisfy_predicate(&prec->record, &scan->query->where)) {
+            prec->used = false;
+            scan->deleted[worker]++;
         }
 
         // move onto the next record
         id = prec->record.id;
     }
+}
+
+static void handle_delete_query(Delete_Query *query, char *result)
+{
+    Delete_Scan scan = {query};
+    int deleted_num = 0;
+
+    scan_morsels(delete_morsel, &scan);
+
+    for (int i = 0; i < MAX_SCAN_WORKERS; i++)
+    {
+        deleted_num += scan.deleted[i];
+    }
+
+    sprintf(result, "Deleted %d records\n", deleted_num);
+}
+
+static void handle_insert_query(Insert_Query *query, char *result)
+{
+    int ids[MAX_INSERT_RECORDS];
+    int i;
+
+    // the whole batch is checked before any record is written
+    for (i = 0; i < query->num_records; i++)
+    {
+        if (!valid_register_id(query->records[i].id))
+        {
+            sprintf(result, "Insert failed: id %d out of range\n", query->records[i].id);
+            return;
+        }
+        ids[i] = query->records[i].id;
+    }
+
+    int num_ids = access_registers_write(ids, query->num_records);
+
+    // records of the same id are written in order, the last one stays
+    for (i = 0; i < query->num_records; i++)
+    {
+        T_PersistRecord *prec = get_register(query->records[i].id);
+
+        prec->used = true;
+        prec->record = query->records[i];
+    }
+
+    release_registers(ids, num_ids);
+
+    if (query->num_records == 1)
+    {
+        T_Record *rec = &query->records[0];
+        sprintf(result, "Insert OK: %d;%d;%lf;%s\n", rec->id, rec->age, rec->height, rec->name);
+    }
+    else
+    {
+        // a single summary for the batch
+        sprintf(result, "Inserted %d records\n", query->num_records);
+    }
+}
+
+typedef struct
+{
+    Update_Query *query;
+    int updated[MAX_SCAN_WORKERS];
+    int failed[MAX_SCAN_WORKERS];
+} Update_Scan;
+
+// every record is updated in place while the scan holds its write lock
+static void update_morsel(void *arg, int worker, int morsel, int first, int end)
+{
+    Update_Scan *scan = arg;
+    T_PersistRecord *prec;
+    int id = -1;
+
+    while ((prec = get_next_record_in(id, first, end, true)) != NULL)
+    {
+        if(satisfy_predicate(&prec->record, &scan->query->where)) {
+            if (apply_assignments(scan->query, &prec->record))
+                scan->updated[worker]++;
+            else
+                scan->failed[worker]++;
+        }
+
+        // move onto the next record
+        id = prec->record.id;
+    }
+}
+
+static void handle_update_query(Update_Query *query, char *result)
+{
+    Update_Scan scan = {query};
+    int updated_num = 0;
+    int failed_num = 0;
+
+    scan_morsels(update_morsel, &scan);
+
+    for (int i = 0; i < MAX_SCAN_WORKERS; i++)
+    {
+        updated_num += scan.updated[i];
+        failed_num += scan.failed[i];
+    }
 
-    sprintf(result, "Updated %d records\n", updated_num);
+    if (failed_num > 0)
+        sprintf(result, "Updated %d records, %d left unchanged by division by zero, overflow or a changed id\n", updated_num, failed_num);
+    else
+        sprintf(result, "Updated %d records\n", updated_num);
 }
 
 // entry point of the thread that handles incoming queries
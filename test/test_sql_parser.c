@@ -1,6 +1,17 @@
 #include "acutest.h"
 #include "SQL_parser.h"
+#include "SQL_lexer.h"
+#include "plan_cache.h"
+#include "compare.h"
+#include "expression.h"
+#include "group_by.h"
+#include "order_by.h"
+#include "csv_io.h"
+#include "scan.h"
+#include "shared_scan.h"
 #include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
 
 
 void test_parse_constraint_id(void) {
@@ -79,7 +90,7 @@ void test_parse_select_1(void)
 
     TEST_CHECK(query.all == false);
 
-    Constraint* c = &query.constraint;
+    Constraint* c = &query.where.constraints[0];
     TEST_CHECK(c->fieldId == AGE);
     TEST_CHECK(c->comparator == GREATER_OR_EQUAL);
     TEST_CHECK(c->fieldVal.age == 18);
@@ -100,22 +111,45 @@ void test_parse_insert(void) {
     bool succ = parse_insert(query_str ,&query);
     TEST_CHECK(succ);
     
-    TEST_CHECK(query.record.id == 2);
-    TEST_CHECK(query.record.age = 21);
-    TEST_CHECK(query.record.height == 168.23);
-    TEST_CHECK(strcmp(query.record.name, "Joe Brown") == 0);
+    TEST_CHECK(query.records[0].id == 2);
+    TEST_CHECK(query.records[0].age = 21);
+    TEST_CHECK(query.records[0].height == 168.23);
+    TEST_CHECK(strcmp(query.records[0].name, "Joe Brown") == 0);
 }
 
 
+void test_parse_insert_values(void) {
+    Insert_Query query;
+
+    TEST_CHECK(parse_insert("INSERT VALUES (2, 21, 168.23, 'Joe Brown'), (3, 35, 175.5, 'Ann Smith'),(4,1,2,'x')", &query));
+    TEST_CHECK(query.num_records == 3);
+    TEST_CHECK(query.records[1].id == 3 && query.records[1].age == 35);
+    TEST_CHECK(strcmp(query.records[2].name, "x") == 0);
+
+    TEST_CHECK(parse_insert("INSERT VALUES (2, 21, 168.23, 'Joe Brown')", &query));
+    TEST_CHECK(query.num_records == 1);
+
+    TEST_CHECK(!parse_insert("INSERT VALUES (2, 21, 168.23, 'Joe Brown'),", &query));
+    TEST_CHECK(!parse_insert("INSERT VALUES (2, 21, 168.23, 'Joe Brown') (3, 35, 175.5, 'Ann')", &query));
+    TEST_CHECK(!parse_insert("INSERT VALUES", &query));
+
+    char sql[MAX_QUERY_LEN] = "INSERT VALUES (0, 1, 2, 'x')";
+    for (int i = 1; i < MAX_INSERT_RECORDS; i++)
+        strcat(sql, ", (0, 1, 2, 'x')");
+    TEST_CHECK(parse_insert(sql, &query) && query.num_records == MAX_INSERT_RECORDS);
+    strcat(sql, ", (0, 1, 2, 'x')");
+    TEST_CHECK(!parse_insert(sql, &query));
+}
+
 void test_parse_delete(void) {
     Delete_Query query;
     char* testStr = "DELETE WHERE ID == 2";
     bool succ = parse_delete(testStr, &query);
     TEST_CHECK(succ);
 
-    TEST_CHECK(query.constraint.fieldId == ID);
-    TEST_CHECK(query.constraint.comparator == EQUAL);
-    TEST_CHECK(query.constraint.fieldVal.id == 2);    
+    TEST_CHECK(query.where.constraints[0].fieldId == ID);
+    TEST_CHECK(query.where.constraints[0].comparator == EQUAL);
+    TEST_CHECK(query.where.constraints[0].fieldVal.id == 2);    
 }
 
 
@@ -124,12 +158,13 @@ void test_parse_update(void) {
     bool succ = parse_update("UPDATE SET HEIGHT=183.3 WHERE ID == 15", &query);
     TEST_CHECK(succ);
 
-    TEST_CHECK(query.fieldId == HEIGHT);
-    TEST_CHECK(query.val.height == 183.3);
+    TEST_CHECK(query.num_assignments == 1);
+    TEST_CHECK(query.assignments[0].fieldId == HEIGHT);
+    TEST_CHECK(query.nodes[(int)query.assignments[0].expression].value.d == 183.3);
 
-    TEST_CHECK(query.constraint.fieldId == ID);
-    TEST_CHECK(query.constraint.comparator == EQUAL);
-    TEST_CHECK(query.constraint.fieldVal.id == 15);
+    TEST_CHECK(query.where.constraints[0].fieldId == ID);
+    TEST_CHECK(query.where.constraints[0].comparator == EQUAL);
+    TEST_CHECK(query.where.constraints[0].fieldVal.id == 15);
 }
 
 void test_parse_update_bs(void) {
@@ -152,12 +187,714 @@ void test_parse_sql_query(void) {
     TEST_CHECK(query.type == SELECT);
     Select_Query* s_q = &query.query.select_q;
     TEST_CHECK(s_q->all == false);
-    TEST_CHECK(s_q->constraint.fieldId == HEIGHT);
-    TEST_CHECK(s_q->constraint.comparator == GREATER);
-    // TEST_CHECK(s_q->constraint.fieldVal.height == 180.1);
-    TEST_CHECK(s_q->constraint.fieldVal.height == 180.23);
+    TEST_CHECK(s_q->where.constraints[0].fieldId == HEIGHT);
+    TEST_CHECK(s_q->where.constraints[0].comparator == GREATER);
+    // TEST_CHECK(s_q->where.constraints[0].fieldVal.height == 180.1);
+    TEST_CHECK(s_q->where.constraints[0].fieldVal.height == 180.23);
+}
+
+void test_lexer_tokens(void) {
+    Lexer lexer;
+    char* testStr = "SELECT * WHERE NAME>='Joe'";
+    lexer_init(&lexer, testStr);
+
+    TEST_CHECK(lexer.current.type == TOKEN_WORD && lexer.current.keyword == KW_SELECT);
+    TEST_CHECK(lexer.current.start == 0 && lexer.current.len == 6);
+    lexer_advance(&lexer);
+    TEST_CHECK(lexer.current.type == TOKEN_STAR);
+    lexer_advance(&lexer);
+    TEST_CHECK(lexer.current.keyword == KW_WHERE);
+    lexer_advance(&lexer);
+    TEST_CHECK(lexer.current.type == TOKEN_WORD && lexer.current.keyword == KW_NONE);
+    lexer_advance(&lexer);
+    TEST_CHECK(lexer.current.type == TOKEN_GREATER_OR_EQUAL);
+    lexer_advance(&lexer);
+    TEST_CHECK(lexer.current.type == TOKEN_STRING);
+    TEST_CHECK(strncmp(TOKEN_TEXT(&lexer, &lexer.current), "'Joe'", lexer.current.len) == 0);
+    lexer_advance(&lexer);
+    TEST_CHECK(lexer.current.type == TOKEN_END);
+}
+
+void test_parse_sql_dispatch(void) {
+    SQL_Query query;
+
+    TEST_CHECK(parse_SQL("  INSERT (2,21,168.23,'Joe Brown')  ", &query));
+    TEST_CHECK(query.type == INSERT);
+    TEST_CHECK(query.query.insert_q.records[0].id == 2);
+
+    TEST_CHECK(parse_SQL("DELETE WHERE AGE>10", &query));
+    TEST_CHECK(query.type == DELETE);
+    TEST_CHECK(query.query.delete_q.where.constraints[0].comparator == GREATER);
+
+    TEST_CHECK(parse_SQL("UPDATE SET AGE=5 WHERE ID == 1", &query));
+    TEST_CHECK(query.type == UPDATE);
+    TEST_CHECK(query.query.update_q.nodes[0].value.i == 5);
+
+    TEST_CHECK(!parse_SQL("DROP TABLE", &query));
+    TEST_CHECK(!parse_SQL("", &query));
+    TEST_CHECK(!parse_SQL("SELECT * WHERE AGE > 3 trailing", &query));
+    TEST_CHECK(!parse_SQL("INSERT(2, 21, 168.23, 'unterminated)", &query));
+}
+
+void test_parse_numbers(void) {
+    Constraint c;
+
+    TEST_CHECK(parse_constraint("WHERE AGE > -12", &c));
+    TEST_CHECK(c.fieldVal.age == -12);
+    TEST_CHECK(parse_constraint("WHERE ID == 2147483647", &c));
+    TEST_CHECK(c.fieldVal.id == INT_MAX);
+    TEST_CHECK(parse_constraint("WHERE ID == -2147483648", &c));
+    TEST_CHECK(c.fieldVal.id == INT_MIN);
+    TEST_CHECK(!parse_constraint("WHERE ID == 2147483648", &c));
+    TEST_CHECK(!parse_constraint("WHERE ID == 99999999999999999999", &c));
+    TEST_CHECK(!parse_constraint("WHERE AGE == 1e3", &c));
+
+    TEST_CHECK(parse_constraint("WHERE HEIGHT < 0.1", &c));
+    TEST_CHECK(c.fieldVal.height == 0.1);
+    TEST_CHECK(parse_constraint("WHERE HEIGHT < -183.25", &c));
+    TEST_CHECK(c.fieldVal.height == -183.25);
+    TEST_CHECK(parse_constraint("WHERE HEIGHT < 1.5e-3", &c));
+    TEST_CHECK(c.fieldVal.height == 1.5e-3);
+    TEST_CHECK(parse_constraint("WHERE HEIGHT < 1.7976931348623157e308", &c));
+    TEST_CHECK(c.fieldVal.height == 1.7976931348623157e308);
+    TEST_CHECK(parse_constraint("WHERE HEIGHT < 123456789012345678901234567890.5", &c));
+    TEST_CHECK(c.fieldVal.height == 123456789012345678901234567890.5);
+    TEST_CHECK(parse_constraint("WHERE HEIGHT < 0.000000000000000000000000000001", &c));
+    TEST_CHECK(c.fieldVal.height == 1e-30);
+    TEST_CHECK(!parse_constraint("WHERE HEIGHT < 1e400", &c));
+}
+
+void test_prepared_statements(void) {
+    Prepared_Statements statements = {0};
+    SQL_Query query;
+
+    TEST_CHECK(parse_session_SQL("PREPARE ins AS INSERT(?, ?, ?, ?)", &statements, &query) == PARSE_PREPARED);
+    TEST_CHECK(statements.count == 1 && statements.statements[0].prepared.num_params == 4);
+    TEST_CHECK(parse_session_SQL("PREPARE old AS SELECT * WHERE AGE > ?", &statements, &query) == PARSE_PREPARED);
+
+    TEST_CHECK(parse_session_SQL("EXECUTE ins(2, -21, 168.5, 'Joe Brown')", &statements, &query) == PARSE_QUERY);
+    TEST_CHECK(query.type == INSERT);
+    TEST_CHECK(query.query.insert_q.records[0].id == 2);
+    TEST_CHECK(query.query.insert_q.records[0].age == -21);
+    TEST_CHECK(query.query.insert_q.records[0].height == 168.5);
+    TEST_CHECK(strcmp(query.query.insert_q.records[0].name, "Joe Brown") == 0);
+
+    TEST_CHECK(parse_session_SQL("EXECUTE old(18)", &statements, &query) == PARSE_QUERY);
+    TEST_CHECK(query.type == SELECT && !query.query.select_q.all);
+    TEST_CHECK(query.query.select_q.where.constraints[0].fieldVal.age == 18);
+
+    // wrong number or type of values, unknown statement
+    TEST_CHECK(parse_session_SQL("EXECUTE ins(2, 21, 168.5)", &statements, &query) == PARSE_FAILED);
+    TEST_CHECK(parse_session_SQL("EXECUTE old('x')", &statements, &query) == PARSE_FAILED);
+    TEST_CHECK(parse_session_SQL("EXECUTE nope(1)", &statements, &query) == PARSE_FAILED);
+
+    // placeholders only in prepared statements
+    TEST_CHECK(parse_session_SQL("SELECT * WHERE AGE > ?", &statements, &query) == PARSE_FAILED);
+    TEST_CHECK(parse_session_SQL("DELETE WHERE ID == 3", &statements, &query) == PARSE_QUERY);
+
+    // preparing again replaces the statement
+    TEST_CHECK(parse_session_SQL("PREPARE old AS SELECT * WHERE HEIGHT < ?", &statements, &query) == PARSE_PREPARED);
+    TEST_CHECK(statements.count == 2);
+    TEST_CHECK(parse_session_SQL("EXECUTE old(1.5)", &statements, &query) == PARSE_QUERY);
+    TEST_CHECK(query.query.select_q.where.constraints[0].fieldId == HEIGHT);
+}
+
+void test_plan_cache(void) {
+    static Plan_Cache cache;
+    Prepared_Statements statements = {0};
+    SQL_Query query;
+
+    plan_cache_init(&cache);
+
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "SELECT * WHERE AGE > 5", &query) == PARSE_QUERY);
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "SELECT *   WHERE AGE>-7", &query) == PARSE_QUERY);
+    TEST_CHECK(query.type == SELECT && query.query.select_q.where.constraints[0].fieldVal.age == -7);
+    TEST_CHECK(cache.misses == 1 && cache.hits == 1);
+
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "INSERT(1, 2, 3.5, 'a')", &query) == PARSE_QUERY);
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "INSERT(4, 5, 6, 'Joe Brown')", &query) == PARSE_QUERY);
+    TEST_CHECK(query.query.insert_q.records[0].id == 4 && query.query.insert_q.records[0].height == 6.0);
+    TEST_CHECK(strcmp(query.query.insert_q.records[0].name, "Joe Brown") == 0);
+    TEST_CHECK(cache.misses == 2 && cache.hits == 2);
+
+    // a literal of the wrong type fails on a hit as on a miss
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "SELECT * WHERE AGE > 1.5", &query) == PARSE_FAILED);
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "SELECT * WHERE AGE > 'x'", &query) == PARSE_FAILED);
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "SELECT * WHERE AGE > ?", &query) == PARSE_FAILED);
+    TEST_CHECK(cache.bypasses == 1);
+
+    // PREPARE and EXECUTE go around the cache
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "PREPARE q AS DELETE WHERE ID == ?", &query) == PARSE_PREPARED);
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "EXECUTE q(3)", &query) == PARSE_QUERY);
+    TEST_CHECK(query.type == DELETE && query.query.delete_q.where.constraints[0].fieldVal.id == 3);
+
+    // the least recently used shapes are evicted
+    const char *fields[] = {"ID", "AGE", "HEIGHT"};
+    const char *comparators[] = {"<", "<=", ">", ">=", "=="};
+    char sql[MAX_QUERY_LEN];
+    for (int i = 0; i < PLAN_CACHE_SIZE; i++) {
+        sprintf(sql, "UPDATE SET %s=1 WHERE %s %s 2", fields[i % 3], fields[i / 3 % 3], comparators[i / 9 % 5]);
+        TEST_CHECK(plan_cache_parse(&cache, &statements, sql, &query) == PARSE_QUERY);
+    }
+    TEST_CHECK(cache.evictions == 2);
+    unsigned long misses = cache.misses;
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "UPDATE SET ID=9 WHERE ID < 2", &query) == PARSE_QUERY);
+    TEST_CHECK(cache.misses == misses);
+    TEST_CHECK(query.query.update_q.nodes[0].value.i == 9 && query.query.update_q.where.constraints[0].comparator == LOWER);
+    // the first select was the least recently used one
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "SELECT * WHERE AGE > 5", &query) == PARSE_QUERY);
+    TEST_CHECK(cache.misses == misses + 1);
+}
+
+// fieldId of the constraints under the children of the root, in evaluation order
+static int root_children(Predicate *p, FieldId *fields) {
+    int count = 0;
+    for (int child = p->nodes[(int)p->root].arg; child != -1; child = p->nodes[child].next) {
+        PredicateNode *n = &p->nodes[child];
+        fields[count++] = n->op == PREDICATE_CONSTRAINT ? p->constraints[(int)n->arg].fieldId : -1;
+    }
+    return count;
+}
+
+void test_parse_predicates(void) {
+    Select_Query query;
+    Predicate *p = &query.where;
+    FieldId fields[MAX_PREDICATE_NODES];
+
+    // conjuncts ordered cheapest and most selective first
+    TEST_CHECK(parse_select("SELECT * WHERE AGE > 3 AND NAME == 'Joe' AND ID == 1", &query));
+    TEST_CHECK(p->nodes[(int)p->root].op == PREDICATE_AND);
+    TEST_CHECK(root_children(p, fields) == 3);
+    TEST_CHECK(fields[0] == ID && fields[1] == AGE && fields[2] == NAME);
+
+    // disjuncts ordered most likely first, AND binds tighter than OR
+    TEST_CHECK(parse_select("SELECT * WHERE NAME == 'x' OR HEIGHT < 3 AND ID == 4 OR AGE < 3", &query));
+    TEST_CHECK(p->nodes[(int)p->root].op == PREDICATE_OR);
+    TEST_CHECK(root_children(p, fields) == 3);
+    TEST_CHECK(fields[0] == AGE && fields[1] == (FieldId)-1 && fields[2] == NAME);
+
+    // nested lists of the same op are flattened, double negations dropped
+    TEST_CHECK(parse_select("SELECT * WHERE (ID == 1 AND (AGE < 2)) AND NOT NOT HEIGHT > 3", &query));
+    TEST_CHECK(root_children(p, fields) == 3);
+
+    TEST_CHECK(!parse_select("SELECT * WHERE (ID == 1 AND AGE < 2", &query));
+    TEST_CHECK(!parse_select("SELECT * WHERE ID == 1 AND", &query));
+    TEST_CHECK(!parse_select("SELECT * WHERE NOT", &query));
+    TEST_CHECK(!parse_select("SELECT * WHERE ID == 1 OR ID == 2 OR ID == 3 OR ID == 4 OR ID == 5 OR ID == 6 OR ID == 7 OR ID == 8 OR ID == 9", &query));
+
+    T_Record joe = {1, 30, 180.5, "Joe"};
+    T_Record ann = {2, 17, 165.0, "Ann"};
+    TEST_CHECK(parse_select("SELECT * WHERE AGE >= 18 AND (NAME == 'Joe' OR NOT HEIGHT < 170)", &query));
+    TEST_CHECK(satisfy_predicate(&joe, p));
+    TEST_CHECK(!satisfy_predicate(&ann, p));
+    TEST_CHECK(parse_select("SELECT * WHERE NOT (ID == 1 OR AGE > 20)", &query));
+    TEST_CHECK(!satisfy_predicate(&joe, p));
+    TEST_CHECK(satisfy_predicate(&ann, p));
+}
+
+void test_parse_select_columns(void) {
+    Select_Query query;
+
+    TEST_CHECK(parse_select("SELECT ID, NAME WHERE AGE >= 18", &query));
+    TEST_CHECK(query.num_columns == 2);
+    TEST_CHECK(query.columns[0].field == ID && query.columns[1].field == NAME);
+    TEST_CHECK(query.columns[0].aggregate == AGG_NONE && !query.aggregate);
+    TEST_CHECK(!query.all);
+
+    TEST_CHECK(parse_select("SELECT HEIGHT", &query));
+    TEST_CHECK(query.all && query.num_columns == 1 && query.columns[0].field == HEIGHT);
+
+    TEST_CHECK(parse_select("SELECT *", &query));
+    TEST_CHECK(query.num_columns == 4 && query.columns[3].field == NAME);
+
+    TEST_CHECK(!parse_select("SELECT ID,", &query));
+    TEST_CHECK(!parse_select("SELECT ID NAME", &query));
+    TEST_CHECK(!parse_select("SELECT *, ID", &query));
+    TEST_CHECK(!parse_select("SELECT WHERE ID == 1", &query));
+}
+
+void test_parse_select_aggregates(void) {
+    Select_Query query;
+
+    TEST_CHECK(parse_select("SELECT COUNT(*), AVG(HEIGHT), MAX(NAME) WHERE AGE >= 18", &query));
+    TEST_CHECK(query.aggregate && query.num_columns == 3);
+    TEST_CHECK(query.columns[0].aggregate == AGG_COUNT);
+    TEST_CHECK(query.columns[1].aggregate == AGG_AVG && query.columns[1].field == HEIGHT);
+    TEST_CHECK(query.columns[2].aggregate == AGG_MAX && query.columns[2].field == NAME);
+
+    TEST_CHECK(parse_select("SELECT SUM(AGE)", &query));
+    TEST_CHECK(query.aggregate && query.all);
+
+    TEST_CHECK(!parse_select("SELECT SUM(NAME)", &query));
+    TEST_CHECK(!parse_select("SELECT MIN(*)", &query));
+    TEST_CHECK(!parse_select("SELECT ID, COUNT(*)", &query));
+    TEST_CHECK(!parse_select("SELECT COUNT(ID", &query));
+    TEST_CHECK(!parse_select("SELECT COUNT", &query));
+}
+
+void test_parse_group_by(void) {
+    Select_Query query;
+
+    TEST_CHECK(parse_select("SELECT AGE, AVG(HEIGHT) WHERE ID > 3 GROUP BY AGE", &query));
+    TEST_CHECK(query.grouped && query.group_by == AGE && query.aggregate && !query.all);
+    TEST_CHECK(query.columns[0].aggregate == AGG_NONE && query.columns[1].aggregate == AGG_AVG);
+
+    TEST_CHECK(parse_select("SELECT COUNT(*) GROUP BY NAME", &query));
+    TEST_CHECK(query.grouped && query.all);
+
+    TEST_CHECK(parse_select("SELECT NAME GROUP BY NAME", &query));
+    TEST_CHECK(query.aggregate);
+
+    TEST_CHECK(!parse_select("SELECT ID, COUNT(*) GROUP BY AGE", &query));
+    TEST_CHECK(!parse_select("SELECT * GROUP BY AGE", &query));
+    TEST_CHECK(!parse_select("SELECT COUNT(*) GROUP AGE", &query));
+    TEST_CHECK(!parse_select("SELECT COUNT(*) GROUP BY AGE WHERE ID > 1", &query));
+}
+
+void test_parse_order_by_limit(void) {
+    Select_Query query;
+
+    TEST_CHECK(parse_select("SELECT NAME ORDER BY HEIGHT DESC LIMIT 10", &query));
+    TEST_CHECK(query.ordered && query.order_by == HEIGHT && query.descending);
+    TEST_CHECK(query.limited && query.limit == 10 && query.offset == 0);
+
+    TEST_CHECK(parse_select("SELECT * WHERE AGE > 3 ORDER BY NAME ASC", &query));
+    TEST_CHECK(query.ordered && !query.descending && !query.limited);
+
+    TEST_CHECK(parse_select("SELECT * LIMIT 5 OFFSET 20", &query));
+    TEST_CHECK(!query.ordered && query.limit == 5 && query.offset == 20);
+
+    TEST_CHECK(!parse_select("SELECT * LIMIT -1", &query));
+    TEST_CHECK(!parse_select("SELECT * LIMIT 1.5", &query));
+    TEST_CHECK(!parse_select("SELECT * OFFSET 2", &query));
+    TEST_CHECK(!parse_select("SELECT * LIMIT 2 ORDER BY ID", &query));
+    TEST_CHECK(!parse_select("SELECT COUNT(*) LIMIT 2", &query));
+
+    // a negative count doesn't get in through a cached shape either
+    static Plan_Cache cache;
+    Prepared_Statements statements = {0};
+    SQL_Query sql_query;
+    plan_cache_init(&cache);
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "SELECT * LIMIT 3 OFFSET 1", &sql_query) == PARSE_QUERY);
+    TEST_CHECK(sql_query.query.select_q.limit == 3 && sql_query.query.select_q.offset == 1);
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "SELECT * LIMIT -3 OFFSET 1", &sql_query) == PARSE_FAILED);
+}
+
+void test_parse_update_expressions(void) {
+    Update_Query query;
+    T_Record rec = {3, 20, 1.5, "Joe"};
+
+    TEST_CHECK(parse_update("UPDATE SET AGE=AGE+1, HEIGHT=HEIGHT*2, NAME='Ann' WHERE ID == 3", &query));
+    TEST_CHECK(query.num_assignments == 3);
+    TEST_CHECK(apply_assignments(&query, &rec));
+    TEST_CHECK(rec.age == 21 && rec.height == 3.0 && strcmp(rec.name, "Ann") == 0);
+
+    // every expression sees the values from before the update, * binds tighter than -
+    TEST_CHECK(parse_update("UPDATE SET HEIGHT=AGE, AGE=AGE - 2 * -(ID - 1) / 2 WHERE ID == 3", &query));
+    TEST_CHECK(apply_assignments(&query, &rec));
+    TEST_CHECK(rec.height == 21.0 && rec.age == 23);
+
+    // the int fields take ints, the height truncated
+    TEST_CHECK(parse_update("UPDATE SET AGE=HEIGHT/2 WHERE ID == 3", &query));
+    TEST_CHECK(apply_assignments(&query, &rec) && rec.age == 10);
+    TEST_CHECK(!parse_update("UPDATE SET AGE=AGE*1.5 WHERE ID == 3", &query));
+
+    // a row that can't be updated is left unchanged
+    TEST_CHECK(parse_update("UPDATE SET HEIGHT=0, AGE=AGE/(ID-3) WHERE ID == 3", &query));
+    TEST_CHECK(!apply_assignments(&query, &rec) && rec.height == 21.0);
+    TEST_CHECK(parse_update("UPDATE SET AGE=0, ID=ID+1 WHERE ID == 3", &query));
+    TEST_CHECK(!apply_assignments(&query, &rec) && rec.id == 3 && rec.age == 10);
+    rec.age = INT_MAX;
+    TEST_CHECK(parse_update("UPDATE SET AGE=AGE+1 WHERE ID == 3", &query));
+    TEST_CHECK(!apply_assignments(&query, &rec) && rec.age == INT_MAX);
+
+    TEST_CHECK(!parse_update("UPDATE SET AGE=1, AGE=2 WHERE ID == 3", &query));
+    TEST_CHECK(!parse_update("UPDATE SET AGE=NAME WHERE ID == 3", &query));
+    TEST_CHECK(!parse_update("UPDATE SET AGE=(AGE+1 WHERE ID == 3", &query));
+    TEST_CHECK(!parse_update("UPDATE SET AGE=AGE+ WHERE ID == 3", &query));
+
+    // the cached shape of a binary minus isn't a negative literal
+    static Plan_Cache cache;
+    Prepared_Statements statements = {0};
+    SQL_Query sql_query;
+    plan_cache_init(&cache);
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "UPDATE SET AGE=AGE-5 WHERE ID == 1", &sql_query) == PARSE_QUERY);
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "UPDATE SET AGE=AGE-7 WHERE ID == 1", &sql_query) == PARSE_QUERY);
+    TEST_CHECK(cache.hits == 1);
+    rec.age = 10;
+    TEST_CHECK(apply_assignments(&sql_query.query.update_q, &rec) && rec.age == 3);
+    TEST_CHECK(plan_cache_parse(&cache, &statements, "UPDATE SET AGE=AGE--7 WHERE ID == 1", &sql_query) == PARSE_QUERY);
+    TEST_CHECK(apply_assignments(&sql_query.query.update_q, &rec) && rec.age == 10);
+}
+
+// groups a table of records with the given memory budget, returns the number of runs spilled
+static int group_records(Select_Query *query, T_Record *records, int num_records, size_t budget, char *str, size_t size)
+{
+    Group_Table table;
+    size_t len = 0;
+    int num_runs;
+
+    group_table_init(&table, query, budget);
+    for (int i = 0; i < num_records; i++)
+        group_table_add(&table, &records[i]);
+    num_runs = table.num_runs;
+    str[0] = '\0';
+    group_table_to_str(&table, str, size, &len);
+    group_table_destroy(&table);
+    return num_runs;
+}
+
+void test_group_by_spill(void) {
+    static T_Record records[1000];
+    static char in_memory[64 * 1024], spilled[64 * 1024];
+    Select_Query query;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        records[i].id = i;
+        records[i].age = i * 7919 % 300;
+        records[i].height = i / 10.0;
+        snprintf(records[i].name, sizeof(records[i].name), "n%d", i % 37);
+    }
+    TEST_CHECK(parse_select("SELECT AGE, COUNT(*), SUM(ID), AVG(HEIGHT), MIN(NAME) GROUP BY AGE", &query));
+
+    TEST_CHECK(group_records(&query, records, 1000, GROUP_MEMORY_BUDGET, in_memory, sizeof(in_memory)) == 0);
+    TEST_CHECK(strncmp(in_memory, "0;", 2) == 0 && strlen(in_memory) > 300 * 10);
+
+    // the smallest table spills every few groups, and the runs are read a group at a time
+    TEST_CHECK(group_records(&query, records, 1000, 0, spilled, sizeof(spilled)) > 10);
+    TEST_CHECK(strcmp(in_memory, spilled) == 0);
+
+    // batches of several groups
+    TEST_CHECK(group_records(&query, records, 1000, 64 * sizeof(Group), spilled, sizeof(spilled)) > 1);
+    TEST_CHECK(strcmp(in_memory, spilled) == 0);
+
+    // a result that doesn't fit ends at the same row
+    group_records(&query, records, 1000, GROUP_MEMORY_BUDGET, in_memory, 100);
+    TEST_CHECK(group_records(&query, records, 1000, 0, spilled, 100) > 10);
+    TEST_CHECK(strcmp(in_memory, spilled) == 0 && strlen(spilled) > 50);
+}
+
+// groups the records split among tables, as the workers of a scan do, some of them spilling
+static void group_records_split(Select_Query *query, T_Record *records, int num_records, int num_tables, size_t spill_budget, char *str, size_t size)
+{
+    Group_Table tables[4];
+    size_t len = 0;
+
+    for (int t = 0; t < num_tables; t++)
+        group_table_init(&tables[t], query, t % 2 == 0 ? GROUP_MEMORY_BUDGET : spill_budget);
+    for (int i = 0; i < num_records; i++)
+        group_table_add(&tables[i * 7 / 100 % num_tables], &records[i]);
+    str[0] = '\0';
+    group_tables_to_str(tables, num_tables, str, size, &len);
+    for (int t = 0; t < num_tables; t++)
+        group_table_destroy(&tables[t]);
+}
+
+void test_group_by_merge_tables(void) {
+    static T_Record records[1000];
+    static char whole[64 * 1024], merged[64 * 1024];
+    Select_Query query;
+
+    for (int i = 0; i < 1000; i++)
+    {
+        records[i].id = i;
+        records[i].age = i % 17;
+        records[i].height = i * 1.5;
+        snprintf(records[i].name, sizeof(records[i].name), "n%d", i * 31 % 400);
+    }
+    TEST_CHECK(parse_select("SELECT NAME, COUNT(*), MAX(AGE), SUM(HEIGHT) GROUP BY NAME", &query));
+    group_records(&query, records, 1000, GROUP_MEMORY_BUDGET, whole, sizeof(whole));
+
+    // tables all in memory
+    group_records_split(&query, records, 1000, 4, GROUP_MEMORY_BUDGET, merged, sizeof(merged));
+    TEST_CHECK(strcmp(whole, merged) == 0);
+
+    // in memory and spilled ones together
+    group_records_split(&query, records, 1000, 4, 0, merged, sizeof(merged));
+    TEST_CHECK(strcmp(whole, merged) == 0);
+    group_records_split(&query, records, 1000, 3, 32 * sizeof(Group), merged, sizeof(merged));
+    TEST_CHECK(strcmp(whole, merged) == 0);
+
+    group_records_split(&query, records, 1000, 1, GROUP_MEMORY_BUDGET, merged, sizeof(merged));
+    TEST_CHECK(strcmp(whole, merged) == 0);
+}
+
+void test_sorter_large_limit(void) {
+    Select_Query query;
+    Sorter sorter;
+    T_Record records[3] = {{1, 30, 1.0, "a"}, {2, 10, 2.0, "b"}, {3, 20, 3.0, "c"}};
+    T_Record *sorted;
+    size_t count;
+
+    // the bound doesn't size the allocation, only the records added do
+    TEST_CHECK(parse_select("SELECT * ORDER BY AGE LIMIT 2147483647 OFFSET 2147483647", &query));
+    sorter_init(&sorter, &query);
+    for (int i = 0; i < 3; i++)
+        sorter_add(&sorter, &records[i]);
+    sorted = sorter_finish(&sorter, &count);
+    TEST_CHECK(count == 3 && sorted[0].id == 2 && sorted[1].id == 3 && sorted[2].id == 1);
+    sorter_destroy(&sorter);
+
+    TEST_CHECK(parse_select("SELECT * ORDER BY AGE DESC LIMIT 1 OFFSET 1", &query));
+    sorter_init(&sorter, &query);
+    for (int i = 0; i < 3; i++)
+        sorter_add(&sorter, &records[i]);
+    sorted = sorter_finish(&sorter, &count);
+    TEST_CHECK(count == 2 && sorted[0].id == 1 && sorted[1].id == 3);
+    sorter_destroy(&sorter);
+}
+
+// parses the lines of the chunks a file is split into at every byte, as the import threads do
+static void csv_parse_split(const char *data, size_t split, int *ids, int *num_ids, int *rejected)
+{
+    size_t size = strlen(data);
+    size_t bounds[3] = {0, csv_line_start(data, size, split), size};
+    T_Record rec;
+
+    *num_ids = 0;
+    *rejected = 0;
+    for (int c = 0; c < 2; c++)
+    {
+        const char *next = data + bounds[c];
+        const char *end = data + bounds[c + 1];
+
+        while (next < end)
+        {
+            const char *line = next;
+            const char *eol = csv_next_line(&next, end);
+
+            if (eol == line)
+                continue;
+            if (csv_parse_record(line, eol, &rec))
+                ids[(*num_ids)++] = rec.id;
+            else
+                (*rejected)++;
+        }
+    }
+}
+
+void test_csv_chunk_lines(void) {
+    // the last line has no new line
+    const char *files[] = {"1,20,1.5,ann\n2,30,1.6,bob\n\n3,40,1.7,carl", "1,20,1.5,ann\r\n2,30,1.6,bob\r\n3,40,1.7,carl\r\n"};
+    int ids[8], num_ids, rejected;
+
+    TEST_CHECK(csv_line_start("ab\ncd", 5, 0) == 0);
+    TEST_CHECK(csv_line_start("ab\ncd", 5, 1) == 3);
+    TEST_CHECK(csv_line_start("ab\ncd", 5, 3) == 3);
+    TEST_CHECK(csv_line_start("ab\ncd", 5, 4) == 5);
+
+    for (int f = 0; f < 2; f++)
+    {
+        for (size_t split = 0; split <= strlen(files[f]); split++)
+        {
+            csv_parse_split(files[f], split, ids, &num_ids, &rejected);
+            // every line once, in file order, whatever the chunk it falls in
+            TEST_CHECK(num_ids == 3 && rejected == 0);
+            TEST_CHECK(ids[0] == 1 && ids[1] == 2 && ids[2] == 3);
+            TEST_MSG("file %d split at %zu", f, split);
+        }
+    }
+}
+
+void test_csv_parse_record(void) {
+    T_Record rec;
+    char line[256];
+    const char *longest = "00000000000000000000000000000042";
+    const char *bad[] = {
+        "1,20,1.5",
+        "1,,1.5,ann",
+        "x1,20,1.5,ann",
+        "2147483648,20,1.5,ann",
+        "1,20,1.5e999,ann",
+        // a field past MAX_CSV_FIELD
+        "000000000000000000000000000000042,20,1.5,ann",
+        "1,20,1.0000000000000000000000000000000,ann",
+    };
+
+    snprintf(line, sizeof(line), "7,-3,1.75,a,b;c\r");
+    TEST_CHECK(csv_parse_record(line, line + strlen(line), &rec));
+    TEST_CHECK(rec.id == 7 && rec.age == -3 && rec.height == 1.75 && strcmp(rec.name, "a,b;c") == 0);
+
+    // the longest field
+    TEST_CHECK(strlen(longest) == 32);
+    snprintf(line, sizeof(line), "%s,%s,%s,", longest, longest, longest);
+    TEST_CHECK(csv_parse_record(line, line + strlen(line), &rec));
+    TEST_CHECK(rec.id == 42 && rec.age == 42 && rec.height == 42.0 && rec.name[0] == '\0');
+
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        TEST_CHECK(!csv_parse_record(bad[i], bad[i] + strlen(bad[i]), &rec));
+        TEST_MSG("line %s", bad[i]);
+    }
+
+    // names of MAX_STR_LEN characters don't fit
+    memset(line, 'n', sizeof(line));
+    memcpy(line, "1,2,3,", 6);
+    TEST_CHECK(csv_parse_record(line, line + 6 + MAX_STR_LEN - 1, &rec) && strlen(rec.name) == MAX_STR_LEN - 1);
+    TEST_CHECK(!csv_parse_record(line, line + 6 + MAX_STR_LEN, &rec));
+}
+
+void test_csv_from_result(void) {
+    char out[128];
+    long num_lines = 0;
+    int last_id = -1;
+    size_t len;
+
+    // separators of the name are kept
+    len = csv_from_result("1;20;1.50;a;b\n12;30;1.60;c", out, &num_lines, &last_id);
+    TEST_CHECK(len == strlen("1,20,1.50,a;b\n12,30,1.60,c") && strncmp(out, "1,20,1.50,a;b\n12,30,1.60,c", len) == 0);
+    TEST_CHECK(num_lines == 2 && last_id == 12);
+
+    TEST_CHECK(csv_from_result("", out, &num_lines, &last_id) == 0);
+    TEST_CHECK(num_lines == 2 && last_id == 12);
+}
+
+#define TEST_MORSELS 200
+#define TEST_MORSEL_SIZE 7
+#define TEST_WORKERS 4
+
+typedef struct
+{
+    int first; // slots of the scan
+    int end;
+    int runs[TEST_MORSELS];
+    int worker[TEST_MORSELS];
+    bool bad_range;
+} Morsel_Runs;
+
+static void count_morsel(void *arg, int worker, int morsel, int first, int end)
+{
+    Morsel_Runs *runs = arg;
+    int morsel_first = runs->first + morsel * TEST_MORSEL_SIZE;
+    int morsel_end = morsel_first + TEST_MORSEL_SIZE < runs->end ? morsel_first + TEST_MORSEL_SIZE : runs->end;
+
+    // the morsels of the first worker are slow, the others steal them
+    if (morsel < TEST_MORSELS / TEST_WORKERS)
+        usleep(2000);
+
+    if (first != morsel_first || end != morsel_end)
+        runs->bad_range = true;
+    __atomic_add_fetch(&runs->runs[morsel], 1, __ATOMIC_RELAXED);
+    runs->worker[morsel] = worker;
+}
+
+void test_scan_morsels_once(void) {
+    static Morsel_Runs runs;
+    int stolen = 0;
+
+    // the last morsel is short
+    runs.first = 100;
+    runs.end = runs.first + TEST_MORSELS * TEST_MORSEL_SIZE - 3;
+    scan_slots(count_morsel, &runs, runs.first, runs.end, TEST_MORSEL_SIZE, TEST_WORKERS);
+
+    TEST_CHECK(!runs.bad_range);
+    for (int i = 0; i < TEST_MORSELS; i++)
+    {
+        TEST_CHECK(runs.runs[i] == 1);
+        TEST_MSG("morsel %d ran %d times", i, runs.runs[i]);
+        TEST_CHECK(runs.worker[i] >= 0 && runs.worker[i] < TEST_WORKERS);
+        if (i < TEST_MORSELS / TEST_WORKERS && runs.worker[i] != 0)
+            stolen++;
+    }
+    TEST_CHECK(stolen > 0);
+
+    // no morsel
+    memset(&runs, 0, sizeof(runs));
+    scan_slots(count_morsel, &runs, 5, 5, TEST_MORSEL_SIZE, TEST_WORKERS);
+    TEST_CHECK(runs.runs[0] == 0);
 }
 
+#define SHARED_TEST_SLOTS 10000
+#define SHARED_TEST_CHUNK 64
+#define SHARED_TEST_JOIN 5000 // slot of the chunk where the second query joins
+
+// a query of the test returns the slots that are multiples of its step
+typedef struct
+{
+    int step;
+    char result[RESULT_MSG_SIZE];
+    pthread_t thread;
+    int chunks; // driven by the thread of the query
+} Shared_Test_Query;
+
+static void scan_test_chunk(void *arg, Shared_Query **queries, int count, int first, int end);
+
+static Shared_Test_Query shared_test_queries[2] = {{100}, {70}};
+static Shared_Scan shared_test_scan = SHARED_SCAN_INITIALIZER(SHARED_TEST_SLOTS, SHARED_TEST_CHUNK, scan_test_chunk, shared_test_queries);
+
+static void *run_test_query(void *arg)
+{
+    Shared_Test_Query *query = arg;
+
+    TEST_CHECK(shared_scan_run(&shared_test_scan, query, query->result));
+    return NULL;
+}
+
+static void scan_test_chunk(void *arg, Shared_Query **queries, int count, int first, int end)
+{
+    Shared_Test_Query *test_queries = arg;
+    char line[16];
+
+    for (int q = 0; q < 2; q++)
+    {
+        if (pthread_equal(pthread_self(), test_queries[q].thread))
+            test_queries[q].chunks++;
+    }
+
+    // the second query joins in the middle of the pass of the first one, at the next chunk
+    if (first <= SHARED_TEST_JOIN && SHARED_TEST_JOIN < end && count == 1 && queries[0]->query == &test_queries[0])
+    {
+        int joined = 1;
+
+        TEST_CHECK(pthread_create(&test_queries[1].thread, NULL, run_test_query, &test_queries[1]) == 0);
+        while (joined == 1)
+        {
+            usleep(100);
+            pthread_mutex_lock(&shared_test_scan.lock);
+            joined = shared_test_scan.count;
+            pthread_mutex_unlock(&shared_test_scan.lock);
+        }
+    }
+
+    for (int slot = first; slot < end; slot++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            Shared_Test_Query *query = queries[i]->query;
+
+            if (slot % query->step == 0)
+                shared_lines_append(shared_query_lines(queries[i], slot), line, snprintf(line, sizeof(line), "%d\n", slot));
+        }
+    }
+}
+
+void test_shared_scan_join(void) {
+    for (int q = 0; q < 2; q++)
+        shared_test_queries[q].chunks = 0;
+
+    shared_test_queries[0].thread = pthread_self();
+    TEST_CHECK(shared_scan_run(&shared_test_scan, &shared_test_queries[0], shared_test_queries[0].result));
+    pthread_join(shared_test_queries[1].thread, NULL);
+
+    // every slot once and in slot order, whatever the slot where the query joined
+    for (int q = 0; q < 2; q++)
+    {
+        Shared_Test_Query *query = &shared_test_queries[q];
+        char expected[RESULT_MSG_SIZE];
+        size_t len = 0;
+
+        for (int slot = 0; slot < SHARED_TEST_SLOTS; slot += query->step)
+            len += snprintf(expected + len, sizeof(expected) - len, "%d\n", slot);
+        TEST_CHECK(strcmp(query->result, expected) == 0);
+        TEST_MSG("query of step %d: %.60s...", query->step, query->result);
+    }
+
+    // the first query leaves at the end of the table, the second one scans the rest of the way
+    TEST_CHECK(shared_test_queries[0].chunks == (SHARED_TEST_SLOTS + SHARED_TEST_CHUNK - 1) / SHARED_TEST_CHUNK);
+    TEST_CHECK(shared_test_queries[1].chunks == SHARED_TEST_JOIN / SHARED_TEST_CHUNK + 1);
+    TEST_CHECK(shared_test_scan.count == 0 && !shared_test_scan.scanning);
+}
 
 TEST_LIST = {
     {"test_parse_constraint_id", test_parse_constraint_id},
@@ -173,10 +910,30 @@ TEST_LIST = {
 
     
     {"test_parse_insert", test_parse_insert},
+    {"test_parse_insert_values", test_parse_insert_values},
     {"test_parse_delete", test_parse_delete},
     {"test_parse_update", test_parse_update},
     {"test_parse_sql_query", test_parse_sql_query},
     {"test_parse_update_bs", test_parse_update_bs},
+    {"test_lexer_tokens", test_lexer_tokens},
+    {"test_parse_sql_dispatch", test_parse_sql_dispatch},
+    {"test_parse_numbers", test_parse_numbers},
+    {"test_prepared_statements", test_prepared_statements},
+    {"test_plan_cache", test_plan_cache},
+    {"test_parse_predicates", test_parse_predicates},
+    {"test_parse_select_columns", test_parse_select_columns},
+    {"test_parse_select_aggregates", test_parse_select_aggregates},
+    {"test_parse_group_by", test_parse_group_by},
+    {"test_parse_order_by_limit", test_parse_order_by_limit},
+    {"test_parse_update_expressions", test_parse_update_expressions},
+    {"test_group_by_spill", test_group_by_spill},
+    {"test_group_by_merge_tables", test_group_by_merge_tables},
+    {"test_sorter_large_limit", test_sorter_large_limit},
+    {"test_csv_chunk_lines", test_csv_chunk_lines},
+    {"test_csv_parse_record", test_csv_parse_record},
+    {"test_csv_from_result", test_csv_from_result},
+    {"test_scan_morsels_once", test_scan_morsels_once},
+    {"test_shared_scan_join", test_shared_scan_join},
     // {"", },
 
     {0} /* Test suite must be terminated with {0} */